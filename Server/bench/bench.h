@@ -0,0 +1,97 @@
+// Minimal benchmark harness shared by the files in this directory.
+//
+// Every benchmark runs a callable in batches until a time budget is spent and
+// reports the median nanoseconds per iteration of the batches. Results are
+// printed as one JSON document so runs can be diffed between commits.
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+    /// Keep the optimizer from discarding a computed value.
+    template<typename T>
+    inline void do_not_optimize(const T& value)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        asm volatile("" : : "r,m"(value) : "memory");
+#else
+        static volatile const T* sink;
+        sink = &value;
+#endif
+    }
+
+    struct result
+    {
+        std::string name;
+        double ns_per_op;
+        double bytes_per_op;
+        size_t iterations;
+    };
+
+    class runner
+    {
+    public:
+        explicit runner(std::chrono::milliseconds budget = std::chrono::milliseconds(300)):
+          budget_(budget)
+        {}
+
+        /// Run `fn` repeatedly. `bytes_per_op` is used to report throughput (0 to omit it).
+        template<typename Fn>
+        void run(const std::string& name, double bytes_per_op, Fn&& fn)
+        {
+            using clock = std::chrono::steady_clock;
+
+            // Warm up and size the batches to roughly 1ms each.
+            size_t batch = 1;
+            for (;;)
+            {
+                auto start = clock::now();
+                for (size_t i = 0; i < batch; i++)
+                    fn();
+                if (clock::now() - start >= std::chrono::milliseconds(1) || batch >= (size_t(1) << 30))
+                    break;
+                batch *= 2;
+            }
+
+            std::vector<double> samples;
+            size_t iterations = 0;
+            auto deadline = clock::now() + budget_;
+            while (clock::now() < deadline || samples.size() < 5)
+            {
+                auto start = clock::now();
+                for (size_t i = 0; i < batch; i++)
+                    fn();
+                auto elapsed = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+                samples.push_back(elapsed / batch);
+                iterations += batch;
+            }
+
+            std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+            results_.push_back({name, samples[samples.size() / 2], bytes_per_op, iterations});
+        }
+
+        /// Print all results as JSON to stdout.
+        void report(const std::string& suite) const
+        {
+            std::printf("{\n  \"suite\": \"%s\",\n  \"results\": [\n", suite.c_str());
+            for (size_t i = 0; i < results_.size(); i++)
+            {
+                const result& r = results_[i];
+                std::printf("    {\"name\": \"%s\", \"ns_per_op\": %.2f, \"iterations\": %zu", r.name.c_str(), r.ns_per_op, r.iterations);
+                if (r.bytes_per_op > 0)
+                    std::printf(", \"mb_per_s\": %.1f", r.bytes_per_op / r.ns_per_op * 1e3);
+                std::printf("}%s\n", i + 1 < results_.size() ? "," : "");
+            }
+            std::printf("  ]\n}\n");
+        }
+
+    private:
+        std::chrono::milliseconds budget_;
+        std::vector<result> results_;
+    };
+} // namespace bench
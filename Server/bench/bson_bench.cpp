@@ -0,0 +1,109 @@
+// BSON work on the /api/surf-locations path: building the filter query, and converting the
+// results to JSON with bsoncxx::to_json against crow's writer (bson_json.h).
+//
+// Needs the MongoDB C++ driver. Build from the Server directory:
+//   g++ -std=c++17 -O2 -DCROW_USE_BOOST -I. bench/bson_bench.cpp -o bson_bench -lpthread $(pkg-config --cflags --libs libbsoncxx)
+#include "crow_all.h"
+#include "bson_json.h"
+#include "bench.h"
+
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/stream/document.hpp>
+#include <bsoncxx/json.hpp>
+#include <bsoncxx/oid.hpp>
+#include <bsoncxx/types.hpp>
+
+// The filters Client/Cody_Maverick.js sends: country and location, either may be empty.
+static const struct
+{
+    const char* name;
+    const char* country;
+    const char* location;
+} filters[] = {
+  {"country", "Canada", ""},
+  {"country_and_location", "Canada", "Tofino"},
+  {"none", "", ""},
+};
+
+// Built like the handler in server.cpp does, minus the logging.
+static bsoncxx::document::value build_query(const std::string& country, const std::string& location)
+{
+    bsoncxx::builder::stream::document query{};
+    if (!country.empty())
+        query << "countryName" << bsoncxx::types::b_regex{country, "i"};
+    if (!location.empty())
+        query << "locationName" << bsoncxx::types::b_regex{location, "i"};
+    return query << bsoncxx::builder::stream::finalize;
+}
+
+// A SurfLocation document with the fields the seed data has.
+static bsoncxx::document::value surf_location(int i)
+{
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+    return make_document(
+      kvp("_id", bsoncxx::types::b_oid{bsoncxx::oid{"6634f0b1a9d5e8b7c4f019f0"}}),
+      kvp("locationName", "Cox Bay " + std::to_string(i)),
+      kvp("breakType", "Beach Break"),
+      kvp("surfScore", 7),
+      kvp("countryName", "Canada"),
+      kvp("description", "Famous surf spot in British Columbia, \"Tuff City\" locals"),
+      kvp("coordinates", make_document(kvp("latitude", 49.1538 + i * 0.01), kvp("longitude", -125.9074))),
+      kvp("TotalLikes", 12 * i),
+      kvp("TotalComments", i));
+}
+
+int main()
+{
+    bench::runner runner;
+    size_t total = 0;
+
+    for (const auto& f : filters)
+    {
+        std::string country = f.country;
+        std::string location = f.location;
+        runner.run("bson_query/" + std::string(f.name), 0, [&] {
+            total += build_query(country, location).view().length();
+        });
+    }
+
+    // A page of results as /api/surf-locations returns them.
+    const int locations = 50;
+    std::vector<bsoncxx::document::value> results;
+    for (int i = 0; i < locations; i++)
+        results.push_back(surf_location(i));
+    std::string body;
+    {
+        crow::json::writer json(body);
+        json.begin_list();
+        for (const auto& doc : results)
+            writeBson(json, doc.view());
+        json.end_list();
+    }
+    const size_t response_size = body.size();
+
+    runner.run("bson_to_json/to_json", response_size, [&] {
+        std::string out = "[";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            if (i)
+                out += ',';
+            out += bsoncxx::to_json(results[i].view());
+        }
+        out += ']';
+        total += out.size();
+    });
+    runner.run("bson_to_json/writer", response_size, [&] {
+        body.clear();
+        crow::json::writer json(body);
+        json.begin_list();
+        for (const auto& doc : results)
+            writeBson(json, doc.view());
+        json.end_list();
+        total += body.size();
+    });
+
+    runner.report("bson");
+    bench::do_not_optimize(total);
+    return total > 0 ? 0 : 1;
+}
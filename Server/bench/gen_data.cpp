@@ -0,0 +1,185 @@
+// Generates the synthetic dataset of dataset.h and loads it into MongoDB, or writes it as NDJSON for mongoimport.
+//
+// Needs the MongoDB C++ driver. Build from the Server directory:
+//   g++ -std=c++17 -O2 -I. bench/gen_data.cpp -o gen_data -lpthread $(pkg-config --cflags --libs libmongocxx)
+// Run e.g. `MONGO_URI=mongodb://localhost DATABASE=surf ./gen_data --drop` to load with parallel insert_many batches,
+// or `./gen_data --ndjson data` to write data/SurfLocation.ndjson and so on. The defaults make about 1.5 million
+// documents. Options:
+//   --locations             surf locations (10000)
+//   --posts                 mean posts per location (10)
+//   --comments              mean comments per post (3)
+//   --likes                 mean likes per post (5)
+//   --comment-likes         mean likes per comment (1)
+//   --users                 distinct users (50000)
+//   --weather-days          days of weather history per location (30)
+//   --seed                  the same seed gives the same documents (1)
+//   --threads               generating and inserting threads (hardware threads)
+//   --batch                 documents per insert_many or write (1000)
+//   --drop                  delete what the collections hold first
+//   --ndjson DIR            write files to DIR instead of loading, one per collection
+#include "dataset.h"
+#include "mongo_storage.h"
+
+#include <bsoncxx/json.hpp>      // For NDJSON output
+#include <mongocxx/instance.hpp> // MongoDB C++ driver instance
+#include <mongocxx/pool.hpp>     // For a client per thread
+#include <mongocxx/uri.hpp>      // For MongoDB URI
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+static const char* const collections[] = {"SurfLocation", "Post", "Comments", "Likes", "Weather"};
+
+/// Appends whole batches to one file per collection.
+class ndjson_writer
+{
+public:
+    explicit ndjson_writer(const std::string& directory)
+    {
+        for (const char* name : collections)
+        {
+            auto& file = files_[name];
+            file.stream.open(directory + '/' + name + ".ndjson", std::ios::binary | std::ios::trunc);
+            if (!file.stream)
+                throw std::runtime_error("Could not open " + directory + '/' + name + ".ndjson");
+        }
+    }
+
+    void write(const std::string& collection, const std::vector<bsoncxx::document::value>& batch)
+    {
+        std::string out;
+        for (const auto& doc : batch)
+        {
+            out += bsoncxx::to_json(doc.view(), bsoncxx::ExtendedJsonMode::k_relaxed);
+            out += '\n';
+        }
+        auto& file = files_.at(collection);
+        std::lock_guard<std::mutex> lock(file.mutex);
+        file.stream.write(out.data(), out.size());
+        if (!file.stream)
+            throw std::runtime_error("Could not write " + collection + ".ndjson");
+    }
+
+private:
+    struct file
+    {
+        std::ofstream stream;
+        std::mutex mutex;
+    };
+    std::map<std::string, file> files_;
+};
+
+int main(int argc, char** argv)
+{
+    DatasetOptions options;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t batch = 1000;
+    bool drop = false;
+    std::string ndjson;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "--drop")
+        {
+            drop = true;
+            continue;
+        }
+        if (arg == "--locations")
+            options.locations = std::strtoull(value, nullptr, 10);
+        else if (arg == "--posts")
+            options.postsPerLocation = std::atof(value);
+        else if (arg == "--comments")
+            options.commentsPerPost = std::atof(value);
+        else if (arg == "--likes")
+            options.likesPerPost = std::atof(value);
+        else if (arg == "--comment-likes")
+            options.likesPerComment = std::atof(value);
+        else if (arg == "--users")
+            options.users = std::max(1ull, std::strtoull(value, nullptr, 10));
+        else if (arg == "--weather-days")
+            options.weatherDays = std::atoi(value);
+        else if (arg == "--seed")
+            options.seed = std::strtoull(value, nullptr, 10);
+        else if (arg == "--threads")
+            threads = std::max(1, std::atoi(value));
+        else if (arg == "--batch")
+            batch = std::max(1, std::atoi(value));
+        else if (arg == "--ndjson")
+            ndjson = value;
+        else
+        {
+            std::fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return 2;
+        }
+        i++;
+    }
+
+    DatasetGenerator generator(options);
+    std::mutex counts_mutex;
+    std::map<std::string, size_t> counts;
+    auto counted = [&](const std::string& collection, size_t n) {
+        std::lock_guard<std::mutex> lock(counts_mutex);
+        counts[collection] += n;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    try
+    {
+        if (!ndjson.empty())
+        {
+            ndjson_writer writer(ndjson);
+            generator.run(threads, [&](size_t) -> DatasetGenerator::Sink {
+                return [&](const std::string& collection, std::vector<bsoncxx::document::value>& docs) {
+                    writer.write(collection, docs);
+                    counted(collection, docs.size());
+                };
+            }, batch);
+        }
+        else
+        {
+            const char* mongo_uri = std::getenv("MONGO_URI");
+            const char* db_name = std::getenv("DATABASE");
+            if (!mongo_uri || !db_name)
+            {
+                std::fprintf(stderr, "Set MONGO_URI and DATABASE, or use --ndjson\n");
+                return 1;
+            }
+            mongocxx::instance instance{};
+            mongocxx::pool pool{mongocxx::uri{mongo_uri}};
+            MongoStorage storage(pool, db_name);
+            if (drop)
+            {
+                for (const char* name : collections)
+                    std::printf("Deleted %lld documents from %s\n", static_cast<long long>(storage.deleteMany(name, {})), name);
+            }
+            generator.run(threads, [&](size_t) -> DatasetGenerator::Sink {
+                return [&](const std::string& collection, std::vector<bsoncxx::document::value>& docs) {
+                    if (!storage.insertMany(collection, docs))
+                        throw std::runtime_error("Insert into " + collection + " was not acknowledged");
+                    counted(collection, docs.size());
+                };
+            }, batch);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t total = 0;
+    for (const char* name : collections)
+    {
+        std::printf("%-14s %zu\n", name, counts[name]);
+        total += counts[name];
+    }
+    std::printf("%zu documents in %.1fs, %.0f per second\n", total, seconds, total / seconds);
+    return 0;
+}
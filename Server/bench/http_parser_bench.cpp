@@ -0,0 +1,115 @@
+// Compares Crow's HTTPParser fast path against the plain http_parser state machine.
+//
+// Build from the Server directory:
+//   g++ -std=c++17 -O2 -DCROW_USE_BOOST -I. bench/http_parser_bench.cpp -o http_parser_bench -lpthread
+// Add -mavx2 to use the AVX2 scanners instead of SSE2.
+#include "crow_all.h"
+#include "bench.h"
+
+// Requests as Chrome sends them for the calls in Client/Cody_Maverick.js.
+static const char* const captures[][2] = {
+  {"surf_locations_get",
+   "GET /api/surf-locations?country=Canada&location=&filterLikes=false HTTP/1.1\r\n"
+   "Host: localhost:3000\r\n"
+   "Connection: keep-alive\r\n"
+   "sec-ch-ua-platform: \"macOS\"\r\n"
+   "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+   "Accept: application/json\r\n"
+   "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+   "Content-Type: application/json\r\n"
+   "sec-ch-ua-mobile: ?0\r\n"
+   "Origin: http://localhost:8000\r\n"
+   "Sec-Fetch-Site: same-site\r\n"
+   "Sec-Fetch-Mode: cors\r\n"
+   "Sec-Fetch-Dest: empty\r\n"
+   "Referer: http://localhost:8000/\r\n"
+   "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+   "Accept-Language: en-CA,en-US;q=0.9,en;q=0.8\r\n"
+   "\r\n"},
+  {"location_details_get",
+   "GET /api/location-details?locationName=Tofino HTTP/1.1\r\n"
+   "Host: localhost:3000\r\n"
+   "Connection: keep-alive\r\n"
+   "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+   "Accept: */*\r\n"
+   "Origin: http://localhost:8000\r\n"
+   "Sec-Fetch-Site: same-site\r\n"
+   "Sec-Fetch-Mode: cors\r\n"
+   "Sec-Fetch-Dest: empty\r\n"
+   "Referer: http://localhost:8000/\r\n"
+   "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+   "Accept-Language: en-CA,en-US;q=0.9,en;q=0.8\r\n"
+   "\r\n"},
+  {"login_post",
+   "POST /api/login HTTP/1.1\r\n"
+   "Host: localhost:3000\r\n"
+   "Connection: keep-alive\r\n"
+   "Content-Length: 41\r\n"
+   "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+   "Content-Type: application/json\r\n"
+   "Accept: */*\r\n"
+   "Origin: http://localhost:8000\r\n"
+   "Sec-Fetch-Site: same-site\r\n"
+   "Sec-Fetch-Mode: cors\r\n"
+   "Sec-Fetch-Dest: empty\r\n"
+   "Referer: http://localhost:8000/\r\n"
+   "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+   "Accept-Language: en-CA,en-US;q=0.9,en;q=0.8\r\n"
+   "\r\n"
+   "{\"username\":\"cody\",\"password\":\"maverick\"}"},
+  {"minimal_get",
+   "GET / HTTP/1.1\r\n"
+   "Host: localhost:3000\r\n"
+   "\r\n"},
+};
+
+/// Stands in for the Connection, resets the parser once a request is complete like a synchronous response does.
+struct null_handler
+{
+    crow::HTTPParser<null_handler>* parser;
+    size_t requests = 0;
+
+    void handle_url() {}
+    void handle_header() {}
+    void handle()
+    {
+        requests++;
+        bench::do_not_optimize(parser->req.url);
+        parser->clear();
+    }
+};
+
+int main()
+{
+    const static crow::http_parser_settings settings{
+      crow::HTTPParser<null_handler>::on_message_begin,
+      crow::HTTPParser<null_handler>::on_method,
+      crow::HTTPParser<null_handler>::on_url,
+      crow::HTTPParser<null_handler>::on_header_field,
+      crow::HTTPParser<null_handler>::on_header_value,
+      crow::HTTPParser<null_handler>::on_headers_complete,
+      crow::HTTPParser<null_handler>::on_body,
+      crow::HTTPParser<null_handler>::on_message_complete,
+    };
+
+    null_handler handler;
+    crow::HTTPParser<null_handler> parser(&handler);
+    handler.parser = &parser;
+
+    bench::runner runner;
+    for (const auto& capture : captures)
+    {
+        std::string name = capture[0];
+        std::string data = capture[1];
+
+        runner.run("http_parser/" + name, data.size(), [&] {
+            crow::http_parser_execute(&parser, &settings, data.data(), data.size());
+        });
+        runner.run("fast_path/" + name, data.size(), [&] {
+            parser.feed(data.data(), data.size());
+        });
+    }
+
+    runner.report("http_parser");
+    return handler.requests > 0 ? 0 : 1;
+}
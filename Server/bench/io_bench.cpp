@@ -0,0 +1,159 @@
+// Keep-alive throughput of a Crow server at several connection counts, to compare the epoll and io_uring backends.
+//
+// Build from the Server directory, once per backend:
+//   g++ -std=c++17 -O2 -DCROW_USE_BOOST -I. bench/io_bench.cpp -o io_bench -lpthread
+//   g++ -std=c++17 -O2 -DCROW_USE_BOOST -DCROW_ENABLE_IO_URING -I. bench/io_bench.cpp -o io_bench_uring -lpthread -luring
+// Run with the connection counts to try, e.g. `./io_bench 16 128 512`.
+//
+// The server runs in a forked child so its numbers aren't mixed with the client's. For exact syscalls per request,
+// attach `strace -c -f -p <pid>` to the pid printed on stderr and divide by the request count in the report.
+#include "crow_all.h"
+
+#include <fstream>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <csignal>
+
+static const unsigned short port = 18090;
+static const char request[] =
+  "GET /api/ping HTTP/1.1\r\n"
+  "Host: localhost:3000\r\n"
+  "Connection: keep-alive\r\n"
+  "Accept: */*\r\n"
+  "\r\n";
+
+/// Context switches of every thread of `pid`, a proxy for how often the workers go back to the kernel.
+static unsigned long context_switches(pid_t pid)
+{
+    unsigned long total = 0;
+    std::string dir = "/proc/" + std::to_string(pid) + "/task";
+    DIR* tasks = opendir(dir.c_str());
+    if (!tasks)
+        return 0;
+    while (dirent* task = readdir(tasks))
+    {
+        if (task->d_name[0] == '.')
+            continue;
+        std::ifstream status(dir + "/" + task->d_name + "/status");
+        std::string line;
+        while (std::getline(status, line))
+            if (line.compare(0, 12, "voluntary_ct") == 0 || line.compare(0, 15, "nonvoluntary_ct") == 0)
+                total += std::stoul(line.substr(line.find(':') + 1));
+    }
+    closedir(tasks);
+    return total;
+}
+
+/// One client connection sending requests back to back.
+struct client : std::enable_shared_from_this<client>
+{
+    boost::asio::ip::tcp::socket socket;
+    boost::asio::streambuf response;
+    size_t& requests;
+
+    client(boost::asio::io_context& io, size_t& requests):
+      socket(io), requests(requests)
+    {}
+
+    void send()
+    {
+        auto self = shared_from_this();
+        boost::asio::async_write(socket, boost::asio::buffer(request, sizeof(request) - 1), [self](const boost::system::error_code& ec, size_t) {
+            if (!ec)
+                self->receive();
+        });
+    }
+
+    void receive()
+    {
+        auto self = shared_from_this();
+        boost::asio::async_read_until(socket, response, "\r\n\r\nok", [self](const boost::system::error_code& ec, size_t n) {
+            if (ec)
+                return;
+            self->response.consume(n);
+            self->requests++;
+            self->send();
+        });
+    }
+};
+
+int main(int argc, char** argv)
+{
+    std::vector<int> connection_counts;
+    for (int i = 1; i < argc; i++)
+        connection_counts.push_back(std::atoi(argv[i]));
+    if (connection_counts.empty())
+        connection_counts = {16, 128, 512};
+
+    pid_t server = fork();
+    if (server == 0)
+    {
+        crow::SimpleApp app;
+        app.loglevel(crow::LogLevel::Warning);
+        CROW_ROUTE(app, "/api/ping")
+        ([] {
+            return "ok";
+        });
+        app.port(port).concurrency(2).run();
+        return 0;
+    }
+    std::fprintf(stderr, "server pid %d\n", server);
+
+    // Wait for the listener.
+    boost::asio::io_context probe_io;
+    for (int attempt = 0;; attempt++)
+    {
+        boost::asio::ip::tcp::socket probe(probe_io);
+        boost::system::error_code ec;
+        probe.connect({boost::asio::ip::make_address("127.0.0.1"), port}, ec);
+        if (!ec)
+            break;
+        if (attempt == 100)
+        {
+            kill(server, SIGKILL);
+            return 1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    std::printf("{\n  \"suite\": \"io\",\n  \"results\": [\n");
+    for (size_t c = 0; c < connection_counts.size(); c++)
+    {
+        boost::asio::io_context io;
+        size_t requests = 0;
+        std::vector<std::shared_ptr<client>> clients;
+        for (int i = 0; i < connection_counts[c]; i++)
+        {
+            clients.push_back(std::make_shared<client>(io, requests));
+            clients.back()->socket.connect({boost::asio::ip::make_address("127.0.0.1"), port});
+        }
+
+        // Warm up, then measure.
+        for (auto& cl : clients)
+            cl->send();
+        io.run_for(std::chrono::milliseconds(300));
+        size_t start_requests = requests;
+        unsigned long start_switches = context_switches(server);
+        auto start = std::chrono::steady_clock::now();
+        io.run_for(std::chrono::seconds(2));
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        size_t done = requests - start_requests;
+        unsigned long switches = context_switches(server) - start_switches;
+
+        std::printf("    {\"name\": \"keep_alive/%d\", \"requests\": %zu, \"requests_per_s\": %.0f, \"server_ctx_switches_per_request\": %.3f}%s\n",
+                    connection_counts[c], done, done / seconds, done ? double(switches) / done : 0.0, c + 1 < connection_counts.size() ? "," : "");
+
+        for (auto& cl : clients)
+        {
+            boost::system::error_code ec;
+            cl->socket.close(ec);
+        }
+    }
+    std::printf("  ]\n}\n");
+
+    kill(server, SIGINT);
+    waitpid(server, nullptr, 0);
+    return 0;
+}
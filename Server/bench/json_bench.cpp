@@ -0,0 +1,124 @@
+// Compares crow::json::load against the on-demand crow::json::lazy_document on request bodies,
+// and crow::json::wvalue against crow::json::writer on a /api/surf-locations response.
+//
+// Build from the Server directory:
+//   g++ -std=c++17 -O2 -DCROW_USE_BOOST -I. bench/json_bench.cpp -o json_bench -lpthread
+// Add -mavx2 to use the AVX2 indexer instead of SSE2.
+#include "crow_all.h"
+#include "bench.h"
+
+// Bodies as Client/Cody_Maverick.js sends them, with the fields each endpoint reads.
+static const struct
+{
+    const char* name;
+    const char* body;
+    std::vector<const char*> fields;
+} bodies[] = {
+  {"login",
+   "{\"username\":\"cody\",\"password\":\"maverick\"}",
+   {"username", "password"}},
+  {"create_account",
+   "{\"username\":\"lani.kealoha\",\"password\":\"pipeline-2024!\",\"email\":\"lani.kealoha@example.com\"}",
+   {"username", "password", "email"}},
+  {"weather_conditions",
+   "{\"locationName\":\"Tofino\",\"date\":\"2024-05-02\"}",
+   {"locationName", "date"}},
+  {"like_comment",
+   "{\"userId\":\"6634f1c2a9d5e8b7c4f01a23\",\"commentId\":\"6634f2d8a9d5e8b7c4f01a9e\"}",
+   {"userId", "commentId"}},
+  {"create_comment",
+   "{\"postId\":\"6634f0b1a9d5e8b7c4f019f0\",\"userId\":\"6634f1c2a9d5e8b7c4f01a23\","
+   "\"description\":\"Glassy chest-high sets at Cox Bay this morning, offshore until about 10. "
+   "Bring a 4/3, the water is still \\\"fresh\\\" \\u2014 and watch the rip by the north rocks.\"}",
+   {"postId", "userId", "description"}},
+};
+
+int main()
+{
+    bench::runner runner;
+    crow::json::lazy_document doc;
+    size_t total = 0;
+
+    for (const auto& b : bodies)
+    {
+        std::string body = b.body;
+        std::string name = b.name;
+
+        runner.run("load/" + name, body.size(), [&] {
+            auto json = crow::json::load(body);
+            for (const char* field : b.fields)
+            {
+                auto value = json[field].s();
+                total += value.size();
+            }
+        });
+        runner.run("lazy/" + name, body.size(), [&] {
+            doc.parse(body);
+            for (const char* field : b.fields)
+            {
+                std::string value = doc[field].s();
+                total += value.size();
+            }
+        });
+        runner.run("lazy_parse_only/" + name, body.size(), [&] {
+            bench::do_not_optimize(doc.parse(body));
+        });
+    }
+
+    // A page of surf locations as /api/surf-locations returns them.
+    const int locations = 50;
+    auto location_name = [](int i) { return "Cox Bay " + std::to_string(i); };
+    auto write_locations = [&](std::string& out) {
+        crow::json::writer json(out);
+        json.begin_list();
+        for (int i = 0; i < locations; i++)
+            json.begin_object()
+              .key("_id")
+              .begin_object()
+              .member("$oid", "6634f0b1a9d5e8b7c4f019f0")
+              .end_object()
+              .member("locationName", location_name(i))
+              .member("breakType", "Beach Break")
+              .member("surfScore", 7)
+              .member("countryName", "Canada")
+              .member("description", "Famous surf spot in British Columbia, \"Tuff City\" locals")
+              .key("coordinates")
+              .begin_object()
+              .member("latitude", 49.1538 + i * 0.01)
+              .member("longitude", -125.9074)
+              .end_object()
+              .member("TotalLikes", 12 * i)
+              .member("TotalComments", i)
+              .end_object();
+        json.end_list();
+    };
+    std::string body;
+    write_locations(body);
+    const size_t response_size = body.size();
+
+    runner.run("wvalue_dump/surf_locations", response_size, [&] {
+        std::vector<crow::json::wvalue> list;
+        for (int i = 0; i < locations; i++)
+            list.push_back(crow::json::wvalue{
+              {"_id", {{"$oid", "6634f0b1a9d5e8b7c4f019f0"}}},
+              {"locationName", location_name(i)},
+              {"breakType", "Beach Break"},
+              {"surfScore", 7},
+              {"countryName", "Canada"},
+              {"description", "Famous surf spot in British Columbia, \"Tuff City\" locals"},
+              {"coordinates", {{"latitude", 49.1538 + i * 0.01}, {"longitude", -125.9074}}},
+              {"TotalLikes", 12 * i},
+              {"TotalComments", i},
+            });
+        total += crow::json::wvalue(list).dump().size();
+    });
+    runner.run("writer/surf_locations", response_size, [&] {
+        body.clear();
+        write_locations(body);
+        total += body.size();
+    });
+
+    runner.report("json");
+    bench::do_not_optimize(total);
+    return total > 0 ? 0 : 1;
+}
@@ -0,0 +1,492 @@
+// Load generator replaying the requests a Client/Cody_Maverick.js user makes, against a running server.
+//
+// Build from the Server directory:
+//   g++ -std=c++17 -O2 -DCROW_USE_BOOST -I. bench/load_gen.cpp -o load_gen -lpthread
+// Run e.g. `./load_gen --port 3000 --connections 64 --rate 5000 --duration 30`. Options:
+//   --host, --port          server address (127.0.0.1:3000)
+//   --connections           keep-alive connections, split over the threads (32)
+//   --threads               client threads, each with its own event loop (2)
+//   --rate                  requests per second over all threads; 0 sends back to back on every connection (1000)
+//   --poisson               exponential gaps between arrivals instead of a fixed interval
+//   --duration, --warmup    seconds to measure, and to run before measuring (30, 5)
+//
+// With a rate, requests arrive open loop: each has an intended start time on the arrival schedule, and waits in a
+// backlog while every connection is busy. Response time runs from the intended start, so a stalled server shows up
+// as the latency its users would have seen rather than as fewer requests sent (coordinated omission). Service time
+// runs from the request actually being written. Results are printed as JSON like the other benchmarks. A request
+// whose connection fails counts as an error and isn't sent again; the connection is replaced.
+#include "crow_all.h"
+
+#include <cstring>
+#include <deque>
+#include <random>
+
+using clock_type = std::chrono::steady_clock;
+namespace asio = boost::asio;
+
+/// One request of the journey: the initial list, searches, then a location's detail view and its posts.
+struct step
+{
+    const char* name;
+    const char* method;
+    std::string target;
+    std::string body;
+};
+
+static const char* const countries[] = {"Canada", "USA", "Australia", "Portugal"};
+static const char* const locations[] = {"Tofino", "Cox%20Bay", "Long%20Beach", "Jordan%20River", "Chesterman%20Beach"};
+static const char* const post_ids[] = {"6634f0b1a9d5e8b7c4f019f0", "6634f0b1a9d5e8b7c4f019f1", "6634f0b1a9d5e8b7c4f019f2"};
+static const char* const comment_ids[] = {"6634f2d8a9d5e8b7c4f01a9e", "6634f2d8a9d5e8b7c4f01a9f"};
+static const char* const user_id = "6634f1c2a9d5e8b7c4f01a23";
+
+/// The journey of user `n`, who looks at a different location than user n - 1.
+static std::vector<step> journey(size_t n)
+{
+    std::string country = countries[n % (sizeof(countries) / sizeof(*countries))];
+    std::string location = locations[n % (sizeof(locations) / sizeof(*locations))];
+    std::string plain_location = location;
+    for (size_t p; (p = plain_location.find("%20")) != std::string::npos;)
+        plain_location.replace(p, 3, " ");
+    std::string post_id = post_ids[n % (sizeof(post_ids) / sizeof(*post_ids))];
+    std::string comment_id = comment_ids[n % (sizeof(comment_ids) / sizeof(*comment_ids))];
+
+    return {
+      {"surf_locations/initial", "GET", "/api/surf-locations?country=&location=&filterLikes=false", ""},
+      {"surf_locations/country", "GET", "/api/surf-locations?country=" + country + "&location=&filterLikes=false", ""},
+      {"surf_locations/location", "GET", "/api/surf-locations?country=&location=" + location + "&filterLikes=false", ""},
+      {"location_details", "GET", "/api/location-details?locationName=" + location, ""},
+      {"surf_risks", "GET", "/api/surf-risks", ""},
+      {"weather_conditions", "POST", "/api/weather-conditions", "{\"locationName\":\"" + plain_location + "\",\"date\":\"2024-05-02\"}"},
+      {"location_top_posts", "GET", "/api/location-top-posts?locationName=" + location, ""},
+      {"post_comments", "GET", "/api/post-comments?postId=" + post_id, ""},
+      {"like_comment", "POST", "/api/like-comment", "{\"userId\":\"" + std::string(user_id) + "\",\"commentId\":\"" + comment_id + "\"}"},
+      {"create_comment", "POST", "/api/create-comment",
+       "{\"postId\":\"" + post_id + "\",\"userId\":\"" + user_id + "\",\"description\":\"Glassy chest-high sets this morning, offshore until about 10.\"}"},
+    };
+}
+
+/// The request as Chrome sends it.
+static std::string serialize(const step& s, const std::string& host)
+{
+    std::string out = std::string(s.method) + ' ' + s.target + " HTTP/1.1\r\n";
+    out += "Host: " + host + "\r\n";
+    out += "Connection: keep-alive\r\n";
+    out += "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n";
+    out += "Accept: application/json\r\n";
+    out += "Origin: http://localhost:8000\r\n";
+    out += "Referer: http://localhost:8000/\r\n";
+    out += "Accept-Encoding: gzip, deflate, br, zstd\r\n";
+    out += "Accept-Language: en-CA,en-US;q=0.9,en;q=0.8\r\n";
+    if (!s.body.empty())
+    {
+        out += "Content-Type: application/json\r\n";
+        out += "Content-Length: " + std::to_string(s.body.size()) + "\r\n";
+    }
+    out += "\r\n";
+    out += s.body;
+    return out;
+}
+
+struct options
+{
+    std::string host = "127.0.0.1";
+    unsigned short port = 3000;
+    size_t connections = 32;
+    size_t threads = 2;
+    double rate = 1000;
+    bool poisson = false;
+    double duration = 30;
+    double warmup = 5;
+};
+
+/// Results of one step, or of all of them.
+struct stats
+{
+    crow::metrics::histogram response_time;
+    crow::metrics::histogram service_time;
+    std::uint64_t status[6] = {};
+    std::uint64_t errors = 0;
+};
+
+/// An arrival waiting for a connection.
+struct pending
+{
+    clock_type::time_point intended;
+    size_t request;
+};
+
+class generator;
+
+/// A keep-alive connection that sends one request at a time.
+class connection : public std::enable_shared_from_this<connection>
+{
+public:
+    connection(asio::io_context& io, generator& owner, const asio::ip::tcp::endpoint& endpoint):
+      socket_(io), endpoint_(endpoint), owner_(owner)
+    {}
+
+    /// Open a new connection and call `then(connected)`. Asynchronous, so the other connections and the arrival timer
+    /// on the thread keep going while it connects.
+    template<typename Handler>
+    void connect(Handler then)
+    {
+        boost::system::error_code ec;
+        socket_.close(ec);
+        input_.consume(input_.size());
+        auto self = shared_from_this();
+        socket_.async_connect(endpoint_, [self, then](const boost::system::error_code& ec) {
+            if (!ec)
+            {
+                boost::system::error_code ignored;
+                self->socket_.set_option(asio::ip::tcp::no_delay(true), ignored);
+            }
+            then(!ec);
+        });
+    }
+
+    void send(const pending& p, const std::string& request);
+
+private:
+    void write();
+    void read_head();
+    void read_body(size_t header_length, size_t content_length);
+    void done(int status);
+    void failed();
+
+    asio::ip::tcp::socket socket_;
+    asio::ip::tcp::endpoint endpoint_;
+    asio::streambuf input_;
+    generator& owner_;
+    pending current_{};
+    const std::string* request_ = nullptr;
+    clock_type::time_point sent_;
+    bool close_ = false;
+};
+
+/// One client thread: its share of the arrivals and connections, on its own io_context.
+class generator
+{
+public:
+    generator(const options& opts, size_t index, size_t connection_count, double rate, const asio::ip::tcp::endpoint& endpoint):
+      opts_(opts), rate_(rate), endpoint_(endpoint), arrival_timer_(io_), random_(static_cast<unsigned>(index + 1))
+    {
+        // Threads start their users at different points of the journey so they don't all hit the same location.
+        for (size_t user = index; user < index + 8; user++)
+            for (const step& s : journey(user))
+            {
+                steps_.push_back(s.name);
+                requests_.push_back(serialize(s, opts.host + ':' + std::to_string(opts.port)));
+            }
+        // The connections go to work as they connect, once run() runs the io_context
+        for (size_t i = 0; i < connection_count; i++)
+            reconnect(std::make_shared<connection>(io_, *this, endpoint_));
+        size_t step_count = requests_.size() / 8;
+        per_step_.resize(step_count);
+        for (auto& s : per_step_)
+            s.reset(new stats);
+    }
+
+    void run(clock_type::time_point start, clock_type::time_point measure_from, clock_type::time_point end)
+    {
+        measure_from_ = measure_from;
+        end_ = end;
+        next_arrival_ = start;
+        if (rate_ > 0)
+            schedule_arrival();
+        io_.run_until(end_);
+        stopping_ = true;
+        // Let requests already sent finish.
+        io_.run_for(std::chrono::seconds(2));
+        unfinished_ = backlog_.size() + in_flight_;
+    }
+
+    /// A connection finished `p` with `status` (0 for a connection error). `closed` if it can't be used again.
+    void finished(const std::shared_ptr<connection>& c, const pending& p, clock_type::time_point sent, int status, bool closed)
+    {
+        in_flight_--;
+        auto now = clock_type::now();
+        if (p.intended >= measure_from_ && p.intended < end_)
+        {
+            stats& s = *per_step_[p.request % per_step_.size()];
+            if (status)
+            {
+                std::uint64_t response_us = std::chrono::duration_cast<std::chrono::microseconds>(now - p.intended).count();
+                s.response_time.record(response_us);
+                std::uint64_t service_us = std::chrono::duration_cast<std::chrono::microseconds>(now - sent).count();
+                s.service_time.record(service_us);
+                s.status[std::min(status / 100, 5)]++;
+            }
+            else
+                s.errors++;
+        }
+        if (closed)
+            return reconnect(c);
+        next(c);
+    }
+
+    const std::vector<std::unique_ptr<stats>>& per_step() const { return per_step_; }
+    const std::vector<const char*>& steps() const { return steps_; }
+    size_t unfinished() const { return unfinished_; }
+    size_t max_backlog() const { return max_backlog_; }
+    size_t connect_failures() const { return connect_failures_; }
+
+private:
+    void reconnect(const std::shared_ptr<connection>& c)
+    {
+        c->connect([this, c](bool connected) {
+            if (!connected)
+                connect_failures_++;
+            else
+                next(c);
+        });
+    }
+
+    void next(const std::shared_ptr<connection>& c)
+    {
+        if (stopping_)
+            return;
+        if (rate_ <= 0)
+        {
+            // Closed loop: the next request starts now.
+            start(c, {clock_type::now(), next_request_++ % requests_.size()});
+            return;
+        }
+        if (backlog_.empty())
+        {
+            idle_.push_back(c);
+            return;
+        }
+        pending p = backlog_.front();
+        backlog_.pop_front();
+        start(c, p);
+    }
+
+    void start(const std::shared_ptr<connection>& c, const pending& p)
+    {
+        in_flight_++;
+        c->send(p, requests_[p.request]);
+    }
+
+    void schedule_arrival()
+    {
+        arrival_timer_.expires_at(next_arrival_);
+        arrival_timer_.async_wait([this](const boost::system::error_code& ec) {
+            if (ec || stopping_)
+                return;
+            // A late timer still queues every arrival that was due, at the time it was due.
+            auto now = clock_type::now();
+            while (next_arrival_ <= now && next_arrival_ < end_)
+            {
+                backlog_.push_back({next_arrival_, next_request_++ % requests_.size()});
+                next_arrival_ += gap();
+            }
+            max_backlog_ = std::max(max_backlog_, backlog_.size());
+            while (!backlog_.empty() && !idle_.empty())
+            {
+                auto c = idle_.back();
+                idle_.pop_back();
+                next(c);
+            }
+            if (next_arrival_ < end_)
+                schedule_arrival();
+        });
+    }
+
+    clock_type::duration gap()
+    {
+        double seconds = opts_.poisson ? std::exponential_distribution<double>(rate_)(random_) : 1 / rate_;
+        return std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(seconds));
+    }
+
+    const options& opts_;
+    double rate_;
+    asio::ip::tcp::endpoint endpoint_;
+    asio::io_context io_;
+    asio::steady_timer arrival_timer_;
+    std::mt19937_64 random_;
+
+    std::vector<const char*> steps_;
+    std::vector<std::string> requests_;
+    std::vector<std::shared_ptr<connection>> idle_;
+    std::deque<pending> backlog_;
+    std::vector<std::unique_ptr<stats>> per_step_;
+
+    clock_type::time_point next_arrival_, measure_from_, end_;
+    size_t next_request_ = 0;
+    size_t in_flight_ = 0;
+    size_t unfinished_ = 0;
+    size_t max_backlog_ = 0;
+    size_t connect_failures_ = 0;
+    bool stopping_ = false;
+};
+
+void connection::send(const pending& p, const std::string& request)
+{
+    current_ = p;
+    request_ = &request;
+    sent_ = clock_type::now();
+    write();
+}
+
+void connection::write()
+{
+    auto self = shared_from_this();
+    asio::async_write(socket_, asio::buffer(*request_), [self](const boost::system::error_code& ec, size_t) {
+        if (ec)
+            return self->failed();
+        self->read_head();
+    });
+}
+
+void connection::read_head()
+{
+    auto self = shared_from_this();
+    asio::async_read_until(socket_, input_, "\r\n\r\n", [self](const boost::system::error_code& ec, size_t header_length) {
+        if (ec)
+            return self->failed();
+        // Find Content-Length, the server doesn't use chunked responses.
+        const char* head = asio::buffer_cast<const char*>(self->input_.data());
+        std::string lower(head, header_length);
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+        size_t content_length = 0;
+        size_t at = lower.find("\r\ncontent-length:");
+        if (at != std::string::npos)
+            content_length = std::strtoul(lower.c_str() + at + 17, nullptr, 10);
+        self->close_ = lower.find("\r\nconnection: close") != std::string::npos;
+        self->read_body(header_length, content_length);
+    });
+}
+
+void connection::read_body(size_t header_length, size_t content_length)
+{
+    int status = std::atoi(asio::buffer_cast<const char*>(input_.data()) + 9);
+    size_t have = input_.size() - header_length;
+    if (have >= content_length)
+    {
+        input_.consume(header_length + content_length);
+        return done(status);
+    }
+    auto self = shared_from_this();
+    asio::async_read(socket_, input_, asio::transfer_exactly(content_length - have), [self, header_length, content_length, status](const boost::system::error_code& ec, size_t) {
+        if (ec)
+            return self->failed();
+        self->input_.consume(header_length + content_length);
+        self->done(status);
+    });
+}
+
+void connection::done(int status)
+{
+    owner_.finished(shared_from_this(), current_, sent_, status, close_);
+}
+
+void connection::failed()
+{
+    owner_.finished(shared_from_this(), current_, sent_, 0, true);
+}
+
+static void print_ms(const char* name, const crow::metrics::histogram::snapshot& s)
+{
+    std::printf("\"%s\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f}",
+                name, s.quantile(0.5) / 1e3, s.quantile(0.9) / 1e3, s.quantile(0.99) / 1e3, s.quantile(0.999) / 1e3, s.max / 1e3);
+}
+
+int main(int argc, char** argv)
+{
+    options opts;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "--poisson")
+        {
+            opts.poisson = true;
+            continue;
+        }
+        if (arg == "--host")
+            opts.host = value;
+        else if (arg == "--port")
+            opts.port = static_cast<unsigned short>(std::atoi(value));
+        else if (arg == "--connections")
+            opts.connections = std::max(1, std::atoi(value));
+        else if (arg == "--threads")
+            opts.threads = std::max(1, std::atoi(value));
+        else if (arg == "--rate")
+            opts.rate = std::atof(value);
+        else if (arg == "--duration")
+            opts.duration = std::atof(value);
+        else if (arg == "--warmup")
+            opts.warmup = std::atof(value);
+        else
+        {
+            std::fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return 2;
+        }
+        i++;
+    }
+    opts.threads = std::min(opts.threads, opts.connections);
+
+    asio::ip::tcp::endpoint endpoint{asio::ip::make_address(opts.host), opts.port};
+    std::vector<std::unique_ptr<generator>> generators;
+    for (size_t i = 0; i < opts.threads; i++)
+    {
+        size_t connections = opts.connections / opts.threads + (i < opts.connections % opts.threads ? 1 : 0);
+        generators.emplace_back(new generator(opts, i, connections, opts.rate / opts.threads, endpoint));
+    }
+
+    auto start = clock_type::now();
+    auto measure_from = start + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(opts.warmup));
+    auto end = measure_from + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(opts.duration));
+    std::vector<std::thread> threads;
+    for (auto& g : generators)
+        threads.emplace_back([&g, start, measure_from, end] {
+            g->run(start, measure_from, end);
+        });
+    for (auto& t : threads)
+        t.join();
+
+    // Merge the threads, per step and overall.
+    const auto& names = generators[0]->steps();
+    size_t step_count = generators[0]->per_step().size();
+    std::vector<crow::metrics::histogram::snapshot> response(step_count + 1), service(step_count + 1);
+    std::vector<stats> totals(step_count + 1);
+    size_t unfinished = 0, max_backlog = 0, connect_failures = 0;
+    for (auto& g : generators)
+    {
+        for (size_t i = 0; i < step_count; i++)
+        {
+            const stats& s = *g->per_step()[i];
+            for (size_t target : {i, step_count})
+            {
+                s.response_time.merge_into(response[target]);
+                s.service_time.merge_into(service[target]);
+                for (int c = 0; c < 6; c++)
+                    totals[target].status[c] += s.status[c];
+                totals[target].errors += s.errors;
+            }
+        }
+        unfinished += g->unfinished();
+        max_backlog = std::max(max_backlog, g->max_backlog());
+        connect_failures += g->connect_failures();
+    }
+
+    std::printf("{\n  \"suite\": \"load\",\n");
+    std::printf("  \"config\": {\"connections\": %zu, \"threads\": %zu, \"rate\": %.0f, \"poisson\": %s, \"duration_s\": %.1f},\n",
+                opts.connections, opts.threads, opts.rate, opts.poisson ? "true" : "false", opts.duration);
+    std::printf("  \"unfinished\": %zu, \"max_backlog\": %zu, \"connect_failures\": %zu,\n", unfinished, max_backlog, connect_failures);
+    std::printf("  \"results\": [\n");
+    for (size_t i = 0; i <= step_count; i++)
+    {
+        const stats& t = totals[i];
+        std::printf("    {\"name\": \"%s\", \"requests\": %llu, \"requests_per_s\": %.1f, \"status_2xx\": %llu, \"status_4xx\": %llu, \"status_5xx\": %llu, \"errors\": %llu, ",
+                    i < step_count ? names[i] : "all", static_cast<unsigned long long>(response[i].count), response[i].count / opts.duration,
+                    static_cast<unsigned long long>(t.status[2]), static_cast<unsigned long long>(t.status[4]), static_cast<unsigned long long>(t.status[5]),
+                    static_cast<unsigned long long>(t.errors));
+        print_ms("response_ms", response[i]);
+        std::printf(", ");
+        print_ms("service_ms", service[i]);
+        std::printf("}%s\n", i < step_count ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+    return 0;
+}
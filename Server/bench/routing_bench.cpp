@@ -0,0 +1,122 @@
+// Routing, query string parsing and response header serialization for the requests Client/Cody_Maverick.js sends.
+//
+// Build from the Server directory:
+//   g++ -std=c++17 -O2 -DCROW_USE_BOOST -I. bench/routing_bench.cpp -o routing_bench -lpthread
+#include "crow_all.h"
+#include "bench.h"
+
+// Request targets as the client sends them, in rough order of frequency.
+static const char* const targets[][2] = {
+  {"surf_locations", "/api/surf-locations?country=Canada&location=&filterLikes=false"},
+  {"location_details", "/api/location-details?locationName=Tofino"},
+  {"location_top_posts", "/api/location-top-posts?locationName=Cox%20Bay"},
+  {"post_comments", "/api/post-comments?postId=6634f0b1a9d5e8b7c4f019f0"},
+  {"db_structure", "/api/db-structure"},
+  {"root", "/"},
+  {"post_by_id", "/api/posts/6634f0b1a9d5e8b7c4f019f0"},
+  {"not_found", "/favicon.ico"},
+};
+
+int main()
+{
+    crow::SimpleApp app;
+    app.loglevel(crow::LogLevel::Warning);
+
+    // The server's routes, plus the ones the client calls that aren't implemented yet.
+    CROW_ROUTE(app, "/")
+    ([] {
+        return "C++ backend server is up and running!";
+    });
+    CROW_ROUTE(app, "/metrics").methods("GET"_method)([] {
+        return "";
+    });
+    CROW_ROUTE(app, "/api/surf-locations").methods("GET"_method)([](const crow::request& req) {
+        return req.url_params.get("country") ? "[]" : "";
+    });
+    CROW_ROUTE(app, "/api/db-structure").methods("GET"_method)([] {
+        return "{}";
+    });
+    CROW_ROUTE(app, "/api/location-details").methods("GET"_method)([] {
+        return "{}";
+    });
+    CROW_ROUTE(app, "/api/location-top-posts").methods("GET"_method)([] {
+        return "[]";
+    });
+    CROW_ROUTE(app, "/api/post-comments").methods("GET"_method)([] {
+        return "[]";
+    });
+    CROW_ROUTE(app, "/api/posts/<string>").methods("GET"_method)([](const std::string& id) {
+        return id;
+    });
+    CROW_ROUTE(app, "/api/login").methods("POST"_method)([] {
+        return "{}";
+    });
+    CROW_ROUTE(app, "/api/create-account").methods("POST"_method)([] {
+        return "{}";
+    });
+    CROW_ROUTE(app, "/api/weather-conditions").methods("POST"_method)([] {
+        return "{}";
+    });
+    CROW_ROUTE(app, "/api/like-comment").methods("POST"_method)([] {
+        return "{}";
+    });
+    CROW_ROUTE(app, "/api/create-comment").methods("POST"_method)([] {
+        return "{}";
+    });
+    app.validate();
+
+    bench::runner runner;
+    size_t total = 0;
+
+    for (const auto& target : targets)
+    {
+        std::string name = target[0];
+        std::string raw_url = target[1];
+
+        crow::request req;
+        req.method = "GET"_method;
+        req.raw_url = raw_url;
+        req.url = raw_url.substr(0, raw_url.find('?'));
+        req.url_params = crow::query_string(raw_url);
+        crow::response res;
+        crow::routing_handle_result found;
+
+        runner.run("router_find/" + name, 0, [&] {
+            app.handle_initial(req, res, found);
+            total += found.rule_index;
+            res.clear();
+        });
+        runner.run("router_handle/" + name, 0, [&] {
+            app.handle_full(req, res);
+            total += res.body.size();
+            res.clear();
+        });
+        runner.run("query_string/" + name, raw_url.size(), [&] {
+            crow::query_string params(raw_url);
+            total += params.keys().size();
+        });
+    }
+
+    // Headers of a /api/surf-locations response, as prepare_buffers() queues them.
+    crow::response res(200);
+    res.body.assign(3000, ' ');
+    res.add_header("Content-Type", "application/json");
+    res.add_header("Access-Control-Allow-Origin", "*");
+    std::vector<crow::asio::const_buffer> buffers;
+    const std::string server_name = "Crow/master";
+    const std::string date = "Sat, 04 May 2024 18:20:01 GMT";
+    std::string content_length;
+    runner.run("response_head/surf_locations", 0, [&] {
+        crow::detail::serialize_response_head(buffers, res, server_name, date, content_length, true);
+        total += buffers.size();
+    });
+    crow::response not_found(404);
+    runner.run("response_head/not_found", 0, [&] {
+        crow::detail::serialize_response_head(buffers, not_found, server_name, date, content_length, true);
+        total += buffers.size();
+    });
+
+    runner.report("routing");
+    bench::do_not_optimize(total);
+    return total > 0 ? 0 : 1;
+}
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Build and run the microbenchmarks, writing one JSON file per suite to
+# bench/results/<commit>/ so two commits can be compared with diff or jq.
+#
+# Run from the Server directory: sh bench/run.sh [output directory]
+# Needs the MongoDB C++ driver (libbsoncxx and libmongocxx through pkg-config)
+# and fails without it. Besides the suites it builds the server, gen_data,
+# io_bench and load_gen, so none of them goes unchecked, and everything is
+# built with warnings as errors.
+set -e
+
+cd "$(dirname "$0")/.."
+if ! pkg-config --exists libbsoncxx libmongocxx; then
+    echo "error: pkg-config can't find libbsoncxx and libmongocxx, install the MongoDB C++ driver or set PKG_CONFIG_PATH" >&2
+    exit 1
+fi
+
+commit=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+out=${1:-bench/results/$commit}
+build=$(mktemp -d)
+trap 'rm -rf "$build"' EXIT
+mkdir -p "$out"
+
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--std=c++17 -O2 -DCROW_USE_BOOST}
+WARNINGS=${WARNINGS:--Wall -Wextra -Werror}
+BSONCXX=$(pkg-config --cflags --libs libbsoncxx)
+MONGOCXX=$(pkg-config --cflags --libs libmongocxx)
+
+$CXX $CXXFLAGS $WARNINGS -I. server.cpp -o "$build/server" -lpthread $MONGOCXX
+$CXX $CXXFLAGS $WARNINGS -I. bench/gen_data.cpp -o "$build/gen_data" -lpthread $MONGOCXX
+# A small dataset written as NDJSON, so gen_data runs without a database
+"$build/gen_data" --locations 20 --ndjson "$build/data" > /dev/null
+# Tools that need a running server or a while to run, only built here
+$CXX $CXXFLAGS $WARNINGS -I. bench/io_bench.cpp -o "$build/io_bench" -lpthread
+$CXX $CXXFLAGS $WARNINGS -I. bench/load_gen.cpp -o "$build/load_gen" -lpthread
+
+for suite in http_parser routing json; do
+    $CXX $CXXFLAGS $WARNINGS -I. "bench/${suite}_bench.cpp" -o "$build/$suite" -lpthread
+    "$build/$suite" > "$out/$suite.json"
+    echo "$out/$suite.json"
+done
+
+$CXX $CXXFLAGS $WARNINGS -I. bench/bson_bench.cpp -o "$build/bson" -lpthread $BSONCXX
+"$build/bson" > "$out/bson.json"
+echo "$out/bson.json"
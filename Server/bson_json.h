@@ -0,0 +1,85 @@
+// BSON to JSON with crow's streaming writer, shared by server.cpp and the benchmarks.
+#pragma once
+
+#include "crow_all.h"            // Crow framework header
+#include <bsoncxx/json.hpp>      // For BSON/JSON conversion
+#include <bsoncxx/builder/basic/document.hpp>   // For wrapping single BSON values
+#include <bsoncxx/document/view.hpp>            // For BSON document views
+#include <bsoncxx/types.hpp>     // For BSON types
+
+#include <string>     // For std::string
+#include <string_view> // For std::string_view
+
+inline void writeBson(crow::json::writer& json, bsoncxx::document::view doc);
+
+// Write one BSON value with crow's JSON writer. ObjectIds and dates use the same
+// extended JSON as bsoncxx::to_json; types our collections don't use go through it.
+template <typename Element>
+void writeBsonValue(crow::json::writer& json, const Element& element)
+{
+    switch (element.type())
+    {
+        case bsoncxx::type::k_double:
+            json.value(element.get_double().value);
+            break;
+        case bsoncxx::type::k_string:
+        {
+            auto str = element.get_string().value;
+            json.value(std::string_view(str.data(), str.size()));
+            break;
+        }
+        case bsoncxx::type::k_document:
+            writeBson(json, element.get_document().value);
+            break;
+        case bsoncxx::type::k_array:
+            json.begin_list();
+            for (auto&& item : element.get_array().value)
+                writeBsonValue(json, item);
+            json.end_list();
+            break;
+        case bsoncxx::type::k_oid:
+            json.begin_object().member("$oid", element.get_oid().value.to_string()).end_object();
+            break;
+        case bsoncxx::type::k_bool:
+            json.value(element.get_bool().value);
+            break;
+        case bsoncxx::type::k_date:
+            json.begin_object().member("$date", element.get_date().to_int64()).end_object();
+            break;
+        case bsoncxx::type::k_null:
+            json.value(nullptr);
+            break;
+        case bsoncxx::type::k_int32:
+            json.value(element.get_int32().value);
+            break;
+        case bsoncxx::type::k_int64:
+            json.value(element.get_int64().value);
+            break;
+        default:
+        {
+            // to_json gives { "v" : <value> }, keep the part after the colon
+            using bsoncxx::builder::basic::kvp;
+            std::string wrapped = bsoncxx::to_json(bsoncxx::builder::basic::make_document(kvp("v", element.get_value())));
+            size_t start = wrapped.find(':') + 1;
+            size_t end = wrapped.rfind('}');
+            std::string_view value(wrapped.data() + start, end - start);
+            size_t first = value.find_first_not_of(' ');
+            size_t last = value.find_last_not_of(' ');
+            json.raw(value.substr(first, last - first + 1));
+            break;
+        }
+    }
+}
+
+// Write a BSON document as a JSON object, in field order.
+inline void writeBson(crow::json::writer& json, bsoncxx::document::view doc)
+{
+    json.begin_object();
+    for (auto&& element : doc)
+    {
+        auto key = element.key();
+        json.key(std::string_view(key.data(), key.size()));
+        writeBsonValue(json, element);
+    }
+    json.end_object();
+}
@@ -0,0 +1,113 @@
+// Cross-origin access to the API for the client, which browsers load from another origin. Its calls send
+// Content-Type: application/json, so browsers ask with an OPTIONS preflight before nearly every one. Cors answers
+// those before routing, from header blocks built once by configure(), and lets browsers cache the answer for
+// maxAge seconds so most calls go out without one.
+#pragma once
+
+#include "crow_all.h"            // Crow framework header
+
+#include <algorithm>  // For std::min
+#include <string>     // For std::string
+#include <string_view> // For std::string_view
+#include <utility>    // For std::pair
+#include <vector>     // For std::vector
+
+struct Cors
+{
+    struct context
+    {};
+
+    // `origins` is "*" for any origin, or the allowed ones separated by commas, e.g.
+    // "https://surf.example.com,http://localhost:8080". Call before the server runs.
+    void configure(const std::string& origins, int maxAge)
+    {
+        allowed_.clear();
+        any_ = origins == "*";
+        if (any_)
+        {
+            any_origin_ = blocks("*", maxAge, false);
+            return;
+        }
+        for (std::size_t start = 0; start <= origins.size();)
+        {
+            std::size_t end = std::min(origins.find(',', start), origins.size());
+            std::size_t first = origins.find_first_not_of(' ', start);
+            std::size_t last = origins.find_last_not_of(' ', end - 1);
+            if (first < end && last != std::string::npos && last >= first)
+            {
+                std::string origin = origins.substr(first, last - first + 1);
+                allowed_.emplace_back(origin, blocks(origin, maxAge, true));
+            }
+            start = end + 1;
+        }
+    }
+
+    void before_handle(crow::request& req, crow::response& res, context&)
+    {
+        // Only preflights, other OPTIONS requests get the Allow header of their route from the router
+        if (req.method != crow::HTTPMethod::Options || req.get_header_view("access-control-request-method").empty())
+            return;
+        const Blocks* allowed = find(req.get_header_view("origin"));
+        res.code = 204;
+        res.manual_length_header = true;  // No Content-Length on a 204
+        // An origin that isn't allowed gets no Access-Control headers, which the browser takes as a refusal
+        res.header_block = allowed ? &allowed->preflight : &vary_;
+        res.end();
+    }
+
+    void after_handle(crow::request& req, crow::response& res, context&)
+    {
+        if (res.header_block)
+            return;
+        if (any_)
+        {
+            res.header_block = &any_origin_.simple;
+            return;
+        }
+        std::string_view origin = req.get_header_view("origin");
+        if (origin.empty())
+            return;
+        const Blocks* allowed = find(origin);
+        res.header_block = allowed ? &allowed->simple : &vary_;
+    }
+
+private:
+    struct Blocks
+    {
+        std::string preflight;  // For the 204 answering a preflight
+        std::string simple;     // Added to every other response
+    };
+
+    static Blocks blocks(const std::string& origin, int maxAge, bool vary)
+    {
+        Blocks result;
+        result.simple = "access-control-allow-origin: " + origin + "\r\n";
+        // The answer depends on the Origin header unless any origin gets the same one, caches have to know
+        if (vary)
+            result.simple += "vary: Origin\r\n";
+        // The methods the client calls the API with, nothing is routed for PUT or DELETE
+        result.preflight = result.simple +
+                           "access-control-allow-methods: GET, POST, OPTIONS\r\n"
+                           "access-control-allow-headers: Content-Type, Accept, Authorization\r\n"
+                           "access-control-max-age: " + std::to_string(maxAge) + "\r\n";
+        return result;
+    }
+
+    // A handful of origins at most, a scan beats hashing the header
+    const Blocks* find(std::string_view origin) const
+    {
+        if (any_)
+            return &any_origin_;
+        for (const auto& allowed : allowed_)
+        {
+            if (allowed.first == origin)
+                return &allowed.second;
+        }
+        return nullptr;
+    }
+
+    bool any_ = true;
+    Blocks any_origin_ = blocks("*", 7200, false);
+    std::vector<std::pair<std::string, Blocks>> allowed_;
+    std::string vary_ = "vary: Origin\r\n";
+};
@@ -459,77 +459,145 @@ inline char * qs_scanvalue(const char * key, const char * qs, char * val, size_t
 // ----------------------------------------------------------------------------
 
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
 namespace crow
 {
-    struct request;
-    /// A class to represent any data coming after the `?` in the request URL into key-value pairs.
-    class query_string
+    namespace detail
     {
-    public:
-        static const int MAX_KEY_VALUE_PAIRS_COUNT = 256;
-
-        query_string() = default;
-
-        query_string(const query_string& qs):
-          url_(qs.url_)
+        namespace qs
         {
-            for (auto p : qs.key_value_pairs_)
+            /// Return the first '%' or '+' in [p, end).
+            inline char* find_escape(char* p, char* end)
             {
-                key_value_pairs_.push_back((char*)(p - qs.url_.c_str() + url_.c_str()));
+#if defined(__AVX2__)
+                const __m256i percent = _mm256_set1_epi8('%'), plus = _mm256_set1_epi8('+');
+                for (; end - p >= 32; p += 32)
+                {
+                    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+                    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(b, percent), _mm256_cmpeq_epi8(b, plus))));
+                    if (mask) return p + __builtin_ctz(mask);
+                }
+#elif defined(__SSE2__) || defined(_M_X64)
+                const __m128i percent = _mm_set1_epi8('%'), plus = _mm_set1_epi8('+');
+                for (; end - p >= 16; p += 16)
+                {
+                    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+                    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(b, percent), _mm_cmpeq_epi8(b, plus))));
+                    if (mask) return p + __builtin_ctz(mask);
+                }
+#endif
+                for (; p != end; ++p)
+                    if (*p == '%' || *p == '+') break;
+                return p;
             }
-        }
 
-        query_string& operator=(const query_string& qs)
-        {
-            url_ = qs.url_;
-            key_value_pairs_.clear();
-            for (auto p : qs.key_value_pairs_)
+            /// Decode `%XX` and `+` in place and return the decoded length.
+
+            ///
+            /// Runs without escapes are skipped (and moved) in bulk. Like qs_decode(), an invalid escape ends the string.
+            inline size_t decode(char* p, size_t length)
             {
-                key_value_pairs_.push_back((char*)(p - qs.url_.c_str() + url_.c_str()));
+                char* end = p + length;
+                char* in = find_escape(p, end);
+                char* out = in;
+                while (in != end)
+                {
+                    if (*in == '+')
+                    {
+                        *out++ = ' ';
+                        in++;
+                    }
+                    else
+                    {
+                        if (end - in < 3 || !CROW_QS_ISHEX(in[1]) || !CROW_QS_ISHEX(in[2]))
+                            break;
+                        *out++ = static_cast<char>(CROW_QS_HEX2DEC(in[1]) * 16 + CROW_QS_HEX2DEC(in[2]));
+                        in += 3;
+                    }
+
+                    char* next = find_escape(in, end);
+                    std::memmove(out, in, next - in);
+                    out += next - in;
+                    in = next;
+                }
+                return out - p;
             }
-            return *this;
-        }
 
-        query_string& operator=(query_string&& qs) noexcept
-        {
-            key_value_pairs_ = std::move(qs.key_value_pairs_);
-            char* old_data = (char*)qs.url_.c_str();
-            url_ = std::move(qs.url_);
-            for (auto& p : key_value_pairs_)
+            /// 32 bit FNV-1a.
+            inline std::uint32_t hash(std::string_view key)
             {
-                p += (char*)url_.c_str() - old_data;
+                std::uint32_t h = 2166136261u;
+                for (char c : key)
+                {
+                    h ^= static_cast<unsigned char>(c);
+                    h *= 16777619u;
+                }
+                return h;
             }
-            return *this;
-        }
+        } // namespace qs
+    }     // namespace detail
+
+    struct request;
+    /// A class to represent any data coming after the `?` in the request URL into key-value pairs.
+
+    ///
+    /// The query is copied once, then split and decoded in place. Lookups use a small open addressing table.
+    /// \ref assign() reuses the storage of an existing object.
+    class query_string
+    {
+    public:
+        query_string() = default;
 
+        query_string(std::string params, bool url = true)
+        {
+            assign(params, url);
+        }
 
-        query_string(std::string params, bool url = true):
-          url_(std::move(params))
+        /// Parse a new query (or the query part of a URL), reusing the storage of this object.
+        void assign(std::string_view params, bool url = true)
         {
-            if (url_.empty())
+            clear();
+            if (url)
+            {
+                size_t start = params.find_first_of("?#");
+                if (start == std::string_view::npos || params[start] == '#')
+                    return;
+                params.remove_prefix(start + 1);
+            }
+            params = params.substr(0, params.find('#'));
+            if (params.empty())
                 return;
 
-            key_value_pairs_.resize(MAX_KEY_VALUE_PAIRS_COUNT);
-            size_t count = qs_parse(&url_[0], &key_value_pairs_[0], MAX_KEY_VALUE_PAIRS_COUNT, url);
-
-            key_value_pairs_.resize(count);
-            key_value_pairs_.shrink_to_fit();
+            buffer_.assign(params.data(), params.size());
+            parse();
         }
 
         void clear()
         {
-            key_value_pairs_.clear();
-            url_.clear();
+            buffer_.clear();
+            entries_.clear();
+            index_.fill(0);
         }
 
         friend std::ostream& operator<<(std::ostream& os, const query_string& qs)
         {
             os << "[ ";
-            for (size_t i = 0; i < qs.key_value_pairs_.size(); ++i)
+            for (size_t i = 0; i < qs.entries_.size(); ++i)
             {
                 if (i)
                     os << ", ";
-                os << qs.key_value_pairs_[i];
+                os << qs.key(qs.entries_[i]) << '=' << qs.value(qs.entries_[i]);
             }
             os << " ]";
             return os;
@@ -539,29 +607,22 @@ namespace crow
 
         ///
         /// Note: this method returns the value of the first occurrence of the key only, to return all occurrences, see \ref get_list().
-        char* get(const std::string& name) const
+        char* get(std::string_view name) const
         {
-            char* ret = qs_k2v(name.c_str(), key_value_pairs_.data(), key_value_pairs_.size());
-            return ret;
+            const entry* e = find(name);
+            return e ? value_ptr(*e) : nullptr;
         }
 
         /// Works similar to \ref get() except it removes the item from the query string.
-        char* pop(const std::string& name)
+        char* pop(std::string_view name)
         {
-            char* ret = get(name);
-            if (ret != nullptr)
-            {
-                const std::string key_name = name + '=';
-                for (unsigned int i = 0; i < key_value_pairs_.size(); i++)
-                {
-                    std::string str_item(key_value_pairs_[i]);
-                    if (str_item.find(key_name)==0)
-                    {
-                        key_value_pairs_.erase(key_value_pairs_.begin() + i);
-                        break;
-                    }
-                }
-            }
+            const entry* e = find(name);
+            if (!e)
+                return nullptr;
+
+            char* ret = value_ptr(*e);
+            entries_.erase(entries_.begin() + (e - entries_.data()));
+            rebuild_index();
             return ret;
         }
 
@@ -573,15 +634,10 @@ namespace crow
         {
             std::vector<char*> ret;
             std::string plus = name + (use_brackets ? "[]" : "");
-            char* element = nullptr;
-
-            int count = 0;
-            while (1)
+            for (const entry& e : entries_)
             {
-                element = qs_k2v(plus.c_str(), key_value_pairs_.data(), key_value_pairs_.size(), count++);
-                if (!element)
-                    break;
-                ret.push_back(element);
+                if (key(e) == plus)
+                    ret.push_back(value_ptr(e));
             }
             return ret;
         }
@@ -590,20 +646,14 @@ namespace crow
         std::vector<char*> pop_list(const std::string& name, bool use_brackets = true)
         {
             std::vector<char*> ret = get_list(name, use_brackets);
-            const size_t name_len = name.length();
             if (!ret.empty())
             {
-                for (unsigned int i = 0; i < key_value_pairs_.size(); i++)
-                {
-                    std::string str_item(key_value_pairs_[i]);
-                    if (str_item.find(name)==0) {
-                      if (use_brackets && str_item.find("[]=",name_len)==name_len) {
-                        key_value_pairs_.erase(key_value_pairs_.begin() + i--);
-                      } else if (!use_brackets && str_item.find('=',name_len)==name_len ) {
-                           key_value_pairs_.erase(key_value_pairs_.begin() + i--);
-                       }
-                    }
-                }
+                std::string plus = name + (use_brackets ? "[]" : "");
+                entries_.erase(std::remove_if(entries_.begin(), entries_.end(), [&](const entry& e) {
+                                   return key(e) == plus;
+                               }),
+                               entries_.end());
+                rebuild_index();
             }
             return ret;
         }
@@ -617,14 +667,11 @@ namespace crow
         std::unordered_map<std::string, std::string> get_dict(const std::string& name) const
         {
             std::unordered_map<std::string, std::string> ret;
-
-            int count = 0;
-            while (1)
+            for (const entry& e : entries_)
             {
-                if (auto element = qs_dict_name2kv(name.c_str(), key_value_pairs_.data(), key_value_pairs_.size(), count++))
-                    ret.insert(*element);
-                else
-                    break;
+                std::string_view sub;
+                if (dict_key(e, name, sub))
+                    ret.emplace(std::string(sub), std::string(value(e)));
             }
             return ret;
         }
@@ -632,42 +679,156 @@ namespace crow
         /// Works the same as \ref get_dict() but removes the values from the query string.
         std::unordered_map<std::string, std::string> pop_dict(const std::string& name)
         {
-            const std::string name_value = name +'[';
             std::unordered_map<std::string, std::string> ret = get_dict(name);
             if (!ret.empty())
             {
-                for (unsigned int i = 0; i < key_value_pairs_.size(); i++)
+                entries_.erase(std::remove_if(entries_.begin(), entries_.end(), [&](const entry& e) {
+                                   std::string_view sub;
+                                   return dict_key(e, name, sub);
+                               }),
+                               entries_.end());
+                rebuild_index();
+            }
+            return ret;
+        }
+
+        std::vector<std::string> keys() const
+        {
+            std::vector<std::string> keys;
+            keys.reserve(entries_.size());
+
+            for (const entry& e : entries_)
+                keys.emplace_back(key(e));
+
+            return keys;
+        }
+
+    private:
+        struct entry
+        {
+            std::uint32_t key_offset, key_length;
+            std::uint32_t value_offset, value_length;
+            std::uint32_t hash;
+        };
+
+        /// Lookup table size, only the first `index_size / 2` distinct keys are indexed (the rest are found by a scan).
+        static constexpr size_t index_size = 64;
+
+        /// Split `buffer_` at '&' and '=', decode keys and values in place and null terminate them.
+        void parse()
+        {
+            char* base = &buffer_[0];
+            char* end = base + buffer_.size();
+            char* p = base;
+            while (p < end)
+            {
+                char* amp = static_cast<char*>(std::memchr(p, '&', end - p));
+                if (!amp) amp = end;
+                if (amp != p)
+                {
+                    char* eq = static_cast<char*>(std::memchr(p, '=', amp - p));
+                    char* key_end = eq ? eq : amp;
+
+                    entry e;
+                    e.key_offset = static_cast<std::uint32_t>(p - base);
+                    e.key_length = static_cast<std::uint32_t>(detail::qs::decode(p, key_end - p));
+                    p[e.key_length] = '\0';
+                    if (eq)
+                    {
+                        e.value_offset = static_cast<std::uint32_t>(eq + 1 - base);
+                        e.value_length = static_cast<std::uint32_t>(detail::qs::decode(eq + 1, amp - eq - 1));
+                        eq[1 + e.value_length] = '\0';
+                    }
+                    else
+                    {
+                        // `?name` has an empty value
+                        e.value_offset = e.key_offset + e.key_length;
+                        e.value_length = 0;
+                    }
+                    e.hash = detail::qs::hash(key(e));
+                    entries_.push_back(e);
+                }
+                p = amp + 1;
+            }
+            rebuild_index();
+        }
+
+        void rebuild_index()
+        {
+            index_.fill(0);
+            size_t indexed = 0, i = 0;
+            for (; i < entries_.size() && i < UINT8_MAX && indexed < index_size / 2; i++)
+            {
+                const entry& e = entries_[i];
+                for (size_t slot = e.hash % index_size;; slot = (slot + 1) % index_size)
                 {
-                    std::string str_item(key_value_pairs_[i]);
-                    if (str_item.find(name_value)==0)
+                    if (!index_[slot])
                     {
-                        key_value_pairs_.erase(key_value_pairs_.begin() + i--);
+                        index_[slot] = static_cast<std::uint8_t>(i + 1);
+                        indexed++;
+                        break;
                     }
+                    // keep the first occurrence of a key
+                    const entry& other = entries_[index_[slot] - 1];
+                    if (other.hash == e.hash && key(other) == key(e))
+                        break;
                 }
             }
-            return ret;
+            fully_indexed_ = i == entries_.size();
         }
 
-        std::vector<std::string> keys() const
+        const entry* find(std::string_view name) const
         {
-            std::vector<std::string> keys;
-            keys.reserve(key_value_pairs_.size());
+            std::uint32_t h = detail::qs::hash(name);
+            for (size_t slot = h % index_size; index_[slot]; slot = (slot + 1) % index_size)
+            {
+                const entry& e = entries_[index_[slot] - 1];
+                if (e.hash == h && key(e) == name)
+                    return &e;
+            }
+            if (fully_indexed_)
+                return nullptr;
 
-            for (const char* const element : key_value_pairs_)
+            for (const entry& e : entries_)
             {
-                const char* delimiter = strchr(element, '=');
-                if (delimiter)
-                    keys.emplace_back(element, delimiter);
-                else
-                    keys.emplace_back(element);
+                if (e.hash == h && key(e) == name)
+                    return &e;
             }
+            return nullptr;
+        }
 
-            return keys;
+        /// Check for `name[sub]` and return `sub`.
+        bool dict_key(const entry& e, const std::string& name, std::string_view& sub) const
+        {
+            std::string_view k = key(e);
+            if (k.size() < name.size() + 2 || k.compare(0, name.size(), name) != 0 || k[name.size()] != '[')
+                return false;
+            size_t close = k.find(']', name.size() + 1);
+            if (close == std::string_view::npos || close == name.size() + 1)
+                return false;
+            sub = k.substr(name.size() + 1, close - name.size() - 1);
+            return true;
         }
 
-    private:
-        std::string url_;
-        std::vector<char*> key_value_pairs_;
+        std::string_view key(const entry& e) const
+        {
+            return {buffer_.data() + e.key_offset, e.key_length};
+        }
+
+        std::string_view value(const entry& e) const
+        {
+            return {buffer_.data() + e.value_offset, e.value_length};
+        }
+
+        char* value_ptr(const entry& e) const
+        {
+            return const_cast<char*>(buffer_.data()) + e.value_offset;
+        }
+
+        std::string buffer_;
+        std::vector<entry> entries_;
+        std::array<std::uint8_t, index_size> index_{};
+        bool fully_indexed_{true};
     };
 
 } // namespace crow
@@ -1031,6 +1192,32 @@ namespace crow
 #define CROW_STATIC_ENDPOINT "/static/<path>"
 #endif
 
+/* #ifdef - runs socket I/O through io_uring instead of epoll */
+/*
+    Needs Linux 5.10+, Boost 1.78+ (or Asio 1.22+) and linking with -luring.
+    The choice is build-time only: asio picks its reactor at compile time, so
+    there is no fallback to epoll at run time. A binary built with this flag
+    refuses to start on a kernel (or seccomp policy) without io_uring, build
+    without it to use epoll. asio submits one-shot operations, there is no
+    multishot accept or receive and no registered buffers.
+*/
+//#define CROW_ENABLE_IO_URING
+
+/* #ifdef - disables cleartext HTTP/2 (prior knowledge and Upgrade: h2c) */
+//#define CROW_DISABLE_HTTP2
+
+/* #ifdef - stops recording the latency histograms and counters behind app.metrics() */
+//#define CROW_DISABLE_METRICS
+
+/* #define - free connection objects each worker keeps for reuse */
+#ifndef CROW_CONNECTION_POOL_SIZE
+#define CROW_CONNECTION_POOL_SIZE 1024
+#endif
+/* #define - free read buffers each worker keeps for reuse */
+#ifndef CROW_READ_BUFFER_POOL_SIZE
+#define CROW_READ_BUFFER_POOL_SIZE 256
+#endif
+
 // compiler flags
 
 #if defined(_MSC_VER)
@@ -1042,6 +1229,15 @@ namespace crow
 #endif
 
 
+#ifdef CROW_ENABLE_IO_URING
+// Must be seen before the first asio include. Disabling epoll makes io_uring the backend for sockets, not only files.
+#define BOOST_ASIO_HAS_IO_URING
+#define BOOST_ASIO_DISABLE_EPOLL
+#define ASIO_HAS_IO_URING
+#define ASIO_DISABLE_EPOLL
+#include <liburing.h>
+#endif
+
 #ifdef CROW_USE_BOOST
 #include <boost/asio.hpp>
 #include <boost/asio/version.hpp>
@@ -1059,12 +1255,16 @@ namespace crow
 #endif
 #endif
 
-#if (CROW_USE_BOOST && BOOST_VERSION >= 107000) || (ASIO_VERSION >= 101300)
+#if (defined(CROW_USE_BOOST) && BOOST_VERSION >= 107000) || (ASIO_VERSION >= 101300)
 #define GET_IO_CONTEXT(s) ((asio::io_context&)(s).get_executor().context())
 #else
 #define GET_IO_CONTEXT(s) ((s).get_io_service())
 #endif
 
+#if defined(CROW_ENABLE_IO_URING) && ((defined(CROW_USE_BOOST) && BOOST_VERSION < 107800) || (!defined(CROW_USE_BOOST) && ASIO_VERSION < 102200))
+#error "CROW_ENABLE_IO_URING needs Boost 1.78 or Asio 1.22 or newer"
+#endif
+
 namespace crow
 {
 #ifdef CROW_USE_BOOST
@@ -1075,10 +1275,33 @@ namespace crow
 #endif
     using tcp = asio::ip::tcp;
 
+    namespace detail
+    {
+#ifdef CROW_ENABLE_IO_URING
+        /// Check that the kernel (and any seccomp policy) lets us create an io_uring.
+        inline bool io_uring_available()
+        {
+            io_uring ring;
+            if (io_uring_queue_init(4, &ring, 0) < 0)
+                return false;
+            io_uring_queue_exit(&ring);
+            return true;
+        }
+#endif
+    } // namespace detail
+
     /// A wrapper for the asio::ip::tcp::socket and asio::ssl::stream
     struct SocketAdaptor
     {
         using context = void;
+        /// Reads can wait for the socket to become readable before taking a buffer.
+#ifdef CROW_ENABLE_IO_URING
+        // Except with io_uring, where a receive submitted to the ring is one operation and the wait would add a syscall.
+        static constexpr bool can_wait_readable = false;
+#else
+        static constexpr bool can_wait_readable = true;
+#endif
+
         SocketAdaptor(asio::io_context& io_context, context*):
           socket_(io_context)
         {}
@@ -1148,6 +1371,8 @@ namespace crow
     {
         using context = asio::ssl::context;
         using ssl_socket_t = asio::ssl::stream<tcp::socket>;
+        /// OpenSSL can hold decrypted data the socket no longer reports as readable.
+        static constexpr bool can_wait_readable = false;
         SSLAdaptor(asio::io_context& io_context, context* ctx):
           ssl_socket_(new ssl_socket_t(io_context, *ctx))
         {}
@@ -2163,6 +2388,10 @@ namespace crow
 #include <string_view>
 #include <locale>
 #include <unordered_map>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <vector>
 
 
 namespace crow
@@ -2199,6 +2428,192 @@ namespace crow
     };
 
     using ci_map = std::unordered_multimap<std::string, std::string, ci_hash, ci_key_eq>;
+
+    /// Header storage used by \ref crow.request.
+
+    ///
+    /// Names and values are copied back to back into one buffer and indexed by a small inline array of string_views,
+    /// so a request's headers cost at most a couple of allocations instead of two strings and a hash node each.
+    /// Lookups are case insensitive linear scans, which beat hashing for the 10-20 headers a request usually carries.
+    /// The views handed out stay valid until the map is modified.
+    class header_map
+    {
+    public:
+        using value_type = std::pair<std::string_view, std::string_view>;
+        using const_iterator = const value_type*;
+        using iterator = const_iterator;
+
+        static constexpr size_t inline_capacity = 16;
+
+        header_map() = default;
+
+        header_map(const header_map& other)
+        {
+            *this = other;
+        }
+
+        header_map(header_map&& other) noexcept
+        {
+            *this = std::move(other);
+        }
+
+        header_map& operator=(const header_map& other)
+        {
+            if (this != &other)
+            {
+                clear();
+                buffer_.reserve(other.buffer_.size());
+                for (const auto& kv : other)
+                    emplace(kv.first, kv.second);
+            }
+            return *this;
+        }
+
+        header_map& operator=(header_map&& other) noexcept
+        {
+            if (this != &other)
+            {
+                // Moving the vector keeps its heap block, so the views into it stay valid.
+                buffer_ = std::move(other.buffer_);
+                size_ = other.size_;
+                if (other.entries_ == other.inline_.data())
+                {
+                    std::copy(other.inline_.begin(), other.inline_.begin() + size_, inline_.begin());
+                    overflow_.clear();
+                    entries_ = inline_.data();
+                }
+                else
+                {
+                    overflow_ = std::move(other.overflow_);
+                    entries_ = overflow_.data();
+                }
+                other.buffer_.clear();
+                other.overflow_.clear();
+                other.entries_ = other.inline_.data();
+                other.size_ = 0;
+            }
+            return *this;
+        }
+
+        void emplace(std::string_view key, std::string_view value)
+        {
+            size_t needed = buffer_.size() + key.size() + value.size();
+            if (needed > buffer_.capacity())
+            {
+                // The arguments can be views into the buffer (re-adding a header), follow them when it moves
+                const char* old_data = buffer_.data();
+                bool key_inside = owns(key), value_inside = owns(value);
+                grow(needed);
+                if (key_inside)
+                    key = std::string_view(buffer_.data() + (key.data() - old_data), key.size());
+                if (value_inside)
+                    value = std::string_view(buffer_.data() + (value.data() - old_data), value.size());
+            }
+
+            // Appending within the capacity moves nothing, so copying from views into the buffer is safe
+            size_t at = buffer_.size();
+            buffer_.resize(needed);
+            char* key_data = buffer_.data() + at;
+            char* value_data = key_data + key.size();
+            if (!key.empty())
+                std::memcpy(key_data, key.data(), key.size());
+            if (!value.empty())
+                std::memcpy(value_data, value.data(), value.size());
+
+            value_type entry{std::string_view(key_data, key.size()), std::string_view(value_data, value.size())};
+            if (entries_ == inline_.data())
+            {
+                if (size_ < inline_capacity)
+                {
+                    inline_[size_++] = entry;
+                    return;
+                }
+                overflow_.assign(inline_.begin(), inline_.end());
+            }
+            overflow_.push_back(entry);
+            entries_ = overflow_.data();
+            size_++;
+        }
+
+        /// Find the first header with the given name (case insensitive), or return end().
+        const_iterator find(std::string_view key) const
+        {
+            for (const_iterator it = begin(); it != end(); ++it)
+                if (equals(it->first, key))
+                    return it;
+            return end();
+        }
+
+        size_t count(std::string_view key) const
+        {
+            size_t n = 0;
+            for (const auto& kv : *this)
+                n += equals(kv.first, key);
+            return n;
+        }
+
+        /// Copy the headers into an owning \ref ci_map.
+        ci_map to_ci_map() const
+        {
+            ci_map result;
+            for (const auto& kv : *this)
+                result.emplace(std::string(kv.first), std::string(kv.second));
+            return result;
+        }
+
+        /// Remove all headers, keeping the allocated storage for reuse.
+        void clear()
+        {
+            buffer_.clear();
+            overflow_.clear();
+            entries_ = inline_.data();
+            size_ = 0;
+        }
+
+        const_iterator begin() const { return entries_; }
+        const_iterator end() const { return entries_ + size_; }
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+
+    private:
+        static bool equals(std::string_view l, std::string_view r)
+        {
+            if (l.size() != r.size())
+                return false;
+            for (size_t i = 0; i < l.size(); i++)
+            {
+                char a = l[i], b = r[i];
+                if (a != b && ((a | 0x20) != (b | 0x20) || (a | 0x20) < 'a' || (a | 0x20) > 'z'))
+                    return false;
+            }
+            return true;
+        }
+
+        /// Enlarge the buffer and move the existing views over to it.
+        bool owns(std::string_view view) const
+        {
+            return !buffer_.empty() && view.data() >= buffer_.data() && view.data() < buffer_.data() + buffer_.size();
+        }
+
+        void grow(size_t needed)
+        {
+            const char* old_data = buffer_.data();
+            buffer_.reserve(std::max<size_t>({needed, buffer_.capacity() * 2, 512}));
+            const char* new_data = buffer_.data();
+            for (size_t i = 0; i < size_; i++)
+            {
+                value_type& kv = entries_[i];
+                kv.first = std::string_view(new_data + (kv.first.data() - old_data), kv.first.size());
+                kv.second = std::string_view(new_data + (kv.second.data() - old_data), kv.second.size());
+            }
+        }
+
+        std::vector<char> buffer_;
+        std::array<value_type, inline_capacity> inline_{};
+        std::vector<value_type> overflow_;
+        value_type* entries_ = inline_.data();
+        size_t size_ = 0;
+    };
 } // namespace crow
 
 
@@ -2556,25 +2971,169 @@ constexpr crow::HTTPMethod operator"" _method(const char* str, size_t /*len*/)
 // clang-format on
 
 
-#ifdef CROW_USE_BOOST
-#include <boost/asio.hpp>
-#else
-#ifndef ASIO_STANDALONE
-#define ASIO_STANDALONE
-#endif
-#include <asio.hpp>
-#endif
-
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
 
-namespace crow // NOTE: Already documented in "crow/app.h"
-{
-#ifdef CROW_USE_BOOST
-    namespace asio = boost::asio;
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
 #endif
 
-    /// Find and return the value associated with the key. (returns an empty string if nothing is found)
-    template<typename T>
-    inline const std::string& get_header_value(const T& headers, const std::string& key)
+namespace crow
+{
+    /// Cheap timestamps for breaking a request down into phases.
+    namespace timing
+    {
+        using ticks = std::uint64_t;
+
+        /// The time stamp counter on x86 (about 20 cycles, no system call), the steady clock elsewhere.
+
+        ///
+        /// Assumes an invariant TSC, which every x86 CPU of the last decade has.
+        inline ticks now()
+        {
+#if (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))) || ((defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)))
+            return __rdtsc();
+#else
+            return static_cast<ticks>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+        }
+
+        namespace detail
+        {
+            struct reference_point
+            {
+                ticks tick;
+                std::chrono::steady_clock::time_point time;
+            };
+
+            inline const reference_point& start()
+            {
+                static const reference_point start{timing::now(), std::chrono::steady_clock::now()};
+                return start;
+            }
+        } // namespace detail
+
+        /// Nanoseconds per tick, measured against the steady clock since the first call.
+
+        ///
+        /// Gets more precise the longer the process runs and stays fixed once a second has passed.
+        inline double ns_per_tick()
+        {
+            static std::atomic<double> fixed{0};
+            double ratio = fixed.load(std::memory_order_relaxed);
+            if (ratio != 0)
+                return ratio;
+
+            const detail::reference_point& start = detail::start();
+            ticks elapsed_ticks = now() - start.tick;
+            auto elapsed = std::chrono::steady_clock::now() - start.time;
+            if (elapsed_ticks == 0)
+                return 1;
+            ratio = std::chrono::duration<double, std::nano>(elapsed).count() / elapsed_ticks;
+            if (elapsed >= std::chrono::seconds(1))
+                fixed.store(ratio, std::memory_order_relaxed);
+            return ratio;
+        }
+
+        /// The phases of one request, each one ends with a \ref mark.
+
+        ///
+        /// Crow marks `route`, `parse`, `middleware`, `handler`, `after` and `write`. A handler can split its own
+        /// time further with `req.phases.mark("query")`, whatever it doesn't mark goes to `handler`.
+        /// Names must be string literals, they are kept as pointers.
+        class phases
+        {
+        public:
+            static constexpr std::size_t capacity = 16;
+
+            struct phase
+            {
+                const char* name;
+                ticks duration;
+            };
+
+            /// Start timing, the first phase runs from here.
+            void start()
+            {
+                count_ = 0;
+                last_ = now();
+            }
+
+            /// End the current phase and start the next one. Does nothing before \ref start, and past \ref capacity phases.
+            void mark(const char* name) const
+            {
+                if (!last_)
+                    return;
+                ticks t = now();
+                if (count_ < capacity)
+                    phases_[count_++] = {name, t - last_};
+                last_ = t;
+            }
+
+            void clear()
+            {
+                count_ = 0;
+                last_ = 0;
+            }
+
+            const phase* begin() const { return phases_; }
+            const phase* end() const { return phases_ + count_; }
+            bool empty() const { return count_ == 0; }
+
+            /// The phases as a `Server-Timing` header value, durations in milliseconds.
+            std::string server_timing() const
+            {
+                double ms_per_tick = ns_per_tick() / 1e6;
+                std::string out;
+                ticks total = 0;
+                char buf[32];
+                for (const phase& p : *this)
+                {
+                    std::snprintf(buf, sizeof(buf), ";dur=%.3f, ", p.duration * ms_per_tick);
+                    out += p.name;
+                    out += buf;
+                    total += p.duration;
+                }
+                std::snprintf(buf, sizeof(buf), "total;dur=%.3f", total * ms_per_tick);
+                out += buf;
+                return out;
+            }
+
+        private:
+            // Marking doesn't change the request, so it works through the `const request&` handlers get.
+            mutable phase phases_[capacity];
+            mutable std::size_t count_ = 0;
+            mutable ticks last_ = 0;
+        };
+    } // namespace timing
+} // namespace crow
+
+
+#ifdef CROW_USE_BOOST
+#include <boost/asio.hpp>
+#else
+#ifndef ASIO_STANDALONE
+#define ASIO_STANDALONE
+#endif
+#include <asio.hpp>
+#endif
+
+
+namespace crow // NOTE: Already documented in "crow/app.h"
+{
+#ifdef CROW_USE_BOOST
+    namespace asio = boost::asio;
+#endif
+
+    /// Find and return the value associated with the key. (returns an empty string if nothing is found)
+    template<typename T, typename = typename std::enable_if<!std::is_same<T, header_map>::value>::type>
+    inline const std::string& get_header_value(const T& headers, const std::string& key)
     {
         if (headers.count(key))
         {
@@ -2584,6 +3143,21 @@ namespace crow // NOTE: Already documented in "crow/app.h"
         return empty;
     }
 
+    /// Find and return the value associated with the key, without copying it. (returns an empty view if nothing is found)
+    ///
+    /// The view is valid until the headers are changed or cleared.
+    inline std::string_view get_header_view(const header_map& headers, std::string_view key)
+    {
+        auto it = headers.find(key);
+        return it != headers.end() ? it->second : std::string_view();
+    }
+
+    /// Find and return a copy of the value associated with the key. (returns an empty string if nothing is found)
+    inline std::string get_header_value(const header_map& headers, std::string_view key)
+    {
+        return std::string(get_header_view(headers, key));
+    }
+
     /// An HTTP request.
     struct request
     {
@@ -2591,7 +3165,7 @@ namespace crow // NOTE: Already documented in "crow/app.h"
         std::string raw_url;     ///< The full URL containing the `?` and URL parameters.
         std::string url;         ///< The endpoint without any parameters.
         query_string url_params; ///< The parameters associated with the request. (everything after the `?` in the URL)
-        ci_map headers;
+        header_map headers;
         std::string body;
         std::string remote_ip_address; ///< The IP address from which the request was sent.
         unsigned char http_ver_major, http_ver_minor;
@@ -2602,6 +3176,7 @@ namespace crow // NOTE: Already documented in "crow/app.h"
         void* middleware_context{};
         void* middleware_container{};
         asio::io_context* io_context{};
+        timing::phases phases; ///< Where the time of this request went so far, handlers can add their own phases.
 
         /// Construct an empty request. (sets the method to `GET`)
         request():
@@ -2609,20 +3184,49 @@ namespace crow // NOTE: Already documented in "crow/app.h"
         {}
 
         /// Construct a request with all values assigned.
-        request(HTTPMethod method_, std::string raw_url_, std::string url_, query_string url_params_, ci_map headers_, std::string body_, unsigned char http_major, unsigned char http_minor, bool has_keep_alive, bool has_close_connection, bool is_upgrade):
+        request(HTTPMethod method_, std::string raw_url_, std::string url_, query_string url_params_, header_map headers_, std::string body_, unsigned char http_major, unsigned char http_minor, bool has_keep_alive, bool has_close_connection, bool is_upgrade):
           method(method_), raw_url(std::move(raw_url_)), url(std::move(url_)), url_params(std::move(url_params_)), headers(std::move(headers_)), body(std::move(body_)), http_ver_major(http_major), http_ver_minor(http_minor), keep_alive(has_keep_alive), close_connection(has_close_connection), upgrade(is_upgrade)
         {}
 
-        void add_header(std::string key, std::string value)
+        void add_header(std::string_view key, std::string_view value)
         {
-            headers.emplace(std::move(key), std::move(value));
+            headers.emplace(key, value);
         }
 
-        const std::string& get_header_value(const std::string& key) const
+        /// Reset the request to its default state, keeping the storage of its strings and headers for reuse.
+        void clear()
+        {
+            method = HTTPMethod::Get;
+            raw_url.clear();
+            url.clear();
+            url_params.clear();
+            headers.clear();
+            // an unusually large body is not worth holding on to
+            if (body.capacity() > 64 * 1024)
+                std::string().swap(body);
+            else
+                body.clear();
+            remote_ip_address.clear();
+            http_ver_major = http_ver_minor = 0;
+            keep_alive = close_connection = upgrade = false;
+            middleware_context = nullptr;
+            middleware_container = nullptr;
+            io_context = nullptr;
+            phases.clear();
+        }
+
+        /// Find and return the value of a header. (returns an empty string if the header isn't present)
+        std::string get_header_value(std::string_view key) const
         {
             return crow::get_header_value(headers, key);
         }
 
+        /// Same as \ref get_header_value() without copying the value. (valid as long as the request)
+        std::string_view get_header_view(std::string_view key) const
+        {
+            return crow::get_header_view(headers, key);
+        }
+
         bool check_version(unsigned char major, unsigned char minor) const
         {
             return http_ver_major == major && http_ver_minor == minor;
@@ -2794,7 +3398,7 @@ namespace crow
             /// Create a multipart message from a request data
             explicit message(const request& req):
               returnable("multipart/form-data; boundary=CROW-BOUNDARY"),
-              headers(req.headers),
+              headers(req.headers.to_ci_map()),
               boundary(get_boundary(get_header_value("Content-Type")))
             {
                 if (!boundary.empty())
@@ -3046,14 +3650,14 @@ namespace crow
         /// The parsed multipart request/response
         struct message_view
         {
-            std::reference_wrapper<const ci_map> headers; ///< The request/response headers
-            std::string boundary;                         ///< The text boundary that separates different `parts`
-            std::vector<part_view> parts;                 ///< The individual parts of the message
-            mp_view_map part_map;                         ///< The individual parts of the message, organized in a map with the `name` header parameter being the key
+            ci_map headers;               ///< The request/response headers
+            std::string boundary;         ///< The text boundary that separates different `parts`
+            std::vector<part_view> parts; ///< The individual parts of the message
+            mp_view_map part_map;         ///< The individual parts of the message, organized in a map with the `name` header parameter being the key
 
             const std::string& get_header_value(const std::string& key) const
             {
-                return crow::get_header_value(headers.get(), key);
+                return crow::get_header_value(headers, key);
             }
 
             part_view get_part_by_name(const std::string_view name)
@@ -3109,7 +3713,7 @@ namespace crow
 
             /// Create a multipart message from a request data
             explicit message_view(const request& req):
-              headers(req.headers),
+              headers(req.headers.to_ci_map()),
               boundary(get_boundary(get_header_value("Content-Type")))
             {
                 parse_body(req.body);
@@ -3395,6 +3999,7 @@ enum http_errno {
         uint32_t nread;          /* # bytes read in various scenarios */
         uint64_t content_length; /* # bytes in body. `(uint64_t) -1` (all bits one) if no Content-Length header. */
         unsigned long qs_point;
+        size_t notify_offset;    /* # bytes of the current input consumed once the running notify callback returns */
 
         /** READ-ONLY **/
         unsigned char http_major;
@@ -3461,6 +4066,7 @@ do {                                                                 \
   assert(CROW_HTTP_PARSER_ERRNO(parser) == CHPE_OK);                 \
                                                                      \
   if (CROW_LIKELY(settings->on_##FOR)) {                             \
+    parser->notify_offset = (ER);                                    \
     if (CROW_UNLIKELY(0 != settings->on_##FOR(parser))) {            \
       CROW_SET_ERRNO(CHPE_CB_##FOR);                                 \
     }                                                                \
@@ -4510,7 +5116,7 @@ reexecute:
 
         switch (parser->header_state) {
           case h_upgrade:
-            // Crow does not support HTTP/2 at the moment.
+            // Crow only supports HTTP/2 as h2c, which the Connection switches to once the whole request is parsed.
             // According to the RFC https://datatracker.ietf.org/doc/html/rfc7540#section-3.2
             // "A server that does not support HTTP/2 can respond to the request as though the Upgrade header field were absent"
             // => `F_UPGRADE` is not set if the header starts by "h2".
@@ -5255,10 +5861,151 @@ http_parser_set_max_header_size(uint32_t size) {
 #include <string>
 #include <unordered_map>
 #include <algorithm>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
+#ifndef CROW_FAST_PARSER_MAX_HEADERS
+#define CROW_FAST_PARSER_MAX_HEADERS 64
+#endif
 
 namespace crow
 {
+    namespace detail
+    {
+        /// Scanners used by the HTTPParser fast path (similar to picohttpparser).
+        /// They use AVX2 or SSE2 when available and handle the tail byte by byte.
+        namespace fast_parser
+        {
+            /// Header field name characters, the same set http_parser accepts (RFC 7230 tchar).
+            inline bool is_token(unsigned char c)
+            {
+                static const bool table[256] = {
+                  // clang-format off
+                  0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,
+                  0,1,0,1,1,1,1,1, 0,0,1,1,0,1,1,0, 1,1,1,1,1,1,1,1, 1,1,0,0,0,0,0,0,
+                  0,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,0,0,0,1,1,
+                  1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,0,1,0,1,0,
+                  // clang-format on
+                };
+                return table[c];
+            }
+
+            inline bool is_url_stop(unsigned char c)
+            {
+                return c <= 0x20 || c >= 0x7f || c == '#';
+            }
+
+            inline bool is_value_stop(unsigned char c)
+            {
+                return (c < 0x20 && c != '\t') || c == 0x7f;
+            }
+
+            /// Return the first byte that can't be part of an origin-form URL (space, control, non-ASCII or '#').
+            inline const char* find_url_end(const char* p, const char* end)
+            {
+#if defined(__AVX2__)
+                const __m256i limit = _mm256_set1_epi8(0x21), del = _mm256_set1_epi8(0x7f), hash = _mm256_set1_epi8('#');
+                for (; end - p >= 32; p += 32)
+                {
+                    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+                    // Signed compare: bytes >= 0x80 are negative and count as below the limit as well.
+                    __m256i stop = _mm256_or_si256(_mm256_cmpgt_epi8(limit, b),
+                                                   _mm256_or_si256(_mm256_cmpeq_epi8(b, del), _mm256_cmpeq_epi8(b, hash)));
+                    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(stop));
+                    if (mask) return p + __builtin_ctz(mask);
+                }
+#elif defined(__SSE2__) || defined(_M_X64)
+                const __m128i limit = _mm_set1_epi8(0x21), del = _mm_set1_epi8(0x7f), hash = _mm_set1_epi8('#');
+                for (; end - p >= 16; p += 16)
+                {
+                    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+                    __m128i stop = _mm_or_si128(_mm_cmplt_epi8(b, limit),
+                                                _mm_or_si128(_mm_cmpeq_epi8(b, del), _mm_cmpeq_epi8(b, hash)));
+                    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(stop));
+                    if (mask) return p + __builtin_ctz(mask);
+                }
+#endif
+                for (; p != end; ++p)
+                    if (is_url_stop(static_cast<unsigned char>(*p))) break;
+                return p;
+            }
+
+            /// Return the first control character (other than tab) in a header value, usually the terminating CR.
+            inline const char* find_value_end(const char* p, const char* end)
+            {
+#if defined(__AVX2__)
+                const __m256i space = _mm256_set1_epi8(0x20), minus_one = _mm256_set1_epi8(-1), tab = _mm256_set1_epi8('\t'), del = _mm256_set1_epi8(0x7f);
+                for (; end - p >= 32; p += 32)
+                {
+                    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+                    __m256i ctl = _mm256_and_si256(_mm256_cmpgt_epi8(space, b), _mm256_cmpgt_epi8(b, minus_one));
+                    __m256i stop = _mm256_or_si256(_mm256_andnot_si256(_mm256_cmpeq_epi8(b, tab), ctl), _mm256_cmpeq_epi8(b, del));
+                    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(stop));
+                    if (mask) return p + __builtin_ctz(mask);
+                }
+#elif defined(__SSE2__) || defined(_M_X64)
+                const __m128i space = _mm_set1_epi8(0x20), minus_one = _mm_set1_epi8(-1), tab = _mm_set1_epi8('\t'), del = _mm_set1_epi8(0x7f);
+                for (; end - p >= 16; p += 16)
+                {
+                    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+                    __m128i ctl = _mm_and_si128(_mm_cmplt_epi8(b, space), _mm_cmpgt_epi8(b, minus_one));
+                    __m128i stop = _mm_or_si128(_mm_andnot_si128(_mm_cmpeq_epi8(b, tab), ctl), _mm_cmpeq_epi8(b, del));
+                    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(stop));
+                    if (mask) return p + __builtin_ctz(mask);
+                }
+#endif
+                for (; p != end; ++p)
+                    if (is_value_stop(static_cast<unsigned char>(*p))) break;
+                return p;
+            }
+
+            inline bool parse_method(const char* p, size_t length, HTTPMethod& method)
+            {
+                switch (length)
+                {
+                    case 3:
+                        if (std::memcmp(p, "GET", 3) == 0) method = HTTPMethod::Get;
+                        else if (std::memcmp(p, "PUT", 3) == 0) method = HTTPMethod::Put;
+                        else return false;
+                        return true;
+                    case 4:
+                        if (std::memcmp(p, "POST", 4) == 0) method = HTTPMethod::Post;
+                        else if (std::memcmp(p, "HEAD", 4) == 0) method = HTTPMethod::Head;
+                        else return false;
+                        return true;
+                    case 5:
+                        if (std::memcmp(p, "PATCH", 5) != 0) return false;
+                        method = HTTPMethod::Patch;
+                        return true;
+                    case 6:
+                        if (std::memcmp(p, "DELETE", 6) != 0) return false;
+                        method = HTTPMethod::Delete;
+                        return true;
+                    case 7:
+                        if (std::memcmp(p, "OPTIONS", 7) != 0) return false;
+                        method = HTTPMethod::Options;
+                        return true;
+                    default:
+                        return false;
+                }
+            }
+
+            /// Case insensitive comparison against a lowercase literal.
+            inline bool iequals(const char* p, size_t length, const char* lower, size_t lower_length)
+            {
+                if (length != lower_length) return false;
+                for (size_t i = 0; i < length; i++)
+                    if ((p[i] | 0x20) != lower[i]) return false;
+                return true;
+            }
+        } // namespace fast_parser
+    } // namespace detail
+
     /// A wrapper for `nodejs/http-parser`.
 
     ///
@@ -5280,9 +6027,9 @@ namespace crow
         static int on_url(http_parser* self_, const char* at, size_t length)
         {
             HTTPParser* self = static_cast<HTTPParser*>(self_);
-            self->req.raw_url.insert(self->req.raw_url.end(), at, at + length);
-            self->req.url_params = query_string(self->req.raw_url);
-            self->req.url = self->req.raw_url.substr(0, self->qs_point != 0 ? self->qs_point : std::string::npos);
+            self->req.raw_url.append(at, length);
+            self->req.url_params.assign(self->req.raw_url);
+            self->req.url.assign(self->req.raw_url, 0, self->qs_point != 0 ? self->qs_point : std::string::npos);
 
             self->process_url();
 
@@ -5296,7 +6043,8 @@ namespace crow
                 case 0:
                     if (!self->header_value.empty())
                     {
-                        self->req.headers.emplace(std::move(self->header_field), std::move(self->header_value));
+                        self->req.headers.emplace(self->header_field, self->header_value);
+                        self->header_value.clear();
                     }
                     self->header_field.assign(at, at + length);
                     self->header_building_state = 1;
@@ -5327,7 +6075,9 @@ namespace crow
             HTTPParser* self = static_cast<HTTPParser*>(self_);
             if (!self->header_field.empty())
             {
-                self->req.headers.emplace(std::move(self->header_field), std::move(self->header_value));
+                self->req.headers.emplace(self->header_field, self->header_value);
+                self->header_field.clear();
+                self->header_value.clear();
             }
 
             self->set_connection_parameters();
@@ -5341,13 +6091,22 @@ namespace crow
             self->req.body.insert(self->req.body.end(), at, at + length);
             return 0;
         }
+        /// on_message_complete as called by http_parser, which knows how much input is left only from notify_offset.
+        static int on_parsed_message_complete(http_parser* self_)
+        {
+            HTTPParser* self = static_cast<HTTPParser*>(self_);
+            self->more_input = self->notify_offset < self->execute_length;
+            return on_message_complete(self_);
+        }
         static int on_message_complete(http_parser* self_)
         {
             HTTPParser* self = static_cast<HTTPParser*>(self_);
 
             self->message_complete = true;
             self->process_message();
-            return 0;
+            // Stop parsing if the request is still being handled (e.g. the response is streamed or completed later).
+            // The remaining input is kept in unparsed_data / unparsed_length and has to be fed again after clear().
+            return self->message_complete ? 1 : 0;
         }
         HTTPParser(Handler* handler):
           http_parser(),
@@ -5371,10 +6130,42 @@ namespace crow
               on_header_value,
               on_headers_complete,
               on_body,
-              on_message_complete,
+              on_parsed_message_complete,
             };
 
+#ifndef CROW_DISABLE_FAST_PARSER
+            // Complete, simple requests skip the http_parser state machine, anything else falls through to it.
+            while (length > 0 && state == CROW_NEW_MESSAGE())
+            {
+                int nparsed = feed_fast(buffer, length);
+                more_input = false;
+                if (nparsed < 0)
+                    break;
+                if (http_errno != CHPE_OK)
+                    return false;
+
+                buffer += nparsed;
+                length -= nparsed;
+                if (message_complete)
+                {
+                    unparsed_data = buffer;
+                    unparsed_length = length;
+                    return true;
+                }
+                if (length == 0)
+                    return true;
+            }
+#endif
+
+            execute_length = length;
             int nparsed = http_parser_execute(this, &settings_, buffer, length);
+            if (http_errno == CHPE_CB_message_complete && message_complete)
+            {
+                http_errno = CHPE_OK;
+                unparsed_data = buffer + nparsed;
+                unparsed_length = length - nparsed;
+                return true;
+            }
             if (http_errno != CHPE_OK)
             {
                 return false;
@@ -5387,9 +6178,164 @@ namespace crow
             return feed(nullptr, 0);
         }
 
+        /// Parse one complete request at the start of the buffer without going through the http_parser state machine.
+        ///
+        /// Only the common case is handled: a GET, HEAD, POST, PUT, PATCH, DELETE or OPTIONS request with an origin-form URL, HTTP/1.0 or 1.1,
+        /// CRLF line endings, no Transfer-Encoding or Upgrade, and the whole body (if any) in the buffer.
+        /// Nothing is touched until the request is known to be handled, the callbacks are then called in the same order http_parser would call them.
+        ///
+        /// \return The number of bytes consumed, or -1 if the request has to go through http_parser instead.
+        int feed_fast(const char* buffer, int length)
+        {
+            namespace fp = detail::fast_parser;
+            const char* p = buffer;
+            const char* end = buffer + length;
+
+            // Request line
+            const char* method_end = static_cast<const char*>(std::memchr(p, ' ', std::min(length, 8)));
+            HTTPMethod parsed_method;
+            if (!method_end || !fp::parse_method(p, method_end - p, parsed_method))
+                return -1;
+
+            const char* url = method_end + 1;
+            if (url == end || *url != '/')
+                return -1;
+            p = fp::find_url_end(url, end);
+            if (p == end || *p != ' ')
+                return -1;
+            const char* url_end = p++;
+
+            if (end - p < 10 || std::memcmp(p, "HTTP/1.", 7) != 0 || (p[7] != '0' && p[7] != '1') || p[8] != '\r' || p[9] != '\n')
+                return -1;
+            unsigned char parsed_minor = p[7] - '0';
+            p += 10;
+
+            // Headers
+            struct header_span
+            {
+                const char* name;
+                size_t name_length;
+                const char* value;
+                size_t value_length;
+            };
+            header_span headers[CROW_FAST_PARSER_MAX_HEADERS];
+            int header_count = 0;
+            unsigned parsed_flags = 0;
+            uint64_t parsed_content_length = CROW_ULLONG_MAX;
+
+            for (;;)
+            {
+                if (end - p < 2)
+                    return -1;
+                if (p[0] == '\r')
+                {
+                    if (p[1] != '\n')
+                        return -1;
+                    p += 2;
+                    break;
+                }
+                if (header_count == CROW_FAST_PARSER_MAX_HEADERS)
+                    return -1;
+
+                const char* name = p;
+                while (p != end && fp::is_token(static_cast<unsigned char>(*p)))
+                    ++p;
+                if (p == name || p == end || *p != ':')
+                    return -1;
+                size_t name_length = p - name;
+                ++p;
+                while (p != end && (*p == ' ' || *p == '\t'))
+                    ++p;
+                const char* value = p;
+                p = fp::find_value_end(p, end);
+                // Empty values, bare LFs and folded lines are left to http_parser.
+                if (p == value || end - p < 2 || p[0] != '\r' || p[1] != '\n')
+                    return -1;
+                size_t value_length = p - value;
+                p += 2;
+
+                switch (name_length)
+                {
+                    case 7:
+                        if (fp::iequals(name, name_length, "upgrade", 7)) return -1;
+                        break;
+                    case 10:
+                        if (fp::iequals(name, name_length, "connection", 10))
+                        {
+                            // Token lists are left to http_parser.
+                            if (fp::iequals(value, value_length, "keep-alive", 10))
+                                parsed_flags |= F_CONNECTION_KEEP_ALIVE;
+                            else if (fp::iequals(value, value_length, "close", 5))
+                                parsed_flags |= F_CONNECTION_CLOSE;
+                            else
+                                return -1;
+                        }
+                        break;
+                    case 14:
+                        if (fp::iequals(name, name_length, "content-length", 14))
+                        {
+                            if ((parsed_flags & F_CONTENTLENGTH) || value_length > 15)
+                                return -1;
+                            parsed_content_length = 0;
+                            for (size_t i = 0; i < value_length; i++)
+                            {
+                                if (value[i] < '0' || value[i] > '9') return -1;
+                                parsed_content_length = parsed_content_length * 10 + (value[i] - '0');
+                            }
+                            parsed_flags |= F_CONTENTLENGTH;
+                        }
+                        break;
+                    case 16:
+                        if (fp::iequals(name, name_length, "proxy-connection", 16)) return -1;
+                        break;
+                    case 17:
+                        if (fp::iequals(name, name_length, "transfer-encoding", 17)) return -1;
+                        break;
+                }
+
+                headers[header_count++] = {name, name_length, value, value_length};
+            }
+
+            if (p - buffer > CROW_HTTP_MAX_HEADER_SIZE)
+                return -1;
+            const char* body = p;
+            size_t body_length = (parsed_flags & F_CONTENTLENGTH) ? parsed_content_length : 0;
+            if (static_cast<uint64_t>(end - body) < body_length)
+                return -1;
+
+            // The request is complete, replay it.
+            method = static_cast<unsigned>(parsed_method);
+            http_major = 1;
+            http_minor = parsed_minor;
+            flags = parsed_flags;
+            upgrade = 0;
+            content_length = parsed_content_length;
+            const char* qs = static_cast<const char*>(std::memchr(url, '?', url_end - url));
+            qs_point = qs ? qs - url : 0;
+            // Mid-message, so a done() from one of the callbacks fails the same way it does inside http_parser.
+            state = s_req_path;
+            more_input = body + body_length < end;
+
+            on_method(this);
+            on_url(this, url, url_end - url);
+            if (http_errno != CHPE_OK) return 0;
+            for (int i = 0; i < header_count; i++)
+            {
+                on_header_field(this, headers[i].name, headers[i].name_length);
+                on_header_value(this, headers[i].value, headers[i].value_length);
+            }
+            on_headers_complete(this);
+            if (http_errno != CHPE_OK) return 0;
+            if (body_length > 0)
+                on_body(this, body, body_length);
+            on_message_complete(this);
+            return static_cast<int>(body + body_length - buffer);
+        }
+
         void clear()
         {
-            req = crow::request();
+            // Keeps the storage of the request (and its capacity) for the next one.
+            req.clear();
             header_field.clear();
             header_value.clear();
             header_building_state = 0;
@@ -5437,7 +6383,16 @@ namespace crow
         /// Data parsed is put directly into this object as soon as the related callback returns. (e.g. the request will have the cooorect method as soon as on_method() returns)
         request req;
 
+        /// Input that followed a request which was still being handled when parsing stopped (points into the buffer passed to feed()).
+        const char* unparsed_data = nullptr;
+        int unparsed_length = 0;
+
+        /// Set while a request is handled if more input follows it in the buffer, i.e. the client pipelined requests.
+        /// Set the same way whether the fast path or http_parser parsed the request.
+        bool more_input = false;
+
     private:
+        std::size_t execute_length = 0; ///< Length of the input given to the running http_parser_execute().
         int header_building_state = 0;
         bool message_complete = false;
         std::string header_field;
@@ -5630,6 +6585,18 @@ namespace crow
 #include <vector>
 #include <cmath>
 #include <cfloat>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <type_traits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
 
 using std::isinf;
@@ -5653,32 +6620,74 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             return 'a' + c - 10;
         }
 
-        inline void escape(const std::string& str, std::string& ret)
+        namespace detail
         {
-            ret.reserve(ret.size() + str.size() + str.size() / 4);
-            for (auto c : str)
+            /// Return the first byte in [p, end) that has to be escaped in a JSON string: '"', '\\' or a control character.
+            inline const char* find_json_escape(const char* p, const char* end)
             {
-                switch (c)
+#if defined(__AVX2__)
+                const __m256i quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\'), ctl = _mm256_set1_epi8(0x1f);
+                for (; end - p >= 32; p += 32)
                 {
-                    case '"': ret += "\\\""; break;
-                    case '\\': ret += "\\\\"; break;
-                    case '\n': ret += "\\n"; break;
-                    case '\b': ret += "\\b"; break;
-                    case '\f': ret += "\\f"; break;
-                    case '\r': ret += "\\r"; break;
-                    case '\t': ret += "\\t"; break;
-                    default:
-                        if (c >= 0 && c < 0x20)
-                        {
+                    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+                    // max(b, 0x1f) == 0x1f is an unsigned b <= 0x1f.
+                    __m256i stop = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(b, ctl), ctl),
+                                                   _mm256_or_si256(_mm256_cmpeq_epi8(b, quote), _mm256_cmpeq_epi8(b, backslash)));
+                    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(stop));
+                    if (mask) return p + __builtin_ctz(mask);
+                }
+#elif defined(__SSE2__) || defined(_M_X64)
+                const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\'), ctl = _mm_set1_epi8(0x1f);
+                for (; end - p >= 16; p += 16)
+                {
+                    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+                    __m128i stop = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(b, ctl), ctl),
+                                                _mm_or_si128(_mm_cmpeq_epi8(b, quote), _mm_cmpeq_epi8(b, backslash)));
+                    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(stop));
+                    if (mask) return p + __builtin_ctz(mask);
+                }
+#endif
+                for (; p != end; ++p)
+                    if (*p == '"' || *p == '\\' || static_cast<unsigned char>(*p) < 0x20) break;
+                return p;
+            }
+
+            /// Append `str` to `ret` with the characters JSON doesn't allow in a string escaped.
+            inline void escape_into(std::string_view str, std::string& ret)
+            {
+                const char* p = str.data();
+                const char* end = p + str.size();
+                for (;;)
+                {
+                    const char* stop = find_json_escape(p, end);
+                    ret.append(p, stop);
+                    if (stop == end)
+                        return;
+                    char c = *stop;
+                    switch (c)
+                    {
+                        case '"': ret += "\\\""; break;
+                        case '\\': ret += "\\\\"; break;
+                        case '\n': ret += "\\n"; break;
+                        case '\b': ret += "\\b"; break;
+                        case '\f': ret += "\\f"; break;
+                        case '\r': ret += "\\r"; break;
+                        case '\t': ret += "\\t"; break;
+                        default:
                             ret += "\\u00";
                             ret += to_hex(c / 16);
                             ret += to_hex(c % 16);
-                        }
-                        else
-                            ret += c;
-                        break;
+                            break;
+                    }
+                    p = stop + 1;
                 }
             }
+        } // namespace detail
+
+        inline void escape(std::string_view str, std::string& ret)
+        {
+            ret.reserve(ret.size() + str.size() + str.size() / 4);
+            detail::escape_into(str, ret);
         }
         inline std::string escape(const std::string& str)
         {
@@ -6891,478 +7900,1228 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             return load(str.data(), str.size());
         }
 
-        struct wvalue_reader;
-
-        /// JSON write value.
-
-        ///
-        /// Value can mean any json value, including a JSON object.<br>
-        /// Write means this class is used to primarily assemble JSON objects using keys and values and export those into a string.
-        class wvalue : public returnable
+        namespace detail
         {
-            friend class crow::mustache::template_t;
-            friend struct wvalue_reader;
+            /// Character classes of a 64 byte block of JSON text, one bit per byte.
+            struct json_block
+            {
+                uint64_t quote;
+                uint64_t backslash;
+                uint64_t op; ///< `{ } [ ] : ,`
+                uint64_t space;
+            };
 
-        public:
-            using object =
-#ifdef CROW_JSON_USE_MAP
-              std::map<std::string, wvalue>;
+            inline json_block classify_json_block(const char* p)
+            {
+                json_block b{0, 0, 0, 0};
+#if defined(__AVX2__)
+                // OR-ing 0x20 folds '[' onto '{' and ']' onto '}', nothing else lands on either.
+                const __m256i quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\'), fold = _mm256_set1_epi8(0x20),
+                              open = _mm256_set1_epi8('{'), close = _mm256_set1_epi8('}'), colon = _mm256_set1_epi8(':'), comma = _mm256_set1_epi8(','),
+                              sp = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t'), lf = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+                for (int i = 0; i < 2; i++)
+                {
+                    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32 * i));
+                    __m256i folded = _mm256_or_si256(v, fold);
+                    __m256i op = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(folded, open), _mm256_cmpeq_epi8(folded, close)),
+                                                 _mm256_or_si256(_mm256_cmpeq_epi8(v, colon), _mm256_cmpeq_epi8(v, comma)));
+                    __m256i space = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, tab)),
+                                                    _mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr)));
+                    b.quote |= uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)))) << (32 * i);
+                    b.backslash |= uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash)))) << (32 * i);
+                    b.op |= uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(op))) << (32 * i);
+                    b.space |= uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(space))) << (32 * i);
+                }
+#elif defined(__SSE2__) || defined(_M_X64)
+                const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\'), fold = _mm_set1_epi8(0x20),
+                              open = _mm_set1_epi8('{'), close = _mm_set1_epi8('}'), colon = _mm_set1_epi8(':'), comma = _mm_set1_epi8(','),
+                              sp = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), lf = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+                for (int i = 0; i < 4; i++)
+                {
+                    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i));
+                    __m128i folded = _mm_or_si128(v, fold);
+                    __m128i op = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(folded, open), _mm_cmpeq_epi8(folded, close)),
+                                              _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+                    __m128i space = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)),
+                                                 _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+                    b.quote |= uint64_t(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)))) << (16 * i);
+                    b.backslash |= uint64_t(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash)))) << (16 * i);
+                    b.op |= uint64_t(static_cast<uint16_t>(_mm_movemask_epi8(op))) << (16 * i);
+                    b.space |= uint64_t(static_cast<uint16_t>(_mm_movemask_epi8(space))) << (16 * i);
+                }
 #else
-              std::unordered_map<std::string, wvalue>;
+                for (int i = 0; i < 64; i++)
+                {
+                    uint64_t bit = uint64_t(1) << i;
+                    switch (p[i])
+                    {
+                        case '"': b.quote |= bit; break;
+                        case '\\': b.backslash |= bit; break;
+                        case '{':
+                        case '}':
+                        case '[':
+                        case ']':
+                        case ':':
+                        case ',': b.op |= bit; break;
+                        case ' ':
+                        case '\t':
+                        case '\n':
+                        case '\r': b.space |= bit; break;
+                    }
+                }
 #endif
+                return b;
+            }
 
-            using list = std::vector<wvalue>;
-
-            type t() const { return t_; }
-
-            /// Create an empty json value (outputs "{}" instead of a "null" string)
-            static crow::json::wvalue empty_object() { return crow::json::wvalue::object(); }
+            /// Bit i of the result is the XOR of bits 0..i of x.
+            inline uint64_t prefix_xor(uint64_t x)
+            {
+                x ^= x << 1;
+                x ^= x << 2;
+                x ^= x << 4;
+                x ^= x << 8;
+                x ^= x << 16;
+                x ^= x << 32;
+                return x;
+            }
 
-        private:
-            type t_{type::Null};         ///< The type of the value.
-            num_type nt{num_type::Null}; ///< The specific type of the number if \ref t_ is a number.
-            union number
+            /// Append the unescaped contents of a JSON string (without its quotes), the same way rvalue::unescape() does.
+            inline void unescape_json(const char* p, const char* end, std::string& out)
             {
-                double d;
-                int64_t si;
-                uint64_t ui;
+                auto from_hex = [](char c) {
+                    if (c >= 'a')
+                        return c - 'a' + 10;
+                    if (c >= 'A')
+                        return c - 'A' + 10;
+                    return c - '0';
+                };
+                while (p != end)
+                {
+                    const char* slash = static_cast<const char*>(std::memchr(p, '\\', end - p));
+                    if (!slash)
+                    {
+                        out.append(p, end);
+                        return;
+                    }
+                    out.append(p, slash);
+                    p = slash + 1;
+                    switch (*p)
+                    {
+                        case 'b': out += '\b'; break;
+                        case 'f': out += '\f'; break;
+                        case 'n': out += '\n'; break;
+                        case 'r': out += '\r'; break;
+                        case 't': out += '\t'; break;
+                        case 'u':
+                        {
+                            unsigned int code = (from_hex(p[1]) << 12) + (from_hex(p[2]) << 8) + (from_hex(p[3]) << 4) + from_hex(p[4]);
+                            if (code >= 0x800)
+                            {
+                                out += static_cast<char>(0xE0 | (code >> 12));
+                                out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                                out += static_cast<char>(0x80 | (code & 0x3F));
+                            }
+                            else if (code >= 0x80)
+                            {
+                                out += static_cast<char>(0xC0 | (code >> 6));
+                                out += static_cast<char>(0x80 | (code & 0x3F));
+                            }
+                            else
+                                out += static_cast<char>(code);
+                            p += 4;
+                            break;
+                        }
+                        default: out += *p; break; // '"', '\\' and '/'
+                    }
+                    p++;
+                }
+            }
+        } // namespace detail
 
-            public:
-                constexpr number() noexcept:
-                  ui() {} /* default constructor initializes unsigned integer. */
-                constexpr number(std::uint64_t value) noexcept:
-                  ui(value) {}
-                constexpr number(std::int64_t value) noexcept:
-                  si(value) {}
-                explicit constexpr number(double value) noexcept:
-                  d(value) {}
-                explicit constexpr number(float value) noexcept:
-                  d(value) {}
-            } num;                                      ///< Value if type is a number.
-            std::string s;                              ///< Value if type is a string.
-            std::unique_ptr<list> l;                    ///< Value if type is a list.
-            std::unique_ptr<object> o;                  ///< Value if type is a JSON object.
-            std::function<std::string(std::string&)> f; ///< Value if type is a function (C++ lambda)
+        class lazy_value;
 
-        public:
-            wvalue():
-              returnable("application/json") {}
+        /// JSON document for on-demand access.
 
-            wvalue(std::nullptr_t):
-              returnable("application/json"), t_(type::Null) {}
+        ///
+        /// Parsing indexes the structural characters of the text 64 bytes at a time with SSE2/AVX2 (the first stage of simdjson)
+        /// and checks the grammar over that index. No tree is built and nothing is copied or unescaped until a value is read,
+        /// so a handler that reads the three fields of a POST body doesn't pay for anything else.<br>
+        /// The document refers to the text it was parsed from, which has to outlive it.
+        /// Reusing one document for several parses keeps its index buffers.
+        class lazy_document
+        {
+            friend class lazy_value;
 
-            wvalue(bool value):
-              returnable("application/json"), t_(value ? type::True : type::False) {}
+        public:
+            lazy_document() = default;
 
-            wvalue(std::uint8_t value):
-              returnable("application/json"), t_(type::Number), nt(num_type::Unsigned_integer), num(static_cast<std::uint64_t>(value)) {}
-            wvalue(std::uint16_t value):
-              returnable("application/json"), t_(type::Number), nt(num_type::Unsigned_integer), num(static_cast<std::uint64_t>(value)) {}
-            wvalue(std::uint32_t value):
-              returnable("application/json"), t_(type::Number), nt(num_type::Unsigned_integer), num(static_cast<std::uint64_t>(value)) {}
-            wvalue(std::uint64_t value):
-              returnable("application/json"), t_(type::Number), nt(num_type::Unsigned_integer), num(static_cast<std::uint64_t>(value)) {}
+            explicit lazy_document(std::string_view text)
+            {
+                parse(text);
+            }
 
-            wvalue(std::int8_t value):
-              returnable("application/json"), t_(type::Number), nt(num_type::Signed_integer), num(static_cast<std::int64_t>(value)) {}
-            wvalue(std::int16_t value):
-              returnable("application/json"), t_(type::Number), nt(num_type::Signed_integer), num(static_cast<std::int64_t>(value)) {}
-            wvalue(std::int32_t value):
-              returnable("application/json"), t_(type::Number), nt(num_type::Signed_integer), num(static_cast<std::int64_t>(value)) {}
-            wvalue(std::int64_t value):
-              returnable("application/json"), t_(type::Number), nt(num_type::Signed_integer), num(static_cast<std::int64_t>(value)) {}
+            /// Index and validate `text`, return false if it isn't valid JSON.
+            bool parse(std::string_view text)
+            {
+                text_ = text;
+                count_ = 0;
+                valid_ = text.size() < UINT32_MAX && index() && validate();
+                return valid_;
+            }
 
-            wvalue(float value):
-              returnable("application/json"), t_(type::Number), nt(num_type::Floating_point), num(static_cast<double>(value)) {}
-            wvalue(double value):
-              returnable("application/json"), t_(type::Number), nt(num_type::Double_precision_floating_point), num(static_cast<double>(value)) {}
+            explicit operator bool() const
+            {
+                return valid_;
+            }
 
-            wvalue(char const* value):
-              returnable("application/json"), t_(type::String), s(value) {}
+            /// The top level value, an invalid lazy_value if parsing failed.
+            lazy_value root() const;
 
-            wvalue(std::string const& value):
-              returnable("application/json"), t_(type::String), s(value) {}
-            wvalue(std::string&& value):
-              returnable("application/json"), t_(type::String), s(std::move(value)) {}
+            lazy_value operator[](std::string_view key) const;
 
-            wvalue(std::initializer_list<std::pair<std::string const, wvalue>> initializer_list):
-              returnable("application/json"), t_(type::Object), o(new object(initializer_list)) {}
+        private:
+            /// An entry of the structural index.
+            struct token
+            {
+                uint32_t offset;
+                /// Index of the matching close token for `{` and `[`, end offset for numbers and literals.
+                uint32_t end;
+            };
 
-            wvalue(object const& value):
-              returnable("application/json"), t_(type::Object), o(new object(value)) {}
-            wvalue(object&& value):
-              returnable("application/json"), t_(type::Object), o(new object(std::move(value))) {}
+            char at(uint32_t k) const
+            {
+                return k < count_ ? text_[tokens_[k].offset] : '\0';
+            }
 
-            wvalue(const list& r):
-              returnable("application/json")
+            /// Index of the token following the value that starts at token k.
+            uint32_t skip(uint32_t k) const
             {
-                t_ = type::List;
-                l = std::unique_ptr<list>(new list{});
-                l->reserve(r.size());
-                for (auto it = r.begin(); it != r.end(); ++it)
-                    l->emplace_back(*it);
+                switch (at(k))
+                {
+                    case '{':
+                    case '[': return tokens_[k].end + 1;
+                    case '"': return k + 2;
+                    default: return k + 1;
+                }
             }
-            wvalue(list& r):
-              returnable("application/json")
+
+            /// Contents of the string whose opening quote is token k.
+            std::string_view string_at(uint32_t k) const
             {
-                t_ = type::List;
-                l = std::unique_ptr<list>(new list{});
-                l->reserve(r.size());
-                for (auto it = r.begin(); it != r.end(); ++it)
-                    l->emplace_back(*it);
+                return std::string_view(text_.data() + tokens_[k].offset + 1, tokens_[k + 1].offset - tokens_[k].offset - 1);
             }
 
-            /// Create a write value from a read value (useful for editing JSON strings).
-            wvalue(const rvalue& r):
-              returnable("application/json")
+            /// Stage 1: record every structural character, every unescaped quote and the first byte of every number or literal.
+            bool index()
             {
-                t_ = r.t();
-                switch (r.t())
+                const size_t size = text_.size();
+                if (tokens_.size() < size)
+                    tokens_.resize(size);
+
+                uint64_t prev_escaped = 0, prev_in_string = 0, prev_scalar = 0, backslashes = 0;
+                uint32_t n = 0;
+                char tail[64];
+                for (size_t base = 0; base < size; base += 64)
                 {
-                    case type::Null:
-                    case type::False:
-                    case type::True:
-                    case type::Function:
-                        return;
-                    case type::Number:
-                        nt = r.nt();
-                        if (nt == num_type::Floating_point || nt == num_type::Double_precision_floating_point)
-                            num.d = r.d();
-                        else if (nt == num_type::Signed_integer)
-                            num.si = r.i();
-                        else
-                            num.ui = r.u();
-                        return;
-                    case type::String:
-                        s = r.s();
-                        return;
-                    case type::List:
-                        l = std::unique_ptr<list>(new list{});
-                        l->reserve(r.size());
-                        for (auto it = r.begin(); it != r.end(); ++it)
-                            l->emplace_back(*it);
-                        return;
-                    case type::Object:
-                        o = std::unique_ptr<object>(new object{});
-                        for (auto it = r.begin(); it != r.end(); ++it)
-                            o->emplace(it->key(), *it);
-                        return;
+                    const char* p = text_.data() + base;
+                    if (size - base < 64)
+                    {
+                        std::memset(tail, ' ', sizeof(tail));
+                        std::memcpy(tail, p, size - base);
+                        p = tail;
+                    }
+                    detail::json_block b = detail::classify_json_block(p);
+
+                    // A backslash escapes the next byte unless it is escaped itself.
+                    backslashes |= b.backslash;
+                    uint64_t escaped = 0;
+                    if (b.backslash | prev_escaped)
+                    {
+                        uint64_t slashes = b.backslash;
+                        if (prev_escaped)
+                        {
+                            escaped = 1;
+                            slashes &= ~uint64_t(1);
+                            prev_escaped = 0;
+                        }
+                        while (slashes)
+                        {
+                            unsigned i = __builtin_ctzll(slashes);
+                            slashes &= slashes - 1;
+                            if (i == 63)
+                                prev_escaped = 1;
+                            else
+                            {
+                                escaped |= uint64_t(1) << (i + 1);
+                                slashes &= ~(uint64_t(1) << (i + 1));
+                            }
+                        }
+                    }
+
+                    uint64_t quote = b.quote & ~escaped;
+                    // Set from an opening quote up to, but not including, its closing quote.
+                    uint64_t in_string = detail::prefix_xor(quote) ^ prev_in_string;
+                    prev_in_string = static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+
+                    uint64_t scalar = ~(b.op | b.space | b.quote | in_string);
+                    uint64_t scalar_start = scalar & ~((scalar << 1) | prev_scalar);
+                    prev_scalar = scalar >> 63;
+
+                    uint64_t bits = (b.op & ~in_string) | quote | scalar_start;
+                    while (bits)
+                    {
+                        tokens_[n++] = {static_cast<uint32_t>(base + __builtin_ctzll(bits)), 0};
+                        bits &= bits - 1;
+                    }
                 }
+                count_ = n;
+                escapes_ = backslashes != 0;
+                return !prev_in_string;
             }
 
-            wvalue(const wvalue& r):
-              returnable("application/json")
+            /// Stage 2: check the grammar and link each `{` and `[` to its closing token.
+            bool validate()
             {
-                t_ = r.t();
-                switch (r.t())
+                stack_.clear();
+                uint32_t k = 0;
+                char c;
+
+            value:
+                switch (at(k))
                 {
-                    case type::Null:
-                    case type::False:
-                    case type::True:
-                        return;
-                    case type::Number:
-                        nt = r.nt;
-                        if (nt == num_type::Floating_point || nt == num_type::Double_precision_floating_point)
-                            num.d = r.num.d;
-                        else if (nt == num_type::Signed_integer)
-                            num.si = r.num.si;
-                        else
-                            num.ui = r.num.ui;
-                        return;
-                    case type::String:
-                        s = r.s;
-                        return;
-                    case type::List:
-                        l = std::unique_ptr<list>(new list{});
-                        l->reserve(r.size());
-                        for (auto it = r.l->begin(); it != r.l->end(); ++it)
-                            l->emplace_back(*it);
-                        return;
-                    case type::Object:
-                        o = std::unique_ptr<object>(new object{});
-                        o->insert(r.o->begin(), r.o->end());
-                        return;
-                    case type::Function:
-                        f = r.f;
+                    case '{':
+                        stack_.push_back(k++);
+                        if (at(k) == '}')
+                            goto close;
+                        goto key;
+                    case '[':
+                        stack_.push_back(k++);
+                        if (at(k) == ']')
+                            goto close;
+                        goto value;
+                    case '"':
+                        if (escapes_ && !valid_string(k))
+                            return false;
+                        k += 2;
+                        goto next;
+                    default:
+                        if (!valid_scalar(k))
+                            return false;
+                        k++;
+                        goto next;
                 }
-            }
 
-            wvalue(wvalue&& r):
-              returnable("application/json")
-            {
-                *this = std::move(r);
+            key:
+                if (at(k) != '"' || (escapes_ && !valid_string(k)) || at(k + 2) != ':')
+                    return false;
+                k += 3;
+                goto value;
+
+            close:
+                tokens_[stack_.back()].end = k++;
+                stack_.pop_back();
+
+            next:
+                if (stack_.empty())
+                    return k == count_;
+                c = at(k);
+                if (c == ',')
+                {
+                    k++;
+                    if (at(stack_.back()) == '{')
+                        goto key;
+                    goto value;
+                }
+                if (c == (at(stack_.back()) == '{' ? '}' : ']'))
+                    goto close;
+                return false;
             }
 
-            wvalue& operator=(wvalue&& r)
+            /// Check the escape sequences of the string whose opening quote is token k.
+            bool valid_string(uint32_t k) const
             {
-                t_ = r.t_;
-                nt = r.nt;
-                num = r.num;
-                s = std::move(r.s);
-                l = std::move(r.l);
-                o = std::move(r.o);
-                return *this;
+                std::string_view s = string_at(k);
+                auto is_hex = [](char c) {
+                    return ('0' <= c && c <= '9') || ('a' <= c && c <= 'f') || ('A' <= c && c <= 'F');
+                };
+                // The closing quote is never escaped, so a backslash always has a byte after it.
+                for (size_t i = s.find('\\'); i != std::string_view::npos; i = s.find('\\', i))
+                {
+                    switch (s[i + 1])
+                    {
+                        case '"':
+                        case '\\':
+                        case '/':
+                        case 'b':
+                        case 'f':
+                        case 'n':
+                        case 'r':
+                        case 't':
+                            i += 2;
+                            break;
+                        case 'u':
+                            if (s.size() - i < 6 || !(is_hex(s[i + 2]) && is_hex(s[i + 3]) && is_hex(s[i + 4]) && is_hex(s[i + 5])))
+                                return false;
+                            i += 6;
+                            break;
+                        default:
+                            return false;
+                    }
+                }
+                return true;
             }
 
-            /// Used for compatibility, same as \ref reset()
-            void clear()
+            static bool is_separator(char c)
             {
-                reset();
+                switch (c)
+                {
+                    case '{':
+                    case '}':
+                    case '[':
+                    case ']':
+                    case ':':
+                    case ',':
+                    case '"':
+                    case ' ':
+                    case '\t':
+                    case '\n':
+                    case '\r':
+                        return true;
+                    default:
+                        return false;
+                }
             }
 
-            void reset()
+            /// Check that the bytes from token k up to the next separator are a literal or a number, and record where they end.
+            bool valid_scalar(uint32_t k)
             {
-                t_ = type::Null;
-                l.reset();
-                o.reset();
+                if (k >= count_)
+                    return false;
+                const char* begin = text_.data() + tokens_[k].offset;
+                const char* end = begin;
+                const char* limit = text_.data() + text_.size();
+                while (end != limit && !is_separator(*end))
+                    end++;
+                tokens_[k].end = static_cast<uint32_t>(end - text_.data());
+
+                std::string_view s(begin, end - begin);
+                if (s == "true" || s == "false" || s == "null")
+                    return true;
+
+                // -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+                auto digits = [&](const char*& p) {
+                    const char* start = p;
+                    while (p != end && *p >= '0' && *p <= '9')
+                        p++;
+                    return p != start;
+                };
+                const char* p = begin;
+                if (p != end && *p == '-')
+                    p++;
+                if (p != end && *p == '0')
+                    p++;
+                else if (p == end || *p < '1' || *p > '9' || !digits(p))
+                    return false;
+                if (p != end && *p == '.')
+                {
+                    p++;
+                    if (!digits(p))
+                        return false;
+                }
+                if (p != end && (*p == 'e' || *p == 'E'))
+                {
+                    p++;
+                    if (p != end && (*p == '+' || *p == '-'))
+                        p++;
+                    if (!digits(p))
+                        return false;
+                }
+                return p == end;
             }
 
-            wvalue& operator=(std::nullptr_t)
+            std::string_view text_;
+            std::vector<token> tokens_;
+            uint32_t count_ = 0;
+            std::vector<uint32_t> stack_;
+            bool escapes_ = false; ///< The text has a backslash somewhere.
+            bool valid_ = false;
+        };
+
+        /// A value inside a lazy_document.
+
+        ///
+        /// It is a position in the document's index, so copying it is cheap. Looking up a key walks the members of
+        /// the object and steps over nested containers without looking inside them.
+        /// Accessors throw the same errors as rvalue's unless CROW_JSON_NO_ERROR_CHECK is defined.
+        class lazy_value
+        {
+            friend class lazy_document;
+
+        public:
+            class iterator
             {
-                reset();
-                return *this;
-            }
-            wvalue& operator=(bool value)
-            {
-                reset();
-                if (value)
-                    t_ = type::True;
-                else
-                    t_ = type::False;
-                return *this;
-            }
+                friend class lazy_value;
 
-            wvalue& operator=(float value)
-            {
-                reset();
-                t_ = type::Number;
-                num.d = value;
-                nt = num_type::Floating_point;
-                return *this;
-            }
+            public:
+                lazy_value operator*() const
+                {
+                    return object_ ? lazy_value(doc_, k_ + 3, k_) : lazy_value(doc_, k_, npos);
+                }
 
-            wvalue& operator=(double value)
-            {
-                reset();
-                t_ = type::Number;
-                num.d = value;
-                nt = num_type::Double_precision_floating_point;
-                return *this;
-            }
+                iterator& operator++()
+                {
+                    k_ = doc_->skip(object_ ? k_ + 3 : k_);
+                    if (doc_->at(k_) == ',')
+                        k_++;
+                    return *this;
+                }
 
-            wvalue& operator=(unsigned short value)
-            {
-                reset();
-                t_ = type::Number;
-                num.ui = value;
-                nt = num_type::Unsigned_integer;
-                return *this;
-            }
+                bool operator==(const iterator& other) const
+                {
+                    return k_ == other.k_;
+                }
 
-            wvalue& operator=(short value)
-            {
-                reset();
-                t_ = type::Number;
-                num.si = value;
-                nt = num_type::Signed_integer;
-                return *this;
-            }
+                bool operator!=(const iterator& other) const
+                {
+                    return k_ != other.k_;
+                }
 
-            wvalue& operator=(long long value)
+            private:
+                iterator(const lazy_document* doc, uint32_t k, bool object):
+                  doc_(doc), k_(k), object_(object)
+                {}
+
+                const lazy_document* doc_;
+                uint32_t k_;
+                bool object_;
+            };
+
+            lazy_value() = default;
+
+            /// False for a value that doesn't exist (the root of a failed parse, or a missing key with CROW_JSON_NO_ERROR_CHECK).
+            explicit operator bool() const
             {
-                reset();
-                t_ = type::Number;
-                num.si = value;
-                nt = num_type::Signed_integer;
-                return *this;
+                return doc_ != nullptr;
             }
 
-            wvalue& operator=(long value)
+            /// The type of the JSON value.
+            type t() const
             {
-                reset();
-                t_ = type::Number;
-                num.si = value;
-                nt = num_type::Signed_integer;
-                return *this;
+                if (!doc_)
+                {
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                    throw std::runtime_error("invalid json object");
+#else
+                    return type::Null;
+#endif
+                }
+                switch (doc_->at(k_))
+                {
+                    case '{': return type::Object;
+                    case '[': return type::List;
+                    case '"': return type::String;
+                    case 't': return type::True;
+                    case 'f': return type::False;
+                    case 'n': return type::Null;
+                    default: return type::Number;
+                }
             }
 
-            wvalue& operator=(int value)
+            /// The text of the value as it appears in the document. Strings are returned without quotes and still escaped.
+            std::string_view raw() const
             {
-                reset();
-                t_ = type::Number;
-                num.si = value;
-                nt = num_type::Signed_integer;
-                return *this;
+                if (!doc_)
+                    return {};
+                const auto& token = doc_->tokens_[k_];
+                switch (doc_->at(k_))
+                {
+                    case '"': return doc_->string_at(k_);
+                    case '{':
+                    case '[': return doc_->text_.substr(token.offset, doc_->tokens_[token.end].offset + 1 - token.offset);
+                    default: return doc_->text_.substr(token.offset, token.end - token.offset);
+                }
             }
 
-            wvalue& operator=(unsigned long long value)
+            /// The integer value.
+            int64_t i() const
             {
-                reset();
-                t_ = type::Number;
-                num.ui = value;
-                nt = num_type::Unsigned_integer;
-                return *this;
+                return integer<int64_t>();
             }
 
-            wvalue& operator=(unsigned long value)
+            /// The unsigned integer value.
+            uint64_t u() const
             {
-                reset();
-                t_ = type::Number;
-                num.ui = value;
-                nt = num_type::Unsigned_integer;
-                return *this;
+                return integer<uint64_t>();
             }
 
-            wvalue& operator=(unsigned int value)
+            /// The double precision floating-point number value.
+            double d() const
             {
-                reset();
-                t_ = type::Number;
-                num.ui = value;
-                nt = num_type::Unsigned_integer;
-                return *this;
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                if (t() != type::Number)
+                    throw std::runtime_error("value is not number");
+#endif
+                std::string_view s = raw();
+                return utility::lexical_cast<double>(s.data(), s.size());
             }
 
-            wvalue& operator=(const char* str)
+            /// The boolean value.
+            bool b() const
             {
-                reset();
-                t_ = type::String;
-                s = str;
-                return *this;
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                if (t() != type::True && t() != type::False)
+                    throw std::runtime_error("value is not boolean");
+#endif
+                return t() == type::True;
             }
 
-            wvalue& operator=(const std::string& str)
+            /// The unescaped string value.
+            std::string s() const
             {
-                reset();
-                t_ = type::String;
-                s = str;
-                return *this;
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                if (t() != type::String)
+                    throw std::runtime_error("value is not string");
+#endif
+                std::string_view s = raw();
+                if (!doc_ || !doc_->escapes_)
+                    return std::string(s);
+                std::string ret;
+                detail::unescape_json(s.data(), s.data() + s.size(), ret);
+                return ret;
             }
 
-            wvalue& operator=(list&& v)
+            /// The unescaped key of an object member reached through iteration.
+            std::string key() const
             {
-                if (t_ != type::List)
-                    reset();
-                t_ = type::List;
-                if (!l)
-                    l = std::unique_ptr<list>(new list{});
-                l->clear();
-                l->resize(v.size());
-                size_t idx = 0;
-                for (auto& x : v)
+                std::string ret;
+                if (doc_ && key_ != npos)
                 {
-                    (*l)[idx++] = std::move(x);
+                    std::string_view s = doc_->string_at(key_);
+                    detail::unescape_json(s.data(), s.data() + s.size(), ret);
                 }
-                return *this;
+                return ret;
             }
 
-            template<typename T>
-            wvalue& operator=(const std::vector<T>& v)
+            bool has(std::string_view key) const
             {
-                if (t_ != type::List)
-                    reset();
-                t_ = type::List;
-                if (!l)
-                    l = std::unique_ptr<list>(new list{});
-                l->clear();
-                l->resize(v.size());
-                size_t idx = 0;
-                for (auto& x : v)
-                {
-                    (*l)[idx++] = x;
-                }
-                return *this;
+                return static_cast<bool>(find(key));
             }
 
-            wvalue& operator=(std::initializer_list<std::pair<std::string const, wvalue>> initializer_list)
+            lazy_value operator[](std::string_view key) const
             {
-                if (t_ != type::Object)
-                {
-                    reset();
-                    t_ = type::Object;
-                    o = std::unique_ptr<object>(new object(initializer_list));
-                }
-                else
-                {
-#if defined(__APPLE__) || defined(__MACH__) || defined(__FreeBSD__) || defined(__ANDROID__) || defined(_LIBCPP_VERSION)
-                    o = std::unique_ptr<object>(new object(initializer_list));
-#else
-                    (*o) = initializer_list;
+                lazy_value ret = find(key);
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                if (!ret)
+                    throw std::runtime_error("cannot find key: " + std::string(key));
 #endif
-                }
-                return *this;
+                return ret;
             }
 
-            wvalue& operator=(object const& value)
+            lazy_value operator[](size_t index) const
             {
-                if (t_ != type::Object)
-                {
-                    reset();
-                    t_ = type::Object;
-                    o = std::unique_ptr<object>(new object(value));
-                }
-                else
-                {
-#if defined(__APPLE__) || defined(__MACH__) || defined(__FreeBSD__) || defined(__ANDROID__) || defined(_LIBCPP_VERSION)
-                    o = std::unique_ptr<object>(new object(value));
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                if (t() != type::List)
+                    throw std::runtime_error("value is not a list");
+#endif
+                for (iterator it = begin(), last = end(); it != last; ++it, index--)
+                    if (index == 0)
+                        return *it;
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                throw std::runtime_error("list out of bound");
 #else
-                    (*o) = value;
+                return {};
 #endif
-                }
-                return *this;
             }
 
-            wvalue& operator=(object&& value)
+            /// Number of members of an object or list, walked on every call.
+            size_t size() const
             {
-                if (t_ != type::Object)
-                {
-                    reset();
-                    t_ = type::Object;
-                    o = std::unique_ptr<object>(new object(std::move(value)));
-                }
-                else
-                {
-                    (*o) = std::move(value);
-                }
-                return *this;
+                size_t ret = 0;
+                for (iterator it = begin(), last = end(); it != last; ++it)
+                    ret++;
+                return ret;
             }
 
-            wvalue& operator=(std::function<std::string(std::string&)>&& func)
+            std::vector<std::string> keys() const
             {
-                reset();
-                t_ = type::Function;
-                f = std::move(func);
-                return *this;
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                if (t() != type::Object)
+                    throw std::runtime_error("value is not an object");
+#endif
+                std::vector<std::string> ret;
+                for (iterator it = begin(), last = end(); it != last; ++it)
+                    ret.emplace_back((*it).key());
+                return ret;
             }
 
-            wvalue& operator[](unsigned index)
+            iterator begin() const
             {
-                if (t_ != type::List)
-                    reset();
-                t_ = type::List;
-                if (!l)
-                    l = std::unique_ptr<list>(new list{});
-                if (l->size() < index + 1)
-                    l->resize(index + 1);
-                return (*l)[index];
+                if (!is_container())
+                    return {doc_, 0, false};
+                return {doc_, k_ + 1, doc_->at(k_) == '{'};
             }
 
-            const wvalue& operator[](unsigned index) const
+            iterator end() const
             {
-                return const_cast<wvalue*>(this)->operator[](index);
+                if (!is_container())
+                    return {doc_, 0, false};
+                return {doc_, doc_->tokens_[k_].end, doc_->at(k_) == '{'};
             }
 
-            int count(const std::string& str) const
-            {
-                if (t_ != type::Object)
-                    return 0;
-                if (!o)
-                    return 0;
-                return o->count(str);
-            }
+        private:
+            static constexpr uint32_t npos = UINT32_MAX;
 
-            wvalue& operator[](const std::string& str)
+            lazy_value(const lazy_document* doc, uint32_t k, uint32_t key):
+              doc_(doc), k_(k), key_(key)
+            {}
+
+            bool is_container() const
             {
-                if (t_ != type::Object)
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                if (t() != type::Object && t() != type::List)
+                    throw std::runtime_error("value is not a container");
+#endif
+                return doc_ && (doc_->at(k_) == '{' || doc_->at(k_) == '[');
+            }
+
+            lazy_value find(std::string_view key) const
+            {
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                if (t() != type::Object)
+                    throw std::runtime_error("value is not an object");
+#else
+                if (!doc_ || doc_->at(k_) != '{')
+                    return {};
+#endif
+                const lazy_document& doc = *doc_;
+                uint32_t k = k_ + 1;
+                if (doc.at(k) == '}')
+                    return {};
+                for (;;)
+                {
+                    std::string_view name = doc.string_at(k);
+                    if (name == key)
+                        return {doc_, k + 3, k};
+                    if (doc.escapes_ && name.find('\\') != std::string_view::npos)
+                    {
+                        std::string unescaped;
+                        detail::unescape_json(name.data(), name.data() + name.size(), unescaped);
+                        if (unescaped == key)
+                            return {doc_, k + 3, k};
+                    }
+                    k = doc.skip(k + 3);
+                    if (doc.at(k) != ',')
+                        return {};
+                    k++;
+                }
+            }
+
+            template<typename T>
+            T integer() const
+            {
+#ifndef CROW_JSON_NO_ERROR_CHECK
+                if (t() != type::Number && t() != type::String)
+                    throw std::runtime_error(std::string("expected number, got: ") + get_type_str(t()));
+#endif
+                std::string_view s = raw();
+                T ret = 0;
+                std::from_chars(s.data(), s.data() + s.size(), ret);
+                return ret;
+            }
+
+            const lazy_document* doc_ = nullptr;
+            uint32_t k_ = 0;
+            uint32_t key_ = npos;
+        };
+
+        inline lazy_value lazy_document::root() const
+        {
+            return valid_ ? lazy_value(this, 0, lazy_value::npos) : lazy_value();
+        }
+
+        inline lazy_value lazy_document::operator[](std::string_view key) const
+        {
+            return root()[key];
+        }
+
+        /// Index a JSON text for on-demand access, see lazy_document. `text` must outlive the result.
+        inline lazy_document load_lazy(std::string_view text)
+        {
+            return lazy_document(text);
+        }
+
+        struct wvalue_reader;
+
+        /// JSON write value.
+
+        ///
+        /// Value can mean any json value, including a JSON object.<br>
+        /// Write means this class is used to primarily assemble JSON objects using keys and values and export those into a string.
+        class wvalue : public returnable
+        {
+            friend class crow::mustache::template_t;
+            friend struct wvalue_reader;
+
+        public:
+            using object =
+#ifdef CROW_JSON_USE_MAP
+              std::map<std::string, wvalue>;
+#else
+              std::unordered_map<std::string, wvalue>;
+#endif
+
+            using list = std::vector<wvalue>;
+
+            type t() const { return t_; }
+
+            /// Create an empty json value (outputs "{}" instead of a "null" string)
+            static crow::json::wvalue empty_object() { return crow::json::wvalue::object(); }
+
+        private:
+            type t_{type::Null};         ///< The type of the value.
+            num_type nt{num_type::Null}; ///< The specific type of the number if \ref t_ is a number.
+            union number
+            {
+                double d;
+                int64_t si;
+                uint64_t ui;
+
+            public:
+                constexpr number() noexcept:
+                  ui() {} /* default constructor initializes unsigned integer. */
+                constexpr number(std::uint64_t value) noexcept:
+                  ui(value) {}
+                constexpr number(std::int64_t value) noexcept:
+                  si(value) {}
+                explicit constexpr number(double value) noexcept:
+                  d(value) {}
+                explicit constexpr number(float value) noexcept:
+                  d(value) {}
+            } num;                                      ///< Value if type is a number.
+            std::string s;                              ///< Value if type is a string.
+            std::unique_ptr<list> l;                    ///< Value if type is a list.
+            std::unique_ptr<object> o;                  ///< Value if type is a JSON object.
+            std::function<std::string(std::string&)> f; ///< Value if type is a function (C++ lambda)
+
+        public:
+            wvalue():
+              returnable("application/json") {}
+
+            wvalue(std::nullptr_t):
+              returnable("application/json"), t_(type::Null) {}
+
+            wvalue(bool value):
+              returnable("application/json"), t_(value ? type::True : type::False) {}
+
+            wvalue(std::uint8_t value):
+              returnable("application/json"), t_(type::Number), nt(num_type::Unsigned_integer), num(static_cast<std::uint64_t>(value)) {}
+            wvalue(std::uint16_t value):
+              returnable("application/json"), t_(type::Number), nt(num_type::Unsigned_integer), num(static_cast<std::uint64_t>(value)) {}
+            wvalue(std::uint32_t value):
+              returnable("application/json"), t_(type::Number), nt(num_type::Unsigned_integer), num(static_cast<std::uint64_t>(value)) {}
+            wvalue(std::uint64_t value):
+              returnable("application/json"), t_(type::Number), nt(num_type::Unsigned_integer), num(static_cast<std::uint64_t>(value)) {}
+
+            wvalue(std::int8_t value):
+              returnable("application/json"), t_(type::Number), nt(num_type::Signed_integer), num(static_cast<std::int64_t>(value)) {}
+            wvalue(std::int16_t value):
+              returnable("application/json"), t_(type::Number), nt(num_type::Signed_integer), num(static_cast<std::int64_t>(value)) {}
+            wvalue(std::int32_t value):
+              returnable("application/json"), t_(type::Number), nt(num_type::Signed_integer), num(static_cast<std::int64_t>(value)) {}
+            wvalue(std::int64_t value):
+              returnable("application/json"), t_(type::Number), nt(num_type::Signed_integer), num(static_cast<std::int64_t>(value)) {}
+
+            wvalue(float value):
+              returnable("application/json"), t_(type::Number), nt(num_type::Floating_point), num(static_cast<double>(value)) {}
+            wvalue(double value):
+              returnable("application/json"), t_(type::Number), nt(num_type::Double_precision_floating_point), num(static_cast<double>(value)) {}
+
+            wvalue(char const* value):
+              returnable("application/json"), t_(type::String), s(value) {}
+
+            wvalue(std::string const& value):
+              returnable("application/json"), t_(type::String), s(value) {}
+            wvalue(std::string&& value):
+              returnable("application/json"), t_(type::String), s(std::move(value)) {}
+
+            wvalue(std::initializer_list<std::pair<std::string const, wvalue>> initializer_list):
+              returnable("application/json"), t_(type::Object), o(new object(initializer_list)) {}
+
+            wvalue(object const& value):
+              returnable("application/json"), t_(type::Object), o(new object(value)) {}
+            wvalue(object&& value):
+              returnable("application/json"), t_(type::Object), o(new object(std::move(value))) {}
+
+            wvalue(const list& r):
+              returnable("application/json")
+            {
+                t_ = type::List;
+                l = std::unique_ptr<list>(new list{});
+                l->reserve(r.size());
+                for (auto it = r.begin(); it != r.end(); ++it)
+                    l->emplace_back(*it);
+            }
+            wvalue(list& r):
+              returnable("application/json")
+            {
+                t_ = type::List;
+                l = std::unique_ptr<list>(new list{});
+                l->reserve(r.size());
+                for (auto it = r.begin(); it != r.end(); ++it)
+                    l->emplace_back(*it);
+            }
+
+            /// Create a write value from a read value (useful for editing JSON strings).
+            wvalue(const rvalue& r):
+              returnable("application/json")
+            {
+                t_ = r.t();
+                switch (r.t())
+                {
+                    case type::Null:
+                    case type::False:
+                    case type::True:
+                    case type::Function:
+                        return;
+                    case type::Number:
+                        nt = r.nt();
+                        if (nt == num_type::Floating_point || nt == num_type::Double_precision_floating_point)
+                            num.d = r.d();
+                        else if (nt == num_type::Signed_integer)
+                            num.si = r.i();
+                        else
+                            num.ui = r.u();
+                        return;
+                    case type::String:
+                        s = r.s();
+                        return;
+                    case type::List:
+                        l = std::unique_ptr<list>(new list{});
+                        l->reserve(r.size());
+                        for (auto it = r.begin(); it != r.end(); ++it)
+                            l->emplace_back(*it);
+                        return;
+                    case type::Object:
+                        o = std::unique_ptr<object>(new object{});
+                        for (auto it = r.begin(); it != r.end(); ++it)
+                            o->emplace(it->key(), *it);
+                        return;
+                }
+            }
+
+            wvalue(const wvalue& r):
+              returnable("application/json")
+            {
+                t_ = r.t();
+                switch (r.t())
+                {
+                    case type::Null:
+                    case type::False:
+                    case type::True:
+                        return;
+                    case type::Number:
+                        nt = r.nt;
+                        if (nt == num_type::Floating_point || nt == num_type::Double_precision_floating_point)
+                            num.d = r.num.d;
+                        else if (nt == num_type::Signed_integer)
+                            num.si = r.num.si;
+                        else
+                            num.ui = r.num.ui;
+                        return;
+                    case type::String:
+                        s = r.s;
+                        return;
+                    case type::List:
+                        l = std::unique_ptr<list>(new list{});
+                        l->reserve(r.size());
+                        for (auto it = r.l->begin(); it != r.l->end(); ++it)
+                            l->emplace_back(*it);
+                        return;
+                    case type::Object:
+                        o = std::unique_ptr<object>(new object{});
+                        o->insert(r.o->begin(), r.o->end());
+                        return;
+                    case type::Function:
+                        f = r.f;
+                }
+            }
+
+            wvalue(wvalue&& r):
+              returnable("application/json")
+            {
+                *this = std::move(r);
+            }
+
+            wvalue& operator=(wvalue&& r)
+            {
+                t_ = r.t_;
+                nt = r.nt;
+                num = r.num;
+                s = std::move(r.s);
+                l = std::move(r.l);
+                o = std::move(r.o);
+                return *this;
+            }
+
+            /// Used for compatibility, same as \ref reset()
+            void clear()
+            {
+                reset();
+            }
+
+            void reset()
+            {
+                t_ = type::Null;
+                l.reset();
+                o.reset();
+            }
+
+            wvalue& operator=(std::nullptr_t)
+            {
+                reset();
+                return *this;
+            }
+            wvalue& operator=(bool value)
+            {
+                reset();
+                if (value)
+                    t_ = type::True;
+                else
+                    t_ = type::False;
+                return *this;
+            }
+
+            wvalue& operator=(float value)
+            {
+                reset();
+                t_ = type::Number;
+                num.d = value;
+                nt = num_type::Floating_point;
+                return *this;
+            }
+
+            wvalue& operator=(double value)
+            {
+                reset();
+                t_ = type::Number;
+                num.d = value;
+                nt = num_type::Double_precision_floating_point;
+                return *this;
+            }
+
+            wvalue& operator=(unsigned short value)
+            {
+                reset();
+                t_ = type::Number;
+                num.ui = value;
+                nt = num_type::Unsigned_integer;
+                return *this;
+            }
+
+            wvalue& operator=(short value)
+            {
+                reset();
+                t_ = type::Number;
+                num.si = value;
+                nt = num_type::Signed_integer;
+                return *this;
+            }
+
+            wvalue& operator=(long long value)
+            {
+                reset();
+                t_ = type::Number;
+                num.si = value;
+                nt = num_type::Signed_integer;
+                return *this;
+            }
+
+            wvalue& operator=(long value)
+            {
+                reset();
+                t_ = type::Number;
+                num.si = value;
+                nt = num_type::Signed_integer;
+                return *this;
+            }
+
+            wvalue& operator=(int value)
+            {
+                reset();
+                t_ = type::Number;
+                num.si = value;
+                nt = num_type::Signed_integer;
+                return *this;
+            }
+
+            wvalue& operator=(unsigned long long value)
+            {
+                reset();
+                t_ = type::Number;
+                num.ui = value;
+                nt = num_type::Unsigned_integer;
+                return *this;
+            }
+
+            wvalue& operator=(unsigned long value)
+            {
+                reset();
+                t_ = type::Number;
+                num.ui = value;
+                nt = num_type::Unsigned_integer;
+                return *this;
+            }
+
+            wvalue& operator=(unsigned int value)
+            {
+                reset();
+                t_ = type::Number;
+                num.ui = value;
+                nt = num_type::Unsigned_integer;
+                return *this;
+            }
+
+            wvalue& operator=(const char* str)
+            {
+                reset();
+                t_ = type::String;
+                s = str;
+                return *this;
+            }
+
+            wvalue& operator=(const std::string& str)
+            {
+                reset();
+                t_ = type::String;
+                s = str;
+                return *this;
+            }
+
+            wvalue& operator=(list&& v)
+            {
+                if (t_ != type::List)
+                    reset();
+                t_ = type::List;
+                if (!l)
+                    l = std::unique_ptr<list>(new list{});
+                l->clear();
+                l->resize(v.size());
+                size_t idx = 0;
+                for (auto& x : v)
+                {
+                    (*l)[idx++] = std::move(x);
+                }
+                return *this;
+            }
+
+            template<typename T>
+            wvalue& operator=(const std::vector<T>& v)
+            {
+                if (t_ != type::List)
+                    reset();
+                t_ = type::List;
+                if (!l)
+                    l = std::unique_ptr<list>(new list{});
+                l->clear();
+                l->resize(v.size());
+                size_t idx = 0;
+                for (auto& x : v)
+                {
+                    (*l)[idx++] = x;
+                }
+                return *this;
+            }
+
+            wvalue& operator=(std::initializer_list<std::pair<std::string const, wvalue>> initializer_list)
+            {
+                if (t_ != type::Object)
+                {
+                    reset();
+                    t_ = type::Object;
+                    o = std::unique_ptr<object>(new object(initializer_list));
+                }
+                else
+                {
+#if defined(__APPLE__) || defined(__MACH__) || defined(__FreeBSD__) || defined(__ANDROID__) || defined(_LIBCPP_VERSION)
+                    o = std::unique_ptr<object>(new object(initializer_list));
+#else
+                    (*o) = initializer_list;
+#endif
+                }
+                return *this;
+            }
+
+            wvalue& operator=(object const& value)
+            {
+                if (t_ != type::Object)
+                {
+                    reset();
+                    t_ = type::Object;
+                    o = std::unique_ptr<object>(new object(value));
+                }
+                else
+                {
+#if defined(__APPLE__) || defined(__MACH__) || defined(__FreeBSD__) || defined(__ANDROID__) || defined(_LIBCPP_VERSION)
+                    o = std::unique_ptr<object>(new object(value));
+#else
+                    (*o) = value;
+#endif
+                }
+                return *this;
+            }
+
+            wvalue& operator=(object&& value)
+            {
+                if (t_ != type::Object)
+                {
+                    reset();
+                    t_ = type::Object;
+                    o = std::unique_ptr<object>(new object(std::move(value)));
+                }
+                else
+                {
+                    (*o) = std::move(value);
+                }
+                return *this;
+            }
+
+            wvalue& operator=(std::function<std::string(std::string&)>&& func)
+            {
+                reset();
+                t_ = type::Function;
+                f = std::move(func);
+                return *this;
+            }
+
+            wvalue& operator[](unsigned index)
+            {
+                if (t_ != type::List)
+                    reset();
+                t_ = type::List;
+                if (!l)
+                    l = std::unique_ptr<list>(new list{});
+                if (l->size() < index + 1)
+                    l->resize(index + 1);
+                return (*l)[index];
+            }
+
+            const wvalue& operator[](unsigned index) const
+            {
+                return const_cast<wvalue*>(this)->operator[](index);
+            }
+
+            int count(const std::string& str) const
+            {
+                if (t_ != type::Object)
+                    return 0;
+                if (!o)
+                    return 0;
+                return o->count(str);
+            }
+
+            wvalue& operator[](const std::string& str)
+            {
+                if (t_ != type::Object)
                     reset();
                 t_ = type::Object;
                 if (!o)
@@ -7370,1053 +9129,4013 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                 return (*o)[str];
             }
 
-            const wvalue& operator[](const std::string& str) const
+            const wvalue& operator[](const std::string& str) const
+            {
+                return const_cast<wvalue*>(this)->operator[](str);
+            }
+
+            std::vector<std::string> keys() const
+            {
+                if (t_ != type::Object)
+                    return {};
+                std::vector<std::string> result;
+                for (auto& kv : *o)
+                {
+                    result.push_back(kv.first);
+                }
+                return result;
+            }
+
+            std::string execute(std::string txt = "") const //Not using reference because it cannot be used with a default rvalue
+            {
+                if (t_ != type::Function)
+                    return "";
+                return f(txt);
+            }
+
+            /// If the wvalue is a list, it returns the length of the list, otherwise it returns 1.
+            std::size_t size() const
+            {
+                if (t_ != type::List)
+                    return 1;
+                return l->size();
+            }
+
+            /// Returns an estimated size of the value in bytes.
+            size_t estimate_length() const
+            {
+                switch (t_)
+                {
+                    case type::Null: return 4;
+                    case type::False: return 5;
+                    case type::True: return 4;
+                    case type::Number: return 30;
+                    case type::String: return 2 + s.size() + s.size() / 2;
+                    case type::List:
+                    {
+                        size_t sum{};
+                        if (l)
+                        {
+                            for (auto& x : *l)
+                            {
+                                sum += 1;
+                                sum += x.estimate_length();
+                            }
+                        }
+                        return sum + 2;
+                    }
+                    case type::Object:
+                    {
+                        size_t sum{};
+                        if (o)
+                        {
+                            for (auto& kv : *o)
+                            {
+                                sum += 2;
+                                sum += 2 + kv.first.size() + kv.first.size() / 2;
+                                sum += kv.second.estimate_length();
+                            }
+                        }
+                        return sum + 2;
+                    }
+                    case type::Function:
+                        return 0;
+                }
+                return 1;
+            }
+
+        private:
+            inline void dump_string(const std::string& str, std::string& out) const
+            {
+                out.push_back('"');
+                escape(str, out);
+                out.push_back('"');
+            }
+
+            inline void dump_indentation_part(std::string& out, const int indent, const char separator, const int indent_level) const
+            {
+                out.push_back('\n');
+                out.append(indent_level * indent, separator);
+            }
+
+
+            inline void dump_internal(const wvalue& v, std::string& out, const int indent, const char separator, const int indent_level = 0) const
+            {
+                switch (v.t_)
+                {
+                    case type::Null: out += "null"; break;
+                    case type::False: out += "false"; break;
+                    case type::True: out += "true"; break;
+                    case type::Number:
+                    {
+                        if (v.nt == num_type::Floating_point || v.nt == num_type::Double_precision_floating_point)
+                        {
+                            if (isnan(v.num.d) || isinf(v.num.d))
+                            {
+                                out += "null";
+                                CROW_LOG_WARNING << "Invalid JSON value detected (" << v.num.d << "), value set to null";
+                                break;
+                            }
+                            enum
+                            {
+                                start,
+                                decp, // Decimal point
+                                zero
+                            } f_state;
+                            char outbuf[128];
+                            if (v.nt == num_type::Double_precision_floating_point)
+                            {
+#ifdef _MSC_VER
+                                sprintf_s(outbuf, sizeof(outbuf), "%.*g", DECIMAL_DIG, v.num.d);
+#else
+                                snprintf(outbuf, sizeof(outbuf), "%.*g", DECIMAL_DIG, v.num.d);
+#endif
+                            }
+                            else
+                            {
+#ifdef _MSC_VER
+                                sprintf_s(outbuf, sizeof(outbuf), "%f", v.num.d);
+#else
+                                snprintf(outbuf, sizeof(outbuf), "%f", v.num.d);
+#endif
+                            }
+                            char* p = &outbuf[0];
+                            char* pos_first_trailing_0 = nullptr;
+                            f_state = start;
+                            while (*p != '\0')
+                            {
+                                //std::cout << *p << std::endl;
+                                char ch = *p;
+                                switch (f_state)
+                                {
+                                    case start: // Loop and lookahead until a decimal point is found
+                                        if (ch == '.')
+                                        {
+                                            char fch = *(p + 1);
+                                            // if the first character is 0, leave it be (this is so that "1.00000" becomes "1.0" and not "1.")
+                                            if (fch != '\0' && fch == '0') p++;
+                                            f_state = decp;
+                                        }
+                                        p++;
+                                        break;
+                                    case decp: // Loop until a 0 is found, if found, record its position
+                                        if (ch == '0')
+                                        {
+                                            f_state = zero;
+                                            pos_first_trailing_0 = p;
+                                        }
+                                        p++;
+                                        break;
+                                    case zero: // if a non 0 is found (e.g. 1.00004) remove the earlier recorded 0 position and look for more trailing 0s
+                                        if (ch != '0')
+                                        {
+                                            pos_first_trailing_0 = nullptr;
+                                            f_state = decp;
+                                        }
+                                        p++;
+                                        break;
+                                }
+                            }
+                            if (pos_first_trailing_0 != nullptr) // if any trailing 0s are found, terminate the string where they begin
+                                *pos_first_trailing_0 = '\0';
+                            out += outbuf;
+                        }
+                        else if (v.nt == num_type::Signed_integer)
+                        {
+                            out += std::to_string(v.num.si);
+                        }
+                        else
+                        {
+                            out += std::to_string(v.num.ui);
+                        }
+                    }
+                    break;
+                    case type::String: dump_string(v.s, out); break;
+                    case type::List:
+                    {
+                        out.push_back('[');
+
+                        if (indent >= 0)
+                        {
+                            dump_indentation_part(out, indent, separator, indent_level + 1);
+                        }
+
+                        if (v.l)
+                        {
+                            bool first = true;
+                            for (auto& x : *v.l)
+                            {
+                                if (!first)
+                                {
+                                    out.push_back(',');
+
+                                    if (indent >= 0)
+                                    {
+                                        dump_indentation_part(out, indent, separator, indent_level + 1);
+                                    }
+                                }
+                                first = false;
+                                dump_internal(x, out, indent, separator, indent_level + 1);
+                            }
+                        }
+
+                        if (indent >= 0)
+                        {
+                            dump_indentation_part(out, indent, separator, indent_level);
+                        }
+
+                        out.push_back(']');
+                    }
+                    break;
+                    case type::Object:
+                    {
+                        out.push_back('{');
+
+                        if (indent >= 0)
+                        {
+                            dump_indentation_part(out, indent, separator, indent_level + 1);
+                        }
+
+                        if (v.o)
+                        {
+                            bool first = true;
+                            for (auto& kv : *v.o)
+                            {
+                                if (!first)
+                                {
+                                    out.push_back(',');
+                                    if (indent >= 0)
+                                    {
+                                        dump_indentation_part(out, indent, separator, indent_level + 1);
+                                    }
+                                }
+                                first = false;
+                                dump_string(kv.first, out);
+                                out.push_back(':');
+
+                                if (indent >= 0)
+                                {
+                                    out.push_back(' ');
+                                }
+
+                                dump_internal(kv.second, out, indent, separator, indent_level + 1);
+                            }
+                        }
+
+                        if (indent >= 0)
+                        {
+                            dump_indentation_part(out, indent, separator, indent_level);
+                        }
+
+                        out.push_back('}');
+                    }
+                    break;
+
+                    case type::Function:
+                        out += "custom function";
+                        break;
+                }
+            }
+
+        public:
+            std::string dump(const int indent, const char separator = ' ') const
+            {
+                std::string ret;
+                ret.reserve(estimate_length());
+                dump_internal(*this, ret, indent, separator);
+                return ret;
+            }
+
+            std::string dump() const override
+            {
+                static constexpr int DontIndent = -1;
+
+                return dump(DontIndent);
+            }
+        };
+
+        // Used for accessing the internals of a wvalue
+        struct wvalue_reader
+        {
+            int64_t get(int64_t fallback)
+            {
+                if (ref.t() != type::Number || ref.nt == num_type::Floating_point ||
+                    ref.nt == num_type::Double_precision_floating_point)
+                    return fallback;
+                return ref.num.si;
+            }
+
+            double get(double fallback)
+            {
+                if (ref.t() != type::Number || ref.nt != num_type::Floating_point ||
+                    ref.nt == num_type::Double_precision_floating_point)
+                    return fallback;
+                return ref.num.d;
+            }
+
+            bool get(bool fallback)
+            {
+                if (ref.t() == type::True) return true;
+                if (ref.t() == type::False) return false;
+                return fallback;
+            }
+
+            std::string get(const std::string& fallback)
+            {
+                if (ref.t() != type::String) return fallback;
+                return ref.s;
+            }
+
+            const wvalue& ref;
+        };
+
+        /// Forward-only JSON writer.
+
+        ///
+        /// Unlike wvalue it doesn't build a tree: every call appends to the output string straight away
+        /// (typically `res.body`), so a response is serialized in one pass without a node allocation per value.
+        /// Commas and colons are inserted automatically, the caller is responsible for the nesting being correct.<br>
+        /// Numbers are formatted with std::to_chars and strings are escaped 16 or 32 bytes at a time.
+        /// With a flush callback the output is handed over whenever it grows past a threshold,
+        /// which lets the writer feed a chunked stream instead of building the whole document.
+        class writer
+        {
+        public:
+            using flush_handler = std::function<void(std::string&)>;
+
+            explicit writer(std::string& out):
+              out_(out)
+            {}
+
+            /// `flush` is called with the pending output once it reaches `threshold` bytes and must consume (clear) it.
+            writer(std::string& out, flush_handler flush, size_t threshold = 16 * 1024):
+              out_(out), flush_(std::move(flush)), threshold_(threshold)
+            {}
+
+            writer& begin_object()
+            {
+                separate();
+                out_ += '{';
+                open_.push_back(false);
+                return *this;
+            }
+
+            writer& end_object()
+            {
+                out_ += '}';
+                return close();
+            }
+
+            writer& begin_list()
+            {
+                separate();
+                out_ += '[';
+                open_.push_back(false);
+                return *this;
+            }
+
+            writer& end_list()
+            {
+                out_ += ']';
+                return close();
+            }
+
+            /// Start an object member, the next call writes its value.
+            writer& key(std::string_view name)
+            {
+                separate();
+                string(name);
+                out_ += ':';
+                after_key_ = true;
+                return *this;
+            }
+
+            writer& value(std::nullptr_t)
+            {
+                separate();
+                out_ += "null";
+                return done();
+            }
+
+            writer& value(bool b)
+            {
+                separate();
+                out_ += b ? "true" : "false";
+                return done();
+            }
+
+            template<typename T>
+            typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, writer&>::type value(T n)
+            {
+                separate();
+                char buf[24];
+                auto result = std::to_chars(buf, buf + sizeof(buf), n);
+                out_.append(buf, result.ptr);
+                return done();
+            }
+
+            /// Shortest representation that reads back as the same double. NaN and infinity become null like in wvalue.
+            writer& value(double d)
+            {
+                separate();
+                if (isnan(d) || isinf(d))
+                    out_ += "null";
+                else
+                {
+                    char buf[32];
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+                    auto result = std::to_chars(buf, buf + sizeof(buf), d);
+                    out_.append(buf, result.ptr);
+#else
+                    int n = snprintf(buf, sizeof(buf), "%.17g", d);
+                    out_.append(buf, n);
+#endif
+                }
+                return done();
+            }
+
+            writer& value(std::string_view s)
+            {
+                separate();
+                string(s);
+                return done();
+            }
+
+            writer& value(const char* s)
+            {
+                return value(std::string_view(s));
+            }
+
+            writer& value(const std::string& s)
+            {
+                return value(std::string_view(s));
+            }
+
+            writer& value(const wvalue& v)
+            {
+                return raw(v.dump());
+            }
+
+            /// Write an already serialized JSON value as is.
+            writer& raw(std::string_view json)
+            {
+                separate();
+                out_.append(json.data(), json.size());
+                return done();
+            }
+
+            template<typename T>
+            writer& member(std::string_view name, T&& v)
+            {
+                key(name);
+                return value(std::forward<T>(v));
+            }
+
+            /// Hand the pending output to the flush callback, if there is one.
+            void flush()
+            {
+                if (flush_ && !out_.empty())
+                    flush_(out_);
+            }
+
+            /// Number of objects and lists that are still open.
+            size_t depth() const
+            {
+                return open_.size();
+            }
+
+        private:
+            /// Write the comma between two members or elements.
+            void separate()
+            {
+                if (after_key_)
+                {
+                    after_key_ = false;
+                    return;
+                }
+                if (!open_.empty())
+                {
+                    if (open_.back())
+                        out_ += ',';
+                    open_.back() = true;
+                }
+            }
+
+            void string(std::string_view s)
+            {
+                out_ += '"';
+                detail::escape_into(s, out_);
+                out_ += '"';
+            }
+
+            writer& close()
+            {
+                open_.pop_back();
+                return done();
+            }
+
+            writer& done()
+            {
+                if (flush_ && out_.size() >= threshold_)
+                    flush_(out_);
+                return *this;
+            }
+
+            std::string& out_;
+            flush_handler flush_;
+            size_t threshold_ = 0;
+            /// One entry per open object or list, true once it has a member.
+            std::vector<bool> open_;
+            bool after_key_ = false;
+        };
+
+        //std::vector<asio::const_buffer> dump_ref(wvalue& v)
+        //{
+        //}
+    } // namespace json
+} // namespace crow
+
+#include <string>
+#include <unordered_map>
+#include <ios>
+#include <fstream>
+#include <sstream>
+// S_ISREG is not defined for windows
+// This defines it like suggested in https://stackoverflow.com/a/62371749
+#if defined(_MSC_VER)
+#define _CRT_INTERNAL_NONSTDC_NAMES 1
+#endif
+#include <sys/stat.h>
+#if !defined(S_ISREG) && defined(S_IFMT) && defined(S_IFREG)
+#define S_ISREG(m) (((m) & S_IFMT) == S_IFREG)
+#endif
+
+
+
+namespace crow
+{
+    template<typename Adaptor, typename Handler, typename... Middlewares>
+    class Connection;
+
+    namespace http2
+    {
+        template<typename Adaptor, typename Handler, typename... Middlewares>
+        class session;
+    }
+
+    class Router;
+
+    /// HTTP response
+    struct response
+    {
+        template<typename Adaptor, typename Handler, typename... Middlewares>
+        friend class crow::Connection;
+
+        template<typename Adaptor, typename Handler, typename... Middlewares>
+        friend class crow::http2::session;
+
+        friend class Router;
+
+        int code{200};    ///< The Status code for the response.
+        std::string body; ///< The actual payload containing the response data.
+        ci_map headers;   ///< HTTP headers.
+
+#ifdef CROW_ENABLE_COMPRESSION
+        bool compressed = true; ///< If compression is enabled and this is false, the individual response will not be compressed.
+#endif
+        bool skip_body = false;            ///< Whether this is a response to a HEAD request.
+        bool manual_length_header = false; ///< Whether Crow should automatically add a "Content-Length" header.
+        /// Headers formatted ahead of time as "Name: value\r\n" lines, sent after `headers` without copying. The string
+        /// has to outlive the response, e.g. be built once at startup. Names have to be lowercase for HTTP/2.
+        const std::string* header_block = nullptr;
+
+        /// Set the value of an existing header in the response.
+        void set_header(std::string key, std::string value)
+        {
+            headers.erase(key);
+            headers.emplace(std::move(key), std::move(value));
+        }
+
+        /// Add a new header to the response.
+        void add_header(std::string key, std::string value)
+        {
+            headers.emplace(std::move(key), std::move(value));
+        }
+
+        const std::string& get_header_value(const std::string& key)
+        {
+            return crow::get_header_value(headers, key);
+        }
+
+        // naive validation of a mime-type string
+        static bool validate_mime_type(const std::string& candidate) noexcept
+        {
+            // Here we simply check that the candidate type starts with
+            // a valid parent type, and has at least one character afterwards.
+            std::array<std::string, 10> valid_parent_types = {
+              "application/", "audio/", "font/", "example/",
+              "image/", "message/", "model/", "multipart/",
+              "text/", "video/"};
+            for (const std::string& parent : valid_parent_types)
+            {
+                // ensure the candidate is *longer* than the parent,
+                // to avoid unnecessary string comparison and to
+                // reject zero-length subtypes.
+                if (candidate.size() <= parent.size())
+                {
+                    continue;
+                }
+                // strncmp is used rather than substr to avoid allocation,
+                // but a string_view approach would be better if Crow
+                // migrates to C++17.
+                if (strncmp(parent.c_str(), candidate.c_str(), parent.size()) == 0)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Find the mime type from the content type either by lookup,
+        // or by the content type itself, if it is a valid a mime type.
+        // Defaults to text/plain.
+        static std::string get_mime_type(const std::string& contentType)
+        {
+            const auto mimeTypeIterator = mime_types.find(contentType);
+            if (mimeTypeIterator != mime_types.end())
+            {
+                return mimeTypeIterator->second;
+            }
+            else if (validate_mime_type(contentType))
+            {
+                return contentType;
+            }
+            else
+            {
+                CROW_LOG_WARNING << "Unable to interpret mime type for content type '" << contentType << "'. Defaulting to text/plain.";
+                return "text/plain";
+            }
+        }
+
+
+        // clang-format off
+        response() {}
+        explicit response(int code_) : code(code_) {}
+        response(std::string body_) : body(std::move(body_)) {}
+        response(int code_, std::string body_) : code(code_), body(std::move(body_)) {}
+        // clang-format on
+        response(returnable&& value)
+        {
+            body = value.dump();
+            set_header("Content-Type", value.content_type);
+        }
+        response(returnable& value)
+        {
+            body = value.dump();
+            set_header("Content-Type", value.content_type);
+        }
+        response(int code_, returnable& value):
+          code(code_)
+        {
+            body = value.dump();
+            set_header("Content-Type", value.content_type);
+        }
+        response(int code_, returnable&& value):
+          code(code_), body(value.dump())
+        {
+            set_header("Content-Type", std::move(value.content_type));
+        }
+
+        response(response&& r)
+        {
+            *this = std::move(r);
+        }
+
+        response(std::string contentType, std::string body_):
+          body(std::move(body_))
+        {
+            set_header("Content-Type", get_mime_type(contentType));
+        }
+
+        response(int code_, std::string contentType, std::string body_):
+          code(code_), body(std::move(body_))
+        {
+            set_header("Content-Type", get_mime_type(contentType));
+        }
+
+        response& operator=(const response& r) = delete;
+
+        response& operator=(response&& r) noexcept
+        {
+            body = std::move(r.body);
+            code = r.code;
+            headers = std::move(r.headers);
+            header_block = r.header_block;
+            completed_ = r.completed_;
+            file_info = std::move(r.file_info);
+            return *this;
+        }
+
+        /// Check if the response has completed (whether response.end() has been called)
+        bool is_completed() const noexcept
+        {
+            return completed_;
+        }
+
+        void clear()
+        {
+            body.clear();
+            code = 200;
+            headers.clear();
+            header_block = nullptr;
+            completed_ = false;
+            manual_length_header = false;
+            skip_body = false;
+            file_info = static_file_info{};
+        }
+
+        /// Return a "Temporary Redirect" response.
+
+        ///
+        /// Location can either be a route or a full URL.
+        void redirect(const std::string& location)
+        {
+            code = 307;
+            set_header("Location", location);
+        }
+
+        /// Return a "Permanent Redirect" response.
+
+        ///
+        /// Location can either be a route or a full URL.
+        void redirect_perm(const std::string& location)
+        {
+            code = 308;
+            set_header("Location", location);
+        }
+
+        /// Return a "Found (Moved Temporarily)" response.
+
+        ///
+        /// Location can either be a route or a full URL.
+        void moved(const std::string& location)
+        {
+            code = 302;
+            set_header("Location", location);
+        }
+
+        /// Return a "Moved Permanently" response.
+
+        ///
+        /// Location can either be a route or a full URL.
+        void moved_perm(const std::string& location)
+        {
+            code = 301;
+            set_header("Location", location);
+        }
+
+        void write(const std::string& body_part)
+        {
+            body += body_part;
+        }
+
+        /// Set the response completion flag and call the handler (to send the response).
+        void end()
+        {
+            if (!completed_)
+            {
+                completed_ = true;
+                if (skip_body)
+                {
+                    set_header("Content-Length", std::to_string(body.size()));
+                    body = "";
+                    manual_length_header = true;
+                }
+                // Nothing is touched after the handler, it may hand the response to another thread (see http2::session).
+                // clear() resets the flags for the next request.
+                if (complete_request_handler_)
+                    complete_request_handler_();
+            }
+        }
+
+        /// Same as end() except it adds a body part right before ending.
+        void end(const std::string& body_part)
+        {
+            body += body_part;
+            end();
+        }
+
+        /// Check if the connection is still alive (usually by checking the socket status).
+        bool is_alive()
+        {
+            return is_alive_helper_ && is_alive_helper_();
+        }
+
+        /// Check whether the response has a static file defined.
+        bool is_static_type()
+        {
+            return file_info.path.size();
+        }
+
+        /// This constains metadata (coming from the `stat` command) related to any static files associated with this response.
+
+        ///
+        /// Either a static file or a string body can be returned as 1 response.
+        struct static_file_info
+        {
+            std::string path = "";
+            struct stat statbuf;
+            int statResult;
+        };
+
+        /// Return a static file as the response body
+        void set_static_file_info(std::string path)
+        {
+            utility::sanitize_filename(path);
+            set_static_file_info_unsafe(path);
+        }
+
+        /// Return a static file as the response body without sanitizing the path (use set_static_file_info instead)
+        void set_static_file_info_unsafe(std::string path)
+        {
+            file_info.path = path;
+            file_info.statResult = stat(file_info.path.c_str(), &file_info.statbuf);
+#ifdef CROW_ENABLE_COMPRESSION
+            compressed = false;
+#endif
+            if (file_info.statResult == 0 && S_ISREG(file_info.statbuf.st_mode))
+            {
+                std::size_t last_dot = path.find_last_of('.');
+                std::string extension = path.substr(last_dot + 1);
+                code = 200;
+                this->add_header("Content-Length", std::to_string(file_info.statbuf.st_size));
+
+                if (!extension.empty())
+                {
+                    this->add_header("Content-Type", get_mime_type(extension));
+                }
+            }
+            else
+            {
+                code = 404;
+                file_info.path.clear();
+            }
+        }
+
+    private:
+        bool completed_{};
+        std::function<void()> complete_request_handler_;
+        std::function<bool()> is_alive_helper_;
+        static_file_info file_info;
+    };
+} // namespace crow
+
+
+
+#include <tuple>
+#include <type_traits>
+#include <iostream>
+#include <utility>
+
+namespace crow // NOTE: Already documented in "crow/app.h"
+{
+
+    /// Local middleware should extend ILocalMiddleware
+    struct ILocalMiddleware
+    {
+        using call_global = std::false_type;
+    };
+
+    namespace detail
+    {
+        template<typename MW>
+        struct check_before_handle_arity_3_const
+        {
+            template<typename T, void (T::*)(request&, response&, typename MW::context&) const = &T::before_handle>
+            struct get
+            {};
+        };
+
+        template<typename MW>
+        struct check_before_handle_arity_3
+        {
+            template<typename T, void (T::*)(request&, response&, typename MW::context&) = &T::before_handle>
+            struct get
+            {};
+        };
+
+        template<typename MW>
+        struct check_after_handle_arity_3_const
+        {
+            template<typename T, void (T::*)(request&, response&, typename MW::context&) const = &T::after_handle>
+            struct get
+            {};
+        };
+
+        template<typename MW>
+        struct check_after_handle_arity_3
+        {
+            template<typename T, void (T::*)(request&, response&, typename MW::context&) = &T::after_handle>
+            struct get
+            {};
+        };
+
+        template<typename MW>
+        struct check_global_call_false
+        {
+            template<typename T, typename std::enable_if<T::call_global::value == false, bool>::type = true>
+            struct get
+            {};
+        };
+
+        template<typename T>
+        struct is_before_handle_arity_3_impl
+        {
+            template<typename C>
+            static std::true_type f(typename check_before_handle_arity_3_const<T>::template get<C>*);
+
+            template<typename C>
+            static std::true_type f(typename check_before_handle_arity_3<T>::template get<C>*);
+
+            template<typename C>
+            static std::false_type f(...);
+
+        public:
+            static const bool value = decltype(f<T>(nullptr))::value;
+        };
+
+        template<typename T>
+        struct is_after_handle_arity_3_impl
+        {
+            template<typename C>
+            static std::true_type f(typename check_after_handle_arity_3_const<T>::template get<C>*);
+
+            template<typename C>
+            static std::true_type f(typename check_after_handle_arity_3<T>::template get<C>*);
+
+            template<typename C>
+            static std::false_type f(...);
+
+        public:
+            static constexpr bool value = decltype(f<T>(nullptr))::value;
+        };
+
+        template<typename MW>
+        struct is_middleware_global
+        {
+            template<typename C>
+            static std::false_type f(typename check_global_call_false<MW>::template get<C>*);
+
+            template<typename C>
+            static std::true_type f(...);
+
+            static const bool value = decltype(f<MW>(nullptr))::value;
+        };
+
+        template<typename MW, typename Context, typename ParentContext>
+        typename std::enable_if<!is_before_handle_arity_3_impl<MW>::value>::type
+          before_handler_call(MW& mw, request& req, response& res, Context& ctx, ParentContext& /*parent_ctx*/)
+        {
+            mw.before_handle(req, res, ctx.template get<MW>(), ctx);
+        }
+
+        template<typename MW, typename Context, typename ParentContext>
+        typename std::enable_if<is_before_handle_arity_3_impl<MW>::value>::type
+          before_handler_call(MW& mw, request& req, response& res, Context& ctx, ParentContext& /*parent_ctx*/)
+        {
+            mw.before_handle(req, res, ctx.template get<MW>());
+        }
+
+        template<typename MW, typename Context, typename ParentContext>
+        typename std::enable_if<!is_after_handle_arity_3_impl<MW>::value>::type
+          after_handler_call(MW& mw, request& req, response& res, Context& ctx, ParentContext& /*parent_ctx*/)
+        {
+            mw.after_handle(req, res, ctx.template get<MW>(), ctx);
+        }
+
+        template<typename MW, typename Context, typename ParentContext>
+        typename std::enable_if<is_after_handle_arity_3_impl<MW>::value>::type
+          after_handler_call(MW& mw, request& req, response& res, Context& ctx, ParentContext& /*parent_ctx*/)
+        {
+            mw.after_handle(req, res, ctx.template get<MW>());
+        }
+
+
+        template<typename CallCriteria,
+                 int N, typename Context, typename Container>
+        typename std::enable_if<(N < std::tuple_size<typename std::remove_reference<Container>::type>::value), bool>::type
+          middleware_call_helper(const CallCriteria& cc, Container& middlewares, request& req, response& res, Context& ctx)
+        {
+
+            using CurrentMW = typename std::tuple_element<N, typename std::remove_reference<Container>::type>::type;
+
+            if (!cc.template enabled<CurrentMW>(N))
+            {
+                return middleware_call_helper<CallCriteria, N + 1, Context, Container>(cc, middlewares, req, res, ctx);
+            }
+
+            using parent_context_t = typename Context::template partial<N - 1>;
+            before_handler_call<CurrentMW, Context, parent_context_t>(std::get<N>(middlewares), req, res, ctx, static_cast<parent_context_t&>(ctx));
+            if (res.is_completed())
+            {
+                after_handler_call<CurrentMW, Context, parent_context_t>(std::get<N>(middlewares), req, res, ctx, static_cast<parent_context_t&>(ctx));
+                return true;
+            }
+
+            if (middleware_call_helper<CallCriteria, N + 1, Context, Container>(cc, middlewares, req, res, ctx))
+            {
+                after_handler_call<CurrentMW, Context, parent_context_t>(std::get<N>(middlewares), req, res, ctx, static_cast<parent_context_t&>(ctx));
+                return true;
+            }
+
+            return false;
+        }
+
+        template<typename CallCriteria, int N, typename Context, typename Container>
+        typename std::enable_if<(N >= std::tuple_size<typename std::remove_reference<Container>::type>::value), bool>::type
+          middleware_call_helper(const CallCriteria& /*cc*/, Container& /*middlewares*/, request& /*req*/, response& /*res*/, Context& /*ctx*/)
+        {
+            return false;
+        }
+
+        template<typename CallCriteria, int N, typename Context, typename Container>
+        typename std::enable_if<(N < 0)>::type
+          after_handlers_call_helper(const CallCriteria& /*cc*/, Container& /*middlewares*/, Context& /*context*/, request& /*req*/, response& /*res*/)
+        {
+        }
+
+        template<typename CallCriteria, int N, typename Context, typename Container>
+        typename std::enable_if<(N == 0)>::type after_handlers_call_helper(const CallCriteria& cc, Container& middlewares, Context& ctx, request& req, response& res)
+        {
+            using parent_context_t = typename Context::template partial<N - 1>;
+            using CurrentMW = typename std::tuple_element<N, typename std::remove_reference<Container>::type>::type;
+            if (cc.template enabled<CurrentMW>(N))
+            {
+                after_handler_call<CurrentMW, Context, parent_context_t>(std::get<N>(middlewares), req, res, ctx, static_cast<parent_context_t&>(ctx));
+            }
+        }
+
+        template<typename CallCriteria, int N, typename Context, typename Container>
+        typename std::enable_if<(N > 0)>::type after_handlers_call_helper(const CallCriteria& cc, Container& middlewares, Context& ctx, request& req, response& res)
+        {
+            using parent_context_t = typename Context::template partial<N - 1>;
+            using CurrentMW = typename std::tuple_element<N, typename std::remove_reference<Container>::type>::type;
+            if (cc.template enabled<CurrentMW>(N))
+            {
+                after_handler_call<CurrentMW, Context, parent_context_t>(std::get<N>(middlewares), req, res, ctx, static_cast<parent_context_t&>(ctx));
+            }
+            after_handlers_call_helper<CallCriteria, N - 1, Context, Container>(cc, middlewares, ctx, req, res);
+        }
+
+        // A CallCriteria that accepts only global middleware
+        struct middleware_call_criteria_only_global
+        {
+            template<typename MW>
+            constexpr bool enabled(int) const
+            {
+                return is_middleware_global<MW>::value;
+            }
+        };
+
+        template<typename F, typename... Args>
+        typename std::enable_if<black_magic::CallHelper<F, black_magic::S<Args...>>::value, void>::type
+          wrapped_handler_call(crow::request& /*req*/, crow::response& res, const F& f, Args&&... args)
+        {
+            static_assert(!std::is_same<void, decltype(f(std::declval<Args>()...))>::value,
+                          "Handler function cannot have void return type; valid return types: string, int, crow::response, crow::returnable");
+
+            res = crow::response(f(std::forward<Args>(args)...));
+            res.end();
+        }
+
+        template<typename F, typename... Args>
+        typename std::enable_if<
+          !black_magic::CallHelper<F, black_magic::S<Args...>>::value &&
+            black_magic::CallHelper<F, black_magic::S<crow::request&, Args...>>::value,
+          void>::type
+          wrapped_handler_call(crow::request& req, crow::response& res, const F& f, Args&&... args)
+        {
+            static_assert(!std::is_same<void, decltype(f(std::declval<crow::request>(), std::declval<Args>()...))>::value,
+                          "Handler function cannot have void return type; valid return types: string, int, crow::response, crow::returnable");
+
+            res = crow::response(f(req, std::forward<Args>(args)...));
+            res.end();
+        }
+
+        template<typename F, typename... Args>
+        typename std::enable_if<
+          !black_magic::CallHelper<F, black_magic::S<Args...>>::value &&
+            !black_magic::CallHelper<F, black_magic::S<crow::request&, Args...>>::value &&
+            black_magic::CallHelper<F, black_magic::S<crow::response&, Args...>>::value,
+          void>::type
+          wrapped_handler_call(crow::request& /*req*/, crow::response& res, const F& f, Args&&... args)
+        {
+            static_assert(std::is_same<void, decltype(f(std::declval<crow::response&>(), std::declval<Args>()...))>::value,
+                          "Handler function with response argument should have void return type");
+
+            f(res, std::forward<Args>(args)...);
+        }
+
+        template<typename F, typename... Args>
+        typename std::enable_if<
+          !black_magic::CallHelper<F, black_magic::S<Args...>>::value &&
+            !black_magic::CallHelper<F, black_magic::S<crow::request&, Args...>>::value &&
+            !black_magic::CallHelper<F, black_magic::S<crow::response&, Args...>>::value &&
+            black_magic::CallHelper<F, black_magic::S<const crow::request&, crow::response&, Args...>>::value,
+          void>::type
+          wrapped_handler_call(crow::request& req, crow::response& res, const F& f, Args&&... args)
+        {
+            static_assert(std::is_same<void, decltype(f(std::declval<crow::request&>(), std::declval<crow::response&>(), std::declval<Args>()...))>::value,
+                          "Handler function with response argument should have void return type");
+
+            f(req, res, std::forward<Args>(args)...);
+        }
+
+        // wrapped_handler_call transparently wraps a handler call behind (req, res, args...)
+        template<typename F, typename... Args>
+        typename std::enable_if<
+          !black_magic::CallHelper<F, black_magic::S<Args...>>::value &&
+            !black_magic::CallHelper<F, black_magic::S<crow::request&, Args...>>::value &&
+            !black_magic::CallHelper<F, black_magic::S<crow::response&, Args...>>::value &&
+            !black_magic::CallHelper<F, black_magic::S<const crow::request&, crow::response&, Args...>>::value,
+          void>::type
+          wrapped_handler_call(crow::request& req, crow::response& res, const F& f, Args&&... args)
+        {
+            static_assert(std::is_same<void, decltype(f(std::declval<crow::request&>(), std::declval<crow::response&>(), std::declval<Args>()...))>::value,
+                          "Handler function with response argument should have void return type");
+
+            f(req, res, std::forward<Args>(args)...);
+        }
+
+        template<bool Reversed>
+        struct middleware_call_criteria_dynamic
+        {};
+
+        template<>
+        struct middleware_call_criteria_dynamic<false>
+        {
+            middleware_call_criteria_dynamic(const std::vector<int>& indices_):
+              indices(indices_), slider(0) {}
+
+            template<typename>
+            bool enabled(int mw_index) const
+            {
+                if (slider < int(indices.size()) && indices[slider] == mw_index)
+                {
+                    slider++;
+                    return true;
+                }
+                return false;
+            }
+
+        private:
+            const std::vector<int>& indices;
+            mutable int slider;
+        };
+
+        template<>
+        struct middleware_call_criteria_dynamic<true>
+        {
+            middleware_call_criteria_dynamic(const std::vector<int>& indices_):
+              indices(indices_), slider(int(indices_.size()) - 1) {}
+
+            template<typename>
+            bool enabled(int mw_index) const
+            {
+                if (slider >= 0 && indices[slider] == mw_index)
+                {
+                    slider--;
+                    return true;
+                }
+                return false;
+            }
+
+        private:
+            const std::vector<int>& indices;
+            mutable int slider;
+        };
+
+    } // namespace detail
+} // namespace crow
+
+
+
+namespace crow
+{
+    namespace detail
+    {
+
+
+        template<typename... Middlewares>
+        struct partial_context : public black_magic::pop_back<Middlewares...>::template rebind<partial_context>, public black_magic::last_element_type<Middlewares...>::type::context
+        {
+            using parent_context = typename black_magic::pop_back<Middlewares...>::template rebind<::crow::detail::partial_context>;
+            template<int N>
+            using partial = typename std::conditional<N == sizeof...(Middlewares) - 1, partial_context, typename parent_context::template partial<N>>::type;
+
+            template<typename T>
+            typename T::context& get()
+            {
+                return static_cast<typename T::context&>(*this);
+            }
+        };
+
+
+
+        template<>
+        struct partial_context<>
+        {
+            template<int>
+            using partial = partial_context;
+        };
+
+
+        template<typename... Middlewares>
+        struct context : private partial_context<Middlewares...>
+        //struct context : private Middlewares::context... // simple but less type-safe
+        {
+            template<typename CallCriteria, int N, typename Context, typename Container>
+            friend typename std::enable_if<(N == 0)>::type after_handlers_call_helper(const CallCriteria& cc, Container& middlewares, Context& ctx, request& req, response& res);
+            template<typename CallCriteria, int N, typename Context, typename Container>
+            friend typename std::enable_if<(N > 0)>::type after_handlers_call_helper(const CallCriteria& cc, Container& middlewares, Context& ctx, request& req, response& res);
+
+            template<typename CallCriteria, int N, typename Context, typename Container>
+            friend typename std::enable_if<(N < std::tuple_size<typename std::remove_reference<Container>::type>::value), bool>::type
+              middleware_call_helper(const CallCriteria& cc, Container& middlewares, request& req, response& res, Context& ctx);
+
+            template<typename T>
+            typename T::context& get()
+            {
+                return static_cast<typename T::context&>(*this);
+            }
+
+            template<int N>
+            using partial = typename partial_context<Middlewares...>::template partial<N>;
+        };
+    } // namespace detail
+} // namespace crow
+
+
+#ifdef CROW_USE_BOOST
+#include <boost/asio.hpp>
+#include <boost/asio/basic_waitable_timer.hpp>
+#else
+#ifndef ASIO_STANDALONE
+#define ASIO_STANDALONE
+#endif
+#include <asio.hpp>
+#include <asio/basic_waitable_timer.hpp>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+
+namespace crow
+{
+#ifdef CROW_USE_BOOST
+    namespace asio = boost::asio;
+    using error_code = boost::system::error_code;
+#else
+    using error_code = asio::error_code;
+#endif
+    namespace detail
+    {
+
+        /// A class for scheduling functions to be called after a specific
+        /// amount of ticks. Ther tick length can  be handed over in constructor, 
+        /// the default tick length is equal to 1 second.
+        ///
+        /// Tasks are kept in a hierarchical timing wheel, scheduling and
+        /// cancelling a task are O(1) and don't allocate once the task slab
+        /// has grown to the number of concurrently scheduled tasks.
+        /// The wheel advances in steps of `resolution` (100ms by default, or
+        /// the tick length if that is shorter), tasks run at most one step
+        /// after their timeout.
+        class task_timer
+        {
+        public:
+            using task_type = std::function<void()>;
+            using identifier_type = std::uint64_t;
+
+        private:
+            using clock_type = std::chrono::steady_clock;
+            using time_type = clock_type::time_point;
+
+            static constexpr unsigned slot_bits = 6;
+            static constexpr unsigned slots_per_level = 1u << slot_bits;
+            static constexpr unsigned slot_mask = slots_per_level - 1;
+            static constexpr unsigned levels = 4;
+            /// List of tasks that are due and currently being executed.
+            static constexpr std::uint32_t firing_list = levels * slots_per_level;
+            static constexpr std::uint32_t npos = UINT32_MAX;
+
+            struct node
+            {
+                task_type task;
+                std::uint64_t expiry{0};
+                std::uint32_t prev{npos};
+                std::uint32_t next{npos};
+                std::uint32_t list{npos}; ///< npos while the node is free.
+                std::uint32_t generation{0};
+            };
+
+        public:
+            task_timer(asio::io_context& io_context,
+                       const std::chrono::milliseconds tick_length =
+                            std::chrono::seconds(1),
+                       const std::chrono::milliseconds resolution =
+                            std::chrono::milliseconds(100)) :
+              io_context_(io_context), timer_(io_context_),
+              tick_length_ms_(tick_length),
+              resolution_ms_(std::max(std::chrono::milliseconds(1), std::min(tick_length, resolution))),
+              start_time_(clock_type::now())
             {
-                return const_cast<wvalue*>(this)->operator[](str);
+                std::fill(std::begin(heads_), std::end(heads_), npos);
+                timer_.expires_at(start_time_ + resolution_ms_);
+                timer_.async_wait(
+                  std::bind(&task_timer::tick_handler, this,
+                  std::placeholders::_1));
             }
 
-            std::vector<std::string> keys() const
+            ~task_timer() { timer_.cancel(); }
+
+            /// Cancel the scheduling of the given task 
+            ///
+            /// \param identifier_type task identifier of the task to cancel.
+            /// Unknown identifiers and identifiers of tasks that have already
+            /// been executed or cancelled are ignored.
+            void cancel(identifier_type id)
             {
-                if (t_ != type::Object)
-                    return {};
-                std::vector<std::string> result;
-                for (auto& kv : *o)
+                std::uint32_t index = static_cast<std::uint32_t>(id & UINT32_MAX);
+                if (index == 0 || index > nodes_.size()) return;
+
+                node& n = nodes_[index - 1];
+                if (n.list == npos || n.generation != static_cast<std::uint32_t>(id >> 32)) return;
+
+                unlink(index - 1);
+                release(index - 1);
+            }
+
+            /// Schedule the given task to be executed after the default amount
+            /// of ticks.
+
+            ///
+            /// \return identifier_type Used to cancel the thread.
+            /// It is not bound to this task_timer instance and in some cases
+            /// could lead to undefined behavior if used with other task_timer
+            /// objects.
+            identifier_type schedule(task_type task)
+            {
+                return schedule(std::move(task), get_default_timeout());
+            }
+
+            /// Schedule the given task to be executed after the given time.
+
+            ///
+            /// \param timeout The amount of ticks to wait before execution.
+            ///
+            /// \return identifier_type Used to cancel the thread.
+            /// It is not bound to this task_timer instance and in some cases
+            /// could lead to undefined behavior if used with other task_timer
+            /// objects.
+            identifier_type schedule(task_type task, uint8_t timeout)
+            {
+                std::uint32_t index = acquire();
+                node& n = nodes_[index];
+                n.task = std::move(task);
+
+                // Round up and skip the step in progress, a task never runs before its timeout has passed.
+                auto steps = (timeout * tick_length_ms_ + resolution_ms_ - std::chrono::milliseconds(1)) / resolution_ms_;
+                n.expiry = current_step_ + steps + 1;
+                insert(index);
+
+                return (static_cast<identifier_type>(n.generation) << 32) | (index + 1);
+            }
+
+            /// Set the default timeout for this task_timer instance.
+            /// (Default: 5)
+
+            ///
+            /// \param timeout The amount of ticks to wait before
+            /// execution. 
+            /// For tick length \see tick_length_ms_ 
+            void set_default_timeout(uint8_t timeout) {
+                default_timeout_ = timeout;
+            }
+
+            /// Get the default timeout. (Default: 5)
+            uint8_t get_default_timeout() const {
+                return default_timeout_;
+            }
+
+            /// returns the length of one tick.
+            std::chrono::milliseconds get_tick_length() const {
+                return tick_length_ms_;
+            }
+
+            /// returns the length of one step of the timing wheel.
+            std::chrono::milliseconds get_resolution() const {
+                return resolution_ms_;
+            }
+
+        private:
+            std::uint32_t acquire()
+            {
+                if (free_head_ != npos)
                 {
-                    result.push_back(kv.first);
+                    std::uint32_t index = free_head_;
+                    free_head_ = nodes_[index].next;
+                    return index;
                 }
-                return result;
+                nodes_.emplace_back();
+                return static_cast<std::uint32_t>(nodes_.size() - 1);
             }
 
-            std::string execute(std::string txt = "") const //Not using reference because it cannot be used with a default rvalue
+            void release(std::uint32_t index)
             {
-                if (t_ != type::Function)
-                    return "";
-                return f(txt);
+                node& n = nodes_[index];
+                n.task = nullptr;
+                n.list = npos;
+                n.prev = npos;
+                n.next = free_head_;
+                ++n.generation;
+                free_head_ = index;
             }
 
-            /// If the wvalue is a list, it returns the length of the list, otherwise it returns 1.
-            std::size_t size() const
+            void push(std::uint32_t list, std::uint32_t index)
             {
-                if (t_ != type::List)
-                    return 1;
-                return l->size();
+                node& n = nodes_[index];
+                n.list = list;
+                n.prev = npos;
+                n.next = heads_[list];
+                if (n.next != npos) nodes_[n.next].prev = index;
+                heads_[list] = index;
             }
 
-            /// Returns an estimated size of the value in bytes.
-            size_t estimate_length() const
+            void unlink(std::uint32_t index)
             {
-                switch (t_)
+                node& n = nodes_[index];
+                if (n.prev != npos)
+                    nodes_[n.prev].next = n.next;
+                else
+                    heads_[n.list] = n.next;
+                if (n.next != npos) nodes_[n.next].prev = n.prev;
+            }
+
+            /// Put a node into the lowest level whose range covers its expiry.
+            void insert(std::uint32_t index)
+            {
+                std::uint64_t expiry = std::max(nodes_[index].expiry, current_step_);
+                unsigned level = 0;
+                while (level + 1 < levels &&
+                       (expiry >> (level * slot_bits)) - (current_step_ >> (level * slot_bits)) >= slots_per_level)
+                    ++level;
+
+                // Anything beyond the top level waits in its furthest slot and is re-sorted on the way down.
+                std::uint64_t distance = (expiry >> (level * slot_bits)) - (current_step_ >> (level * slot_bits));
+                if (distance >= slots_per_level)
+                    expiry = ((current_step_ >> (level * slot_bits)) + slot_mask) << (level * slot_bits);
+
+                push(level * slots_per_level + ((expiry >> (level * slot_bits)) & slot_mask), index);
+            }
+
+            /// Move the tasks of a higher level slot down the hierarchy.
+            void cascade(unsigned level)
+            {
+                std::uint32_t list = level * slots_per_level + ((current_step_ >> (level * slot_bits)) & slot_mask);
+                while (heads_[list] != npos)
                 {
-                    case type::Null: return 4;
-                    case type::False: return 5;
-                    case type::True: return 4;
-                    case type::Number: return 30;
-                    case type::String: return 2 + s.size() + s.size() / 2;
-                    case type::List:
-                    {
-                        size_t sum{};
-                        if (l)
-                        {
-                            for (auto& x : *l)
-                            {
-                                sum += 1;
-                                sum += x.estimate_length();
-                            }
-                        }
-                        return sum + 2;
-                    }
-                    case type::Object:
+                    std::uint32_t index = heads_[list];
+                    unlink(index);
+                    insert(index);
+                }
+            }
+
+            void advance()
+            {
+                ++current_step_;
+
+                unsigned top = 0;
+                while (top + 1 < levels && (current_step_ & ((std::uint64_t(1) << ((top + 1) * slot_bits)) - 1)) == 0)
+                    ++top;
+                for (unsigned level = top; level > 0; --level)
+                    cascade(level);
+
+                // Detach the due slot first, tasks may schedule or cancel other tasks while running.
+                std::uint32_t due = current_step_ & slot_mask;
+                while (heads_[due] != npos)
+                {
+                    std::uint32_t index = heads_[due];
+                    unlink(index);
+                    push(firing_list, index);
+                }
+
+                while (heads_[firing_list] != npos)
+                {
+                    std::uint32_t index = heads_[firing_list];
+                    unlink(index);
+                    task_type task = std::move(nodes_[index].task);
+                    release(index);
+                    task();
+                }
+            }
+
+            void tick_handler(const error_code& ec)
+            {
+                if (ec) return;
+
+                // Catch up on every step that passed, the handler may have been delayed.
+                time_type current_time = clock_type::now();
+                while (start_time_ + (current_step_ + 1) * resolution_ms_ <= current_time)
+                    advance();
+
+                timer_.expires_at(start_time_ + (current_step_ + 1) * resolution_ms_);
+                timer_.async_wait(
+                  std::bind(&task_timer::tick_handler, this, std::placeholders::_1));
+            }
+
+        private:
+            asio::io_context& io_context_;
+            asio::basic_waitable_timer<clock_type> timer_;
+
+            std::vector<node> nodes_;
+            std::uint32_t heads_[levels * slots_per_level + 1];
+            std::uint32_t free_head_{npos};
+
+            std::chrono::milliseconds tick_length_ms_;
+            std::chrono::milliseconds resolution_ms_;
+            time_type start_time_;
+            // Number of wheel steps since start_time_.
+            std::uint64_t current_step_{0};
+            uint8_t default_timeout_{5};
+
+        };
+    } // namespace detail
+} // namespace crow
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+namespace crow
+{
+    /// Request latency and traffic counters of an app, served in the Prometheus text format.
+    namespace metrics
+    {
+        /// A log-linear latency histogram in microseconds, the bucket layout of an HdrHistogram with 2 significant digits.
+
+        ///
+        /// Values below 32 get a bucket each, every power of 2 above is split into 16 buckets, so a bucket is at most
+        /// 1/16 of its value wide and quantiles are off by less than 3.2%. Values from 2^36us (19 hours) up share the last bucket.
+        /// Only one thread records into a histogram, the counters are atomic so a scrape can read them at the same time.
+        class histogram
+        {
+        public:
+            static constexpr unsigned sub_bucket_bits = 5;
+            static constexpr unsigned sub_buckets = 1u << sub_bucket_bits;
+            static constexpr unsigned max_magnitude = 36;
+            static constexpr unsigned bucket_count = sub_buckets + (max_magnitude - sub_bucket_bits) * (sub_buckets / 2);
+
+            /// Merged counts of one or more histograms.
+            struct snapshot
+            {
+                std::vector<std::uint64_t> counts = std::vector<std::uint64_t>(bucket_count);
+                std::uint64_t count = 0;
+                std::uint64_t sum = 0;
+                std::uint64_t max = 0;  ///< The largest value recorded, exact.
+
+                /// The value at quantile `q` (0 to 1), the middle of the bucket it falls in but no more than \ref max.
+
+                ///
+                /// Only the bucket of a value is kept, so the result is off by up to half a bucket: exact below 32us,
+                /// otherwise within 1/32 (3.1%) of the true value. It can come out below the true value, or above it
+                /// by as much, except where the clamp to \ref max keeps the top quantiles from passing the maximum.
+                std::uint64_t quantile(double q) const
+                {
+                    if (!count)
+                        return 0;
+                    std::uint64_t rank = static_cast<std::uint64_t>(q * count + 0.5);
+                    rank = std::max<std::uint64_t>(rank, 1);
+                    std::uint64_t seen = 0;
+                    for (unsigned i = 0; i < bucket_count; i++)
                     {
-                        size_t sum{};
-                        if (o)
-                        {
-                            for (auto& kv : *o)
-                            {
-                                sum += 2;
-                                sum += 2 + kv.first.size() + kv.first.size() / 2;
-                                sum += kv.second.estimate_length();
-                            }
-                        }
-                        return sum + 2;
+                        seen += counts[i];
+                        if (seen >= rank)
+                            return std::min(lower_bound(i) + bucket_width(i) / 2, max);
                     }
-                    case type::Function:
-                        return 0;
+                    return std::min(lower_bound(bucket_count - 1), max);
                 }
-                return 1;
+            };
+
+            void record(std::uint64_t micros)
+            {
+                add(counts_[index(micros)], 1);
+                add(sum_, micros);
+                if (micros > max_.load(std::memory_order_relaxed))
+                    max_.store(micros, std::memory_order_relaxed);
+            }
+
+            void merge_into(snapshot& out) const
+            {
+                for (unsigned i = 0; i < bucket_count; i++)
+                {
+                    std::uint64_t n = counts_[i].load(std::memory_order_relaxed);
+                    out.counts[i] += n;
+                    out.count += n;
+                }
+                out.sum += sum_.load(std::memory_order_relaxed);
+                out.max = std::max(out.max, max_.load(std::memory_order_relaxed));
+            }
+
+            static unsigned index(std::uint64_t value)
+            {
+                const std::uint64_t max_value = (std::uint64_t(1) << max_magnitude) - 1;
+                if (value > max_value)
+                    value = max_value;
+                if (value < sub_buckets)
+                    return static_cast<unsigned>(value);
+#if defined(__GNUC__) || defined(__clang__)
+                unsigned magnitude = 63 - __builtin_clzll(value);
+#else
+                unsigned magnitude = 0;
+                for (std::uint64_t v = value; v >>= 1;)
+                    magnitude++;
+#endif
+                unsigned shift = magnitude - (sub_bucket_bits - 1);
+                return sub_buckets + (magnitude - sub_bucket_bits) * (sub_buckets / 2) + static_cast<unsigned>(value >> shift) - sub_buckets / 2;
+            }
+
+            static std::uint64_t lower_bound(unsigned index)
+            {
+                if (index < sub_buckets)
+                    return index;
+                unsigned k = index - sub_buckets;
+                unsigned shift = k / (sub_buckets / 2) + 1;
+                return std::uint64_t(sub_buckets / 2 + k % (sub_buckets / 2)) << shift;
+            }
+
+            static std::uint64_t bucket_width(unsigned index)
+            {
+                return index < sub_buckets ? 1 : std::uint64_t(1) << ((index - sub_buckets) / (sub_buckets / 2) + 1);
             }
 
         private:
-            inline void dump_string(const std::string& str, std::string& out) const
+            /// Single writer, so a plain load and store is enough and avoids a locked instruction.
+            static void add(std::atomic<std::uint64_t>& counter, std::uint64_t n)
             {
-                out.push_back('"');
-                escape(str, out);
-                out.push_back('"');
+                counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
             }
 
-            inline void dump_indentation_part(std::string& out, const int indent, const char separator, const int indent_level) const
+            std::atomic<std::uint64_t> counts_[bucket_count]{};
+            std::atomic<std::uint64_t> sum_{0};
+            std::atomic<std::uint64_t> max_{0};
+        };
+
+        /// Gauges of one worker thread.
+        struct worker_stats
+        {
+            /// How late the worker's probe timer ran past its deadline, recorded by the worker.
+            histogram lag;
+            /// Probes that were late by more than the stall threshold.
+            std::atomic<std::uint64_t> stalls{0};
+            /// Requests the worker has handed to their handler and that haven't been answered yet.
+            std::atomic<std::int64_t> requests_in_flight{0};
+            /// The server's count of connections assigned to the worker, which it balances new connections on.
+            std::atomic<const std::atomic<unsigned int>*> queue_length{nullptr};
+        };
+
+        /// Per-route latency histograms and traffic counters of an app.
+
+        ///
+        /// Every thread records into its own shard without locking (a shard's mutex is only taken to add a route
+        /// it hasn't seen before), \ref render merges the shards. Everything counts from the start of the process.
+        class registry
+        {
+        public:
+            registry():
+              id_(next_id()++)
             {
-                out.push_back('\n');
-                out.append(indent_level * indent, separator);
+                // Start calibrating the tick clock now rather than at the first scrape
+                timing::ns_per_tick();
             }
 
+            registry(const registry&) = delete;
+            registry& operator=(const registry&) = delete;
 
-            inline void dump_internal(const wvalue& v, std::string& out, const int indent, const char separator, const int indent_level = 0) const
+            /// Record a response. `route` is the matched rule (null if none matched), `latency` runs from the request line to the response being ready.
+            void observe(const std::string* route, HTTPMethod method, int status, std::chrono::steady_clock::duration latency, std::size_t bytes)
             {
-                switch (v.t_)
+                shard& s = local_shard();
+                series_key key{route, method, status};
+                auto it = s.series.find(key);
+                if (it == s.series.end())
                 {
-                    case type::Null: out += "null"; break;
-                    case type::False: out += "false"; break;
-                    case type::True: out += "true"; break;
-                    case type::Number:
+                    std::lock_guard<std::mutex> lock(s.mutex);
+                    it = s.series.emplace(key, std::unique_ptr<histogram>(new histogram)).first;
+                }
+                auto micros = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+                it->second->record(micros > 0 ? static_cast<std::uint64_t>(micros) : 0);
+                add(s.sent_bytes, bytes);
+            }
+
+            /// Add the phases of a request to the totals of its route.
+            void observe_phases(const std::string* route, HTTPMethod method, const timing::phases& phases)
+            {
+                if (phases.empty())
+                    return;
+                shard& s = local_shard();
+                series_key key{route, method, 0};
+                auto it = s.phase_series.find(key);
+                if (it == s.phase_series.end())
+                {
+                    std::lock_guard<std::mutex> lock(s.mutex);
+                    it = s.phase_series.emplace(key, std::unique_ptr<phase_totals>(new phase_totals)).first;
+                }
+                phase_totals& totals = *it->second;
+                for (const auto& p : phases)
+                {
+                    auto total = std::find_if(totals.begin(), totals.end(), [&](const phase_total& t) {
+                        return t.name == p.name || std::strcmp(t.name, p.name) == 0;
+                    });
+                    if (total == totals.end())
                     {
-                        if (v.nt == num_type::Floating_point || v.nt == num_type::Double_precision_floating_point)
-                        {
-                            if (isnan(v.num.d) || isinf(v.num.d))
-                            {
-                                out += "null";
-                                CROW_LOG_WARNING << "Invalid JSON value detected (" << v.num.d << "), value set to null";
-                                break;
-                            }
-                            enum
-                            {
-                                start,
-                                decp, // Decimal point
-                                zero
-                            } f_state;
-                            char outbuf[128];
-                            if (v.nt == num_type::Double_precision_floating_point)
-                            {
-#ifdef _MSC_VER
-                                sprintf_s(outbuf, sizeof(outbuf), "%.*g", DECIMAL_DIG, v.num.d);
-#else
-                                snprintf(outbuf, sizeof(outbuf), "%.*g", DECIMAL_DIG, v.num.d);
-#endif
-                            }
-                            else
-                            {
-#ifdef _MSC_VER
-                                sprintf_s(outbuf, sizeof(outbuf), "%f", v.num.d);
-#else
-                                snprintf(outbuf, sizeof(outbuf), "%f", v.num.d);
-#endif
-                            }
-                            char* p = &outbuf[0];
-                            char* pos_first_trailing_0 = nullptr;
-                            f_state = start;
-                            while (*p != '\0')
-                            {
-                                //std::cout << *p << std::endl;
-                                char ch = *p;
-                                switch (f_state)
-                                {
-                                    case start: // Loop and lookahead until a decimal point is found
-                                        if (ch == '.')
-                                        {
-                                            char fch = *(p + 1);
-                                            // if the first character is 0, leave it be (this is so that "1.00000" becomes "1.0" and not "1.")
-                                            if (fch != '\0' && fch == '0') p++;
-                                            f_state = decp;
-                                        }
-                                        p++;
-                                        break;
-                                    case decp: // Loop until a 0 is found, if found, record its position
-                                        if (ch == '0')
-                                        {
-                                            f_state = zero;
-                                            pos_first_trailing_0 = p;
-                                        }
-                                        p++;
-                                        break;
-                                    case zero: // if a non 0 is found (e.g. 1.00004) remove the earlier recorded 0 position and look for more trailing 0s
-                                        if (ch != '0')
-                                        {
-                                            pos_first_trailing_0 = nullptr;
-                                            f_state = decp;
-                                        }
-                                        p++;
-                                        break;
-                                }
-                            }
-                            if (pos_first_trailing_0 != nullptr) // if any trailing 0s are found, terminate the string where they begin
-                                *pos_first_trailing_0 = '\0';
-                            out += outbuf;
-                        }
-                        else if (v.nt == num_type::Signed_integer)
-                        {
-                            out += std::to_string(v.num.si);
-                        }
-                        else
-                        {
-                            out += std::to_string(v.num.ui);
-                        }
+                        std::lock_guard<std::mutex> lock(s.mutex);
+                        totals.emplace_back(p.name);
+                        total = totals.end() - 1;
                     }
-                    break;
-                    case type::String: dump_string(v.s, out); break;
-                    case type::List:
-                    {
-                        out.push_back('[');
+                    add(total->ticks, p.duration);
+                    add(total->count, 1);
+                }
+            }
 
-                        if (indent >= 0)
-                        {
-                            dump_indentation_part(out, indent, separator, indent_level + 1);
-                        }
+            /// The stats of worker `index`, they stay with the registry when the server stops.
+            worker_stats& worker(std::size_t index)
+            {
+                std::lock_guard<std::mutex> lock(shards_mutex_);
+                while (workers_.size() <= index)
+                    workers_.emplace_back(new worker_stats);
+                return *workers_[index];
+            }
 
-                        if (v.l)
-                        {
-                            bool first = true;
-                            for (auto& x : *v.l)
-                            {
-                                if (!first)
-                                {
-                                    out.push_back(',');
+            /// Count bytes read from a connection.
+            void received(std::size_t bytes)
+            {
+                add(local_shard().received_bytes, bytes);
+            }
 
-                                    if (indent >= 0)
-                                    {
-                                        dump_indentation_part(out, indent, separator, indent_level + 1);
-                                    }
-                                }
-                                first = false;
-                                dump_internal(x, out, indent, separator, indent_level + 1);
-                            }
-                        }
+            void connection_opened()
+            {
+                connections_.fetch_add(1, std::memory_order_relaxed);
+                active_connections_.fetch_add(1, std::memory_order_relaxed);
+            }
 
-                        if (indent >= 0)
-                        {
-                            dump_indentation_part(out, indent, separator, indent_level);
-                        }
+            void connection_closed()
+            {
+                active_connections_.fetch_sub(1, std::memory_order_relaxed);
+            }
 
-                        out.push_back(']');
-                    }
-                    break;
-                    case type::Object:
+            /// Everything recorded so far in the Prometheus text exposition format (version 0.0.4).
+            std::string render() const
+            {
+                std::map<std::tuple<std::string, int, int>, histogram::snapshot> merged;
+                std::map<std::tuple<std::string, int, std::string>, std::pair<std::uint64_t, std::uint64_t>> merged_phases;
+                std::uint64_t received_bytes = 0, sent_bytes = 0;
+                std::string workers;
+                {
+                    std::lock_guard<std::mutex> lock(shards_mutex_);
+                    render_workers(workers);
+                    for (const auto& s : shards_)
                     {
-                        out.push_back('{');
-
-                        if (indent >= 0)
+                        std::lock_guard<std::mutex> shard_lock(s->mutex);
+                        for (const auto& kv : s->series)
                         {
-                            dump_indentation_part(out, indent, separator, indent_level + 1);
+                            auto& snapshot = merged[std::make_tuple(kv.first.route ? *kv.first.route : std::string(), static_cast<int>(kv.first.method), kv.first.status)];
+                            kv.second->merge_into(snapshot);
                         }
-
-                        if (v.o)
+                        for (const auto& kv : s->phase_series)
                         {
-                            bool first = true;
-                            for (auto& kv : *v.o)
+                            for (const auto& total : *kv.second)
                             {
-                                if (!first)
-                                {
-                                    out.push_back(',');
-                                    if (indent >= 0)
-                                    {
-                                        dump_indentation_part(out, indent, separator, indent_level + 1);
-                                    }
-                                }
-                                first = false;
-                                dump_string(kv.first, out);
-                                out.push_back(':');
-
-                                if (indent >= 0)
-                                {
-                                    out.push_back(' ');
-                                }
-
-                                dump_internal(kv.second, out, indent, separator, indent_level + 1);
+                                auto& sum = merged_phases[std::make_tuple(kv.first.route ? *kv.first.route : std::string(), static_cast<int>(kv.first.method), std::string(total.name))];
+                                sum.first += total.ticks.load(std::memory_order_relaxed);
+                                sum.second += total.count.load(std::memory_order_relaxed);
                             }
                         }
+                        received_bytes += s->received_bytes.load(std::memory_order_relaxed);
+                        sent_bytes += s->sent_bytes.load(std::memory_order_relaxed);
+                    }
+                }
 
-                        if (indent >= 0)
-                        {
-                            dump_indentation_part(out, indent, separator, indent_level);
-                        }
-
-                        out.push_back('}');
+                std::string out;
+                out += "# HELP crow_request_duration_seconds Time from the request line to the response being ready to send.\n"
+                       "# TYPE crow_request_duration_seconds summary\n";
+                std::uint64_t requests = 0;
+                for (const auto& kv : merged)
+                {
+                    std::string labels = "route=\"";
+                    append_label_value(labels, std::get<0>(kv.first));
+                    labels += "\",method=\"";
+                    labels += method_name(static_cast<HTTPMethod>(std::get<1>(kv.first)));
+                    labels += "\",status=\"";
+                    labels += std::to_string(std::get<2>(kv.first));
+                    labels += '"';
+
+                    const histogram::snapshot& snapshot = kv.second;
+                    for (const char* q : {"0.5", "0.9", "0.99", "0.999"})
+                    {
+                        out += "crow_request_duration_seconds{" + labels + ",quantile=\"" + q + "\"} ";
+                        append_seconds(out, snapshot.quantile(std::atof(q)));
                     }
-                    break;
+                    out += "crow_request_duration_seconds_sum{" + labels + "} ";
+                    append_seconds(out, snapshot.sum);
+                    out += "crow_request_duration_seconds_count{" + labels + "} " + std::to_string(snapshot.count) + '\n';
+                    requests += snapshot.count;
+                }
 
-                    case type::Function:
-                        out += "custom function";
-                        break;
+                out += "# HELP crow_request_phase_seconds Time spent in each phase of a request (see crow::timing::phases).\n"
+                       "# TYPE crow_request_phase_seconds summary\n";
+                double us_per_tick = timing::ns_per_tick() / 1e3;
+                for (const auto& kv : merged_phases)
+                {
+                    std::string labels = "route=\"";
+                    append_label_value(labels, std::get<0>(kv.first));
+                    labels += "\",method=\"";
+                    labels += method_name(static_cast<HTTPMethod>(std::get<1>(kv.first)));
+                    labels += "\",phase=\"";
+                    append_label_value(labels, std::get<2>(kv.first));
+                    labels += '"';
+                    out += "crow_request_phase_seconds_sum{" + labels + "} ";
+                    append_seconds(out, static_cast<std::uint64_t>(kv.second.first * us_per_tick));
+                    out += "crow_request_phase_seconds_count{" + labels + "} " + std::to_string(kv.second.second) + '\n';
                 }
+
+                out += "# HELP crow_requests_total Responses sent.\n"
+                       "# TYPE crow_requests_total counter\n"
+                       "crow_requests_total " + std::to_string(requests) + "\n"
+                       "# HELP crow_received_bytes_total Bytes read from HTTP connections.\n"
+                       "# TYPE crow_received_bytes_total counter\n"
+                       "crow_received_bytes_total " + std::to_string(received_bytes) + "\n"
+                       "# HELP crow_sent_bytes_total Bytes of responses, headers included.\n"
+                       "# TYPE crow_sent_bytes_total counter\n"
+                       "crow_sent_bytes_total " + std::to_string(sent_bytes) + "\n"
+                       "# HELP crow_connections_total HTTP connections accepted.\n"
+                       "# TYPE crow_connections_total counter\n"
+                       "crow_connections_total " + std::to_string(connections_.load(std::memory_order_relaxed)) + "\n"
+                       "# HELP crow_active_connections Open HTTP connections, websockets are not counted once upgraded.\n"
+                       "# TYPE crow_active_connections gauge\n"
+                       "crow_active_connections " + std::to_string(active_connections_.load(std::memory_order_relaxed)) + "\n";
+                out += workers;
+                return out;
             }
 
-        public:
-            std::string dump(const int indent, const char separator = ' ') const
+        private:
+            struct series_key
             {
-                std::string ret;
-                ret.reserve(estimate_length());
-                dump_internal(*this, ret, indent, separator);
-                return ret;
-            }
+                const std::string* route;
+                HTTPMethod method;
+                int status;
 
-            std::string dump() const override
+                bool operator==(const series_key& other) const
+                {
+                    return route == other.route && method == other.method && status == other.status;
+                }
+            };
+
+            struct series_key_hash
             {
-                static constexpr int DontIndent = -1;
+                std::size_t operator()(const series_key& key) const
+                {
+                    return std::hash<const void*>()(key.route) ^ (static_cast<std::size_t>(key.method) << 16) ^ static_cast<std::size_t>(key.status);
+                }
+            };
 
-                return dump(DontIndent);
+            struct phase_total
+            {
+                explicit phase_total(const char* name_):
+                  name(name_)
+                {}
+
+                const char* name;
+                std::atomic<std::uint64_t> ticks{0};
+                std::atomic<std::uint64_t> count{0};
+            };
+            /// A deque, so adding a phase doesn't move the others.
+            using phase_totals = std::deque<phase_total>;
+
+            struct shard
+            {
+                /// Held by the owning thread while it adds a series or phase and by a scrape while it reads them.
+                std::mutex mutex;
+                std::unordered_map<series_key, std::unique_ptr<histogram>, series_key_hash> series;
+                /// By route and method, the status is always 0.
+                std::unordered_map<series_key, std::unique_ptr<phase_totals>, series_key_hash> phase_series;
+                std::atomic<std::uint64_t> received_bytes{0};
+                std::atomic<std::uint64_t> sent_bytes{0};
+            };
+
+            static std::atomic<std::uint64_t>& next_id()
+            {
+                static std::atomic<std::uint64_t> id{0};
+                return id;
             }
-        };
 
-        // Used for accessing the internals of a wvalue
-        struct wvalue_reader
-        {
-            int64_t get(int64_t fallback)
+            static void add(std::atomic<std::uint64_t>& counter, std::uint64_t n)
             {
-                if (ref.t() != type::Number || ref.nt == num_type::Floating_point ||
-                    ref.nt == num_type::Double_precision_floating_point)
-                    return fallback;
-                return ref.num.si;
+                counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
             }
 
-            double get(double fallback)
+            static void append_label_value(std::string& out, const std::string& value)
             {
-                if (ref.t() != type::Number || ref.nt != num_type::Floating_point ||
-                    ref.nt == num_type::Double_precision_floating_point)
-                    return fallback;
-                return ref.num.d;
+                for (char c : value)
+                {
+                    if (c == '\\' || c == '"')
+                        out += '\\';
+                    if (c == '\n')
+                        out += "\\n";
+                    else
+                        out += c;
+                }
+            }
+
+            /// Called with shards_mutex_ held.
+            void render_workers(std::string& out) const
+            {
+                if (workers_.empty())
+                    return;
+                out += "# HELP crow_worker_lag_seconds How late a worker ran its probe timer.\n"
+                       "# TYPE crow_worker_lag_seconds summary\n";
+                for (std::size_t i = 0; i < workers_.size(); i++)
+                {
+                    histogram::snapshot snapshot;
+                    workers_[i]->lag.merge_into(snapshot);
+                    std::string labels = "worker=\"" + std::to_string(i) + '"';
+                    for (const char* q : {"0.5", "0.99", "0.999"})
+                    {
+                        out += "crow_worker_lag_seconds{" + labels + ",quantile=\"" + q + "\"} ";
+                        append_seconds(out, snapshot.quantile(std::atof(q)));
+                    }
+                    out += "crow_worker_lag_seconds_sum{" + labels + "} ";
+                    append_seconds(out, snapshot.sum);
+                    out += "crow_worker_lag_seconds_count{" + labels + "} " + std::to_string(snapshot.count) + '\n';
+                }
+
+                out += "# HELP crow_worker_stalls_total Probes that were late by more than the stall threshold.\n"
+                       "# TYPE crow_worker_stalls_total counter\n";
+                for (std::size_t i = 0; i < workers_.size(); i++)
+                    out += "crow_worker_stalls_total{worker=\"" + std::to_string(i) + "\"} " + std::to_string(workers_[i]->stalls.load(std::memory_order_relaxed)) + '\n';
+
+                out += "# HELP crow_worker_requests_in_flight Requests a worker has handed to their handler and not answered yet.\n"
+                       "# TYPE crow_worker_requests_in_flight gauge\n";
+                for (std::size_t i = 0; i < workers_.size(); i++)
+                    out += "crow_worker_requests_in_flight{worker=\"" + std::to_string(i) + "\"} " + std::to_string(workers_[i]->requests_in_flight.load(std::memory_order_relaxed)) + '\n';
+
+                out += "# HELP crow_worker_queue_length Open connections assigned to a worker, new connections go to the shortest queue.\n"
+                       "# TYPE crow_worker_queue_length gauge\n";
+                for (std::size_t i = 0; i < workers_.size(); i++)
+                {
+                    const std::atomic<unsigned int>* queue_length = workers_[i]->queue_length.load();
+                    out += "crow_worker_queue_length{worker=\"" + std::to_string(i) + "\"} " + std::to_string(queue_length ? queue_length->load() : 0) + '\n';
+                }
             }
 
-            bool get(bool fallback)
+            static void append_seconds(std::string& out, std::uint64_t micros)
             {
-                if (ref.t() == type::True) return true;
-                if (ref.t() == type::False) return false;
-                return fallback;
+                char buf[32];
+                std::snprintf(buf, sizeof(buf), "%.6f\n", micros / 1e6);
+                out += buf;
             }
 
-            std::string get(const std::string& fallback)
+            /// The shard of the calling thread. Shards stay with the registry when their thread exits.
+            shard& local_shard()
             {
-                if (ref.t() != type::String) return fallback;
-                return ref.s;
+                // Keyed by registry id, not address, a new registry can reuse the address of a destroyed one
+                thread_local std::vector<std::pair<std::uint64_t, shard*>> local;
+                for (const auto& entry : local)
+                    if (entry.first == id_)
+                        return *entry.second;
+
+                std::lock_guard<std::mutex> lock(shards_mutex_);
+                shards_.emplace_back(new shard);
+                local.emplace_back(id_, shards_.back().get());
+                return *shards_.back();
             }
 
-            const wvalue& ref;
+            const std::uint64_t id_;
+            mutable std::mutex shards_mutex_;
+            std::vector<std::unique_ptr<shard>> shards_;
+            std::vector<std::unique_ptr<worker_stats>> workers_;
+            std::atomic<std::uint64_t> connections_{0};
+            std::atomic<std::int64_t> active_connections_{0};
         };
-
-        //std::vector<asio::const_buffer> dump_ref(wvalue& v)
-        //{
-        //}
-    } // namespace json
+    } // namespace metrics
 } // namespace crow
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <unordered_map>
-#include <ios>
-#include <fstream>
-#include <sstream>
-// S_ISREG is not defined for windows
-// This defines it like suggested in https://stackoverflow.com/a/62371749
-#if defined(_MSC_VER)
-#define _CRT_INTERNAL_NONSTDC_NAMES 1
-#endif
-#include <sys/stat.h>
-#if !defined(S_ISREG) && defined(S_IFMT) && defined(S_IFREG)
-#define S_ISREG(m) (((m) & S_IFMT) == S_IFREG)
-#endif
-
+#include <thread>
+#include <vector>
 
+#if defined(__linux__) && defined(__GLIBC__)
+#include <cerrno>
+#include <csignal>
+#include <cxxabi.h>
+#include <execinfo.h>
+#include <sys/time.h>
+#endif
 
 namespace crow
 {
-    template<typename Adaptor, typename Handler, typename... Middlewares>
-    class Connection;
+    /// Samples the stacks of Crow's worker threads from a CPU time timer, for flame graphs of a live server.
 
-    class Router;
-
-    /// HTTP response
-    struct response
+    ///
+    /// ITIMER_PROF raises SIGPROF every 1/frequency seconds of CPU time used by the process, on a thread that was running.
+    /// Samples landing on a worker are recorded with backtrace() into a buffer allocated on the first start; other threads
+    /// are ignored. \ref stop returns the samples as folded stacks (`root;...;leaf count` lines), which flamegraph.pl and
+    /// speedscope read directly. Function names come from the dynamic symbol table, so link with `-rdynamic` to see
+    /// more than shared library frames.
+    ///
+    /// Only available on Linux with glibc. There is one profiler per process, and its SIGPROF handler stays installed
+    /// once started, so it doesn't mix with other SIGPROF users such as gperftools.
+    class sampling_profiler
     {
-        template<typename Adaptor, typename Handler, typename... Middlewares>
-        friend class crow::Connection;
-
-        friend class Router;
-
-        int code{200};    ///< The Status code for the response.
-        std::string body; ///< The actual payload containing the response data.
-        ci_map headers;   ///< HTTP headers.
-
-#ifdef CROW_ENABLE_COMPRESSION
-        bool compressed = true; ///< If compression is enabled and this is false, the individual response will not be compressed.
-#endif
-        bool skip_body = false;            ///< Whether this is a response to a HEAD request.
-        bool manual_length_header = false; ///< Whether Crow should automatically add a "Content-Length" header.
+    public:
+        static constexpr int max_stack_depth = 48;
+        static constexpr std::size_t max_samples = 16384;
 
-        /// Set the value of an existing header in the response.
-        void set_header(std::string key, std::string value)
+        /// Sample the calling thread while a profile runs. Called by each worker thread.
+        static void sample_current_thread()
         {
-            headers.erase(key);
-            headers.emplace(std::move(key), std::move(value));
+            sampled_thread() = true;
         }
 
-        /// Add a new header to the response.
-        void add_header(std::string key, std::string value)
+#if defined(__linux__) && defined(__GLIBC__)
+        /// Start sampling `frequency` times per second of CPU time, false if a profile is already running.
+        static bool start(unsigned int frequency)
         {
-            headers.emplace(std::move(key), std::move(value));
+            state& s = get_state();
+            std::lock_guard<std::mutex> lock(s.mutex);
+            if (s.running.load() || frequency == 0)
+                return false;
+            if (!s.samples)
+            {
+                // The first backtrace() loads libgcc, which isn't safe from a signal handler
+                void* warm_up[1];
+                backtrace(warm_up, 1);
+                s.samples.reset(new sample[max_samples]);
+
+                struct sigaction action = {};
+                action.sa_handler = &on_signal;
+                action.sa_flags = SA_RESTART;
+                sigemptyset(&action.sa_mask);
+                sigaction(SIGPROF, &action, nullptr);
+            }
+            for (std::size_t i = 0; i < max_samples; i++)
+                s.samples[i].depth.store(0, std::memory_order_relaxed);
+            s.next.store(0);
+            s.running.store(true);
+
+            long period = frequency > 1000000 ? 1 : 1000000 / frequency;
+            itimerval timer = {};
+            timer.it_interval.tv_sec = period / 1000000;
+            timer.it_interval.tv_usec = period % 1000000;
+            timer.it_value = timer.it_interval;
+            if (setitimer(ITIMER_PROF, &timer, nullptr) != 0)
+            {
+                s.running.store(false);
+                return false;
+            }
+            return true;
         }
 
-        const std::string& get_header_value(const std::string& key)
+        /// Stop sampling and return the samples as folded stacks, empty if no profile was running.
+        static std::string stop()
         {
-            return crow::get_header_value(headers, key);
-        }
+            state& s = get_state();
+            std::lock_guard<std::mutex> lock(s.mutex);
+            if (!s.running.load())
+                return std::string();
+            itimerval timer = {};
+            setitimer(ITIMER_PROF, &timer, nullptr);
+            s.running.store(false);
+            // A handler may still be writing the last sample
+            while (s.in_handler.load() > 0)
+                std::this_thread::yield();
 
-        // naive validation of a mime-type string
-        static bool validate_mime_type(const std::string& candidate) noexcept
-        {
-            // Here we simply check that the candidate type starts with
-            // a valid parent type, and has at least one character afterwards.
-            std::array<std::string, 10> valid_parent_types = {
-              "application/", "audio/", "font/", "example/",
-              "image/", "message/", "model/", "multipart/",
-              "text/", "video/"};
-            for (const std::string& parent : valid_parent_types)
+            std::size_t taken = s.next.load();
+            if (taken > max_samples)
             {
-                // ensure the candidate is *longer* than the parent,
-                // to avoid unnecessary string comparison and to
-                // reject zero-length subtypes.
-                if (candidate.size() <= parent.size())
-                {
+                CROW_LOG_WARNING << "Profiler buffer full, dropped " << taken - max_samples << " of " << taken << " samples";
+                taken = max_samples;
+            }
+
+            // Count each distinct stack, root first. Frame 0 is the signal handler and frame 1 the signal trampoline.
+            std::map<std::vector<void*>, std::size_t> stacks;
+            std::map<void*, std::string> names;
+            for (std::size_t i = 0; i < taken; i++)
+            {
+                const sample& sampled = s.samples[i];
+                int depth = sampled.depth.load(std::memory_order_acquire);
+                if (depth <= 2)
                     continue;
-                }
-                // strncmp is used rather than substr to avoid allocation,
-                // but a string_view approach would be better if Crow
-                // migrates to C++17.
-                if (strncmp(parent.c_str(), candidate.c_str(), parent.size()) == 0)
+                std::vector<void*> stack(sampled.frames + 2, sampled.frames + depth);
+                std::reverse(stack.begin(), stack.end());
+                for (void* frame : stack)
+                    names.emplace(frame, std::string());
+                stacks[std::move(stack)]++;
+            }
+
+            std::vector<void*> addresses;
+            addresses.reserve(names.size());
+            for (const auto& name : names)
+                addresses.push_back(name.first);
+            char** symbols = backtrace_symbols(addresses.data(), static_cast<int>(addresses.size()));
+            for (std::size_t i = 0; i < addresses.size(); i++)
+                names[addresses[i]] = symbols ? frame_name(symbols[i]) : "??";
+            std::free(symbols);
+
+            // Stacks through different instructions of the same functions fold into one line
+            std::map<std::string, std::size_t> folded;
+            for (const auto& stack : stacks)
+            {
+                std::string line;
+                for (std::size_t i = 0; i < stack.first.size(); i++)
                 {
-                    return true;
+                    if (i)
+                        line += ';';
+                    line += names[stack.first[i]];
                 }
+                folded[line] += stack.second;
             }
-            return false;
-        }
 
-        // Find the mime type from the content type either by lookup,
-        // or by the content type itself, if it is a valid a mime type.
-        // Defaults to text/plain.
-        static std::string get_mime_type(const std::string& contentType)
-        {
-            const auto mimeTypeIterator = mime_types.find(contentType);
-            if (mimeTypeIterator != mime_types.end())
-            {
-                return mimeTypeIterator->second;
-            }
-            else if (validate_mime_type(contentType))
-            {
-                return contentType;
-            }
-            else
+            std::string out;
+            for (const auto& line : folded)
             {
-                CROW_LOG_WARNING << "Unable to interpret mime type for content type '" << contentType << "'. Defaulting to text/plain.";
-                return "text/plain";
+                out += line.first;
+                out += ' ';
+                out += std::to_string(line.second);
+                out += '\n';
             }
+            return out;
         }
-
-
-        // clang-format off
-        response() {}
-        explicit response(int code_) : code(code_) {}
-        response(std::string body_) : body(std::move(body_)) {}
-        response(int code_, std::string body_) : code(code_), body(std::move(body_)) {}
-        // clang-format on
-        response(returnable&& value)
-        {
-            body = value.dump();
-            set_header("Content-Type", value.content_type);
-        }
-        response(returnable& value)
-        {
-            body = value.dump();
-            set_header("Content-Type", value.content_type);
-        }
-        response(int code_, returnable& value):
-          code(code_)
-        {
-            body = value.dump();
-            set_header("Content-Type", value.content_type);
-        }
-        response(int code_, returnable&& value):
-          code(code_), body(value.dump())
+#else
+        static bool start(unsigned int)
         {
-            set_header("Content-Type", std::move(value.content_type));
+            return false;
         }
 
-        response(response&& r)
+        static std::string stop()
         {
-            *this = std::move(r);
+            return std::string();
         }
+#endif
 
-        response(std::string contentType, std::string body_):
-          body(std::move(body_))
+    private:
+        static bool& sampled_thread()
         {
-            set_header("Content-Type", get_mime_type(contentType));
+            static thread_local bool sampled = false;
+            return sampled;
         }
 
-        response(int code_, std::string contentType, std::string body_):
-          code(code_), body(std::move(body_))
+#if defined(__linux__) && defined(__GLIBC__)
+        struct sample
         {
-            set_header("Content-Type", get_mime_type(contentType));
-        }
+            std::atomic<int> depth{0}; ///< 0 until the frames are written.
+            void* frames[max_stack_depth];
+        };
 
-        response& operator=(const response& r) = delete;
+        struct state
+        {
+            std::mutex mutex; ///< Serializes start and stop.
+            std::unique_ptr<sample[]> samples;
+            std::atomic<std::size_t> next{0};
+            std::atomic<bool> running{false};
+            std::atomic<int> in_handler{0};
+        };
 
-        response& operator=(response&& r) noexcept
+        static state& get_state()
         {
-            body = std::move(r.body);
-            code = r.code;
-            headers = std::move(r.headers);
-            completed_ = r.completed_;
-            file_info = std::move(r.file_info);
-            return *this;
+            static state s;
+            return s;
         }
 
-        /// Check if the response has completed (whether response.end() has been called)
-        bool is_completed() const noexcept
+        static void on_signal(int)
         {
-            return completed_;
+            if (!sampled_thread())
+                return;
+            int saved_errno = errno;
+            state& s = get_state();
+            s.in_handler.fetch_add(1);
+            if (s.running.load())
+            {
+                std::size_t index = s.next.fetch_add(1, std::memory_order_relaxed);
+                if (index < max_samples)
+                {
+                    sample& slot = s.samples[index];
+                    slot.depth.store(backtrace(slot.frames, max_stack_depth), std::memory_order_release);
+                }
+            }
+            s.in_handler.fetch_sub(1);
+            errno = saved_errno;
         }
 
-        void clear()
+        /// The function in a backtrace_symbols() line, `binary(symbol+0x1f) [0x...]`, or `binary+0x...` if it isn't exported.
+        static std::string frame_name(const char* line)
         {
-            body.clear();
-            code = 200;
-            headers.clear();
-            completed_ = false;
-            file_info = static_file_info{};
+            const char* open = std::strchr(line, '(');
+            const char* plus = open ? std::strchr(open, '+') : nullptr;
+            const char* close = open ? std::strchr(open, ')') : nullptr;
+            if (!open || !close)
+                return line;
+            if (plus && plus > open + 1 && plus < close)
+            {
+                std::string symbol(open + 1, plus);
+                int status = 0;
+                char* demangled = abi::__cxa_demangle(symbol.c_str(), nullptr, nullptr, &status);
+                if (demangled)
+                {
+                    symbol = demangled;
+                    std::free(demangled);
+                }
+                return symbol;
+            }
+            const char* base = line;
+            for (const char* c = line; c < open; c++)
+                if (*c == '/')
+                    base = c + 1;
+            return std::string(base, open) + std::string(plus ? plus : close, close);
         }
+#endif
+    };
+} // namespace crow
 
-        /// Return a "Temporary Redirect" response.
+#ifdef CROW_USE_BOOST
+#include <boost/asio.hpp>
+#else
+#ifndef ASIO_STANDALONE
+#define ASIO_STANDALONE
+#endif
+#include <asio.hpp>
+#endif
 
-        ///
-        /// Location can either be a route or a full URL.
-        void redirect(const std::string& location)
-        {
-            code = 307;
-            set_header("Location", location);
-        }
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
 
-        /// Return a "Permanent Redirect" response.
+#if defined(__linux__) && defined(__GLIBC__)
+#include <csignal>
+#include <execinfo.h>
+#include <pthread.h>
+#endif
+
+namespace crow
+{
+#ifdef CROW_USE_BOOST
+    namespace asio = boost::asio;
+#endif
+
+    namespace detail
+    {
+        /// Watches how long a worker's io_context takes to get to new work, and what the worker is busy with when it is slow.
 
         ///
-        /// Location can either be a route or a full URL.
-        void redirect_perm(const std::string& location)
+        /// The worker runs a probe timer and records how late past its deadline it ran. The server's monitor thread calls \ref check
+        /// periodically; a probe late by more than the stall threshold means something is blocking the worker. That is logged
+        /// once, with the route whose handler is running and, on Linux with glibc, the stack of the worker.
+        /// The timer's handler is allocated and freed on the worker, so asio recycles it and probing doesn't allocate.
+        class worker_monitor
         {
-            code = 308;
-            set_header("Location", location);
-        }
+        public:
+            static constexpr int max_stack_depth = 32;
 
-        /// Return a "Found (Moved Temporarily)" response.
+            worker_monitor(asio::io_context& io_context, std::size_t index, metrics::worker_stats& stats, const std::atomic<unsigned int>& queue_length):
+              timer_(io_context), index_(index), stats_(stats)
+            {
+                stats_.queue_length.store(&queue_length);
+            }
+
+            ~worker_monitor()
+            {
+                stats_.queue_length.store(nullptr);
+            }
+
+            /// The monitor of the worker running on this thread, null on other threads.
+            static worker_monitor*& current()
+            {
+                static thread_local worker_monitor* monitor = nullptr;
+                return monitor;
+            }
+
+            /// Called by the worker thread before it starts running its io_context.
+            void bind_to_current_thread()
+            {
+                current() = this;
+#if defined(__linux__) && defined(__GLIBC__)
+                thread_ = pthread_self();
+                install_stack_handler();
+#endif
+            }
+
+            metrics::worker_stats& stats()
+            {
+                return stats_;
+            }
+
+            /// A handler for `route` (null if none matched) starts running on the worker.
+            void enter(const std::string* route, HTTPMethod method)
+            {
+                busy_route_.store(route, std::memory_order_relaxed);
+                busy_method_.store(static_cast<int>(method), std::memory_order_relaxed);
+                busy_since_.store(now(), std::memory_order_release);
+            }
+
+            void leave()
+            {
+                busy_since_.store(0, std::memory_order_relaxed);
+            }
 
-        ///
-        /// Location can either be a route or a full URL.
-        void moved(const std::string& location)
-        {
-            code = 302;
-            set_header("Location", location);
-        }
+            /// Start probing every `interval`. Called by the worker thread.
+            void start(std::chrono::milliseconds interval)
+            {
+                interval_ = interval;
+                schedule();
+            }
 
-        /// Return a "Moved Permanently" response.
+            /// Report the worker if its probe is late by more than `stall_threshold`. Called from the server's monitor thread only,
+            /// which this blocks for up to 100ms while the worker captures its stack.
+            void check(std::chrono::milliseconds stall_threshold)
+            {
+                std::int64_t due = probe_due_.load(std::memory_order_acquire);
+                if (!due || due == reported_due_)
+                    return;
+                std::int64_t late = now() - due;
+                if (std::chrono::nanoseconds(late) < stall_threshold)
+                    return;
+                reported_due_ = due;
+                stats_.stalls.store(stats_.stalls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                report_stall(late);
+            }
 
-        ///
-        /// Location can either be a route or a full URL.
-        void moved_perm(const std::string& location)
-        {
-            code = 301;
-            set_header("Location", location);
-        }
+        private:
+            static std::int64_t now()
+            {
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            }
 
-        void write(const std::string& body_part)
-        {
-            body += body_part;
-        }
+            void schedule()
+            {
+                timer_.expires_after(interval_);
+                probe_due_.store(std::chrono::duration_cast<std::chrono::nanoseconds>(timer_.expiry().time_since_epoch()).count(), std::memory_order_release);
+                timer_.async_wait([this](const error_code& ec) {
+                    if (ec)
+                        return;
+                    std::int64_t late = now() - probe_due_.load(std::memory_order_relaxed);
+                    stats_.lag.record(static_cast<std::uint64_t>(late > 0 ? late / 1000 : 0));
+                    schedule();
+                });
+            }
 
-        /// Set the response completion flag and call the handler (to send the response).
-        void end()
-        {
-            if (!completed_)
+            void report_stall(std::int64_t waited)
             {
-                completed_ = true;
-                if (skip_body)
+                std::string busy;
+                std::int64_t since = busy_since_.load(std::memory_order_acquire);
+                if (since)
                 {
-                    set_header("Content-Length", std::to_string(body.size()));
-                    body = "";
-                    manual_length_header = true;
+                    const std::string* route = busy_route_.load(std::memory_order_relaxed);
+                    busy = ", it has been running the handler of ";
+                    busy += method_name(static_cast<HTTPMethod>(busy_method_.load(std::memory_order_relaxed)));
+                    busy += ' ';
+                    busy += route ? *route : std::string("(no route)");
+                    busy += " for " + std::to_string((now() - since) / 1000000) + "ms";
                 }
-                if (complete_request_handler_)
+                else
                 {
-                    complete_request_handler_();
-                    manual_length_header = false;
-                    skip_body = false;
+                    busy = ", it is not in a request handler";
                 }
+                CROW_LOG_WARNING << "Worker " << index_ << " has not picked up new work for " << waited / 1000000 << "ms" << busy << capture_stack();
             }
-        }
-
-        /// Same as end() except it adds a body part right before ending.
-        void end(const std::string& body_part)
-        {
-            body += body_part;
-            end();
-        }
-
-        /// Check if the connection is still alive (usually by checking the socket status).
-        bool is_alive()
-        {
-            return is_alive_helper_ && is_alive_helper_();
-        }
 
-        /// Check whether the response has a static file defined.
-        bool is_static_type()
-        {
-            return file_info.path.size();
-        }
+#if defined(__linux__) && defined(__GLIBC__)
+            // SIGURG is ignored by default and only raised for socket out-of-band data with F_SETOWN, which Crow doesn't use.
+            static constexpr int stack_signal = SIGURG;
 
-        /// This constains metadata (coming from the `stat` command) related to any static files associated with this response.
+            static void install_stack_handler()
+            {
+                static std::once_flag once;
+                std::call_once(once, [] {
+                    // The first backtrace() loads libgcc, which isn't safe from a signal handler
+                    void* warm_up[1];
+                    backtrace(warm_up, 1);
 
-        ///
-        /// Either a static file or a string body can be returned as 1 response.
-        struct static_file_info
-        {
-            std::string path = "";
-            struct stat statbuf;
-            int statResult;
-        };
+                    struct sigaction action = {};
+                    action.sa_handler = &on_stack_signal;
+                    action.sa_flags = SA_RESTART;
+                    sigemptyset(&action.sa_mask);
+                    sigaction(stack_signal, &action, nullptr);
+                });
+            }
 
-        /// Return a static file as the response body
-        void set_static_file_info(std::string path)
-        {
-            utility::sanitize_filename(path);
-            set_static_file_info_unsafe(path);
-        }
+            /// Runs on the stalled worker. -1 means a capture was asked for, -2 that it is being written.
+            static void on_stack_signal(int)
+            {
+                worker_monitor* monitor = current();
+                int requested = -1;
+                if (!monitor || !monitor->stack_depth_.compare_exchange_strong(requested, -2))
+                    return;
+                monitor->stack_depth_.store(backtrace(monitor->stack_, max_stack_depth), std::memory_order_release);
+            }
 
-        /// Return a static file as the response body without sanitizing the path (use set_static_file_info instead)
-        void set_static_file_info_unsafe(std::string path)
-        {
-            file_info.path = path;
-            file_info.statResult = stat(file_info.path.c_str(), &file_info.statbuf);
-#ifdef CROW_ENABLE_COMPRESSION
-            compressed = false;
-#endif
-            if (file_info.statResult == 0 && S_ISREG(file_info.statbuf.st_mode))
+            std::string capture_stack()
             {
-                std::size_t last_dot = path.find_last_of('.');
-                std::string extension = path.substr(last_dot + 1);
-                code = 200;
-                this->add_header("Content-Length", std::to_string(file_info.statbuf.st_size));
+                stack_depth_.store(-1, std::memory_order_release);
+                if (pthread_kill(thread_, stack_signal) != 0)
+                    return std::string();
+                for (int i = 0; i < 100 && stack_depth_.load(std::memory_order_acquire) < 0; i++)
+                {
+                    int requested = -1;
+                    // Give up if the worker hasn't started writing after 50ms
+                    if (i == 50 && stack_depth_.compare_exchange_strong(requested, 0))
+                        break;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                int depth = stack_depth_.load(std::memory_order_acquire);
+                if (depth <= 0)
+                    return std::string();
 
-                if (!extension.empty())
+                std::string out = ", stack:";
+                char** symbols = backtrace_symbols(stack_, depth);
+                // Frame 0 is the signal handler and frame 1 the signal trampoline
+                for (int i = 2; i < depth; i++)
                 {
-                    this->add_header("Content-Type", get_mime_type(extension));
+                    out += "\n    ";
+                    out += symbols ? symbols[i] : "?";
                 }
+                std::free(symbols);
+                return out;
             }
-            else
+
+            pthread_t thread_{};
+            void* stack_[max_stack_depth];
+            std::atomic<int> stack_depth_{0};
+#else
+            std::string capture_stack()
             {
-                code = 404;
-                file_info.path.clear();
+                return std::string();
             }
-        }
+#endif
 
-    private:
-        bool completed_{};
-        std::function<void()> complete_request_handler_;
-        std::function<bool()> is_alive_helper_;
-        static_file_info file_info;
-    };
-} // namespace crow
+            asio::steady_timer timer_;
+            std::chrono::milliseconds interval_{};
+            std::size_t index_;
+            metrics::worker_stats& stats_;
 
+            std::atomic<std::int64_t> probe_due_{0}; ///< Deadline of the pending probe, 0 before the first one.
+            std::int64_t reported_due_ = 0;          ///< The probe a stall was last reported for, monitor thread only.
 
+            std::atomic<std::int64_t> busy_since_{0}; ///< When the running handler started, 0 outside of handlers.
+            std::atomic<const std::string*> busy_route_{nullptr};
+            std::atomic<int> busy_method_{0};
+        };
+    } // namespace detail
+} // namespace crow
 
-#include <tuple>
-#include <type_traits>
-#include <iostream>
-#include <utility>
+#ifdef CROW_USE_BOOST
+#include <boost/asio.hpp>
+#else
+#ifndef ASIO_STANDALONE
+#define ASIO_STANDALONE
+#endif
+#include <asio.hpp>
+#endif
 
-namespace crow // NOTE: Already documented in "crow/app.h"
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace crow
 {
+#ifdef CROW_USE_BOOST
+    namespace asio = boost::asio;
+    using error_code = boost::system::error_code;
+#else
+    using error_code = asio::error_code;
+#endif
 
-    /// Local middleware should extend ILocalMiddleware
-    struct ILocalMiddleware
+    /// Cleartext HTTP/2 (h2c), entered with prior knowledge or through `Upgrade: h2c` from a \ref crow.Connection.
+    namespace http2
     {
-        using call_global = std::false_type;
-    };
+        /// The first bytes a client sends on a prior knowledge connection.
+        constexpr char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+        constexpr std::size_t preface_length = sizeof(preface) - 1;
 
-    namespace detail
-    {
-        template<typename MW>
-        struct check_before_handle_arity_3_const
+        /// Check whether the input so far can be the start of the connection preface.
+        inline bool is_preface(const char* data, std::size_t length)
         {
-            template<typename T, void (T::*)(request&, response&, typename MW::context&) const = &T::before_handle>
-            struct get
-            {};
+            return length > 0 && std::memcmp(data, preface, length < preface_length ? length : preface_length) == 0;
+        }
+
+        enum frame_type : uint8_t
+        {
+            DATA = 0x0,
+            HEADERS = 0x1,
+            PRIORITY = 0x2,
+            RST_STREAM = 0x3,
+            SETTINGS = 0x4,
+            PUSH_PROMISE = 0x5,
+            PING = 0x6,
+            GOAWAY = 0x7,
+            WINDOW_UPDATE = 0x8,
+            CONTINUATION = 0x9,
         };
 
-        template<typename MW>
-        struct check_before_handle_arity_3
+        enum frame_flag : uint8_t
         {
-            template<typename T, void (T::*)(request&, response&, typename MW::context&) = &T::before_handle>
-            struct get
-            {};
+            END_STREAM = 0x1,
+            ACK = 0x1,
+            END_HEADERS = 0x4,
+            PADDED = 0x8,
+            PRIORITY_FLAG = 0x20,
         };
 
-        template<typename MW>
-        struct check_after_handle_arity_3_const
+        enum error_code_t : uint32_t
+        {
+            NO_ERROR = 0x0,
+            PROTOCOL_ERROR = 0x1,
+            INTERNAL_ERROR = 0x2,
+            FLOW_CONTROL_ERROR = 0x3,
+            STREAM_CLOSED = 0x5,
+            FRAME_SIZE_ERROR = 0x6,
+            REFUSED_STREAM = 0x7,
+            COMPRESSION_ERROR = 0x9,
+            ENHANCE_YOUR_CALM = 0xb,
+        };
+
+        enum setting_id : uint16_t
         {
-            template<typename T, void (T::*)(request&, response&, typename MW::context&) const = &T::after_handle>
-            struct get
-            {};
+            HEADER_TABLE_SIZE = 0x1,
+            ENABLE_PUSH = 0x2,
+            MAX_CONCURRENT_STREAMS = 0x3,
+            INITIAL_WINDOW_SIZE = 0x4,
+            MAX_FRAME_SIZE = 0x5,
         };
 
-        template<typename MW>
-        struct check_after_handle_arity_3
-        {
-            template<typename T, void (T::*)(request&, response&, typename MW::context&) = &T::after_handle>
-            struct get
-            {};
-        };
+        namespace hpack
+        {
+            struct header_field
+            {
+                std::string_view name;
+                std::string_view value;
+            };
+
+            /// RFC 7541 Appendix A, index 1 is the first entry.
+            constexpr header_field static_table[] = {
+              {":authority", ""},
+              {":method", "GET"},
+              {":method", "POST"},
+              {":path", "/"},
+              {":path", "/index.html"},
+              {":scheme", "http"},
+              {":scheme", "https"},
+              {":status", "200"},
+              {":status", "204"},
+              {":status", "206"},
+              {":status", "304"},
+              {":status", "400"},
+              {":status", "404"},
+              {":status", "500"},
+              {"accept-charset", ""},
+              {"accept-encoding", "gzip, deflate"},
+              {"accept-language", ""},
+              {"accept-ranges", ""},
+              {"accept", ""},
+              {"access-control-allow-origin", ""},
+              {"age", ""},
+              {"allow", ""},
+              {"authorization", ""},
+              {"cache-control", ""},
+              {"content-disposition", ""},
+              {"content-encoding", ""},
+              {"content-language", ""},
+              {"content-length", ""},
+              {"content-location", ""},
+              {"content-range", ""},
+              {"content-type", ""},
+              {"cookie", ""},
+              {"date", ""},
+              {"etag", ""},
+              {"expect", ""},
+              {"expires", ""},
+              {"from", ""},
+              {"host", ""},
+              {"if-match", ""},
+              {"if-modified-since", ""},
+              {"if-none-match", ""},
+              {"if-range", ""},
+              {"if-unmodified-since", ""},
+              {"last-modified", ""},
+              {"link", ""},
+              {"location", ""},
+              {"max-forwards", ""},
+              {"proxy-authenticate", ""},
+              {"proxy-authorization", ""},
+              {"range", ""},
+              {"referer", ""},
+              {"refresh", ""},
+              {"retry-after", ""},
+              {"server", ""},
+              {"set-cookie", ""},
+              {"strict-transport-security", ""},
+              {"transfer-encoding", ""},
+              {"user-agent", ""},
+              {"vary", ""},
+              {"via", ""},
+              {"www-authenticate", ""},
+            };
+            constexpr std::size_t static_table_size = sizeof(static_table) / sizeof(static_table[0]);
+
+            struct huffman_code
+            {
+                uint32_t code;
+                uint8_t length;
+            };
+
+            /// RFC 7541 Appendix B, the last entry is EOS.
+            constexpr huffman_code huffman_codes[257] = {
+                  {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28}, {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+                  {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28}, {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+                  {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28}, {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+                  {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28}, {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+                  {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12}, {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+                  {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11}, {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+                  {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6}, {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+                  {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8}, {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+                  {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+                  {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+                  {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7}, {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+                  {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+                  {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+                  {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7}, {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+                  {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5}, {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+                  {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+                  {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20}, {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+                  {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+                  {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+                  {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23}, {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+                  {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+                  {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+                  {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21}, {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+                  {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+                  {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+                  {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27}, {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+                  {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+                  {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+                  {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21}, {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+                  {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+                  {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+                  {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27}, {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+                  {0x3fffffff, 30},
+            };
+
+            /// Binary decoding tree for \ref huffman_codes, built on first use.
+            class huffman_tree
+            {
+            public:
+                static const huffman_tree& get()
+                {
+                    static const huffman_tree tree;
+                    return tree;
+                }
+
+                /// Append the decoded string to `out`, false on an invalid code, EOS or bad padding.
+                bool decode(const uint8_t* p, std::size_t length, std::string& out) const
+                {
+                    int node = 0;
+                    int depth = 0;
+                    bool padding = true; // the bits since the last symbol are all ones
+                    for (std::size_t i = 0; i < length; i++)
+                    {
+                        for (int bit = 7; bit >= 0; bit--)
+                        {
+                            int b = (p[i] >> bit) & 1;
+                            padding = padding && b;
+                            node = nodes_[node].child[b];
+                            depth++;
+                            if (node <= 0)
+                                return false;
+                            if (nodes_[node].symbol >= 0)
+                            {
+                                if (nodes_[node].symbol == 256)
+                                    return false;
+                                out.push_back(static_cast<char>(nodes_[node].symbol));
+                                node = 0;
+                                depth = 0;
+                                padding = true;
+                            }
+                        }
+                    }
+                    return depth < 8 && padding;
+                }
+
+            private:
+                struct node
+                {
+                    int child[2] = {0, 0};
+                    int symbol = -1;
+                };
+
+                huffman_tree()
+                {
+                    nodes_.reserve(514);
+                    nodes_.emplace_back();
+                    for (int symbol = 0; symbol < 257; symbol++)
+                    {
+                        int n = 0;
+                        for (int bit = huffman_codes[symbol].length - 1; bit >= 0; bit--)
+                        {
+                            int b = (huffman_codes[symbol].code >> bit) & 1;
+                            if (!nodes_[n].child[b])
+                            {
+                                nodes_[n].child[b] = static_cast<int>(nodes_.size());
+                                nodes_.emplace_back();
+                            }
+                            n = nodes_[n].child[b];
+                        }
+                        nodes_[n].symbol = symbol;
+                    }
+                }
+
+                std::vector<node> nodes_;
+            };
+
+            /// Append an integer with an N bit prefix, `first` holds the bits above the prefix.
+            inline void encode_integer(std::string& out, uint8_t first, int prefix_bits, std::size_t value)
+            {
+                std::size_t max_prefix = (std::size_t(1) << prefix_bits) - 1;
+                if (value < max_prefix)
+                {
+                    out.push_back(static_cast<char>(first | value));
+                    return;
+                }
+                out.push_back(static_cast<char>(first | max_prefix));
+                value -= max_prefix;
+                while (value >= 128)
+                {
+                    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+                    value >>= 7;
+                }
+                out.push_back(static_cast<char>(value));
+            }
+
+            /// Append a string literal, Huffman coded when that is shorter.
+            inline void encode_string(std::string& out, std::string_view s)
+            {
+                std::size_t bits = 0;
+                for (unsigned char c : s)
+                    bits += huffman_codes[c].length;
+                std::size_t huffman_length = (bits + 7) / 8;
+                if (huffman_length >= s.size())
+                {
+                    encode_integer(out, 0x00, 7, s.size());
+                    out.append(s.data(), s.size());
+                    return;
+                }
+
+                encode_integer(out, 0x80, 7, huffman_length);
+                uint64_t acc = 0;
+                int acc_bits = 0;
+                for (unsigned char c : s)
+                {
+                    acc = (acc << huffman_codes[c].length) | huffman_codes[c].code;
+                    acc_bits += huffman_codes[c].length;
+                    while (acc_bits >= 8)
+                    {
+                        acc_bits -= 8;
+                        out.push_back(static_cast<char>(acc >> acc_bits));
+                    }
+                }
+                if (acc_bits > 0)
+                    out.push_back(static_cast<char>((acc << (8 - acc_bits)) | (0xff >> acc_bits)));
+            }
+
+            /// The dynamic table shared by the encoder or decoder of one direction.
+            class dynamic_table
+            {
+            public:
+                /// Size of an entry as defined by RFC 7541 section 4.1.
+                static std::size_t entry_size(std::string_view name, std::string_view value)
+                {
+                    return name.size() + value.size() + 32;
+                }
+
+                void add(std::string_view name, std::string_view value)
+                {
+                    std::size_t size = entry_size(name, value);
+                    while (!entries_.empty() && size_ + size > max_size_)
+                        evict();
+                    if (size > max_size_)
+                        return;
+                    entries_.emplace_front(std::string(name), std::string(value));
+                    size_ += size;
+                }
+
+                void set_max_size(std::size_t max_size)
+                {
+                    max_size_ = max_size;
+                    while (size_ > max_size_)
+                        evict();
+                }
+
+                std::size_t max_size() const
+                {
+                    return max_size_;
+                }
+
+                /// Look up an index across the static and dynamic table, null if it is out of range.
+                bool get(std::size_t index, std::string_view& name, std::string_view& value) const
+                {
+                    if (index == 0)
+                        return false;
+                    if (index <= static_table_size)
+                    {
+                        name = static_table[index - 1].name;
+                        value = static_table[index - 1].value;
+                        return true;
+                    }
+                    index -= static_table_size + 1;
+                    if (index >= entries_.size())
+                        return false;
+                    name = entries_[index].first;
+                    value = entries_[index].second;
+                    return true;
+                }
+
+                /// Find a field, the result is the index of an exact match or (negated) of an entry with the same name, 0 if there is neither.
+                long find(std::string_view name, std::string_view value) const
+                {
+                    long name_match = 0;
+                    for (std::size_t i = 0; i < entries_.size(); i++)
+                        if (entries_[i].first == name)
+                        {
+                            if (entries_[i].second == value)
+                                return static_cast<long>(static_table_size + 1 + i);
+                            if (!name_match)
+                                name_match = -static_cast<long>(static_table_size + 1 + i);
+                        }
+                    for (std::size_t i = 0; i < static_table_size; i++)
+                        if (static_table[i].name == name)
+                        {
+                            if (static_table[i].value == value)
+                                return static_cast<long>(i + 1);
+                            // Static names take less space than dynamic ones
+                            if (!name_match || name_match < -static_cast<long>(static_table_size))
+                                name_match = -static_cast<long>(i + 1);
+                        }
+                    return name_match;
+                }
 
-        template<typename MW>
-        struct check_global_call_false
-        {
-            template<typename T, typename std::enable_if<T::call_global::value == false, bool>::type = true>
-            struct get
-            {};
-        };
+            private:
+                void evict()
+                {
+                    size_ -= entry_size(entries_.back().first, entries_.back().second);
+                    entries_.pop_back();
+                }
 
-        template<typename T>
-        struct is_before_handle_arity_3_impl
-        {
-            template<typename C>
-            static std::true_type f(typename check_before_handle_arity_3_const<T>::template get<C>*);
+                std::deque<std::pair<std::string, std::string>> entries_;
+                std::size_t size_ = 0;
+                std::size_t max_size_ = 4096;
+            };
 
-            template<typename C>
-            static std::true_type f(typename check_before_handle_arity_3<T>::template get<C>*);
+            /// Decodes header blocks of one connection.
+            class decoder
+            {
+            public:
+                /// Decode a complete header block, calling `on_field(name, value)` for every field. False on a compression error,
+                /// or as soon as `on_field` returns false to stop. The table is then out of step with the peer's, so the
+                /// connection can't be used any further.
+                template<typename Callback>
+                bool decode(const uint8_t* p, std::size_t length, Callback&& on_field)
+                {
+                    const uint8_t* end = p + length;
+                    bool fields_seen = false;
+                    while (p < end)
+                    {
+                        std::size_t index;
+                        uint8_t first = *p;
+                        if (first & 0x80)
+                        {
+                            // Indexed header field
+                            std::string_view name, value;
+                            if (!decode_integer(p, end, 7, index) || !table_.get(index, name, value))
+                                return false;
+                            if (!on_field(name, value))
+                                return false;
+                        }
+                        else if ((first & 0xe0) == 0x20)
+                        {
+                            // Dynamic table size update, only allowed before the first field
+                            if (fields_seen || !decode_integer(p, end, 5, index) || index > settings_max_size)
+                                return false;
+                            table_.set_max_size(index);
+                            continue;
+                        }
+                        else
+                        {
+                            // Literal, with incremental indexing (01), without (0000) or never indexed (0001)
+                            bool indexing = (first & 0xc0) == 0x40;
+                            if (!decode_integer(p, end, indexing ? 6 : 4, index))
+                                return false;
+                            name_.clear();
+                            value_.clear();
+                            if (index)
+                            {
+                                std::string_view name, value;
+                                if (!table_.get(index, name, value))
+                                    return false;
+                                name_.assign(name.data(), name.size());
+                            }
+                            else if (!decode_string(p, end, name_))
+                                return false;
+                            if (!decode_string(p, end, value_))
+                                return false;
+                            if (!on_field(std::string_view(name_), std::string_view(value_)))
+                                return false;
+                            if (indexing)
+                                table_.add(name_, value_);
+                        }
+                        fields_seen = true;
+                    }
+                    return true;
+                }
 
-            template<typename C>
-            static std::false_type f(...);
+                /// The table size this endpoint advertised (SETTINGS_HEADER_TABLE_SIZE).
+                static constexpr std::size_t settings_max_size = 4096;
 
-        public:
-            static const bool value = decltype(f<T>(nullptr))::value;
-        };
+            private:
+                static bool decode_integer(const uint8_t*& p, const uint8_t* end, int prefix_bits, std::size_t& value)
+                {
+                    std::size_t max_prefix = (std::size_t(1) << prefix_bits) - 1;
+                    value = *p++ & max_prefix;
+                    if (value < max_prefix)
+                        return true;
+                    for (int shift = 0; p < end && shift <= 28; shift += 7)
+                    {
+                        uint8_t b = *p++;
+                        value += std::size_t(b & 0x7f) << shift;
+                        if (!(b & 0x80))
+                            return true;
+                    }
+                    return false;
+                }
 
-        template<typename T>
-        struct is_after_handle_arity_3_impl
-        {
-            template<typename C>
-            static std::true_type f(typename check_after_handle_arity_3_const<T>::template get<C>*);
+                static bool decode_string(const uint8_t*& p, const uint8_t* end, std::string& out)
+                {
+                    if (p >= end)
+                        return false;
+                    bool huffman = *p & 0x80;
+                    std::size_t length;
+                    if (!decode_integer(p, end, 7, length) || length > static_cast<std::size_t>(end - p))
+                        return false;
+                    bool ok = true;
+                    if (huffman)
+                        ok = huffman_tree::get().decode(p, length, out);
+                    else
+                        out.append(reinterpret_cast<const char*>(p), length);
+                    p += length;
+                    return ok;
+                }
 
-            template<typename C>
-            static std::true_type f(typename check_after_handle_arity_3<T>::template get<C>*);
+                dynamic_table table_;
+                std::string name_;
+                std::string value_;
+            };
 
-            template<typename C>
-            static std::false_type f(...);
+            /// Encodes the response header blocks of one connection.
+            class encoder
+            {
+            public:
+                /// Follow a new SETTINGS_HEADER_TABLE_SIZE from the peer, announced at the start of the next block.
+                void set_max_size(std::size_t max_size)
+                {
+                    max_size = max_size < 4096 ? max_size : 4096;
+                    if (max_size != table_.max_size())
+                    {
+                        table_.set_max_size(max_size);
+                        size_update_ = true;
+                    }
+                }
 
-        public:
-            static constexpr bool value = decltype(f<T>(nullptr))::value;
-        };
+                void begin(std::string& out)
+                {
+                    if (size_update_)
+                    {
+                        encode_integer(out, 0x20, 5, table_.max_size());
+                        size_update_ = false;
+                    }
+                }
 
-        template<typename MW>
-        struct is_middleware_global
-        {
-            template<typename C>
-            static std::false_type f(typename check_global_call_false<MW>::template get<C>*);
+                /// Add a field, values that change with every response are not worth a table entry.
+                void field(std::string& out, std::string_view name, std::string_view value, bool index = true)
+                {
+                    long found = table_.find(name, value);
+                    if (found > 0)
+                    {
+                        encode_integer(out, 0x80, 7, static_cast<std::size_t>(found));
+                        return;
+                    }
+                    if (index)
+                        encode_integer(out, 0x40, 6, static_cast<std::size_t>(-found));
+                    else
+                        encode_integer(out, 0x00, 4, static_cast<std::size_t>(-found));
+                    if (!found)
+                        encode_string(out, name);
+                    encode_string(out, value);
+                    if (index)
+                        table_.add(name, value);
+                }
 
-            template<typename C>
-            static std::true_type f(...);
+            private:
+                dynamic_table table_;
+                bool size_update_ = false;
+            };
+        } // namespace hpack
 
-            static const bool value = decltype(f<MW>(nullptr))::value;
-        };
+        /// An HTTP/2 connection, serves every stream on it through the same handler and middlewares as \ref crow.Connection.
 
-        template<typename MW, typename Context, typename ParentContext>
-        typename std::enable_if<!is_before_handle_arity_3_impl<MW>::value>::type
-          before_handler_call(MW& mw, request& req, response& res, Context& ctx, ParentContext& /*parent_ctx*/)
+        ///
+        /// Everything runs on the io_context of the adaptor, responses completed on other threads are dispatched back to it.
+        /// Frames produced while handling one read (or one completion) are sent with a single write.
+        template<typename Adaptor, typename Handler, typename... Middlewares>
+        class session : public std::enable_shared_from_this<session<Adaptor, Handler, Middlewares...>>
         {
-            mw.before_handle(req, res, ctx.template get<MW>(), ctx);
-        }
+        public:
+            static constexpr uint32_t max_concurrent_streams = 100;
+            static constexpr uint32_t max_frame_size = 16384;
+            static constexpr std::size_t read_buffer_size = 16384;
+
+            session(
+              Adaptor&& adaptor,
+              Handler* handler,
+              const std::string& server_name,
+              std::tuple<Middlewares...>* middlewares,
+              std::function<const std::string&()>& get_cached_date_str_f,
+              detail::task_timer& task_timer,
+              std::atomic<unsigned int>& queue_length):
+              adaptor_(std::move(adaptor)),
+              handler_(handler),
+              server_name_(server_name),
+              middlewares_(middlewares),
+              get_cached_date_str(get_cached_date_str_f),
+              task_timer_(task_timer),
+              queue_length_(queue_length)
+            {
+                error_code ec;
+                auto endpoint = adaptor_.raw_socket().remote_endpoint(ec);
+                if (!ec)
+                    remote_ip_address_ = endpoint.address().to_string();
+            }
 
-        template<typename MW, typename Context, typename ParentContext>
-        typename std::enable_if<is_before_handle_arity_3_impl<MW>::value>::type
-          before_handler_call(MW& mw, request& req, response& res, Context& ctx, ParentContext& /*parent_ctx*/)
-        {
-            mw.before_handle(req, res, ctx.template get<MW>());
-        }
+            /// The connection was counted by the \ref crow.Connection it started on.
+            ~session()
+            {
+                queue_length_--;
+#ifndef CROW_DISABLE_METRICS
+                handler_->metrics().connection_closed();
+#endif
+            }
 
-        template<typename MW, typename Context, typename ParentContext>
-        typename std::enable_if<!is_after_handle_arity_3_impl<MW>::value>::type
-          after_handler_call(MW& mw, request& req, response& res, Context& ctx, ParentContext& /*parent_ctx*/)
-        {
-            mw.after_handle(req, res, ctx.template get<MW>(), ctx);
-        }
+            /// Start on a prior knowledge connection, `data` is the input read so far (starting with the preface).
+            void start(const char* data, std::size_t length)
+            {
+                write_settings();
+                input_.assign(data, length);
+                process_input();
+            }
 
-        template<typename MW, typename Context, typename ParentContext>
-        typename std::enable_if<is_after_handle_arity_3_impl<MW>::value>::type
-          after_handler_call(MW& mw, request& req, response& res, Context& ctx, ParentContext& /*parent_ctx*/)
-        {
-            mw.after_handle(req, res, ctx.template get<MW>());
-        }
+            /// Start after `Upgrade: h2c` was answered, the request that carried the upgrade becomes stream 1.
+            ///
+            /// `settings` is the decoded HTTP2-Settings header.
+            void start_upgraded(request&& req, const std::string& settings)
+            {
+                write_settings();
+                if (!apply_settings(reinterpret_cast<const uint8_t*>(settings.data()), settings.size()))
+                {
+                    close(PROTOCOL_ERROR);
+                    return;
+                }
 
+                last_stream_id_ = 1;
+                stream& s = streams_[1];
+                s.req = std::move(req);
+                s.req.upgrade = false;
+#ifndef CROW_DISABLE_METRICS
+                s.req.phases.start();
+#endif
+                s.send_window = peer_initial_window_;
+                dispatch(1, s);
 
-        template<typename CallCriteria,
-                 int N, typename Context, typename Container>
-        typename std::enable_if<(N < std::tuple_size<typename std::remove_reference<Container>::type>::value), bool>::type
-          middleware_call_helper(const CallCriteria& cc, Container& middlewares, request& req, response& res, Context& ctx)
-        {
+                process_input();
+            }
 
-            using CurrentMW = typename std::tuple_element<N, typename std::remove_reference<Container>::type>::type;
+        private:
+            struct stream
+            {
+                request req;
+                response res;
+                detail::context<Middlewares...> ctx;
+                int64_t send_window = 65535;
+                std::string body;       ///< Response body, sent as far as flow control allows.
+                std::size_t sent = 0;   ///< Bytes of `body` already sent.
+                bool handling = false;  ///< The handler hasn't completed the response yet.
+                bool after_handlers = false;
+                bool reset = false;     ///< The client reset the stream, the response is dropped.
+                bool has_method = false;
+                bool has_path = false;
+#ifndef CROW_DISABLE_METRICS
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                const std::string* route = nullptr;
+                metrics::worker_stats* in_flight = nullptr;
+#endif
+            };
 
-            if (!cc.template enabled<CurrentMW>(N))
+            /// Read more input.
+            void do_read()
             {
-                return middleware_call_helper<CallCriteria, N + 1, Context, Container>(cc, middlewares, req, res, ctx);
+                if (streams_.empty())
+                    start_deadline();
+                auto self = this->shared_from_this();
+                adaptor_.socket().async_read_some(
+                  asio::buffer(read_buffer_, read_buffer_size),
+                  [self](const error_code& ec, std::size_t bytes_transferred) {
+                      if (ec)
+                      {
+                          // Responses still being handled are dropped
+                          self->closing_ = true;
+                          self->cancel_deadline_timer();
+                          self->adaptor_.close();
+                          return;
+                      }
+#ifndef CROW_DISABLE_METRICS
+                      self->handler_->metrics().received(bytes_transferred);
+#endif
+                      self->input_.append(self->read_buffer_, bytes_transferred);
+                      self->process_input();
+                  });
             }
 
-            using parent_context_t = typename Context::template partial<N - 1>;
-            before_handler_call<CurrentMW, Context, parent_context_t>(std::get<N>(middlewares), req, res, ctx, static_cast<parent_context_t&>(ctx));
-            if (res.is_completed())
+            /// Handle every complete frame in the input, then send what they produced and read on.
+            void process_input()
             {
-                after_handler_call<CurrentMW, Context, parent_context_t>(std::get<N>(middlewares), req, res, ctx, static_cast<parent_context_t&>(ctx));
-                return true;
+                in_process_input_ = true;
+                std::size_t offset = 0;
+                if (!preface_received_)
+                {
+                    if (!input_.empty() && !is_preface(input_.data(), input_.size()))
+                    {
+                        close(PROTOCOL_ERROR);
+                        return;
+                    }
+                    if (input_.size() < preface_length)
+                        return flush_and_read();
+                    preface_received_ = true;
+                    offset = preface_length;
+                }
+
+                while (!closing_ && input_.size() - offset >= 9)
+                {
+                    const uint8_t* p = reinterpret_cast<const uint8_t*>(input_.data()) + offset;
+                    uint32_t length = (uint32_t(p[0]) << 16) | (uint32_t(p[1]) << 8) | p[2];
+                    if (length > max_frame_size)
+                    {
+                        close(FRAME_SIZE_ERROR);
+                        return;
+                    }
+                    if (input_.size() - offset < 9 + length)
+                        break;
+                    uint8_t type = p[3];
+                    uint8_t flags = p[4];
+                    uint32_t stream_id = read32(p + 5) & 0x7fffffff;
+                    offset += 9 + length;
+                    if (!process_frame(type, flags, stream_id, p + 9, length))
+                        return;
+                }
+                input_.erase(0, offset);
+
+                if (!closing_)
+                    flush_and_read();
             }
 
-            if (middleware_call_helper<CallCriteria, N + 1, Context, Container>(cc, middlewares, req, res, ctx))
+            /// \return false if the connection was closed.
+            bool process_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t length)
             {
-                after_handler_call<CurrentMW, Context, parent_context_t>(std::get<N>(middlewares), req, res, ctx, static_cast<parent_context_t&>(ctx));
-                return true;
+                // A header block has to be finished before anything else
+                if (continuation_stream_ && (type != CONTINUATION || stream_id != continuation_stream_))
+                    return close(PROTOCOL_ERROR);
+
+                switch (type)
+                {
+                    case DATA:
+                        return on_data(flags, stream_id, payload, length);
+                    case HEADERS:
+                        return on_headers(flags, stream_id, payload, length);
+                    case CONTINUATION:
+                        if (!continuation_stream_)
+                            return close(PROTOCOL_ERROR);
+                        return on_header_block_fragment(flags, stream_id, payload, length);
+                    case RST_STREAM:
+                    {
+                        if (length != 4 || stream_id == 0)
+                            return close(length != 4 ? FRAME_SIZE_ERROR : PROTOCOL_ERROR);
+                        auto it = streams_.find(stream_id);
+                        if (it != streams_.end())
+                        {
+                            if (it->second.handling)
+                                it->second.reset = true;
+                            else
+                                streams_.erase(it);
+                        }
+                        return true;
+                    }
+                    case SETTINGS:
+                        if (stream_id != 0)
+                            return close(PROTOCOL_ERROR);
+                        if (flags & ACK)
+                            return length == 0 || close(FRAME_SIZE_ERROR);
+                        if (length % 6 != 0)
+                            return close(FRAME_SIZE_ERROR);
+                        if (!apply_settings(payload, length))
+                            return close(PROTOCOL_ERROR);
+                        write_frame_header(0, SETTINGS, ACK, 0);
+                        send_pending_data();
+                        return true;
+                    case PING:
+                        if (stream_id != 0)
+                            return close(PROTOCOL_ERROR);
+                        if (length != 8)
+                            return close(FRAME_SIZE_ERROR);
+                        if (!(flags & ACK))
+                        {
+                            write_frame_header(8, PING, ACK, 0);
+                            output_.append(reinterpret_cast<const char*>(payload), 8);
+                        }
+                        return true;
+                    case GOAWAY:
+                        // The client won't open more streams, finish the ones in progress
+                        goaway_received_ = true;
+                        return true;
+                    case WINDOW_UPDATE:
+                    {
+                        if (length != 4)
+                            return close(FRAME_SIZE_ERROR);
+                        uint32_t increment = read32(payload) & 0x7fffffff;
+                        if (increment == 0)
+                            return stream_id ? (reset_stream(stream_id, PROTOCOL_ERROR), true) : close(PROTOCOL_ERROR);
+                        if (stream_id == 0)
+                        {
+                            connection_send_window_ += increment;
+                            if (connection_send_window_ > 0x7fffffff)
+                                return close(FLOW_CONTROL_ERROR);
+                        }
+                        else
+                        {
+                            auto it = streams_.find(stream_id);
+                            if (it == streams_.end())
+                                return true;
+                            it->second.send_window += increment;
+                            if (it->second.send_window > 0x7fffffff)
+                            {
+                                reset_stream(stream_id, FLOW_CONTROL_ERROR);
+                                return true;
+                            }
+                        }
+                        send_pending_data();
+                        return true;
+                    }
+                    case PUSH_PROMISE:
+                        return close(PROTOCOL_ERROR);
+                    default:
+                        // PRIORITY and unknown frame types are ignored
+                        return true;
+                }
             }
 
-            return false;
-        }
+            bool on_headers(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t length)
+            {
+                if (stream_id == 0 || !(stream_id & 1))
+                    return close(PROTOCOL_ERROR);
+                if (!strip_padding(flags, payload, length))
+                    return close(PROTOCOL_ERROR);
+                if (flags & PRIORITY_FLAG)
+                {
+                    if (length < 5)
+                        return close(FRAME_SIZE_ERROR);
+                    payload += 5;
+                    length -= 5;
+                }
 
-        template<typename CallCriteria, int N, typename Context, typename Container>
-        typename std::enable_if<(N >= std::tuple_size<typename std::remove_reference<Container>::type>::value), bool>::type
-          middleware_call_helper(const CallCriteria& /*cc*/, Container& /*middlewares*/, request& /*req*/, response& /*res*/, Context& /*ctx*/)
-        {
-            return false;
-        }
+                auto it = streams_.find(stream_id);
+                if (it == streams_.end())
+                {
+                    if (stream_id <= last_stream_id_)
+                        return close(STREAM_CLOSED);
+                    last_stream_id_ = stream_id;
+                    if (goaway_received_ || streams_.size() >= max_concurrent_streams)
+                    {
+                        // The header block still has to go through the decoder to keep its table in sync
+                        refused_stream_ = stream_id;
+                    }
+                    else
+                    {
+                        stream& s = streams_[stream_id];
+                        s.send_window = peer_initial_window_;
+#ifndef CROW_DISABLE_METRICS
+                        s.req.phases.start();
+#endif
+                        cancel_deadline_timer();
+                    }
+                }
+                else if (it->second.handling || it->second.sent || !(flags & END_STREAM))
+                {
+                    // Trailers have to end the stream
+                    return close(PROTOCOL_ERROR);
+                }
 
-        template<typename CallCriteria, int N, typename Context, typename Container>
-        typename std::enable_if<(N < 0)>::type
-          after_handlers_call_helper(const CallCriteria& /*cc*/, Container& /*middlewares*/, Context& /*context*/, request& /*req*/, response& /*res*/)
-        {
-        }
+                header_block_.clear();
+                header_block_end_stream_ = flags & END_STREAM;
+                return on_header_block_fragment(flags, stream_id, payload, length);
+            }
 
-        template<typename CallCriteria, int N, typename Context, typename Container>
-        typename std::enable_if<(N == 0)>::type after_handlers_call_helper(const CallCriteria& cc, Container& middlewares, Context& ctx, request& req, response& res)
-        {
-            using parent_context_t = typename Context::template partial<N - 1>;
-            using CurrentMW = typename std::tuple_element<N, typename std::remove_reference<Container>::type>::type;
-            if (cc.template enabled<CurrentMW>(N))
+            bool on_header_block_fragment(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t length)
             {
-                after_handler_call<CurrentMW, Context, parent_context_t>(std::get<N>(middlewares), req, res, ctx, static_cast<parent_context_t&>(ctx));
+                if (header_block_.size() + length > CROW_HTTP_MAX_HEADER_SIZE)
+                    return close(ENHANCE_YOUR_CALM);
+                header_block_.append(reinterpret_cast<const char*>(payload), length);
+                if (!(flags & END_HEADERS))
+                {
+                    continuation_stream_ = stream_id;
+                    return true;
+                }
+                continuation_stream_ = 0;
+
+                auto it = streams_.find(stream_id);
+                stream* s = it != streams_.end() && !refused_stream_ ? &it->second : nullptr;
+                bool trailers = s && (s->has_method || s->has_path);
+                bool malformed = false;
+                std::size_t list_size = 0;
+                bool too_large = false;
+                bool ok = decoder_.decode(
+                  reinterpret_cast<const uint8_t*>(header_block_.data()), header_block_.size(),
+                  [&](std::string_view name, std::string_view value) {
+                      // Small blocks can expand through the dynamic table, so stop before storing past the limit
+                      list_size += hpack::dynamic_table::entry_size(name, value);
+                      if (list_size > CROW_HTTP_MAX_HEADER_SIZE)
+                      {
+                          too_large = true;
+                          return false;
+                      }
+                      if (s && !trailers)
+                          malformed |= !add_field(*s, name, value);
+                      return true;
+                  });
+                if (too_large)
+                    return close(ENHANCE_YOUR_CALM);
+                if (!ok)
+                    return close(COMPRESSION_ERROR);
+
+                if (refused_stream_)
+                {
+                    reset_stream(refused_stream_, REFUSED_STREAM);
+                    refused_stream_ = 0;
+                    return true;
+                }
+                if (!s)
+                    return true;
+                if (malformed || !s->has_method || !s->has_path)
+                {
+                    reset_stream(stream_id, PROTOCOL_ERROR);
+                    return true;
+                }
+                if (header_block_end_stream_)
+                    dispatch(stream_id, *s);
+                return true;
             }
-        }
 
-        template<typename CallCriteria, int N, typename Context, typename Container>
-        typename std::enable_if<(N > 0)>::type after_handlers_call_helper(const CallCriteria& cc, Container& middlewares, Context& ctx, request& req, response& res)
-        {
-            using parent_context_t = typename Context::template partial<N - 1>;
-            using CurrentMW = typename std::tuple_element<N, typename std::remove_reference<Container>::type>::type;
-            if (cc.template enabled<CurrentMW>(N))
+            /// Put a decoded field into the request, false if the request is malformed.
+            bool add_field(stream& s, std::string_view name, std::string_view value)
             {
-                after_handler_call<CurrentMW, Context, parent_context_t>(std::get<N>(middlewares), req, res, ctx, static_cast<parent_context_t&>(ctx));
+                if (name.empty() || name[0] != ':')
+                {
+                    s.req.headers.emplace(name, value);
+                    return true;
+                }
+                if (name == ":method")
+                {
+                    for (int m = 0; m < static_cast<int>(HTTPMethod::InternalMethodCount); m++)
+                        if (value == method_strings[m])
+                        {
+                            s.req.method = static_cast<HTTPMethod>(m);
+                            s.has_method = true;
+                            return true;
+                        }
+                    return false;
+                }
+                if (name == ":path")
+                {
+                    s.req.raw_url.assign(value.data(), value.size());
+                    s.req.url_params.assign(s.req.raw_url);
+                    s.req.url.assign(s.req.raw_url, 0, s.req.raw_url.find('?'));
+                    s.has_path = !value.empty();
+                    return true;
+                }
+                if (name == ":authority")
+                {
+                    // Routes and middlewares look for the Host header
+                    if (!s.req.headers.count("host"))
+                        s.req.headers.emplace("host", value);
+                    return true;
+                }
+                return name == ":scheme";
             }
-            after_handlers_call_helper<CallCriteria, N - 1, Context, Container>(cc, middlewares, ctx, req, res);
-        }
 
-        // A CallCriteria that accepts only global middleware
-        struct middleware_call_criteria_only_global
-        {
-            template<typename MW>
-            constexpr bool enabled(int) const
+            bool on_data(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t length)
             {
-                return is_middleware_global<MW>::value;
-            }
-        };
-
-        template<typename F, typename... Args>
-        typename std::enable_if<black_magic::CallHelper<F, black_magic::S<Args...>>::value, void>::type
-          wrapped_handler_call(crow::request& /*req*/, crow::response& res, const F& f, Args&&... args)
-        {
-            static_assert(!std::is_same<void, decltype(f(std::declval<Args>()...))>::value,
-                          "Handler function cannot have void return type; valid return types: string, int, crow::response, crow::returnable");
+                if (stream_id == 0)
+                    return close(PROTOCOL_ERROR);
+                // Padding counts against flow control too
+                uint32_t frame_length = length;
+                if (!strip_padding(flags, payload, length))
+                    return close(PROTOCOL_ERROR);
 
-            res = crow::response(f(std::forward<Args>(args)...));
-            res.end();
-        }
+                auto it = streams_.find(stream_id);
+                if (it == streams_.end() && stream_id > last_stream_id_)
+                    return close(PROTOCOL_ERROR);
 
-        template<typename F, typename... Args>
-        typename std::enable_if<
-          !black_magic::CallHelper<F, black_magic::S<Args...>>::value &&
-            black_magic::CallHelper<F, black_magic::S<crow::request&, Args...>>::value,
-          void>::type
-          wrapped_handler_call(crow::request& req, crow::response& res, const F& f, Args&&... args)
-        {
-            static_assert(!std::is_same<void, decltype(f(std::declval<crow::request>(), std::declval<Args>()...))>::value,
-                          "Handler function cannot have void return type; valid return types: string, int, crow::response, crow::returnable");
+                // Everything received is consumed right away, so the windows are opened again at once. Only the
+                // connection's for a stream that is gone or already answered, its own window doesn't matter any more.
+                if (frame_length > 0)
+                    write_window_update(0, frame_length);
+                if (it == streams_.end() || it->second.handling || it->second.sent)
+                {
+                    reset_stream(stream_id, STREAM_CLOSED);
+                    return true;
+                }
+                stream& s = it->second;
+                if (frame_length > 0 && !(flags & END_STREAM))
+                    write_window_update(stream_id, frame_length);
+                s.req.body.append(reinterpret_cast<const char*>(payload), length);
+                if (flags & END_STREAM)
+                    dispatch(stream_id, s);
+                return true;
+            }
 
-            res = crow::response(f(req, std::forward<Args>(args)...));
-            res.end();
-        }
+            /// Hand a complete request to the middlewares and the router, the same way \ref crow.Connection::handle does.
+            void dispatch(uint32_t stream_id, stream& s)
+            {
+                request& req = s.req;
+                response& res = s.res;
+#ifndef CROW_DISABLE_METRICS
+                req.phases.mark("parse");
+#endif
+                req.http_ver_major = 2;
+                req.http_ver_minor = 0;
+                req.keep_alive = true;
+                req.middleware_context = static_cast<void*>(&s.ctx);
+                req.middleware_container = static_cast<void*>(middlewares_);
+                req.io_context = &adaptor_.get_io_context();
+                req.remote_ip_address = remote_ip_address_;
+
+                CROW_LOG_INFO << "Request: " << remote_ip_address_ << " " << this << " HTTP/2 stream " << stream_id << ' ' << method_name(req.method) << " " << req.url;
+
+                s.handling = true;
+                if (!handling_count_++)
+                    self_while_handling_ = this->shared_from_this();
+
+                // The stream can't be completed from inside response::end(), the router still holds the response.
+                // Completions during a read are collected and sent together, the ones from other threads are posted.
+                res.complete_request_handler_ = [this, stream_id] {
+                    if (adaptor_.get_io_context().get_executor().running_in_this_thread() && in_process_input_)
+                    {
+                        completed_.push_back(stream_id);
+                        return;
+                    }
+                    // complete() can let go of the last reference
+                    asio::post(adaptor_.get_io_context(), [self = this->shared_from_this(), stream_id] {
+                        self->complete(stream_id);
+                        self->flush();
+                        self->close_if_done();
+                    });
+                };
+                res.is_alive_helper_ = [this]() -> bool {
+                    return adaptor_.is_open();
+                };
 
-        template<typename F, typename... Args>
-        typename std::enable_if<
-          !black_magic::CallHelper<F, black_magic::S<Args...>>::value &&
-            !black_magic::CallHelper<F, black_magic::S<crow::request&, Args...>>::value &&
-            black_magic::CallHelper<F, black_magic::S<crow::response&, Args...>>::value,
-          void>::type
-          wrapped_handler_call(crow::request& /*req*/, crow::response& res, const F& f, Args&&... args)
-        {
-            static_assert(std::is_same<void, decltype(f(std::declval<crow::response&>(), std::declval<Args>()...))>::value,
-                          "Handler function with response argument should have void return type");
+                routing_handle_result found;
+                found.rule_index = 0;
+                // As over HTTP/1, OPTIONS goes to the middlewares first and is routed only if none of them answered it
+                bool route_after_middlewares = req.method == HTTPMethod::Options;
+                if (!route_after_middlewares)
+                {
+                    handler_->handle_initial(req, res, found);
+#ifndef CROW_DISABLE_METRICS
+                    s.route = handler_->matched_rule(found);
+                    req.phases.mark("route");
+#endif
+                    if (!found.rule_index)
+                    {
+                        completed_.push_back(stream_id);
+                        return;
+                    }
+                }
 
-            f(res, std::forward<Args>(args)...);
-        }
+                detail::middleware_call_helper<detail::middleware_call_criteria_only_global,
+                                               0, decltype(s.ctx), decltype(*middlewares_)>({}, *middlewares_, req, res, s.ctx);
+#ifndef CROW_DISABLE_METRICS
+                req.phases.mark("middleware");
+#endif
+                if (!res.completed_ && route_after_middlewares)
+                {
+                    s.after_handlers = true;
+                    handler_->handle_initial(req, res, found);
+                }
+                else if (!res.completed_)
+                {
+                    s.after_handlers = true;
+#ifndef CROW_DISABLE_METRICS
+                    detail::worker_monitor* monitor = detail::worker_monitor::current();
+                    if (monitor)
+                    {
+                        s.in_flight = &monitor->stats();
+                        s.in_flight->requests_in_flight.fetch_add(1, std::memory_order_relaxed);
+                        monitor->enter(s.route, req.method);
+                    }
+                    handler_->handle(req, res, found);
+                    if (monitor)
+                        monitor->leave();
+#else
+                    handler_->handle(req, res, found);
+#endif
+                }
+                else
+                {
+                    completed_.push_back(stream_id);
+                }
+            }
 
-        template<typename F, typename... Args>
-        typename std::enable_if<
-          !black_magic::CallHelper<F, black_magic::S<Args...>>::value &&
-            !black_magic::CallHelper<F, black_magic::S<crow::request&, Args...>>::value &&
-            !black_magic::CallHelper<F, black_magic::S<crow::response&, Args...>>::value &&
-            black_magic::CallHelper<F, black_magic::S<const crow::request&, crow::response&, Args...>>::value,
-          void>::type
-          wrapped_handler_call(crow::request& req, crow::response& res, const F& f, Args&&... args)
-        {
-            static_assert(std::is_same<void, decltype(f(std::declval<crow::request&>(), std::declval<crow::response&>(), std::declval<Args>()...))>::value,
-                          "Handler function with response argument should have void return type");
+            /// Complete the streams that were answered while handling the input.
+            void complete_collected()
+            {
+                for (std::size_t i = 0; i < completed_.size(); i++)
+                    complete(completed_[i]);
+                completed_.clear();
+            }
 
-            f(req, res, std::forward<Args>(args)...);
-        }
+            /// Run the after handlers and queue the response of a stream.
+            void complete(uint32_t stream_id)
+            {
+                auto it = streams_.find(stream_id);
+                if (it == streams_.end())
+                    return;
+                stream& s = it->second;
+                request& req = s.req;
+                response& res = s.res;
+                res.complete_request_handler_ = nullptr;
+                res.is_alive_helper_ = nullptr;
+#ifndef CROW_DISABLE_METRICS
+                req.phases.mark("handler");
+                if (s.in_flight)
+                {
+                    s.in_flight->requests_in_flight.fetch_sub(1, std::memory_order_relaxed);
+                    s.in_flight = nullptr;
+                }
+#endif
 
-        // wrapped_handler_call transparently wraps a handler call behind (req, res, args...)
-        template<typename F, typename... Args>
-        typename std::enable_if<
-          !black_magic::CallHelper<F, black_magic::S<Args...>>::value &&
-            !black_magic::CallHelper<F, black_magic::S<crow::request&, Args...>>::value &&
-            !black_magic::CallHelper<F, black_magic::S<crow::response&, Args...>>::value &&
-            !black_magic::CallHelper<F, black_magic::S<const crow::request&, crow::response&, Args...>>::value,
-          void>::type
-          wrapped_handler_call(crow::request& req, crow::response& res, const F& f, Args&&... args)
-        {
-            static_assert(std::is_same<void, decltype(f(std::declval<crow::request&>(), std::declval<crow::response&>(), std::declval<Args>()...))>::value,
-                          "Handler function with response argument should have void return type");
+                if (s.after_handlers)
+                {
+                    detail::after_handlers_call_helper<
+                      detail::middleware_call_criteria_only_global,
+                      (static_cast<int>(sizeof...(Middlewares)) - 1),
+                      decltype(s.ctx),
+                      decltype(*middlewares_)>({}, *middlewares_, s.ctx, req, res);
+                }
+                CROW_LOG_INFO << "Response: " << this << " stream " << stream_id << ' ' << req.raw_url << ' ' << res.code;
+
+                s.handling = false;
+                std::shared_ptr<session> self;
+                if (!--handling_count_)
+                    self = std::move(self_while_handling_);
+
+#ifndef CROW_DISABLE_METRICS
+                auto latency = std::chrono::steady_clock::now() - s.start;
+                const std::string* route = s.route;
+                HTTPMethod method = req.method;
+                int code = res.code;
+                std::size_t bytes = 0;
+#endif
+                if (s.reset || closing_)
+                {
+                    streams_.erase(it);
+                }
+                else
+                {
+                    if (res.is_static_type())
+                    {
+                        std::ifstream is(res.file_info.path.c_str(), std::ios::in | std::ios::binary);
+                        res.body.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+                    }
+#ifdef CROW_ENABLE_COMPRESSION
+                    if (!res.body.empty() && handler_->compression_used() && res.compressed)
+                    {
+                        std::string_view accept_encoding = req.get_header_view("Accept-Encoding");
+                        if (handler_->compression_algorithm() == compression::DEFLATE && accept_encoding.find("deflate") != std::string::npos)
+                        {
+                            res.body = compression::compress_string(res.body, compression::algorithm::DEFLATE);
+                            res.set_header("Content-Encoding", "deflate");
+                        }
+                        else if (handler_->compression_algorithm() == compression::GZIP && accept_encoding.find("gzip") != std::string::npos)
+                        {
+                            res.body = compression::compress_string(res.body, compression::algorithm::GZIP);
+                            res.set_header("Content-Encoding", "gzip");
+                        }
+                    }
+#endif
+#ifndef CROW_DISABLE_METRICS
+                    req.phases.mark("after");
+                    if (handler_->server_timing())
+                        res.set_header("Server-Timing", req.phases.server_timing());
+                    handler_->metrics().observe_phases(route, method, req.phases);
+#endif
+                    write_headers(stream_id, res);
+                    s.body = std::move(res.body);
+                    s.sent = 0;
+#ifndef CROW_DISABLE_METRICS
+                    bytes = header_block_out_.size() + s.body.size();
+#endif
+                    if (s.body.empty())
+                        streams_.erase(it);
+                    else
+                        send_pending_data();
+                }
+#ifndef CROW_DISABLE_METRICS
+                handler_->metrics().observe(route, method, code, latency, bytes);
+#endif
+            }
 
-            f(req, res, std::forward<Args>(args)...);
-        }
+            /// After a GOAWAY from the client the connection is closed once its last stream is answered.
+            void close_if_done()
+            {
+                if (goaway_received_ && streams_.empty() && !closing_)
+                    close(NO_ERROR);
+            }
 
-        template<bool Reversed>
-        struct middleware_call_criteria_dynamic
-        {};
+            void write_headers(uint32_t stream_id, response& res)
+            {
+                std::string& block = header_block_out_;
+                block.clear();
+                encoder_.begin(block);
+                std::string status = std::to_string(res.code);
+                encoder_.field(block, ":status", status);
 
-        template<>
-        struct middleware_call_criteria_dynamic<false>
-        {
-            middleware_call_criteria_dynamic(const std::vector<int>& indices_):
-              indices(indices_), slider(0) {}
+                std::string name;
+                for (const auto& kv : res.headers)
+                {
+                    name.assign(kv.first);
+                    for (char& c : name)
+                        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+                    // Connection specific headers are not allowed in HTTP/2
+                    if (name == "connection" || name == "keep-alive" || name == "transfer-encoding" || name == "upgrade" || name == "proxy-connection")
+                        continue;
+                    encoder_.field(block, name, kv.second, name != "content-length" && name != "date" && name != "etag");
+                }
+                if (res.header_block)
+                {
+                    std::string_view lines = *res.header_block;
+                    for (std::size_t start = 0, end; (end = lines.find("\r\n", start)) != std::string_view::npos; start = end + 2)
+                    {
+                        std::size_t colon = lines.find(':', start);
+                        if (colon >= end)
+                            continue;
+                        std::size_t value = std::min(lines.find_first_not_of(' ', colon + 1), end);
+                        encoder_.field(block, lines.substr(start, colon - start), lines.substr(value, end - value));
+                    }
+                }
+                if (!res.manual_length_header && !res.headers.count("content-length"))
+                    encoder_.field(block, "content-length", std::to_string(res.body.size()), false);
+                if (!res.headers.count("server"))
+                    encoder_.field(block, "server", server_name_);
+                if (!res.headers.count("date"))
+                    encoder_.field(block, "date", get_cached_date_str());
+
+                // Split into HEADERS and CONTINUATION frames
+                bool end_stream = res.body.empty();
+                std::size_t offset = 0;
+                do
+                {
+                    std::size_t length = std::min<std::size_t>(block.size() - offset, peer_max_frame_size_);
+                    uint8_t flags = (offset + length == block.size() ? END_HEADERS : 0);
+                    if (offset == 0)
+                        flags |= end_stream ? END_STREAM : 0;
+                    write_frame_header(static_cast<uint32_t>(length), offset == 0 ? HEADERS : CONTINUATION, flags, stream_id);
+                    output_.append(block, offset, length);
+                    offset += length;
+                } while (offset < block.size());
+            }
 
-            template<typename>
-            bool enabled(int mw_index) const
+            /// Send response bodies as far as the flow control windows allow.
+            void send_pending_data()
             {
-                if (slider < int(indices.size()) && indices[slider] == mw_index)
+                for (auto it = streams_.begin(); it != streams_.end() && connection_send_window_ > 0;)
                 {
-                    slider++;
-                    return true;
+                    stream& s = it->second;
+                    if (s.handling || s.body.empty())
+                    {
+                        ++it;
+                        continue;
+                    }
+                    while (s.sent < s.body.size() && s.send_window > 0 && connection_send_window_ > 0)
+                    {
+                        std::size_t length = std::min<std::size_t>({s.body.size() - s.sent, peer_max_frame_size_,
+                                                                    static_cast<std::size_t>(s.send_window), static_cast<std::size_t>(connection_send_window_)});
+                        bool last = s.sent + length == s.body.size();
+                        write_frame_header(static_cast<uint32_t>(length), DATA, last ? END_STREAM : 0, it->first);
+                        output_.append(s.body, s.sent, length);
+                        s.sent += length;
+                        s.send_window -= length;
+                        connection_send_window_ -= length;
+                    }
+                    if (s.sent == s.body.size())
+                        it = streams_.erase(it);
+                    else
+                        ++it;
                 }
-                return false;
             }
 
-        private:
-            const std::vector<int>& indices;
-            mutable int slider;
-        };
-
-        template<>
-        struct middleware_call_criteria_dynamic<true>
-        {
-            middleware_call_criteria_dynamic(const std::vector<int>& indices_):
-              indices(indices_), slider(int(indices_.size()) - 1) {}
-
-            template<typename>
-            bool enabled(int mw_index) const
+            /// \return false if the settings are invalid.
+            bool apply_settings(const uint8_t* p, std::size_t length)
             {
-                if (slider >= 0 && indices[slider] == mw_index)
+                for (std::size_t i = 0; i + 6 <= length; i += 6)
                 {
-                    slider--;
-                    return true;
+                    uint16_t id = static_cast<uint16_t>((p[i] << 8) | p[i + 1]);
+                    uint32_t value = read32(p + i + 2);
+                    switch (id)
+                    {
+                        case HEADER_TABLE_SIZE:
+                            encoder_.set_max_size(value);
+                            break;
+                        case ENABLE_PUSH:
+                            if (value > 1)
+                                return false;
+                            break;
+                        case INITIAL_WINDOW_SIZE:
+                        {
+                            if (value > 0x7fffffff)
+                                return false;
+                            int64_t delta = static_cast<int64_t>(value) - peer_initial_window_;
+                            peer_initial_window_ = value;
+                            for (auto& s : streams_)
+                                s.second.send_window += delta;
+                            break;
+                        }
+                        case MAX_FRAME_SIZE:
+                            if (value < 16384 || value > 16777215)
+                                return false;
+                            peer_max_frame_size_ = value;
+                            break;
+                        default:
+                            break;
+                    }
                 }
-                return false;
+                return true;
             }
 
-        private:
-            const std::vector<int>& indices;
-            mutable int slider;
-        };
-
-    } // namespace detail
-} // namespace crow
-
+            void write_settings()
+            {
+                write_frame_header(6, SETTINGS, 0, 0);
+                write16(MAX_CONCURRENT_STREAMS);
+                write32(max_concurrent_streams);
+            }
 
+            void write_window_update(uint32_t stream_id, uint32_t increment)
+            {
+                write_frame_header(4, WINDOW_UPDATE, 0, stream_id);
+                write32(increment);
+            }
 
-namespace crow
-{
-    namespace detail
-    {
+            void reset_stream(uint32_t stream_id, error_code_t error)
+            {
+                write_frame_header(4, RST_STREAM, 0, stream_id);
+                write32(error);
+                auto it = streams_.find(stream_id);
+                if (it == streams_.end())
+                    return;
+                if (it->second.handling)
+                    it->second.reset = true;
+                else
+                    streams_.erase(it);
+            }
 
+            /// Remove the padding of a DATA or HEADERS payload, false if the padding is longer than the frame.
+            static bool strip_padding(uint8_t flags, const uint8_t*& payload, uint32_t& length)
+            {
+                if (!(flags & PADDED))
+                    return true;
+                if (length < 1 || payload[0] >= length)
+                    return false;
+                length -= 1 + payload[0];
+                payload += 1;
+                return true;
+            }
 
-        template<typename... Middlewares>
-        struct partial_context : public black_magic::pop_back<Middlewares...>::template rebind<partial_context>, public black_magic::last_element_type<Middlewares...>::type::context
-        {
-            using parent_context = typename black_magic::pop_back<Middlewares...>::template rebind<::crow::detail::partial_context>;
-            template<int N>
-            using partial = typename std::conditional<N == sizeof...(Middlewares) - 1, partial_context, typename parent_context::template partial<N>>::type;
+            void write_frame_header(uint32_t length, uint8_t type, uint8_t flags, uint32_t stream_id)
+            {
+                char header[9] = {static_cast<char>(length >> 16), static_cast<char>(length >> 8), static_cast<char>(length),
+                                  static_cast<char>(type), static_cast<char>(flags),
+                                  static_cast<char>(stream_id >> 24), static_cast<char>(stream_id >> 16), static_cast<char>(stream_id >> 8), static_cast<char>(stream_id)};
+                output_.append(header, 9);
+            }
 
-            template<typename T>
-            typename T::context& get()
+            void write16(uint16_t value)
             {
-                return static_cast<typename T::context&>(*this);
+                output_.push_back(static_cast<char>(value >> 8));
+                output_.push_back(static_cast<char>(value));
             }
-        };
 
+            void write32(uint32_t value)
+            {
+                write16(static_cast<uint16_t>(value >> 16));
+                write16(static_cast<uint16_t>(value));
+            }
 
+            static uint32_t read32(const uint8_t* p)
+            {
+                return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+            }
 
-        template<>
-        struct partial_context<>
-        {
-            template<int>
-            using partial = partial_context;
-        };
+            void flush_and_read()
+            {
+                complete_collected();
+                in_process_input_ = false;
+                close_if_done();
+                if (closing_)
+                    return;
+                flush();
+                do_read();
+            }
 
+            /// Send everything written so far, one write at a time.
+            void flush()
+            {
+                if (writing_ || output_.empty() || !adaptor_.is_open())
+                    return;
+                writing_ = true;
+                writing_buffer_.swap(output_);
+                output_.clear();
+                auto self = this->shared_from_this();
+                asio::async_write(
+                  adaptor_.socket(), asio::buffer(writing_buffer_),
+                  [self](const error_code& ec, std::size_t /*bytes_transferred*/) {
+                      self->writing_ = false;
+                      self->writing_buffer_.clear();
+                      if (ec)
+                      {
+                          CROW_LOG_DEBUG << self.get() << " from write (http2): " << ec.message();
+                          self->adaptor_.close();
+                          return;
+                      }
+                      if (self->closing_ && self->output_.empty())
+                      {
+                          self->adaptor_.shutdown_readwrite();
+                          self->adaptor_.close();
+                          return;
+                      }
+                      self->flush();
+                  });
+            }
 
-        template<typename... Middlewares>
-        struct context : private partial_context<Middlewares...>
-        //struct context : private Middlewares::context... // simple but less type-safe
-        {
-            template<typename CallCriteria, int N, typename Context, typename Container>
-            friend typename std::enable_if<(N == 0)>::type after_handlers_call_helper(const CallCriteria& cc, Container& middlewares, Context& ctx, request& req, response& res);
-            template<typename CallCriteria, int N, typename Context, typename Container>
-            friend typename std::enable_if<(N > 0)>::type after_handlers_call_helper(const CallCriteria& cc, Container& middlewares, Context& ctx, request& req, response& res);
+            /// Send GOAWAY and close the connection once it is written.
+            ///
+            /// \return false, so frame handlers can `return close(...)`.
+            bool close(error_code_t error)
+            {
+                if (closing_)
+                    return false;
+                closing_ = true;
+                cancel_deadline_timer();
+                // Lets the handled streams go (closing_ drops their responses)
+                complete_collected();
+                write_frame_header(8, GOAWAY, 0, 0);
+                write32(last_stream_id_);
+                write32(error);
+                in_process_input_ = false;
+                flush();
+                return false;
+            }
 
-            template<typename CallCriteria, int N, typename Context, typename Container>
-            friend typename std::enable_if<(N < std::tuple_size<typename std::remove_reference<Container>::type>::value), bool>::type
-              middleware_call_helper(const CallCriteria& cc, Container& middlewares, request& req, response& res, Context& ctx);
+            void cancel_deadline_timer()
+            {
+                task_timer_.cancel(task_id_);
+                task_id_ = 0;
+            }
 
-            template<typename T>
-            typename T::context& get()
+            void start_deadline()
             {
-                return static_cast<typename T::context&>(*this);
+                cancel_deadline_timer();
+                auto self = this->shared_from_this();
+                task_id_ = task_timer_.schedule([self] {
+                    if (!self->adaptor_.is_open() || !self->streams_.empty())
+                        return;
+                    self->adaptor_.shutdown_readwrite();
+                    self->adaptor_.close();
+                });
             }
 
-            template<int N>
-            using partial = typename partial_context<Middlewares...>::template partial<N>;
+        private:
+            Adaptor adaptor_;
+            Handler* handler_;
+            const std::string& server_name_;
+            std::tuple<Middlewares...>* middlewares_;
+            std::function<const std::string&()>& get_cached_date_str;
+            detail::task_timer& task_timer_;
+            std::atomic<unsigned int>& queue_length_;
+            detail::task_timer::identifier_type task_id_{};
+            std::string remote_ip_address_;
+
+            char read_buffer_[read_buffer_size];
+            std::string input_;
+            std::string output_;
+            std::string writing_buffer_;
+            bool writing_ = false;
+            bool in_process_input_ = true;
+            bool preface_received_ = false;
+            bool goaway_received_ = false;
+            bool closing_ = false;
+
+            std::unordered_map<uint32_t, stream> streams_;
+            std::vector<uint32_t> completed_;
+            uint32_t last_stream_id_ = 0;
+            std::size_t handling_count_ = 0;
+            std::shared_ptr<session> self_while_handling_;
+
+            hpack::decoder decoder_;
+            hpack::encoder encoder_;
+            std::string header_block_;
+            std::string header_block_out_;
+            bool header_block_end_stream_ = false;
+            uint32_t continuation_stream_ = 0;
+            uint32_t refused_stream_ = 0;
+
+            int64_t connection_send_window_ = 65535;
+            int64_t peer_initial_window_ = 65535;
+            uint32_t peer_max_frame_size_ = 16384;
         };
-    } // namespace detail
+    } // namespace http2
 } // namespace crow
 
 
 #ifdef CROW_USE_BOOST
 #include <boost/asio.hpp>
-#include <boost/asio/basic_waitable_timer.hpp>
 #else
 #ifndef ASIO_STANDALONE
 #define ASIO_STANDALONE
 #endif
 #include <asio.hpp>
-#include <asio/basic_waitable_timer.hpp>
 #endif
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
-#include <functional>
-#include <map>
+#include <cstddef>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 
@@ -8428,175 +13147,355 @@ namespace crow
 #else
     using error_code = asio::error_code;
 #endif
+    using tcp = asio::ip::tcp;
+
     namespace detail
     {
+        /// A monotonic allocator for the request-scoped storage of a single connection.
 
-        /// A class for scheduling functions to be called after a specific
-        /// amount of ticks. Ther tick length can  be handed over in constructor, 
-        /// the default tick length is equal to 1 second.
-        class task_timer
+        ///
+        /// Memory is handed out from an inline block first, then from heap blocks; deallocation is a no-op.
+        /// `reset()` releases everything at once and keeps the largest heap block, so a keep-alive connection
+        /// settles on a block big enough for its requests and stops allocating.
+        class connection_arena
         {
         public:
-            using task_type = std::function<void()>;
-            using identifier_type = size_t;
+            static constexpr std::size_t inline_size = 2048;
+
+            connection_arena() = default;
+            connection_arena(const connection_arena&) = delete;
+            connection_arena& operator=(const connection_arena&) = delete;
+
+            void* allocate(std::size_t size, std::size_t alignment)
+            {
+                void* ptr = try_allocate(size, alignment);
+                if (!ptr)
+                {
+                    grow(size + alignment);
+                    ptr = try_allocate(size, alignment);
+                }
+                return ptr;
+            }
+
+            /// Invalidate everything allocated so far.
+            void reset()
+            {
+                if (blocks_.empty())
+                {
+                    current_ = inline_block_;
+                    remaining_ = inline_size;
+                    return;
+                }
+
+                // Blocks grow geometrically, the last one can hold everything the previous cycle needed.
+                blocks_.erase(blocks_.begin(), blocks_.end() - 1);
+                current_ = blocks_.back().data.get();
+                remaining_ = blocks_.back().size;
+            }
 
         private:
-            using clock_type = std::chrono::steady_clock;
-            using time_type = clock_type::time_point;
-        public:
-            task_timer(asio::io_context& io_context,
-                       const std::chrono::milliseconds tick_length =
-                            std::chrono::seconds(1)) :
-              io_context_(io_context), timer_(io_context_),
-              tick_length_ms_(tick_length)
+            struct block
             {
-                timer_.expires_after(tick_length_ms_);
-                timer_.async_wait(
-                  std::bind(&task_timer::tick_handler, this,
-                  std::placeholders::_1));
+                std::unique_ptr<char[]> data;
+                std::size_t size;
+            };
+
+            void* try_allocate(std::size_t size, std::size_t alignment)
+            {
+                void* ptr = current_;
+                if (!std::align(alignment, size, ptr, remaining_)) return nullptr;
+                current_ = static_cast<char*>(ptr) + size;
+                remaining_ -= size;
+                return ptr;
             }
 
-            ~task_timer() { timer_.cancel(); }
+            void grow(std::size_t at_least)
+            {
+                std::size_t size = blocks_.empty() ? inline_size * 2 : blocks_.back().size * 2;
+                while (size < at_least)
+                    size *= 2;
+                blocks_.push_back({std::unique_ptr<char[]>(new char[size]), size});
+                current_ = blocks_.back().data.get();
+                remaining_ = size;
+            }
 
-            /// Cancel the scheduling of the given task 
-            ///
-            /// \param identifier_type task identifier of the task to cancel.
-            void cancel(identifier_type id)
+            alignas(std::max_align_t) char inline_block_[inline_size];
+            char* current_{inline_block_};
+            std::size_t remaining_{inline_size};
+            std::vector<block> blocks_;
+        };
+
+        /// Standard allocator adaptor for \ref connection_arena.
+        template<typename T>
+        struct arena_allocator
+        {
+            using value_type = T;
+
+            explicit arena_allocator(connection_arena& arena) noexcept:
+              arena_(&arena)
+            {}
+
+            template<typename U>
+            arena_allocator(const arena_allocator<U>& other) noexcept:
+              arena_(other.arena_)
+            {}
+
+            T* allocate(std::size_t n)
             {
-                tasks_.erase(id);
-                CROW_LOG_DEBUG << "task_timer task cancelled: " << this << ' ' << id;
+                return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
             }
 
-            /// Schedule the given task to be executed after the default amount
-            /// of ticks.
+            void deallocate(T*, std::size_t) noexcept {}
 
-            ///
-            /// \return identifier_type Used to cancel the thread.
-            /// It is not bound to this task_timer instance and in some cases
-            /// could lead to undefined behavior if used with other task_timer
-            /// objects or after the task has been successfully executed.
-            identifier_type schedule(const task_type& task)
+            template<typename U>
+            bool operator==(const arena_allocator<U>& other) const noexcept
             {
-                return schedule(task, get_default_timeout());
+                return arena_ == other.arena_;
             }
 
-            /// Schedule the given task to be executed after the given time.
+            template<typename U>
+            bool operator!=(const arena_allocator<U>& other) const noexcept
+            {
+                return arena_ != other.arena_;
+            }
 
-            ///
-            /// \param timeout The amount of ticks to wait before execution.
-            ///
-            /// \return identifier_type Used to cancel the thread.
-            /// It is not bound to this task_timer instance and in some cases
-            /// could lead to undefined behavior if used with other task_timer
-            /// objects or after the task has been successfully executed.
-            identifier_type schedule(const task_type& task, uint8_t timeout)
+        private:
+            template<typename U>
+            friend struct arena_allocator;
+
+            connection_arena* arena_;
+        };
+
+        /// A free list of equally sized memory blocks, shared by the connections of one worker.
+
+        ///
+        /// Blocks can come back from any thread (a response may be completed outside the worker), so the list is guarded by a mutex
+        /// that is only held to push or pop a pointer. At most `max_free` blocks are kept, anything beyond that goes back to the heap.
+        class block_pool
+        {
+        public:
+            block_pool(std::size_t block_size, std::size_t max_free):
+              block_size_(block_size), max_free_(max_free)
+            {}
+
+            block_pool(const block_pool&) = delete;
+            block_pool& operator=(const block_pool&) = delete;
+
+            ~block_pool()
             {
-                tasks_.insert({++highest_id_,
-                               {clock_type::now() + (timeout * tick_length_ms_),
-                                task}});
-                CROW_LOG_DEBUG << "task_timer scheduled: " << this << ' ' <<
-                                  highest_id_;
-                return highest_id_;
+                for (void* block : free_)
+                    ::operator delete(block);
             }
 
-            /// Set the default timeout for this task_timer instance.
-            /// (Default: 5)
+            void* allocate()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (!free_.empty())
+                    {
+                        void* block = free_.back();
+                        free_.pop_back();
+                        return block;
+                    }
+                }
+                return ::operator new(block_size_);
+            }
 
-            ///
-            /// \param timeout The amount of ticks to wait before
-            /// execution. 
-            /// For tick length \see tick_length_ms_ 
-            void set_default_timeout(uint8_t timeout) {
-                default_timeout_ = timeout;
+            void deallocate(void* block) noexcept
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (free_.size() < max_free_)
+                    {
+                        free_.push_back(block);
+                        return;
+                    }
+                }
+                ::operator delete(block);
             }
 
-            /// Get the default timeout. (Default: 5)
-            uint8_t get_default_timeout() const {
-                return default_timeout_;
+            std::size_t block_size() const
+            {
+                return block_size_;
             }
 
-            /// returns the length of one tick.
-            std::chrono::milliseconds get_tick_length() const {
-                return tick_length_ms_;
+        private:
+            const std::size_t block_size_;
+            const std::size_t max_free_;
+            std::mutex mutex_;
+            std::vector<void*> free_;
+        };
+
+        /// Standard allocator adaptor for \ref block_pool, larger requests go to the heap.
+        template<typename T>
+        struct pool_allocator
+        {
+            using value_type = T;
+
+            explicit pool_allocator(block_pool& pool) noexcept:
+              pool_(&pool)
+            {}
+
+            template<typename U>
+            pool_allocator(const pool_allocator<U>& other) noexcept:
+              pool_(other.pool_)
+            {}
+
+            T* allocate(std::size_t n)
+            {
+                if (fits(n))
+                    return static_cast<T*>(pool_->allocate());
+                return static_cast<T*>(::operator new(n * sizeof(T)));
+            }
+
+            void deallocate(T* ptr, std::size_t n) noexcept
+            {
+                if (fits(n))
+                    pool_->deallocate(ptr);
+                else
+                    ::operator delete(ptr);
+            }
+
+            template<typename U>
+            bool operator==(const pool_allocator<U>& other) const noexcept
+            {
+                return pool_ == other.pool_;
+            }
+
+            template<typename U>
+            bool operator!=(const pool_allocator<U>& other) const noexcept
+            {
+                return pool_ != other.pool_;
             }
 
         private:
-            void process_tasks()
+            template<typename U>
+            friend struct pool_allocator;
+
+            bool fits(std::size_t n) const noexcept
             {
-                time_type current_time = clock_type::now();
-                std::vector<identifier_type> finished_tasks;
+                return n * sizeof(T) <= pool_->block_size() && alignof(T) <= alignof(std::max_align_t);
+            }
+
+            block_pool* pool_;
+        };
+
+        /// Queue the status line and headers of `res` in `buffers`, ending with the blank line.
+
+        ///
+        /// The buffers point into `res`, `server_name`, `date`, `content_length` (filled in here) and static strings, which
+        /// have to stay put until the buffers are written. Status codes Crow doesn't know are sent as 500.
+        template<typename Buffers>
+        void serialize_response_head(Buffers& buffers, response& res, const std::string& server_name, const std::string& date, std::string& content_length, bool keep_alive)
+        {
+            // TODO(EDev): HTTP version in status codes should be dynamic
+            // Keep in sync with common.h/status
+            static std::unordered_map<int, std::string> statusCodes = {
+              {status::CONTINUE, "HTTP/1.1 100 Continue\r\n"},
+              {status::SWITCHING_PROTOCOLS, "HTTP/1.1 101 Switching Protocols\r\n"},
+
+              {status::OK, "HTTP/1.1 200 OK\r\n"},
+              {status::CREATED, "HTTP/1.1 201 Created\r\n"},
+              {status::ACCEPTED, "HTTP/1.1 202 Accepted\r\n"},
+              {status::NON_AUTHORITATIVE_INFORMATION, "HTTP/1.1 203 Non-Authoritative Information\r\n"},
+              {status::NO_CONTENT, "HTTP/1.1 204 No Content\r\n"},
+              {status::RESET_CONTENT, "HTTP/1.1 205 Reset Content\r\n"},
+              {status::PARTIAL_CONTENT, "HTTP/1.1 206 Partial Content\r\n"},
+
+              {status::MULTIPLE_CHOICES, "HTTP/1.1 300 Multiple Choices\r\n"},
+              {status::MOVED_PERMANENTLY, "HTTP/1.1 301 Moved Permanently\r\n"},
+              {status::FOUND, "HTTP/1.1 302 Found\r\n"},
+              {status::SEE_OTHER, "HTTP/1.1 303 See Other\r\n"},
+              {status::NOT_MODIFIED, "HTTP/1.1 304 Not Modified\r\n"},
+              {status::TEMPORARY_REDIRECT, "HTTP/1.1 307 Temporary Redirect\r\n"},
+              {status::PERMANENT_REDIRECT, "HTTP/1.1 308 Permanent Redirect\r\n"},
+
+              {status::BAD_REQUEST, "HTTP/1.1 400 Bad Request\r\n"},
+              {status::UNAUTHORIZED, "HTTP/1.1 401 Unauthorized\r\n"},
+              {status::FORBIDDEN, "HTTP/1.1 403 Forbidden\r\n"},
+              {status::NOT_FOUND, "HTTP/1.1 404 Not Found\r\n"},
+              {status::METHOD_NOT_ALLOWED, "HTTP/1.1 405 Method Not Allowed\r\n"},
+              {status::NOT_ACCEPTABLE, "HTTP/1.1 406 Not Acceptable\r\n"},
+              {status::PROXY_AUTHENTICATION_REQUIRED, "HTTP/1.1 407 Proxy Authentication Required\r\n"},
+              {status::CONFLICT, "HTTP/1.1 409 Conflict\r\n"},
+              {status::GONE, "HTTP/1.1 410 Gone\r\n"},
+              {status::PAYLOAD_TOO_LARGE, "HTTP/1.1 413 Payload Too Large\r\n"},
+              {status::UNSUPPORTED_MEDIA_TYPE, "HTTP/1.1 415 Unsupported Media Type\r\n"},
+              {status::RANGE_NOT_SATISFIABLE, "HTTP/1.1 416 Range Not Satisfiable\r\n"},
+              {status::EXPECTATION_FAILED, "HTTP/1.1 417 Expectation Failed\r\n"},
+              {status::PRECONDITION_REQUIRED, "HTTP/1.1 428 Precondition Required\r\n"},
+              {status::TOO_MANY_REQUESTS, "HTTP/1.1 429 Too Many Requests\r\n"},
+              {status::UNAVAILABLE_FOR_LEGAL_REASONS, "HTTP/1.1 451 Unavailable For Legal Reasons\r\n"},
+
+              {status::INTERNAL_SERVER_ERROR, "HTTP/1.1 500 Internal Server Error\r\n"},
+              {status::NOT_IMPLEMENTED, "HTTP/1.1 501 Not Implemented\r\n"},
+              {status::BAD_GATEWAY, "HTTP/1.1 502 Bad Gateway\r\n"},
+              {status::SERVICE_UNAVAILABLE, "HTTP/1.1 503 Service Unavailable\r\n"},
+              {status::GATEWAY_TIMEOUT, "HTTP/1.1 504 Gateway Timeout\r\n"},
+              {status::VARIANT_ALSO_NEGOTIATES, "HTTP/1.1 506 Variant Also Negotiates\r\n"},
+            };
 
-                for (const auto& task : tasks_)
-                {
-                    if (task.second.first < current_time)
-                    {
-                        (task.second.second)();
-                        finished_tasks.push_back(task.first);
-                        CROW_LOG_DEBUG << "task_timer called: " << this <<
-                                          ' ' << task.first;
-                    }
-                }
+            static const std::string seperator = ": ";
 
-                for (const auto& task : finished_tasks)
-                    tasks_.erase(task);
+            buffers.clear();
+            buffers.reserve(4 * (res.headers.size() + 5) + 4);
 
-                // If no task is currently scheduled, reset the issued ids back
-                // to 0.
-                if (tasks_.empty()) highest_id_ = 0;
+            if (!statusCodes.count(res.code))
+            {
+                CROW_LOG_WARNING << "Status code "
+                                 << "(" << res.code << ")"
+                                 << " not defined, returning 500 instead";
+                res.code = 500;
             }
 
-            void tick_handler(const error_code& ec)
-            {
-                if (ec) return;
+            auto& status = statusCodes.find(res.code)->second;
+            buffers.emplace_back(status.data(), status.size());
 
-                process_tasks();
+            if (res.code >= 400 && res.body.empty())
+                res.body = status.substr(9);
 
-                timer_.expires_after(tick_length_ms_);
-                timer_.async_wait(
-                  std::bind(&task_timer::tick_handler, this, std::placeholders::_1));
+            for (auto& kv : res.headers)
+            {
+                buffers.emplace_back(kv.first.data(), kv.first.size());
+                buffers.emplace_back(seperator.data(), seperator.size());
+                buffers.emplace_back(kv.second.data(), kv.second.size());
+                buffers.emplace_back(crlf.data(), crlf.size());
             }
+            if (res.header_block)
+                buffers.emplace_back(res.header_block->data(), res.header_block->size());
 
-        private:
-            asio::io_context& io_context_;
-            asio::basic_waitable_timer<clock_type> timer_;
-            std::map<identifier_type, std::pair<time_type, task_type>> tasks_;
-
-            // A continuously increasing number to be issued to threads to
-            // identify them. If no tasks are scheduled, it will be reset to 0.
-            identifier_type highest_id_{0};
-            std::chrono::milliseconds tick_length_ms_;
-            uint8_t default_timeout_{5};
+            if (!res.manual_length_header && !res.headers.count("content-length"))
+            {
+                content_length = std::to_string(res.body.size());
+                static std::string content_length_tag = "Content-Length: ";
+                buffers.emplace_back(content_length_tag.data(), content_length_tag.size());
+                buffers.emplace_back(content_length.data(), content_length.size());
+                buffers.emplace_back(crlf.data(), crlf.size());
+            }
+            if (!res.headers.count("server"))
+            {
+                static std::string server_tag = "Server: ";
+                buffers.emplace_back(server_tag.data(), server_tag.size());
+                buffers.emplace_back(server_name.data(), server_name.size());
+                buffers.emplace_back(crlf.data(), crlf.size());
+            }
+            if (!res.headers.count("date"))
+            {
+                static std::string date_tag = "Date: ";
+                buffers.emplace_back(date_tag.data(), date_tag.size());
+                buffers.emplace_back(date.data(), date.size());
+                buffers.emplace_back(crlf.data(), crlf.size());
+            }
+            if (keep_alive)
+            {
+                static std::string keep_alive_tag = "Connection: Keep-Alive";
+                buffers.emplace_back(keep_alive_tag.data(), keep_alive_tag.size());
+                buffers.emplace_back(crlf.data(), crlf.size());
+            }
 
-        };
+            buffers.emplace_back(crlf.data(), crlf.size());
+        }
     } // namespace detail
-} // namespace crow
-
-
-#ifdef CROW_USE_BOOST
-#include <boost/asio.hpp>
-#else
-#ifndef ASIO_STANDALONE
-#define ASIO_STANDALONE
-#endif
-#include <asio.hpp>
-#endif
-
-#include <algorithm>
-#include <atomic>
-#include <chrono>
-#include <memory>
-#include <vector>
-
-
-namespace crow
-{
-#ifdef CROW_USE_BOOST
-    namespace asio = boost::asio;
-    using error_code = boost::system::error_code;
-#else
-    using error_code = asio::error_code;
-#endif
-    using tcp = asio::ip::tcp;
 
 #ifdef CROW_ENABLE_DEBUG
     static std::atomic<int> connectionCount;
@@ -8608,16 +13507,21 @@ namespace crow
     {
         friend struct crow::response;
 
+        using buffer_list = std::vector<asio::const_buffer, detail::arena_allocator<asio::const_buffer>>;
+
     public:
+        static constexpr std::size_t read_buffer_size = 4096;
+
         Connection(
           asio::io_context& io_context,
           Handler* handler,
           const std::string& server_name,
           std::tuple<Middlewares...>* middlewares,
-          std::function<std::string()>& get_cached_date_str_f,
+          std::function<const std::string&()>& get_cached_date_str_f,
           detail::task_timer& task_timer,
           typename Adaptor::context* adaptor_ctx_,
-          std::atomic<unsigned int>& queue_length):
+          std::atomic<unsigned int>& queue_length,
+          detail::block_pool& read_buffers):
           adaptor_(io_context, adaptor_ctx_),
           handler_(handler),
           parser_(this),
@@ -8627,7 +13531,9 @@ namespace crow
           get_cached_date_str(get_cached_date_str_f),
           task_timer_(task_timer),
           res_stream_threshold_(handler->stream_threshold()),
-          queue_length_(queue_length)
+          res_stream_write_budget_(handler->stream_write_budget()),
+          queue_length_(queue_length),
+          read_buffers_(read_buffers)
         {
 #ifdef CROW_ENABLE_DEBUG
             connectionCount++;
@@ -8637,6 +13543,18 @@ namespace crow
 
         ~Connection()
         {
+            release_read_buffer();
+            if (accepted_)
+            {
+                queue_length_--;
+#ifndef CROW_DISABLE_METRICS
+                handler_->metrics().connection_closed();
+#endif
+            }
+#ifndef CROW_DISABLE_METRICS
+            if (in_flight_)
+                in_flight_->requests_in_flight.fetch_sub(1, std::memory_order_relaxed);
+#endif
 #ifdef CROW_ENABLE_DEBUG
             connectionCount--;
             CROW_LOG_DEBUG << "Connection (" << this << ") freed, total: " << connectionCount;
@@ -8651,6 +13569,10 @@ namespace crow
 
         void start()
         {
+            accepted_ = true;
+#ifndef CROW_DISABLE_METRICS
+            handler_->metrics().connection_opened();
+#endif
             auto self = this->shared_from_this();
             adaptor_.start([self](const error_code& ec) {
                 if (!ec)
@@ -8658,6 +13580,12 @@ namespace crow
                     self->start_deadline();
                     self->parser_.clear();
 
+                    // read_available reads after a readiness wait, which can wake up with nothing to read
+                    if (Adaptor::can_wait_readable)
+                    {
+                        error_code nb_ec;
+                        self->adaptor_.raw_socket().non_blocking(true, nb_ec);
+                    }
                     self->do_read();
                 }
                 else
@@ -8669,10 +13597,32 @@ namespace crow
 
         void handle_url()
         {
-            routing_handle_result_ = handler_->handle_initial(req_, res);
+            if (close_connection_)
+                return;
+#ifndef CROW_DISABLE_METRICS
+            request_start_ = std::chrono::steady_clock::now();
+            req_.phases.start();
+#endif
+            // OPTIONS is routed after the middlewares have seen the headers, so they can answer CORS preflights without
+            // a lookup in every method's routes
+            if (req_.method == HTTPMethod::Options)
+            {
+                routing_handle_result_.rule_index = 0;
+                routing_handle_result_.blueprint_indices.clear();
+                return;
+            }
+            handler_->handle_initial(req_, res, routing_handle_result_);
+#ifndef CROW_DISABLE_METRICS
+            req_.phases.mark("route");
+#endif
             // if no route is found for the request method, return the response without parsing or processing anything further.
-            if (!routing_handle_result_->rule_index)
+            if (!routing_handle_result_.rule_index)
             {
+                // The rest of the request isn't read, so the connection can't be reused. Say so rather than have the
+                // client find out by its next request failing.
+                close_connection_ = true;
+                add_keep_alive_ = false;
+                res.set_header("Connection", "close");
                 parser_.done();
                 need_to_call_after_handlers_ = true;
                 complete_request();
@@ -8682,7 +13632,7 @@ namespace crow
         void handle_header()
         {
             // HTTP 1.1 Expect: 100-continue
-            if (req_.http_ver_major == 1 && req_.http_ver_minor == 1 && get_header_value(req_.headers, "expect") == "100-continue")
+            if (req_.http_ver_major == 1 && req_.http_ver_minor == 1 && req_.get_header_view("expect") == "100-continue")
             {
                 continue_requested = true;
                 buffers_.clear();
@@ -8694,6 +13644,13 @@ namespace crow
 
         void handle()
         {
+            // Nothing pipelined after a request that closes the connection is answered, parsing stops here.
+            if (close_connection_)
+                return;
+#ifndef CROW_DISABLE_METRICS
+            req_.phases.mark("parse");
+#endif
+
             // TODO(EDev): cancel_deadline_timer should be looked into, it might be a good idea to add it to handle_url() and then restart the timer once everything passes
             cancel_deadline_timer();
             bool is_invalid_request = false;
@@ -8705,7 +13662,9 @@ namespace crow
             req_.middleware_container = static_cast<void*>(middlewares_);
             req_.io_context = &adaptor_.get_io_context();
 
-            req_.remote_ip_address = adaptor_.remote_endpoint().address().to_string();
+            if (remote_ip_address_.empty())
+                remote_ip_address_ = adaptor_.remote_endpoint().address().to_string();
+            req_.remote_ip_address = remote_ip_address_;
 
             add_keep_alive_ = req_.keep_alive;
             close_connection_ = req_.close_connection;
@@ -8720,7 +13679,7 @@ namespace crow
                 else if (req_.upgrade)
                 {
                     // h2 or h2c headers
-                    if (req_.get_header_value("upgrade").find("h2")==0)
+                    if (req_.get_header_view("upgrade").find("h2")==0)
                     {
                         // TODO(ipkn): HTTP/2
                         // currently, ignore upgrade header
@@ -8731,10 +13690,19 @@ namespace crow
                         detail::middleware_call_helper<detail::middleware_call_criteria_only_global,
                                                        0, decltype(ctx_), decltype(*middlewares_)>({}, *middlewares_, req_, res, ctx_);
                         close_connection_ = true;
+                        write_pipelined();
                         handler_->handle_upgrade(req_, res, std::move(adaptor_));
                         return;
                     }
                 }
+#ifndef CROW_DISABLE_HTTP2
+                // The parser doesn't flag h2 upgrades (see s_header_value_start), the request is complete including its body
+                else if (req_.get_header_view("upgrade") == "h2c" && req_.headers.count("http2-settings"))
+                {
+                    upgrade_http2();
+                    return;
+                }
+#endif
             }
 
             CROW_LOG_INFO << "Request: " << utility::lexical_cast<std::string>(adaptor_.remote_endpoint()) << " " << this << " HTTP/" << (char)(req_.http_ver_major + '0') << "." << (char)(req_.http_ver_minor + '0') << ' ' << method_name(req_.method) << " " << req_.url;
@@ -8744,23 +13712,48 @@ namespace crow
             if (!is_invalid_request)
             {
                 res.complete_request_handler_ = nullptr;
-                auto self = this->shared_from_this();
-                res.is_alive_helper_ = [self]() -> bool {
-                    return self->adaptor_.is_open();
+                // Keeps the connection alive until the response is completed, possibly from another thread.
+                // The handlers below only capture `this`, which lets std::function store them without allocating.
+                self_while_handling_ = this->shared_from_this();
+                res.is_alive_helper_ = [this]() -> bool {
+                    return adaptor_.is_open();
                 };
 
                 detail::middleware_call_helper<detail::middleware_call_criteria_only_global,
                                                0, decltype(ctx_), decltype(*middlewares_)>({}, *middlewares_, req_, res, ctx_);
+#ifndef CROW_DISABLE_METRICS
+                req_.phases.mark("middleware");
+#endif
 
-                if (!res.completed_)
+                if (!res.completed_ && req_.method == HTTPMethod::Options)
+                {
+                    // The router always answers, with the methods the URL allows or a 404
+                    res.complete_request_handler_ = [this] {
+                        complete_request();
+                    };
+                    need_to_call_after_handlers_ = true;
+                    handler_->handle_initial(req_, res, routing_handle_result_);
+                }
+                else if (!res.completed_)
                 {
-                    res.complete_request_handler_ = [self] {
-                        self->complete_request();
+                    res.complete_request_handler_ = [this] {
+                        complete_request();
                     };
                     need_to_call_after_handlers_ = true;
+#ifndef CROW_DISABLE_METRICS
+                    detail::worker_monitor* monitor = detail::worker_monitor::current();
+                    if (monitor)
+                    {
+                        in_flight_ = &monitor->stats();
+                        in_flight_->requests_in_flight.fetch_add(1, std::memory_order_relaxed);
+                        monitor->enter(handler_->matched_rule(routing_handle_result_), req_.method);
+                    }
                     handler_->handle(req_, res, routing_handle_result_);
-                    if (add_keep_alive_)
-                        res.set_header("connection", "Keep-Alive");
+                    if (monitor)
+                        monitor->leave();
+#else
+                    handler_->handle(req_, res, routing_handle_result_);
+#endif
                 }
                 else
                 {
@@ -8773,9 +13766,49 @@ namespace crow
             }
         }
 
+#ifndef CROW_DISABLE_HTTP2
+        /// Switch to HTTP/2 after a prior knowledge preface, `data` is everything read so far.
+        void start_http2(const char* data, std::size_t length)
+        {
+            cancel_deadline_timer();
+            auto session = std::make_shared<http2::session<Adaptor, Handler, Middlewares...>>(
+              std::move(adaptor_), handler_, server_name_, middlewares_, get_cached_date_str, task_timer_, queue_length_);
+            accepted_ = false;
+            session->start(data, length);
+        }
+
+        /// Answer `Upgrade: h2c` and continue the connection as HTTP/2, the response to this request is sent on stream 1.
+        void upgrade_http2()
+        {
+            std::string settings = utility::base64decode(req_.get_header_value("http2-settings"));
+            static const std::string switching_protocols = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+            close_connection_ = true;
+            cancel_deadline_timer();
+            write_pipelined();
+
+            error_code ec;
+            write_all(asio::buffer(switching_protocols), ec);
+            if (ec)
+                return;
+            auto session = std::make_shared<http2::session<Adaptor, Handler, Middlewares...>>(
+              std::move(adaptor_), handler_, server_name_, middlewares_, get_cached_date_str, task_timer_, queue_length_);
+            accepted_ = false;
+            session->start_upgraded(std::move(req_), settings);
+        }
+#endif
+
         /// Call the after handle middleware and send the write the response to the connection.
         void complete_request()
         {
+            auto self = std::move(self_while_handling_);
+#ifndef CROW_DISABLE_METRICS
+            req_.phases.mark("handler");
+            if (in_flight_)
+            {
+                in_flight_->requests_in_flight.fetch_sub(1, std::memory_order_relaxed);
+                in_flight_ = nullptr;
+            }
+#endif
             CROW_LOG_INFO << "Response: " << this << ' ' << req_.raw_url << ' ' << res.code << ' ' << close_connection_;
             res.is_alive_helper_ = nullptr;
 
@@ -8793,7 +13826,7 @@ namespace crow
 #ifdef CROW_ENABLE_COMPRESSION
             if (!res.body.empty() && handler_->compression_used())
             {
-                std::string accept_encoding = req_.get_header_value("Accept-Encoding");
+                std::string_view accept_encoding = req_.get_header_view("Accept-Encoding");
                 if (!accept_encoding.empty() && res.compressed)
                 {
                     switch (handler_->compression_algorithm())
@@ -8819,7 +13852,23 @@ namespace crow
             }
 #endif
 
+#ifndef CROW_DISABLE_METRICS
+            req_.phases.mark("after");
+            if (handler_->server_timing())
+                res.set_header("Server-Timing", req_.phases.server_timing());
+#endif
+
             prepare_buffers();
+#ifndef CROW_DISABLE_METRICS
+            std::size_t bytes = 0;
+            if (adaptor_.is_open())
+                bytes = asio::buffer_size(buffers_) + (res.is_static_type() ? (res.file_info.statResult == 0 ? res.file_info.statbuf.st_size : 0) : res.skip_body ? 0 : res.body.size());
+            const std::string* route = handler_->matched_rule(routing_handle_result_);
+            handler_->metrics().observe(route, req_.method, res.code, std::chrono::steady_clock::now() - request_start_, bytes);
+            // Writing can go on to the next pipelined request, which reuses req_
+            HTTPMethod method = req_.method;
+            timing::phases phases = req_.phases;
+#endif
 
             if (res.is_static_type())
             {
@@ -8829,6 +13878,10 @@ namespace crow
             {
                 do_write_general();
             }
+#ifndef CROW_DISABLE_METRICS
+            phases.mark("write");
+            handler_->metrics().observe_phases(route, method, phases);
+#endif
         }
 
     private:
@@ -8843,231 +13896,369 @@ namespace crow
                 //delete this;
                 return;
             }
-            // TODO(EDev): HTTP version in status codes should be dynamic
-            // Keep in sync with common.h/status
-            static std::unordered_map<int, std::string> statusCodes = {
-              {status::CONTINUE, "HTTP/1.1 100 Continue\r\n"},
-              {status::SWITCHING_PROTOCOLS, "HTTP/1.1 101 Switching Protocols\r\n"},
+            if (!res.headers.count("date"))
+                date_str_ = get_cached_date_str();
+            detail::serialize_response_head(buffers_, res, server_name_, date_str_, content_length_, add_keep_alive_);
+        }
 
-              {status::OK, "HTTP/1.1 200 OK\r\n"},
-              {status::CREATED, "HTTP/1.1 201 Created\r\n"},
-              {status::ACCEPTED, "HTTP/1.1 202 Accepted\r\n"},
-              {status::NON_AUTHORITATIVE_INFORMATION, "HTTP/1.1 203 Non-Authoritative Information\r\n"},
-              {status::NO_CONTENT, "HTTP/1.1 204 No Content\r\n"},
-              {status::RESET_CONTENT, "HTTP/1.1 205 Reset Content\r\n"},
-              {status::PARTIAL_CONTENT, "HTTP/1.1 206 Partial Content\r\n"},
+        void do_write_static()
+        {
+            write_pipelined();
+            error_code ec;
+            write_all(buffers_, ec);
+            if (ec)
+                CROW_LOG_ERROR << ec << " - happened while sending static file headers";
 
-              {status::MULTIPLE_CHOICES, "HTTP/1.1 300 Multiple Choices\r\n"},
-              {status::MOVED_PERMANENTLY, "HTTP/1.1 301 Moved Permanently\r\n"},
-              {status::FOUND, "HTTP/1.1 302 Found\r\n"},
-              {status::SEE_OTHER, "HTTP/1.1 303 See Other\r\n"},
-              {status::NOT_MODIFIED, "HTTP/1.1 304 Not Modified\r\n"},
-              {status::TEMPORARY_REDIRECT, "HTTP/1.1 307 Temporary Redirect\r\n"},
-              {status::PERMANENT_REDIRECT, "HTTP/1.1 308 Permanent Redirect\r\n"},
+            if (res.file_info.statResult == 0)
+            {
+                std::ifstream is(res.file_info.path.c_str(), std::ios::in | std::ios::binary);
+                std::vector<asio::const_buffer> buffers{1};
+                char buf[16384];
+                is.read(buf, sizeof(buf));
+                while (is.gcount() > 0)
+                {
+                    buffers[0] = asio::buffer(buf, is.gcount());
+                    do_write_sync(buffers);
+                    is.read(buf, sizeof(buf));
+                }
+            }
+            if (close_connection_)
+            {
+                adaptor_.shutdown_readwrite();
+                adaptor_.close();
+                CROW_LOG_DEBUG << this << " from write (static)";
+            }
 
-              {status::BAD_REQUEST, "HTTP/1.1 400 Bad Request\r\n"},
-              {status::UNAUTHORIZED, "HTTP/1.1 401 Unauthorized\r\n"},
-              {status::FORBIDDEN, "HTTP/1.1 403 Forbidden\r\n"},
-              {status::NOT_FOUND, "HTTP/1.1 404 Not Found\r\n"},
-              {status::METHOD_NOT_ALLOWED, "HTTP/1.1 405 Method Not Allowed\r\n"},
-              {status::NOT_ACCEPTABLE, "HTTP/1.1 406 Not Acceptable\r\n"},
-              {status::PROXY_AUTHENTICATION_REQUIRED, "HTTP/1.1 407 Proxy Authentication Required\r\n"},
-              {status::CONFLICT, "HTTP/1.1 409 Conflict\r\n"},
-              {status::GONE, "HTTP/1.1 410 Gone\r\n"},
-              {status::PAYLOAD_TOO_LARGE, "HTTP/1.1 413 Payload Too Large\r\n"},
-              {status::UNSUPPORTED_MEDIA_TYPE, "HTTP/1.1 415 Unsupported Media Type\r\n"},
-              {status::RANGE_NOT_SATISFIABLE, "HTTP/1.1 416 Range Not Satisfiable\r\n"},
-              {status::EXPECTATION_FAILED, "HTTP/1.1 417 Expectation Failed\r\n"},
-              {status::PRECONDITION_REQUIRED, "HTTP/1.1 428 Precondition Required\r\n"},
-              {status::TOO_MANY_REQUESTS, "HTTP/1.1 429 Too Many Requests\r\n"},
-              {status::UNAVAILABLE_FOR_LEGAL_REASONS, "HTTP/1.1 451 Unavailable For Legal Reasons\r\n"},
+            res.end();
+            res.clear();
+            parser_.clear();
+            recycle_request_storage();
+        }
 
-              {status::INTERNAL_SERVER_ERROR, "HTTP/1.1 500 Internal Server Error\r\n"},
-              {status::NOT_IMPLEMENTED, "HTTP/1.1 501 Not Implemented\r\n"},
-              {status::BAD_GATEWAY, "HTTP/1.1 502 Bad Gateway\r\n"},
-              {status::SERVICE_UNAVAILABLE, "HTTP/1.1 503 Service Unavailable\r\n"},
-              {status::GATEWAY_TIMEOUT, "HTTP/1.1 504 Gateway Timeout\r\n"},
-              {status::VARIANT_ALSO_NEGOTIATES, "HTTP/1.1 506 Variant Also Negotiates\r\n"},
+        void do_write_general()
+        {
+            if (res.body.length() < res_stream_threshold_)
+            {
+                res_body_copy_.swap(res.body);
+
+                // Hold back the responses to pipelined requests and send them with the last one of the batch.
+                if (parser_.more_input && !close_connection_)
+                {
+                    queue_pipelined();
+                    return;
+                }
+                if (!pipelined_.empty())
+                {
+                    queue_pipelined();
+                    write_pipelined();
+                }
+                else
+                {
+                    buffers_.emplace_back(res_body_copy_.data(), res_body_copy_.size());
+                    do_write_sync(buffers_);
+                }
+
+                if (need_to_start_read_after_complete_)
+                {
+                    need_to_start_read_after_complete_ = false;
+                    resume_read();
+                }
+            }
+            else
+            {
+                // Large bodies are sent asynchronously, one slice at a time, so a slow reader only holds its own connection.
+                // No new request is read until the whole body is written.
+                write_pipelined();
+                is_writing_ = true;
+                res_body_copy_.swap(res.body);
+                res_stream_offset_ = 0;
+                do_write_stream();
+            }
+        }
+
+        /// Write the next slice of a streamed response body (the first slice also carries the response start / headers).
+        ///
+        /// At most `res_stream_write_budget_` body bytes are queued per write.
+        /// The deadline is restarted before every slice, so a client that stops reading is disconnected after one timeout period.
+        void do_write_stream()
+        {
+            size_t to_transfer = CROW_MIN(res_stream_write_budget_, res_body_copy_.size() - res_stream_offset_);
+            asio::const_buffer slice(res_body_copy_.data() + res_stream_offset_, to_transfer);
+
+            start_deadline();
+            auto self = this->shared_from_this();
+            auto on_written = [self, to_transfer](const error_code& ec, std::size_t /*bytes_transferred*/) {
+                self->buffers_.clear();
+                if (ec)
+                {
+                    CROW_LOG_DEBUG << self << " from write (res_stream)(2): " << ec.message();
+                    self->cancel_deadline_timer();
+                    self->adaptor_.shutdown_readwrite();
+                    self->adaptor_.close();
+                    self->finish_stream_write();
+                    return;
+                }
+
+                self->res_stream_offset_ += to_transfer;
+                if (self->res_stream_offset_ < self->res_body_copy_.size())
+                {
+                    self->do_write_stream();
+                    return;
+                }
+
+                if (self->close_connection_)
+                {
+                    self->cancel_deadline_timer();
+                    self->adaptor_.shutdown_readwrite();
+                    self->adaptor_.close();
+                    CROW_LOG_DEBUG << self << " from write (res_stream)";
+                }
+                self->finish_stream_write();
             };
 
-            static const std::string seperator = ": ";
+            // Later slices go out as a single buffer, asio then has no buffer sequence to copy.
+            if (buffers_.empty())
+            {
+                asio::async_write(adaptor_.socket(), slice, std::move(on_written));
+            }
+            else
+            {
+                if (to_transfer > 0)
+                    buffers_.push_back(slice);
+                asio::async_write(adaptor_.socket(), buffers_, std::move(on_written));
+            }
+        }
+
+        /// Keep the response that was just prepared until the rest of the pipelined batch is handled.
+        ///
+        /// The headers point into storage the next request reuses, so they are copied, the body is moved.
+        void queue_pipelined()
+        {
+            size_t head_size = 0;
+            for (const auto& buffer : buffers_)
+                head_size += buffer.size();
+            std::string head;
+            head.reserve(head_size);
+            for (const auto& buffer : buffers_)
+                head.append(static_cast<const char*>(buffer.data()), buffer.size());
+            pipelined_.push_back(std::move(head));
+            if (!res_body_copy_.empty())
+                pipelined_.push_back(std::move(res_body_copy_));
+
+            res.clear();
+            res_body_copy_.clear();
+            parser_.clear();
+            recycle_request_storage();
+        }
+
+        /// Send the queued responses to pipelined requests with a single gathered write.
+        void write_pipelined()
+        {
+            if (pipelined_.empty())
+                return;
+
+            // Built from a separate list so the buffers of a response that is still being prepared stay untouched.
+            std::vector<asio::const_buffer> buffers;
+            buffers.reserve(pipelined_.size());
+            for (const auto& part : pipelined_)
+                buffers.emplace_back(part.data(), part.size());
 
-            buffers_.clear();
-            buffers_.reserve(4 * (res.headers.size() + 5) + 3);
+            error_code ec;
+            write_all(buffers, ec);
+            pipelined_.clear();
 
-            if (!statusCodes.count(res.code))
+            if (ec)
             {
-                CROW_LOG_WARNING << this << " status code "
-                                 << "(" << res.code << ")"
-                                 << " not defined, returning 500 instead";
-                res.code = 500;
+                CROW_LOG_ERROR << ec << " - happened while sending pipelined responses";
+                CROW_LOG_DEBUG << this << " from write (pipelined)";
             }
+        }
 
-            auto& status = statusCodes.find(res.code)->second;
-            buffers_.emplace_back(status.data(), status.size());
-
-            if (res.code >= 400 && res.body.empty())
-                res.body = statusCodes[res.code].substr(9);
+        /// Reset the response state after a streamed write and resume reading if a request came in meanwhile.
+        void finish_stream_write()
+        {
+            is_writing_ = false;
+            res_stream_offset_ = 0;
+            res.end();
+            res.clear();
+            res_body_copy_.clear();
+            parser_.clear();
+            recycle_request_storage();
 
-            for (auto& kv : res.headers)
+            if (need_to_start_read_after_complete_)
             {
-                buffers_.emplace_back(kv.first.data(), kv.first.size());
-                buffers_.emplace_back(seperator.data(), seperator.size());
-                buffers_.emplace_back(kv.second.data(), kv.second.size());
-                buffers_.emplace_back(crlf.data(), crlf.size());
+                need_to_start_read_after_complete_ = false;
+                if (adaptor_.is_open())
+                    resume_read();
             }
+        }
 
-            if (!res.manual_length_header && !res.headers.count("content-length"))
-            {
-                content_length_ = std::to_string(res.body.size());
-                static std::string content_length_tag = "Content-Length: ";
-                buffers_.emplace_back(content_length_tag.data(), content_length_tag.size());
-                buffers_.emplace_back(content_length_.data(), content_length_.size());
-                buffers_.emplace_back(crlf.data(), crlf.size());
-            }
-            if (!res.headers.count("server"))
-            {
-                static std::string server_tag = "Server: ";
-                buffers_.emplace_back(server_tag.data(), server_tag.size());
-                buffers_.emplace_back(server_name_.data(), server_name_.size());
-                buffers_.emplace_back(crlf.data(), crlf.size());
-            }
-            if (!res.headers.count("date"))
+        /// Read the next input. On a plain socket this first waits for data without holding a buffer,
+        /// so idle keep-alive connections don't tie up a read buffer each.
+        void do_read()
+        {
+            auto self = this->shared_from_this();
+            if (Adaptor::can_wait_readable)
             {
-                static std::string date_tag = "Date: ";
-                date_str_ = get_cached_date_str();
-                buffers_.emplace_back(date_tag.data(), date_tag.size());
-                buffers_.emplace_back(date_str_.data(), date_str_.size());
-                buffers_.emplace_back(crlf.data(), crlf.size());
+                adaptor_.raw_socket().async_wait(
+                  tcp::socket::wait_read,
+                  [self](const error_code& ec) {
+                      self->read_available(ec);
+                  });
             }
-            if (add_keep_alive_)
+            else
             {
-                static std::string keep_alive_tag = "Connection: Keep-Alive";
-                buffers_.emplace_back(keep_alive_tag.data(), keep_alive_tag.size());
-                buffers_.emplace_back(crlf.data(), crlf.size());
+                acquire_read_buffer();
+                adaptor_.socket().async_read_some(
+                  asio::buffer(read_buffer_, read_buffer_size),
+                  [self](const error_code& ec, std::size_t bytes_transferred) {
+#ifndef CROW_DISABLE_METRICS
+                      self->handler_->metrics().received(bytes_transferred);
+#endif
+                      self->process_input(ec, self->read_buffer_, bytes_transferred);
+                  });
             }
-
-            buffers_.emplace_back(crlf.data(), crlf.size());
         }
 
-        void do_write_static()
+        /// The socket is readable (or failed), borrow a buffer and take what has arrived.
+        ///
+        /// The socket is non-blocking, so a wakeup with nothing to read goes back to waiting instead of blocking the worker.
+        void read_available(error_code ec)
         {
-            asio::write(adaptor_.socket(), buffers_);
-
-            if (res.file_info.statResult == 0)
+            std::size_t bytes_transferred = 0;
+            if (!ec)
             {
-                std::ifstream is(res.file_info.path.c_str(), std::ios::in | std::ios::binary);
-                std::vector<asio::const_buffer> buffers{1};
-                char buf[16384];
-                is.read(buf, sizeof(buf));
-                while (is.gcount() > 0)
+                acquire_read_buffer();
+                bytes_transferred = adaptor_.socket().read_some(asio::buffer(read_buffer_, read_buffer_size), ec);
+                if (ec == asio::error::would_block || ec == asio::error::try_again)
                 {
-                    buffers[0] = asio::buffer(buf, is.gcount());
-                    do_write_sync(buffers);
-                    is.read(buf, sizeof(buf));
+                    release_read_buffer();
+                    do_read();
+                    return;
                 }
+#ifndef CROW_DISABLE_METRICS
+                handler_->metrics().received(bytes_transferred);
+#endif
             }
-            if (close_connection_)
+            process_input(ec, read_buffer_, bytes_transferred);
+        }
+
+        /// asio::write on the non-blocking socket. When the send buffer is full it blocks until the rest is written, as
+        /// writes did before reads turned the socket non-blocking.
+        template<typename Buffers>
+        void write_all(const Buffers& buffers, error_code& ec)
+        {
+            bool blocking = false;
+            asio::write(
+              adaptor_.socket(), buffers,
+              [this, &blocking](const error_code& write_ec, std::size_t transferred) -> std::size_t {
+                  if (write_ec == asio::error::would_block || write_ec == asio::error::try_again)
+                  {
+                      error_code nb_ec;
+                      adaptor_.raw_socket().non_blocking(false, nb_ec);
+                      blocking = !nb_ec;
+                      return nb_ec ? 0 : asio::transfer_all()(error_code(), transferred);
+                  }
+                  return asio::transfer_all()(write_ec, transferred);
+              },
+              ec);
+            if (blocking)
             {
-                adaptor_.shutdown_readwrite();
-                adaptor_.close();
-                CROW_LOG_DEBUG << this << " from write (static)";
+                error_code nb_ec;
+                adaptor_.raw_socket().non_blocking(true, nb_ec);
             }
+        }
 
-            res.end();
-            res.clear();
-            buffers_.clear();
-            parser_.clear();
+        void acquire_read_buffer()
+        {
+            if (!read_buffer_)
+                read_buffer_ = static_cast<char*>(read_buffers_.allocate());
         }
 
-        void do_write_general()
+        void release_read_buffer()
         {
-            if (res.body.length() < res_stream_threshold_)
+            if (read_buffer_)
             {
-                res_body_copy_.swap(res.body);
-                buffers_.emplace_back(res_body_copy_.data(), res_body_copy_.size());
-
-                do_write_sync(buffers_);
+                read_buffers_.deallocate(read_buffer_);
+                read_buffer_ = nullptr;
+            }
+        }
 
-                if (need_to_start_read_after_complete_)
+        /// Feed received data to the parser and decide whether to keep reading from the socket.
+        void process_input(const error_code& ec, const char* data, std::size_t length)
+        {
+#ifndef CROW_DISABLE_HTTP2
+            // Only the first input can be an HTTP/2 preface, 3 bytes tell it apart from POST, PUT and PATCH.
+            if (!http2_checked_)
+            {
+                http2_checked_ = true;
+                if (!ec && length >= 3 && http2::is_preface(data, length))
                 {
-                    need_to_start_read_after_complete_ = false;
-                    start_deadline();
-                    do_read();
+                    start_http2(data, length);
+                    return;
                 }
             }
-            else
+#endif
+            bool error_while_reading = true;
+            if (!ec)
             {
-                asio::write(adaptor_.socket(), buffers_); // Write the response start / headers
-                cancel_deadline_timer();
-                if (res.body.length() > 0)
-                {
-                    std::vector<asio::const_buffer> buffers{1};
-                    const uint8_t* data = reinterpret_cast<const uint8_t*>(res.body.data());
-                    size_t length = res.body.length();
-                    for (size_t transferred = 0; transferred < length;)
-                    {
-                        size_t to_transfer = CROW_MIN(16384UL, length - transferred);
-                        buffers[0] = asio::const_buffer(data + transferred, to_transfer);
-                        do_write_sync(buffers);
-                        transferred += to_transfer;
-                    }
-                }
-                if (close_connection_)
+                bool ret = parser_.feed(data, length);
+                // Whatever the batch ended with (an incomplete request, a parse error, a response completed later), the earlier responses go out now.
+                write_pipelined();
+                if (ret && adaptor_.is_open())
                 {
-                    adaptor_.shutdown_readwrite();
-                    adaptor_.close();
-                    CROW_LOG_DEBUG << this << " from write (res_stream)";
+                    error_while_reading = false;
                 }
+            }
 
-                res.end();
-                res.clear();
-                buffers_.clear();
-                parser_.clear();
+            if (error_while_reading)
+            {
+                cancel_deadline_timer();
+                parser_.done();
+                adaptor_.shutdown_read();
+                adaptor_.close();
+                CROW_LOG_DEBUG << this << " from read(1) with description: \"" << http_errno_description(static_cast<http_errno>(parser_.http_errno)) << '\"';
+            }
+            else if (close_connection_)
+            {
+                // a streamed write keeps its own deadline running
+                if (!is_writing_)
+                    cancel_deadline_timer();
+                parser_.done();
+                // adaptor will close after write
+            }
+            else if (!need_to_call_after_handlers_ && !is_writing_)
+            {
+                start_deadline();
+                do_read();
+            }
+            else
+            {
+                // res will be completed later by user, or is still being streamed
+                need_to_start_read_after_complete_ = true;
             }
+
+            // Once the parser has no input left to come back to, the buffer isn't needed until the socket is readable again.
+            if (Adaptor::can_wait_readable && parser_.unparsed_length == 0)
+                release_read_buffer();
         }
 
-        void do_read()
+        /// Continue with the next request, starting with any input the parser stopped at while the previous one was handled.
+        void resume_read()
         {
-            auto self = this->shared_from_this();
-            adaptor_.socket().async_read_some(
-              asio::buffer(buffer_),
-              [self](const error_code& ec, std::size_t bytes_transferred) {
-                  bool error_while_reading = true;
-                  if (!ec)
-                  {
-                      bool ret = self->parser_.feed(self->buffer_.data(), bytes_transferred);
-                      if (ret && self->adaptor_.is_open())
-                      {
-                          error_while_reading = false;
-                      }
-                  }
-
-                  if (error_while_reading)
-                  {
-                      self->cancel_deadline_timer();
-                      self->parser_.done();
-                      self->adaptor_.shutdown_read();
-                      self->adaptor_.close();
-                      CROW_LOG_DEBUG << self << " from read(1) with description: \"" << http_errno_description(static_cast<http_errno>(self->parser_.http_errno)) << '\"';
-                  }
-                  else if (self->close_connection_)
-                  {
-                      self->cancel_deadline_timer();
-                      self->parser_.done();
-                      // adaptor will close after write
-                  }
-                  else if (!self->need_to_call_after_handlers_)
-                  {
-                      self->start_deadline();
-                      self->do_read();
-                  }
-                  else
-                  {
-                      // res will be completed later by user
-                      self->need_to_start_read_after_complete_ = true;
-                  }
-              });
+            if (parser_.unparsed_length > 0)
+            {
+                const char* data = parser_.unparsed_data;
+                std::size_t length = parser_.unparsed_length;
+                parser_.unparsed_data = nullptr;
+                parser_.unparsed_length = 0;
+                process_input({}, data, length);
+            }
+            else
+            {
+                start_deadline();
+                do_read();
+            }
         }
 
         void do_write()
@@ -9081,6 +14272,7 @@ namespace crow
                   if (!self->continue_requested)
                   {
                       self->parser_.clear();
+                      self->recycle_request_storage();
                   }
                   else
                   {
@@ -9103,10 +14295,11 @@ namespace crow
               });
         }
 
-        inline void do_write_sync(std::vector<asio::const_buffer>& buffers)
+        template<typename Buffers>
+        inline void do_write_sync(Buffers& buffers)
         {
             error_code ec;
-            asio::write(adaptor_.socket(), buffers, ec);
+            write_all(buffers, ec);
 
             this->res.clear();
             this->res_body_copy_.clear();
@@ -9117,6 +14310,7 @@ namespace crow
             else
             {
                 this->parser_.clear();
+                recycle_request_storage();
             }
 
             if (ec)
@@ -9128,8 +14322,8 @@ namespace crow
 
         void cancel_deadline_timer()
         {
-            CROW_LOG_DEBUG << this << " timer cancelled: " << &task_timer_ << ' ' << task_id_;
             task_timer_.cancel(task_id_);
+            task_id_ = 0;
         }
 
         void start_deadline(/*int timeout = 5*/)
@@ -9145,45 +14339,68 @@ namespace crow
                 self->adaptor_.shutdown_readwrite();
                 self->adaptor_.close();
             });
-            CROW_LOG_DEBUG << this << " timer added: " << &task_timer_ << ' ' << task_id_;
+        }
+
+        /// Release the storage of the request that was just answered so the next one can reuse it.
+        void recycle_request_storage()
+        {
+            buffer_list(buffers_.get_allocator()).swap(buffers_);
+            arena_.reset();
         }
 
     private:
         Adaptor adaptor_;
         Handler* handler_;
 
-        std::array<char, 4096> buffer_;
-
         HTTPParser<Connection> parser_;
-        std::unique_ptr<routing_handle_result> routing_handle_result_;
+        routing_handle_result routing_handle_result_;
         request& req_;
         response res;
 
         bool close_connection_ = false;
 
         const std::string& server_name_;
-        std::vector<asio::const_buffer> buffers_;
+
+        // Request-scoped storage, reset once the response is written.
+        detail::connection_arena arena_;
+        buffer_list buffers_{buffer_list::allocator_type(arena_)};
 
         std::string content_length_;
         std::string date_str_;
         std::string res_body_copy_;
+        size_t res_stream_offset_{};
+        std::vector<std::string> pipelined_;
 
         detail::task_timer::identifier_type task_id_{};
+        std::shared_ptr<Connection> self_while_handling_;
+        std::string remote_ip_address_;
 
         bool continue_requested{};
+        bool is_writing_{};
         bool need_to_call_after_handlers_{};
         bool need_to_start_read_after_complete_{};
         bool add_keep_alive_{};
+        bool http2_checked_{};
+        bool accepted_{}; ///< Counted in the worker's queue length and as an active connection, until destroyed or handed to an HTTP/2 session.
+#ifndef CROW_DISABLE_METRICS
+        std::chrono::steady_clock::time_point request_start_;
+        metrics::worker_stats* in_flight_{}; ///< The worker the request being handled is counted on.
+#endif
 
         std::tuple<Middlewares...>* middlewares_;
         detail::context<Middlewares...> ctx_;
 
-        std::function<std::string()>& get_cached_date_str;
+        std::function<const std::string&()>& get_cached_date_str;
         detail::task_timer& task_timer_;
 
         size_t res_stream_threshold_;
+        size_t res_stream_write_budget_;
 
         std::atomic<unsigned int>& queue_length_;
+
+        /// Borrowed from the worker's pool while reading, see do_read().
+        detail::block_pool& read_buffers_;
+        char* read_buffer_ = nullptr;
     };
 
 } // namespace crow
@@ -9311,7 +14528,7 @@ namespace crow // NOTE: Already documented in "crow/app.h"
               error_handler_(std::move(error_handler)),
               accept_handler_(std::move(accept_handler))
             {
-                if (!utility::string_equals(req.get_header_value("upgrade"), "websocket"))
+                if (!utility::string_equals(req.get_header_view("upgrade"), "websocket"))
                 {
                     adaptor_.close();
                     handler_->remove_websocket(this);
@@ -10061,6 +15278,8 @@ namespace crow // NOTE: Already documented in "crow/app.h"
     template<typename Handler, typename Adaptor = SocketAdaptor, typename... Middlewares>
     class Server
     {
+        using connection_type = Connection<Adaptor, Handler, Middlewares...>;
+
     public:
       Server(Handler* handler,
              const tcp::endpoint& endpoint,
@@ -10069,14 +15288,15 @@ namespace crow // NOTE: Already documented in "crow/app.h"
              uint16_t concurrency = 1,
              uint8_t timeout = 5,
              typename Adaptor::context* adaptor_ctx = nullptr):
+          task_queue_length_pool_(concurrency - 1),
           acceptor_(io_context_,endpoint),
           signals_(io_context_),
           tick_timer_(io_context_),
+          monitor_timer_(monitor_io_context_),
           handler_(handler),
           concurrency_(concurrency),
           timeout_(timeout),
           server_name_(server_name),
-          task_queue_length_pool_(concurrency_ - 1),
           middlewares_(middlewares),
           adaptor_ctx_(adaptor_ctx)
         {}
@@ -10098,13 +15318,36 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             });
         }
 
+#ifndef CROW_DISABLE_METRICS
+        void on_monitor_tick()
+        {
+            for (auto& monitor : worker_monitor_pool_)
+                monitor->check(handler_->stall_threshold());
+            monitor_timer_.expires_after(handler_->worker_probe_interval());
+            monitor_timer_.async_wait([this](const error_code& ec) {
+                if (ec)
+                    return;
+                on_monitor_tick();
+            });
+        }
+#endif
+
         void run()
         {
             uint16_t worker_thread_count = concurrency_ - 1;
             for (int i = 0; i < worker_thread_count; i++)
+            {
                 io_context_pool_.emplace_back(new asio::io_context());
+                // Room for the shared_ptr control block next to the connection.
+                connection_pool_.emplace_back(new detail::block_pool(sizeof(connection_type) + 64, CROW_CONNECTION_POOL_SIZE));
+                read_buffer_pool_.emplace_back(new detail::block_pool(connection_type::read_buffer_size, CROW_READ_BUFFER_POOL_SIZE));
+            }
             get_cached_date_str_pool_.resize(worker_thread_count);
             task_timer_pool_.resize(worker_thread_count);
+#ifndef CROW_DISABLE_METRICS
+            for (uint16_t i = 0; i < worker_thread_count; i++)
+                worker_monitor_pool_.emplace_back(new detail::worker_monitor(*io_context_pool_[i], i, handler_->metrics().worker(i), task_queue_length_pool_[i]));
+#endif
 
             std::vector<std::future<void>> v;
             std::atomic<int> init_count(0);
@@ -10130,7 +15373,7 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                             date_str.resize(date_str_sz);
                         };
                         update_date_str();
-                        get_cached_date_str_pool_[i] = [&]() -> std::string {
+                        get_cached_date_str_pool_[i] = [&]() -> const std::string& {
                             if (std::chrono::steady_clock::now() - last >= std::chrono::seconds(1))
                             {
                                 last = std::chrono::steady_clock::now();
@@ -10144,6 +15387,12 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                         task_timer.set_default_timeout(timeout_);
                         task_timer_pool_[i] = &task_timer;
                         task_queue_length_pool_[i] = 0;
+                        sampling_profiler::sample_current_thread();
+#ifndef CROW_DISABLE_METRICS
+                        worker_monitor_pool_[i]->bind_to_current_thread();
+                        if (handler_->worker_probe_interval().count() > 0)
+                            worker_monitor_pool_[i]->start(handler_->worker_probe_interval());
+#endif
 
                         init_count++;
                         while (1)
@@ -10174,6 +15423,17 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                   });
             }
 
+#ifndef CROW_DISABLE_METRICS
+            // On a thread of its own, capturing a stalled worker's stack waits for the worker and would hold up accepting
+            if (handler_->worker_probe_interval().count() > 0)
+            {
+                on_monitor_tick();
+                monitor_thread_ = std::thread([this] {
+                    monitor_io_context_.run();
+                });
+            }
+#endif
+
             handler_->port(acceptor_.local_endpoint().port());
 
 
@@ -10199,6 +15459,10 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                   CROW_LOG_INFO << "Exiting.";
               })
               .join();
+#ifndef CROW_DISABLE_METRICS
+            if (monitor_thread_.joinable())
+                monitor_thread_.join();
+#endif
         }
 
         void stop()
@@ -10213,6 +15477,10 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                 }
             }
 
+#ifndef CROW_DISABLE_METRICS
+            monitor_io_context_.stop();
+#endif
+
             CROW_LOG_INFO << "Closing main IO service (" << &io_context_ << ')';
             io_context_.stop(); // Close main io_service
         }
@@ -10268,9 +15536,11 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                 task_queue_length_pool_[context_idx]++;
                 CROW_LOG_DEBUG << &ic << " {" << context_idx << "} queue length: " << task_queue_length_pool_[context_idx];
 
-                auto p = std::make_shared<Connection<Adaptor, Handler, Middlewares...>>(
+                auto p = std::allocate_shared<connection_type>(
+                  detail::pool_allocator<connection_type>(*connection_pool_[context_idx]),
                   ic, handler_, server_name_, middlewares_,
-                  get_cached_date_str_pool_[context_idx], *task_timer_pool_[context_idx], adaptor_ctx_, task_queue_length_pool_[context_idx]);
+                  get_cached_date_str_pool_[context_idx], *task_timer_pool_[context_idx], adaptor_ctx_, task_queue_length_pool_[context_idx],
+                  *read_buffer_pool_[context_idx]);
 
                 acceptor_.async_accept(
                   p->socket(),
@@ -10301,10 +15571,19 @@ namespace crow // NOTE: Already documented in "crow/app.h"
         }
 
     private:
+        // Per worker. Declared before the io_contexts so they outlive connections still held by pending handlers.
+        std::vector<std::unique_ptr<detail::block_pool>> connection_pool_;
+        std::vector<std::unique_ptr<detail::block_pool>> read_buffer_pool_;
+        std::vector<std::atomic<unsigned int>> task_queue_length_pool_;
+
         std::vector<std::unique_ptr<asio::io_context>> io_context_pool_;
+#ifndef CROW_DISABLE_METRICS
+        // Hold timers on the io_contexts above, so must go first.
+        std::vector<std::unique_ptr<detail::worker_monitor>> worker_monitor_pool_;
+#endif
         asio::io_context io_context_;
         std::vector<detail::task_timer*> task_timer_pool_;
-        std::vector<std::function<std::string()>> get_cached_date_str_pool_;
+        std::vector<std::function<const std::string&()>> get_cached_date_str_pool_;
         tcp::acceptor acceptor_;
         bool shutting_down_ = false;
         bool server_started_{false};
@@ -10313,12 +15592,14 @@ namespace crow // NOTE: Already documented in "crow/app.h"
         asio::signal_set signals_;
 
         asio::basic_waitable_timer<std::chrono::high_resolution_clock> tick_timer_;
+        asio::io_context monitor_io_context_;
+        asio::steady_timer monitor_timer_;
+        std::thread monitor_thread_;
 
         Handler* handler_;
         uint16_t concurrency_{2};
         std::uint8_t timeout_;
         std::string server_name_;
-        std::vector<std::atomic<unsigned int>> task_queue_length_pool_;
 
         std::chrono::milliseconds tick_interval_;
         std::function<void()> tick_function_;
@@ -12024,6 +17305,7 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             if (!head_.IsSimpleNode())
                 throw std::runtime_error("Internal error: Trie header should be simple!");
             optimize();
+            build_static_routes();
         }
 
         //Rule_index, Blueprint_index, routing_params
@@ -12187,12 +17469,21 @@ namespace crow // NOTE: Already documented in "crow/app.h"
 
         routing_handle_result find(const std::string& req_url) const
         {
+            if (!static_routes_.empty())
+            {
+                const static_route& route = static_routes_[static_route_slot(static_route_hash(req_url), static_routes_seed_)];
+                if (route.result.rule_index && route.url == req_url)
+                    return route.result;
+            }
             return find(req_url, head_);
         }
 
         //This functions assumes any blueprint info passed is valid
         void add(const std::string& url, uint16_t rule_index, unsigned bp_prefix_length = 0, uint16_t blueprint_index = INVALID_BP_ID)
         {
+            // rebuilt by validate()
+            static_routes_.clear();
+
             auto idx = &head_;
 
             bool has_blueprint = bp_prefix_length != 0 && blueprint_index != INVALID_BP_ID;
@@ -12277,7 +17568,105 @@ namespace crow // NOTE: Already documented in "crow/app.h"
         }
 
     private:
+        /// A parameterless URL and what the trie resolves it to.
+        struct static_route
+        {
+            std::string url;
+            routing_handle_result result{0, {}, {}};
+        };
+
+        static uint64_t static_route_hash(const std::string& url)
+        {
+            uint64_t h = 14695981039346656037ull;
+            for (char c : url)
+            {
+                h ^= static_cast<unsigned char>(c);
+                h *= 1099511628211ull;
+            }
+            return h;
+        }
+
+        size_t static_route_slot(uint64_t hash, uint64_t seed) const
+        {
+            hash ^= seed;
+            hash *= 0x9e3779b97f4a7c15ull;
+            return static_cast<size_t>(hash >> 32) & (static_routes_.size() - 1);
+        }
+
+        void collect_static_urls(const Node& node, std::string& url, std::vector<std::string>& urls) const
+        {
+            for (const Node& child : node.children)
+            {
+                if (child.param != ParamType::MAX)
+                    continue;
+                url += child.key;
+                if (child.rule_index)
+                    urls.push_back(url);
+                collect_static_urls(child, url, urls);
+                url.resize(url.size() - child.key.size());
+            }
+        }
+
+        /// Build a collision free (perfect) hash table of every URL without parameters.
+
+        ///
+        /// Each entry holds the result of a regular trie lookup, so a hit answers exactly what find() would.
+        /// The table is grown and reseeded until every URL has a slot of its own.
+        void build_static_routes()
+        {
+            static_routes_.clear();
+
+            std::vector<std::string> urls;
+            std::string url;
+            collect_static_urls(head_, url, urls);
+
+            std::vector<std::pair<uint64_t, static_route>> routes;
+            for (auto& u : urls)
+            {
+                routing_handle_result result = find(u, head_);
+                if (result.rule_index)
+                {
+                    uint64_t hash = static_route_hash(u);
+                    routes.emplace_back(hash, static_route{std::move(u), std::move(result)});
+                }
+            }
+            if (routes.empty())
+                return;
+
+            size_t size = 1;
+            while (size < routes.size() * 2)
+                size <<= 1;
+            for (;; size <<= 1)
+            {
+                static_routes_.assign(size, static_route{});
+                for (uint64_t seed = 0; seed < 64; seed++)
+                {
+                    std::vector<bool> used(size);
+                    bool collision = false;
+                    for (auto& route : routes)
+                    {
+                        size_t slot = static_route_slot(route.first, seed);
+                        if (used[slot])
+                        {
+                            collision = true;
+                            break;
+                        }
+                        used[slot] = true;
+                    }
+                    if (collision)
+                        continue;
+
+                    for (auto& route : routes)
+                        static_routes_[static_route_slot(route.first, seed)] = std::move(route.second);
+                    static_routes_seed_ = seed;
+                    return;
+                }
+            }
+        }
+
         Node head_;
+        std::vector<static_route> static_routes_;
+        uint64_t static_routes_seed_{};
     };
 
     /// A blueprint can be considered a smaller section of a Crow app, specifically where the router is concerned.
@@ -12742,40 +18131,37 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             return std::string();
         }
 
-        std::unique_ptr<routing_handle_result> handle_initial(request& req, response& res)
+        void handle_initial(request& req, response& res, routing_handle_result& found)
         {
             HTTPMethod method_actual = req.method;
 
-            std::unique_ptr<routing_handle_result> found{
-              new routing_handle_result(
-                0,
-                std::vector<uint16_t>(),
-                routing_params(),
-                HTTPMethod::InternalMethodCount)}; // This is always returned to avoid a null pointer dereference.
+            found.rule_index = 0;
+            found.blueprint_indices.clear();
+            found.method = HTTPMethod::InternalMethodCount;
 
             // NOTE(EDev): This most likely will never run since the parser should handle this situation and close the connection before it gets here.
             if (CROW_UNLIKELY(req.method >= HTTPMethod::InternalMethodCount))
-                return found;
+                return;
             else if (req.method == HTTPMethod::Head)
             {
-                *found = per_methods_[static_cast<int>(method_actual)].trie.find(req.url);
+                found = per_methods_[static_cast<int>(method_actual)].trie.find(req.url);
                 // support HEAD requests using GET if not defined as method for the requested URL
-                if (!found->rule_index)
+                if (!found.rule_index)
                 {
                     method_actual = HTTPMethod::Get;
-                    *found = per_methods_[static_cast<int>(method_actual)].trie.find(req.url);
-                    if (!found->rule_index) // If a route is still not found, return a 404 without executing the rest of the HEAD specific code.
+                    found = per_methods_[static_cast<int>(method_actual)].trie.find(req.url);
+                    if (!found.rule_index) // If a route is still not found, return a 404 without executing the rest of the HEAD specific code.
                     {
                         CROW_LOG_DEBUG << "Cannot match rules " << req.url;
                         res = response(404); //TODO(EDev): Should this redirect to catchall?
                         res.end();
-                        return found;
+                        return;
                     }
                 }
 
                 res.skip_body = true;
-                found->method = method_actual;
-                return found;
+                found.method = method_actual;
+                return;
             }
             else if (req.method == HTTPMethod::Options)
             {
@@ -12802,8 +18188,8 @@ namespace crow // NOTE: Already documented in "crow/app.h"
 
                     res.set_header("Allow", allow);
                     res.end();
-                    found->method = method_actual;
-                    return found;
+                    found.method = method_actual;
+                    return;
                 }
                 else
                 {
@@ -12830,49 +18216,58 @@ namespace crow // NOTE: Already documented in "crow/app.h"
 #endif
                         res.set_header("Allow", allow);
                         res.end();
-                        found->method = method_actual;
-                        return found;
+                        found.method = method_actual;
+                        return;
                     }
                     else
                     {
                         CROW_LOG_DEBUG << "Cannot match rules " << req.url;
                         res = response(404); //TODO(EDev): Should this redirect to catchall?
                         res.end();
-                        return found;
+                        return;
                     }
                 }
             }
             else // Every request that isn't a HEAD or OPTIONS request
             {
-                *found = per_methods_[static_cast<int>(method_actual)].trie.find(req.url);
+                found = per_methods_[static_cast<int>(method_actual)].trie.find(req.url);
                 // TODO(EDev): maybe ending the else here would allow the requests coming from above (after removing the return statement) to be checked on whether they actually point to a route
-                if (!found->rule_index)
+                if (!found.rule_index)
                 {
                     for (auto& per_method : per_methods_)
                     {
                         if (per_method.trie.find(req.url).rule_index) //Route found, but in another method
                         {
-                            const std::string error_message(get_error(405, *found, req, res));
+                            const std::string error_message(get_error(405, found, req, res));
                             CROW_LOG_DEBUG << "Cannot match method " << req.url << " " << method_name(method_actual) << ". " << error_message;
                             res.end();
-                            return found;
+                            return;
                         }
                     }
                     //Route does not exist anywhere
 
-                    const std::string error_message(get_error(404, *found, req, res));
+                    const std::string error_message(get_error(404, found, req, res));
                     CROW_LOG_DEBUG << "Cannot match rules " << req.url << ". " << error_message;
                     res.end();
-                    return found;
+                    return;
                 }
 
-                found->method = method_actual;
-                return found;
+                found.method = method_actual;
+                return;
             }
         }
 
+        /// The rule pattern a request was routed to, null if it didn't match one.
+        const std::string* matched_rule(const routing_handle_result& found) const
+        {
+            if (found.rule_index <= RULE_SPECIAL_REDIRECT_SLASH || found.method >= HTTPMethod::InternalMethodCount)
+                return nullptr;
+            const auto& rules = per_methods_[static_cast<int>(found.method)].rules;
+            return found.rule_index < rules.size() ? &rules[found.rule_index]->rule_ : nullptr;
+        }
+
         template<typename App>
-        void handle(request& req, response& res, routing_handle_result found)
+        void handle(request& req, response& res, const routing_handle_result& found)
         {
             HTTPMethod method_actual = found.method;
             auto& rules = per_methods_[static_cast<int>(method_actual)].rules;
@@ -13231,22 +18626,71 @@ namespace crow
         }
 
         /// \brief Process only the method and URL of a request and provide a route (or an error response)
-        std::unique_ptr<routing_handle_result> handle_initial(request& req, response& res)
+        void handle_initial(request& req, response& res, routing_handle_result& found)
         {
-            return router_.handle_initial(req, res);
+            router_.handle_initial(req, res, found);
         }
 
         /// \brief Process the fully parsed request and generate a response for it
-        void handle(request& req, response& res, std::unique_ptr<routing_handle_result>& found)
+        void handle(request& req, response& res, routing_handle_result& found)
+        {
+            router_.handle<self_t>(req, res, found);
+        }
+
+        /// \brief The rule pattern a request was routed to (null if none matched)
+        const std::string* matched_rule(const routing_handle_result& found) const
+        {
+            return router_.matched_rule(found);
+        }
+
+        /// \brief Latency histograms and traffic counters, `metrics().render()` gives them in the Prometheus text format
+        metrics::registry& metrics()
         {
-            router_.handle<self_t>(req, res, *found);
+            return metrics_;
+        }
+
+        /// \brief Send the phases of each request (see crow::timing::phases) back in a `Server-Timing` header
+        self_t& server_timing(bool enabled)
+        {
+            server_timing_ = enabled;
+            return *this;
+        }
+
+        bool server_timing() const
+        {
+            return server_timing_;
+        }
+
+        /// \brief How often each worker is probed for event loop lag (0 turns the probes off)
+        self_t& worker_probe_interval(std::chrono::milliseconds interval)
+        {
+            worker_probe_interval_ = interval;
+            return *this;
+        }
+
+        std::chrono::milliseconds worker_probe_interval() const
+        {
+            return worker_probe_interval_;
+        }
+
+        /// \brief How long a worker can go without running a probe before it is reported as stalled
+        self_t& stall_threshold(std::chrono::milliseconds threshold)
+        {
+            stall_threshold_ = threshold;
+            return *this;
+        }
+
+        std::chrono::milliseconds stall_threshold() const
+        {
+            return stall_threshold_;
         }
 
         /// \brief Process a fully parsed request from start to finish (primarily used for debugging)
         void handle_full(request& req, response& res)
         {
-            auto found = handle_initial(req, res);
-            if (found->rule_index)
+            routing_handle_result found;
+            handle_initial(req, res, found);
+            if (found.rule_index)
                 handle(req, res, found);
         }
 
@@ -13390,7 +18834,7 @@ namespace crow
 
         /// \brief Set the response body size (in bytes) beyond which Crow automatically streams responses (Default is 1MiB)
         ///
-        /// Any streamed response is unaffected by Crow's timer, and therefore won't timeout before a response is fully sent.
+        /// Streamed responses are written asynchronously. Crow's timer is restarted after every written slice, so a response only times out if the client stops reading.
         self_t& stream_threshold(size_t threshold)
         {
             res_stream_threshold_ = threshold;
@@ -13403,6 +18847,19 @@ namespace crow
             return res_stream_threshold_;
         }
 
+        /// \brief Set the maximum number of body bytes a connection queues in a single write when streaming a response (Default is 16KiB)
+        self_t& stream_write_budget(size_t budget)
+        {
+            res_stream_write_budget_ = budget > 0 ? budget : 1;
+            return *this;
+        }
+
+        /// \brief Get the maximum number of body bytes a connection queues in a single write when streaming a response
+        size_t& stream_write_budget()
+        {
+            return res_stream_write_budget_;
+        }
+
 
         self_t& register_blueprint(Blueprint& blueprint)
         {
@@ -13517,6 +18974,14 @@ namespace crow
                 return;
             }
             tcp::endpoint endpoint(addr, port_);
+#ifdef CROW_ENABLE_IO_URING
+            if (!detail::io_uring_available())
+            {
+                // No fallback, the epoll reactor isn't compiled in
+                CROW_LOG_ERROR << "io_uring is not available on this system - rebuild without CROW_ENABLE_IO_URING to use epoll";
+                return;
+            }
+#endif
 #ifdef CROW_ENABLE_SSL
             if (ssl_used_)
             {
@@ -13768,8 +19233,13 @@ namespace crow
         std::string server_name_ = std::string("Crow/") + VERSION;
         std::string bindaddr_ = "0.0.0.0";
         size_t res_stream_threshold_ = 1048576;
+        size_t res_stream_write_budget_ = 16384;
         Router router_;
         bool static_routes_added_{false};
+        metrics::registry metrics_;
+        bool server_timing_{false};
+        std::chrono::milliseconds worker_probe_interval_{100};
+        std::chrono::milliseconds stall_threshold_{1000};
 
 #ifdef CROW_ENABLE_COMPRESSION
         compression::algorithm comp_algorithm_;
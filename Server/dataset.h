@@ -0,0 +1,358 @@
+// Synthetic SurfLocation, Post, Comments, Likes and Weather documents at a realistic scale and shape, for benchmarks
+// and load tests. bench/gen_data.cpp loads them into MongoDB or writes them as NDJSON.
+//
+// Locations are spread over countries by how much surf tourism they get, and posts over locations by a Zipf law, so
+// a few spots have most of the posts. Comments and likes per post and likes per comment follow a Pareto distribution
+// (most have a few, some have thousands), as do the users writing them. Every location also gets a daily
+// weather history. TotalLikes and TotalComments agree with the Likes and Comments generated.
+//
+// The work is split in chunks of locations (with their posts, comments, likes and weather), each generated from its
+// own random engine, so the same options always give the same documents whatever thread runs a chunk.
+#pragma once
+
+#include <bsoncxx/builder/basic/document.hpp>   // For building documents
+#include <bsoncxx/builder/basic/kvp.hpp>        // For bsoncxx::builder::basic::kvp
+#include <bsoncxx/document/value.hpp>           // For owned BSON documents
+#include <bsoncxx/oid.hpp>       // For ObjectIds
+#include <bsoncxx/types.hpp>     // For BSON types
+
+#include <algorithm>  // For std::min, std::max
+#include <atomic>     // For handing out chunks to threads
+#include <chrono>     // For std::chrono::system_clock
+#include <cmath>      // For std::pow, std::floor
+#include <cstdint>    // For std::uint64_t
+#include <ctime>      // For gmtime_r
+#include <exception>  // For std::exception_ptr
+#include <functional> // For std::function
+#include <map>        // For std::map
+#include <random>     // For std::mt19937_64 and the distributions
+#include <string>     // For std::string
+#include <thread>     // For std::thread
+#include <vector>     // For std::vector
+
+struct DatasetOptions
+{
+    std::size_t locations = 10000;
+    double postsPerLocation = 10;   // mean, spread over locations by a Zipf law with exponent locationSkew
+    double locationSkew = 1.1;
+    double commentsPerPost = 3;     // means of Pareto distributions with shape tail
+    double likesPerPost = 5;
+    double likesPerComment = 1;
+    double tail = 1.5;
+    std::size_t users = 50000;
+    int weatherDays = 30;           // daily weather records per location, up to the reference date
+    std::uint64_t seed = 1;
+};
+
+class DatasetGenerator
+{
+public:
+    // Receives full batches of one collection, it may take the documents out of `batch`.
+    using Sink = std::function<void(const std::string& collection, std::vector<bsoncxx::document::value>& batch)>;
+
+    static constexpr std::size_t chunkSize = 64;
+
+    explicit DatasetGenerator(DatasetOptions options) :
+      options_(std::move(options)), postOffset_(options_.locations + 1, 0)
+    {
+        // Posts of location i (by rank i + 1 of the Zipf law), and where its post ids start
+        double total = 0;
+        for (std::size_t i = 0; i < options_.locations; i++)
+            total += std::pow(static_cast<double>(i + 1), -options_.locationSkew);
+        double posts = options_.postsPerLocation * options_.locations;
+        for (std::size_t i = 0; i < options_.locations; i++)
+        {
+            double share = std::pow(static_cast<double>(i + 1), -options_.locationSkew) / total;
+            postOffset_[i + 1] = postOffset_[i] + static_cast<std::uint64_t>(std::floor(posts * share + 0.5));
+        }
+    }
+
+    std::size_t chunks() const { return (options_.locations + chunkSize - 1) / chunkSize; }
+
+    // Generates the locations of `chunk` and everything that belongs to them, calling `sink` with batches of up to
+    // `batchSize` documents.
+    void generate(std::size_t chunk, const Sink& sink, std::size_t batchSize = 1000) const
+    {
+        using bsoncxx::builder::basic::kvp;
+        using bsoncxx::builder::basic::make_document;
+
+        std::mt19937_64 random(options_.seed * 0x9E3779B97F4A7C15ull + chunk);
+        std::map<std::string, std::vector<bsoncxx::document::value>> batches;
+        auto add = [&](const char* collection, bsoncxx::document::value doc) {
+            auto& batch = batches[collection];
+            batch.push_back(std::move(doc));
+            if (batch.size() >= batchSize)
+            {
+                sink(collection, batch);
+                batch.clear();
+            }
+        };
+
+        std::size_t end = std::min(options_.locations, (chunk + 1) * chunkSize);
+        for (std::size_t location = chunk * chunkSize; location < end; location++)
+        {
+            const Country& country = pickCountry(random);
+            std::string locationName = this->locationName(location);
+            std::int32_t locationLikes = 0;
+            std::int32_t locationComments = 0;
+
+            for (std::uint64_t post = postOffset_[location]; post < postOffset_[location + 1]; post++)
+            {
+                bsoncxx::oid postId = id(Tag::Post, post);
+                std::int32_t postLikes = count(random, options_.likesPerPost, 1000000);
+                std::int32_t postComments = count(random, options_.commentsPerPost, 65535);
+                for (std::int32_t like = 0; like < postLikes; like++)
+                    add("Likes", make_document(
+                                   kvp("userId", bsoncxx::types::b_oid{user(random)}),
+                                   kvp("postId", bsoncxx::types::b_oid{postId}),
+                                   kvp("created", bsoncxx::types::b_date{created(random)})));
+                for (std::int32_t comment = 0; comment < postComments; comment++)
+                {
+                    bsoncxx::oid commentId = id(Tag::Comment, (post << 16) | static_cast<std::uint64_t>(comment));
+                    std::int32_t commentLikes = count(random, options_.likesPerComment, 1000000);
+                    for (std::int32_t like = 0; like < commentLikes; like++)
+                        add("Likes", make_document(
+                                       kvp("userId", bsoncxx::types::b_oid{user(random)}),
+                                       kvp("commentId", bsoncxx::types::b_oid{commentId}),
+                                       kvp("created", bsoncxx::types::b_date{created(random)})));
+                    add("Comments", make_document(
+                                      kvp("_id", bsoncxx::types::b_oid{commentId}),
+                                      kvp("commentId", bsoncxx::types::b_oid{commentId}),
+                                      kvp("postId", bsoncxx::types::b_oid{postId}),
+                                      kvp("userId", bsoncxx::types::b_oid{user(random)}),
+                                      kvp("commentDescription", pick(random, commentTexts)),
+                                      kvp("TotalLikes", commentLikes),
+                                      kvp("created", bsoncxx::types::b_date{created(random)})));
+                }
+                add("Post", make_document(
+                              kvp("_id", bsoncxx::types::b_oid{postId}),
+                              kvp("postId", bsoncxx::types::b_oid{postId}),
+                              kvp("locationName", locationName),
+                              kvp("userId", bsoncxx::types::b_oid{user(random)}),
+                              kvp("descript", std::string(pick(random, postOpenings)) + ' ' + pick(random, postClosings)),
+                              kvp("TotalLikes", postLikes),
+                              kvp("TotalComments", postComments),
+                              kvp("TotalInteractions", postLikes + postComments),
+                              kvp("created", bsoncxx::types::b_date{created(random)})));
+                locationLikes += postLikes;
+                locationComments += postComments;
+            }
+
+            std::normal_distribution<double> scatter(0, country.spread);
+            add("SurfLocation", make_document(
+                                  kvp("_id", bsoncxx::types::b_oid{id(Tag::Location, location)}),
+                                  kvp("locationName", locationName),
+                                  kvp("breakType", pickBreakType(random)),
+                                  kvp("surfScore", std::max(1, std::min(10, static_cast<int>(std::normal_distribution<double>(6, 1.8)(random) + 0.5)))),
+                                  kvp("countryName", country.name),
+                                  kvp("userId", bsoncxx::types::b_oid{user(random)}),
+                                  kvp("description", std::string(pick(random, locationDescriptions)) + " in " + country.name),
+                                  kvp("coordinates", make_document(
+                                                       kvp("latitude", std::max(-90.0, std::min(90.0, country.latitude + scatter(random)))),
+                                                       kvp("longitude", std::remainder(country.longitude + scatter(random), 360.0)))),
+                                  kvp("TotalLikes", locationLikes),
+                                  kvp("TotalComments", locationComments)));
+
+            // Swell varies day to day around the country's typical size, wind and rain independently of it
+            std::lognormal_distribution<double> wave(std::log(country.waveSize), 0.45);
+            std::normal_distribution<double> wind(15, 8);
+            std::bernoulli_distribution rain(0.25);
+            for (int day = 0; day < options_.weatherDays; day++)
+                add("Weather", make_document(
+                                 kvp("locationName", locationName),
+                                 kvp("wTimeStamp", date(day)),
+                                 kvp("waveSize", std::floor(wave(random) * 10 + 0.5) / 10),
+                                 kvp("windSpeed", std::max(0, static_cast<int>(wind(random) + 0.5))),
+                                 kvp("precipitation", rain(random))));
+        }
+
+        for (auto& batch : batches)
+        {
+            if (!batch.second.empty())
+                sink(batch.first, batch.second);
+        }
+    }
+
+    // Generates every chunk on `threads` threads. makeSink(i) is called on thread i for the sink it uses. The first
+    // exception a thread throws stops the others after their current chunk and is rethrown here.
+    void run(std::size_t threads, const std::function<Sink(std::size_t)>& makeSink, std::size_t batchSize = 1000) const
+    {
+        std::atomic<std::size_t> next{0};
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;
+        std::vector<std::thread> workers;
+        for (std::size_t i = 0; i < std::max<std::size_t>(1, threads); i++)
+        {
+            workers.emplace_back([&, i] {
+                try {
+                    Sink sink = makeSink(i);
+                    std::size_t chunk;
+                    while (!failed && (chunk = next++) < chunks())
+                        generate(chunk, sink, batchSize);
+                } catch (...) {
+                    if (!failed.exchange(true))
+                        error = std::current_exception();
+                }
+            });
+        }
+        for (auto& worker : workers)
+            worker.join();
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    // The name of location `index`, "Cox Bay", "Long Beach" and so on, unique for every index.
+    static std::string locationName(std::size_t index)
+    {
+        const std::size_t words = sizeof(nameWords) / sizeof(*nameWords);
+        const std::size_t features = sizeof(nameFeatures) / sizeof(*nameFeatures);
+        std::string name = std::string(nameWords[index % words]) + ' ' + nameFeatures[(index / words) % features];
+        if (index >= words * features)
+            name += ' ' + std::to_string(index / (words * features) + 1);
+        return name;
+    }
+
+private:
+    enum class Tag : unsigned char { Location = 1, Post, Comment, User };
+
+    struct Country
+    {
+        const char* name;
+        double weight;
+        double latitude, longitude;
+        double spread;      // degrees
+        double waveSize;    // typical wave height in metres
+    };
+
+    static constexpr Country countries[] = {
+      {"USA", 22, 34.0, -119.0, 6, 1.5},
+      {"Australia", 14, -28.0, 153.5, 6, 1.6},
+      {"Indonesia", 10, -8.7, 115.2, 3, 1.8},
+      {"Brazil", 8, -23.0, -43.5, 5, 1.2},
+      {"Portugal", 6, 39.4, -9.3, 2, 2.0},
+      {"France", 6, 43.6, -1.5, 1.5, 1.7},
+      {"Mexico", 6, 17.0, -101.0, 4, 1.8},
+      {"Canada", 4, 49.1, -125.9, 1.5, 1.9},
+      {"South Africa", 4, -34.0, 24.9, 3, 1.9},
+      {"Costa Rica", 4, 9.6, -85.0, 1.5, 1.5},
+      {"Spain", 3, 43.4, -4.0, 2, 1.5},
+      {"Peru", 3, -8.0, -79.5, 3, 1.6},
+      {"Japan", 3, 35.0, 140.0, 3, 1.2},
+      {"New Zealand", 3, -38.0, 175.0, 3, 1.6},
+      {"Morocco", 2, 30.5, -9.8, 2, 1.8},
+      {"United Kingdom", 2, 50.4, -5.0, 1.5, 1.4},
+      {"Ireland", 1.5, 53.0, -9.5, 1.5, 1.8},
+      {"Sri Lanka", 1.5, 6.5, 80.0, 1, 1.2},
+      {"Philippines", 1.5, 9.8, 126.2, 3, 1.3},
+      {"Chile", 1.5, -33.0, -71.7, 5, 2.0},
+    };
+
+    static constexpr const char* nameWords[] = {
+      "Cox", "Long", "Rocky", "Sunset", "Crescent", "Shipwreck", "Lighthouse", "Pelican", "Driftwood", "Hidden",
+      "Salt", "Coral", "Black Rock", "Whale", "Seal", "Pine", "Sandy", "Dolphin", "Kelp", "Eagle",
+      "Windy", "Lone Tree", "Old Mill", "Surfers", "Pebble", "Gull", "Tide", "Storm", "Cathedral", "Horseshoe",
+      "Jordan", "Chesterman", "Mystic", "Bluff", "Cannon", "Ocean", "Monument", "Golden", "Silver", "Breakwater",
+    };
+    static constexpr const char* nameFeatures[] = {"Bay", "Beach", "Point", "Reef", "Cove", "Rivermouth", "Jetty", "Bank"};
+
+    static constexpr const char* locationDescriptions[] = {
+      "Consistent beach break, best on a mid tide", "Long left-hand point that lines up on bigger swells",
+      "Shallow reef, for experienced surfers only", "Sheltered cove, good for beginners", "Punchy peaks off the river mouth after rain",
+      "Heavy barrels on a south swell", "Crowded on weekends, go early", "Remote spot reached by a dirt road",
+    };
+    static constexpr const char* postOpenings[] = {
+      "Glassy chest-high sets this morning.", "Blown out by lunch.", "Overhead and pumping!", "Tiny but fun on a longboard.",
+      "Sketchy rip on the north end.", "Best session of the year.", "Crowded, but everyone was friendly.", "Saw a seal in the lineup.",
+    };
+    static constexpr const char* postClosings[] = {
+      "Offshore until about 10.", "Bring a 4/3.", "Watch the rocks at low tide.", "Parking fills up fast.",
+      "Will be back tomorrow.", "Tide was dropping fast.", "Wind swell, short period.", "Fingers crossed for the weekend.",
+    };
+    static constexpr const char* commentTexts[] = {
+      "Thanks for the report!", "Was it crowded?", "Looks fun, heading there this weekend.", "Any parking left by 9?",
+      "Same here, it shut down after the tide turned.", "Great photos.", "How cold was the water?", "See you out there.",
+    };
+
+    template <typename T, std::size_t N>
+    static const char* pick(std::mt19937_64& random, const T (&items)[N])
+    {
+        return items[std::uniform_int_distribution<std::size_t>(0, N - 1)(random)];
+    }
+
+    static const Country& pickCountry(std::mt19937_64& random)
+    {
+        double total = 0;
+        for (const Country& c : countries)
+            total += c.weight;
+        double at = std::uniform_real_distribution<double>(0, total)(random);
+        for (const Country& c : countries)
+        {
+            if (at < c.weight)
+                return c;
+            at -= c.weight;
+        }
+        return countries[0];
+    }
+
+    static const char* pickBreakType(std::mt19937_64& random)
+    {
+        double at = std::uniform_real_distribution<double>(0, 1)(random);
+        return at < 0.5 ? "Beach Break" : at < 0.7 ? "Point Break" : at < 0.9 ? "Reef Break" : at < 0.95 ? "River Mouth" : "Jetty";
+    }
+
+    // A Pareto draw with the given mean, rounded at random so the mean holds for small values too.
+    std::int32_t count(std::mt19937_64& random, double mean, std::int32_t max) const
+    {
+        if (mean <= 0)
+            return 0;
+        double scale = mean * (options_.tail - 1) / options_.tail;
+        std::uniform_real_distribution<double> uniform(0, 1);
+        double x = scale / std::pow(1 - uniform(random), 1 / options_.tail);
+        return static_cast<std::int32_t>(std::min<double>(max, std::floor(x + uniform(random))));
+    }
+
+    // Users by activity: a few write most of the posts, comments and likes.
+    bsoncxx::oid user(std::mt19937_64& random) const
+    {
+        double at = std::uniform_real_distribution<double>(0, 1)(random);
+        return id(Tag::User, static_cast<std::uint64_t>(std::pow(at, 3) * options_.users));
+    }
+
+    // ObjectIds made from the kind and index of a document, so references between collections need no lookups.
+    // The timestamp part is the reference date.
+    static bsoncxx::oid id(Tag tag, std::uint64_t index)
+    {
+        char bytes[12];
+        std::uint32_t seconds = static_cast<std::uint32_t>(referenceTime);
+        for (int i = 0; i < 4; i++)
+            bytes[i] = static_cast<char>(seconds >> (24 - 8 * i));
+        bytes[4] = static_cast<char>(tag);
+        for (int i = 0; i < 7; i++)
+            bytes[5 + i] = static_cast<char>(index >> (48 - 8 * i));
+        return bsoncxx::oid(bytes, sizeof(bytes));
+    }
+
+    // Some time in the year before the reference date.
+    static std::chrono::system_clock::time_point created(std::mt19937_64& random)
+    {
+        auto ago = std::uniform_int_distribution<std::int64_t>(0, 365 * 86400 - 1)(random);
+        return std::chrono::system_clock::from_time_t(referenceTime - ago);
+    }
+
+    // YYYY-MM-DD, `day` days before the reference date, as the client's date input sends it.
+    static std::string date(int day)
+    {
+        std::time_t t = referenceTime - static_cast<std::time_t>(day) * 86400;
+        std::tm tm;
+        gmtime_r(&t, &tm);
+        char buffer[11];
+        std::strftime(buffer, sizeof(buffer), "%Y-%m-%d", &tm);
+        return buffer;
+    }
+
+    // 2024-05-01 00:00 UTC, so the dataset doesn't depend on when it was generated.
+    static constexpr std::time_t referenceTime = 1714521600;
+
+    DatasetOptions options_;
+    std::vector<std::uint64_t> postOffset_;
+};
@@ -0,0 +1,103 @@
+// Storage on a MongoDB database through the C++ driver.
+#pragma once
+
+#include "storage.h"
+#include <mongocxx/client.hpp>   // MongoDB C++ driver client
+#include <mongocxx/database.hpp> // MongoDB C++ driver database
+#include <mongocxx/options/insert.hpp> // For unordered bulk inserts
+#include <mongocxx/pipeline.hpp> // For $sample
+#include <mongocxx/pool.hpp>     // For a client per call
+
+#include <algorithm>  // For std::min
+#include <cstdint>    // For std::int64_t, INT32_MAX
+#include <string>     // For std::string
+#include <vector>     // For std::vector
+
+// A mongocxx::client can't be used from two threads at once, so every call takes one from the pool. That makes
+// this safe to share between the server's worker threads.
+class MongoStorage : public Storage
+{
+public:
+    // `pool` has to outlive this.
+    MongoStorage(mongocxx::pool& pool, std::string database) :
+      pool_(pool), database_(std::move(database))
+    {}
+
+    std::vector<std::string> collectionNames() override
+    {
+        auto client = pool_.acquire();
+        auto names = (*client)[database_].list_collection_names();
+        return std::vector<std::string>(names.begin(), names.end());
+    }
+
+    void createCollection(const std::string& name) override
+    {
+        auto client = pool_.acquire();
+        (*client)[database_].create_collection(name);
+    }
+
+    void createIndex(const std::string& collection, bsoncxx::document::view keys) override
+    {
+        auto client = pool_.acquire();
+        (*client)[database_][collection].create_index(keys);
+    }
+
+    std::vector<bsoncxx::document::value> find(const std::string& collection, bsoncxx::document::view filter) override
+    {
+        auto client = pool_.acquire();
+        std::vector<bsoncxx::document::value> results;
+        auto cursor = (*client)[database_][collection].find(filter);
+        for (auto&& doc : cursor)
+            results.push_back(bsoncxx::document::value(doc));
+        return results;
+    }
+
+    // $sample, which MongoDB serves with a random cursor rather than a sort of the whole collection while `size` is
+    // under 5% of it.
+    std::vector<bsoncxx::document::value> sample(const std::string& collection, std::size_t size) override
+    {
+        mongocxx::pipeline pipeline;
+        pipeline.sample(static_cast<std::int32_t>(std::min<std::size_t>(size, INT32_MAX)));
+        auto client = pool_.acquire();
+        std::vector<bsoncxx::document::value> results;
+        auto cursor = (*client)[database_][collection].aggregate(pipeline);
+        for (auto&& doc : cursor)
+            results.push_back(bsoncxx::document::value(doc));
+        return results;
+    }
+
+    std::int64_t count(const std::string& collection) override
+    {
+        auto client = pool_.acquire();
+        return (*client)[database_][collection].estimated_document_count();
+    }
+
+    bool insertOne(const std::string& collection, bsoncxx::document::view doc) override
+    {
+        auto client = pool_.acquire();
+        return static_cast<bool>((*client)[database_][collection].insert_one(doc));
+    }
+
+    // Unordered, so the server can apply the batch in parallel. The driver throws for an empty batch, MemoryStorage
+    // takes it as nothing to do, so this does too.
+    bool insertMany(const std::string& collection, const std::vector<bsoncxx::document::value>& docs) override
+    {
+        if (docs.empty())
+            return true;
+        mongocxx::options::insert options;
+        options.ordered(false);
+        auto client = pool_.acquire();
+        return static_cast<bool>((*client)[database_][collection].insert_many(docs, options));
+    }
+
+    std::int64_t deleteMany(const std::string& collection, bsoncxx::document::view filter) override
+    {
+        auto client = pool_.acquire();
+        auto result = (*client)[database_][collection].delete_many(filter);
+        return result ? result->deleted_count() : 0;
+    }
+
+private:
+    mongocxx::pool& pool_;
+    std::string database_;
+};
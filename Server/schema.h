@@ -0,0 +1,270 @@
+// The shape of the collections for /api/db-structure: field paths, their types, how often they appear and a few
+// example values, inferred from a random sample of each collection. Inferring reads a bounded number of documents
+// and happens in the background, the endpoint answers from the last result.
+#pragma once
+
+#include "bson_json.h"           // For writing example values
+#include "storage.h"
+
+#include <algorithm>  // For std::sort, std::min
+#include <chrono>     // For the age of a schema
+#include <cstdint>    // For std::int64_t
+#include <iostream>   // For std::cerr
+#include <map>        // For std::map
+#include <memory>     // For std::shared_ptr
+#include <mutex>      // For std::mutex
+#include <string>     // For std::string
+#include <string_view> // For std::string_view
+#include <thread>     // For std::thread
+#include <unordered_map> // For looking up fields by path
+#include <vector>     // For std::vector
+
+// The names MongoDB's $type uses.
+inline const char* bsonTypeName(bsoncxx::type type)
+{
+    switch (type)
+    {
+        case bsoncxx::type::k_double: return "double";
+        case bsoncxx::type::k_string: return "string";
+        case bsoncxx::type::k_document: return "object";
+        case bsoncxx::type::k_array: return "array";
+        case bsoncxx::type::k_binary: return "binData";
+        case bsoncxx::type::k_oid: return "objectId";
+        case bsoncxx::type::k_bool: return "bool";
+        case bsoncxx::type::k_date: return "date";
+        case bsoncxx::type::k_null: return "null";
+        case bsoncxx::type::k_regex: return "regex";
+        case bsoncxx::type::k_int32: return "int";
+        case bsoncxx::type::k_timestamp: return "timestamp";
+        case bsoncxx::type::k_int64: return "long";
+        case bsoncxx::type::k_decimal128: return "decimal";
+        default: return "other";
+    }
+}
+
+// The schema of one collection, from the documents given to add(). Memory stays bounded: past maxFields new paths
+// are only counted as dropped, and each field keeps at most maxExamples short examples.
+class CollectionSchema
+{
+public:
+    static constexpr std::size_t maxFields = 200;
+    static constexpr std::size_t maxDepth = 4;
+    static constexpr std::size_t maxExamples = 3;
+    static constexpr std::size_t maxExampleLength = 80;
+
+    void add(bsoncxx::document::view doc)
+    {
+        documents_++;
+        addFields(doc, "", 0);
+    }
+
+    // {"sampled": N, "fields": [{"path", "frequency", "types": {name: count}, "examples": [...]}], "droppedFields": N}
+    // Paths join nested fields with '.', array elements are "field[]". Frequency is the share of sampled documents
+    // that have the field.
+    void write(crow::json::writer& json) const
+    {
+        json.member("sampled", documents_);
+        json.key("fields").begin_list();
+        for (const auto& field : fields_)
+        {
+            json.begin_object();
+            json.member("path", field.path);
+            json.member("frequency", documents_ ? static_cast<double>(field.documents) / documents_ : 0.0);
+            json.key("types").begin_object();
+            for (const auto& type : field.types)
+                json.member(type.first, type.second);
+            json.end_object();
+            json.key("examples").begin_list();
+            for (const auto& example : field.examples)
+                json.raw(example);
+            json.end_list();
+            json.end_object();
+        }
+        json.end_list();
+        json.member("droppedFields", dropped_);
+    }
+
+private:
+    struct Field
+    {
+        std::string path;
+        std::size_t documents = 0;
+        std::size_t lastDocument = 0;  // So a field repeated in an array counts once per document
+        std::map<std::string, std::size_t> types;
+        std::vector<std::string> examples;
+    };
+
+    void addFields(bsoncxx::document::view doc, const std::string& prefix, std::size_t depth)
+    {
+        for (auto&& element : doc)
+        {
+            auto key = element.key();
+            add(prefix + std::string(key.data(), key.size()), element, depth);
+        }
+    }
+
+    template <typename Element>
+    void add(const std::string& path, const Element& element, std::size_t depth)
+    {
+        Field* field = find(path);
+        if (!field)
+            return;
+        if (field->lastDocument != documents_)
+        {
+            field->lastDocument = documents_;
+            field->documents++;
+        }
+        field->types[bsonTypeName(element.type())]++;
+
+        if (element.type() == bsoncxx::type::k_document)
+        {
+            if (depth + 1 < maxDepth)
+                addFields(element.get_document().value, path + '.', depth + 1);
+        }
+        else if (element.type() == bsoncxx::type::k_array)
+        {
+            if (depth + 1 < maxDepth)
+            {
+                for (auto&& item : element.get_array().value)
+                    add(path + "[]", item, depth + 1);
+            }
+        }
+        else if (field->examples.size() < maxExamples)
+        {
+            std::string example = exampleOf(element);
+            if (!example.empty() && std::find(field->examples.begin(), field->examples.end(), example) == field->examples.end())
+                field->examples.push_back(std::move(example));
+        }
+    }
+
+    Field* find(const std::string& path)
+    {
+        auto it = index_.find(path);
+        if (it != index_.end())
+            return &fields_[it->second];
+        if (fields_.size() >= maxFields)
+        {
+            dropped_++;
+            return nullptr;
+        }
+        index_.emplace(path, fields_.size());
+        fields_.emplace_back();
+        fields_.back().path = path;
+        return &fields_.back();
+    }
+
+    // The value as JSON, strings cut to maxExampleLength characters. Empty for values too long to show.
+    template <typename Element>
+    static std::string exampleOf(const Element& element)
+    {
+        std::string out;
+        crow::json::writer json(out);
+        if (element.type() == bsoncxx::type::k_string)
+        {
+            auto str = element.get_string().value;
+            std::size_t length = std::min<std::size_t>(str.size(), maxExampleLength);
+            // Don't cut a UTF-8 sequence in half
+            while (length < str.size() && length > 0 && (static_cast<unsigned char>(str[length]) & 0xC0) == 0x80)
+                length--;
+            json.value(std::string_view(str.data(), length));
+        }
+        else
+        {
+            writeBsonValue(json, element);
+            if (out.size() > maxExampleLength)
+                out.clear();
+        }
+        return out;
+    }
+
+    std::size_t documents_ = 0;
+    std::size_t dropped_ = 0;
+    std::vector<Field> fields_;
+    std::unordered_map<std::string, std::size_t> index_;
+};
+
+// Keeps the last inferred schema of every collection as a JSON body and infers a new one in the background when it's
+// older than `ttl`, so a request never waits on the database.
+class SchemaCache
+{
+public:
+    // `db` has to outlive this.
+    SchemaCache(Storage& db, std::size_t sampleSize, std::chrono::seconds ttl) :
+      db_(db), sampleSize_(sampleSize), ttl_(ttl)
+    {}
+
+    ~SchemaCache()
+    {
+        if (worker_.joinable())
+            worker_.join();
+    }
+
+    // The last schema, or null until the first is done. Starts inferring a new one if it's missing or stale.
+    std::shared_ptr<const std::string> get()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (std::chrono::steady_clock::now() >= next_ && !inferring_)
+        {
+            inferring_ = true;
+            // Any previous worker is past its last use of the lock, so this doesn't wait on it for long
+            if (worker_.joinable())
+                worker_.join();
+            worker_ = std::thread([this]() { refresh(); });
+        }
+        return current_;
+    }
+
+private:
+    void refresh()
+    {
+        std::shared_ptr<const std::string> inferred;
+        try {
+            inferred = std::make_shared<const std::string>(infer());
+        } catch (const std::exception& e) {
+            std::cerr << "Error inferring the database schema: " << e.what() << std::endl;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        // A failed attempt leaves the old schema in place and is retried sooner than the TTL
+        if (inferred)
+            current_ = std::move(inferred);
+        next_ = std::chrono::steady_clock::now() + (inferred ? ttl_ : std::min<std::chrono::steady_clock::duration>(ttl_, std::chrono::seconds(10)));
+        inferring_ = false;
+    }
+
+    // {"generatedAt": ms since the epoch, "sampleSize": N, "collections": [{"name", "count", ...CollectionSchema}]}
+    std::string infer()
+    {
+        std::vector<std::string> names = db_.collectionNames();
+        std::sort(names.begin(), names.end());
+        std::string out;
+        crow::json::writer json(out);
+        json.begin_object();
+        json.member("generatedAt", static_cast<std::int64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                       std::chrono::system_clock::now().time_since_epoch()).count()));
+        json.member("sampleSize", sampleSize_);
+        json.key("collections").begin_list();
+        for (const auto& name : names)
+        {
+            CollectionSchema schema;
+            for (const auto& doc : db_.sample(name, sampleSize_))
+                schema.add(doc.view());
+            json.begin_object();
+            json.member("name", name);
+            json.member("count", db_.count(name));
+            schema.write(json);
+            json.end_object();
+        }
+        json.end_list();
+        json.end_object();
+        return out;
+    }
+
+    Storage& db_;
+    std::size_t sampleSize_;
+    std::chrono::steady_clock::duration ttl_;
+    std::mutex mutex_;
+    std::shared_ptr<const std::string> current_;
+    std::chrono::steady_clock::time_point next_;  // When the schema goes stale
+    bool inferring_ = false;
+    std::thread worker_;
+};
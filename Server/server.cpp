@@ -1,8 +1,15 @@
 #include "crow_all.h"            // Crow framework header
+#include "bson_json.h"           // For writing BSON documents with crow's JSON writer
+#include "mongo_storage.h"       // For the collections, in MongoDB or in memory
+#include "dataset.h"             // For seeding synthetic data
+#include "snapshot.h"            // For warm restarts from a snapshot file
+#include "schema.h"              // For /api/db-structure
+#include "cors.h"                // For answering CORS preflights
 #include <bsoncxx/json.hpp>      // For BSON/JSON conversion
-#include <mongocxx/client.hpp>   // MongoDB C++ driver client
 #include <mongocxx/instance.hpp> // MongoDB C++ driver instance
+#include <mongocxx/pool.hpp>     // MongoDB C++ driver client pool
 #include <mongocxx/uri.hpp>      // For MongoDB URI
+#include <bsoncxx/builder/basic/document.hpp>   // For building index keys
 #include <bsoncxx/builder/stream/document.hpp>  // For building BSON documents
 #include <bsoncxx/types.hpp>     // For BSON types
 
@@ -12,7 +19,17 @@
 #include <iostream>   // For std::cerr, std::cout
 #include <string>     // For std::string
 #include <chrono>     // For std::chrono::system_clock
-#include <algorithm>  // For std::transform
+#include <algorithm>  // For std::transform, std::min, std::max
+#include <thread>     // For std::thread
+#include <memory>     // For std::unique_ptr
+#include <atomic>     // For std::atomic
+#include <future>     // For std::async
+#include <mutex>      // For std::mutex
+#include <condition_variable> // For waking the snapshot thread at shutdown
+
+#ifdef CROW_USE_BOOST
+namespace asio = boost::asio;
+#endif
 
 // Simple function to load .env file variables into environment variables.
 void loadDotEnv(const std::string& path)
@@ -55,71 +72,83 @@ void loadDotEnv(const std::string& path)
     file.close();
 }
 
-int main()
+// Collections the handlers need
+static const char* const requiredCollections[] = {"SurfLocation", "Post", "Likes", "Comments"};
+
+// The fields the handlers look documents up by
+static const std::pair<const char*, const char*> lookupIndexes[] = {
+    {"SurfLocation", "countryName"},
+    {"SurfLocation", "locationName"},
+    {"Post", "locationName"},
+    {"Comments", "postId"},
+    {"Likes", "postId"},
+    {"Likes", "commentId"},
+};
+
+// Creates the missing collections, in parallel. Retries until the database answers or `stopping` is set.
+bool ensureCollections(Storage& db, const std::atomic<bool>& stopping)
 {
-    // Load environment variables from .env
-    loadDotEnv(".env");
-    
-    // Initialize MongoDB driver instance (only needed once per application)
-    mongocxx::instance instance{};
-
-    // Retrieve MongoDB connection info from environment variables.
-    const char* mongo_uri_env = std::getenv("MONGO_URI");
-    if (!mongo_uri_env)
-    {
-        std::cerr << "Error: MONGO_URI environment variable not set." << std::endl;
-        return 1;
-    }
-    std::string mongo_uri(mongo_uri_env);
-
-    const char* db_name_env = std::getenv("DATABASE");
-    if (!db_name_env)
+    for (int attempt = 1; !stopping; attempt++)
     {
-        std::cerr << "Error: DATABASE environment variable not set." << std::endl;
-        return 1;
-    }
-    std::string db_name(db_name_env);
-
-    // Retrieve port, default to 3000 if not set.
-    const char* port_env = std::getenv("PORT");
-    int port = port_env ? std::stoi(port_env) : 3000;
+        try {
+            std::vector<std::string> existing_collections = db.collectionNames();
+            std::cout << "Existing collections: " << std::endl;
+            for (const auto& name : existing_collections) {
+                std::cout << "  - " << name << std::endl;
+            }
 
-    // Create a client connection to MongoDB Atlas.
-    mongocxx::client client{mongocxx::uri{mongo_uri}};
-    auto db = client[db_name];
-
-    // Print connection info
-    std::cout << "Connected to database: " << db_name << std::endl;
-    std::cout << "Using URI: " << mongo_uri << std::endl;
-
-    // Check if collections exist and create them if they don't
-    try {
-        // List all collections
-        auto collections = db.list_collection_names();
-        std::vector<std::string> existing_collections(collections.begin(), collections.end());
-        std::cout << "Existing collections: " << std::endl;
-        for (const auto& name : existing_collections) {
-            std::cout << "  - " << name << std::endl;
+            std::vector<std::future<void>> creating;
+            for (const char* collection_name : requiredCollections) {
+                if (std::find(existing_collections.begin(), existing_collections.end(), collection_name) == existing_collections.end()) {
+                    creating.push_back(std::async(std::launch::async, [&db, collection_name]() {
+                        db.createCollection(collection_name);
+                        std::cout << "Created collection: " << collection_name << std::endl;
+                    }));
+                }
+            }
+            for (auto& created : creating) {
+                created.get();
+            }
+            return true;
+        } catch (const std::exception& e) {
+            std::cerr << "Error setting up collections (attempt " << attempt << "): " << e.what() << std::endl;
+            std::this_thread::sleep_for(std::chrono::seconds(std::min(attempt, 5)));
         }
+    }
+    return false;
+}
 
-        // Collections we need
-        std::vector<std::string> required_collections = {"SurfLocation", "Post", "Likes", "Comments"};
-
-        // Create missing collections
-        for (const auto& collection_name : required_collections) {
-            if (std::find(existing_collections.begin(), existing_collections.end(), collection_name) == existing_collections.end()) {
-                db.create_collection(collection_name);
-                std::cout << "Created collection: " << collection_name << std::endl;
-            }
+// Builds the lookup indexes, in parallel. Requests are served without them meanwhile, just slower.
+void ensureIndexes(Storage& db)
+{
+    std::vector<std::future<void>> building;
+    for (const auto& index : lookupIndexes) {
+        building.push_back(std::async(std::launch::async, [&db, index]() {
+            using bsoncxx::builder::basic::kvp;
+            db.createIndex(index.first, bsoncxx::builder::basic::make_document(kvp(index.second, 1)).view());
+        }));
+    }
+    for (size_t i = 0; i < building.size(); i++) {
+        try {
+            building[i].get();
+        } catch (const std::exception& e) {
+            std::cerr << "Error creating index on " << lookupIndexes[i].first << "." << lookupIndexes[i].second << ": " << e.what() << std::endl;
         }
+    }
+    std::cout << "Indexes are in place" << std::endl;
+}
 
+// Replaces what the collections hold with test data. "test" is the single Tofino document, "synthetic" the
+// dataset of dataset.h with SEED_LOCATIONS locations (1000 by default).
+void seedStorage(Storage& db, const std::string& mode)
+{
+    if (mode == "test")
+    {
         // Insert a test document into SurfLocation collection
-        auto surf_location = db["SurfLocation"];
-        
         // First, clear existing data
-        auto delete_result = surf_location.delete_many({});
-        std::cout << "Deleted " << delete_result->deleted_count() << " documents" << std::endl;
-        
+        auto deleted_count = db.deleteMany("SurfLocation", {});
+        std::cout << "Deleted " << deleted_count << " documents" << std::endl;
+
         // Create and insert test document
         bsoncxx::builder::stream::document test_doc{};
         test_doc << "locationName" << "Tofino"
@@ -132,33 +161,302 @@ int main()
                  << "latitude" << 49.1538
                  << "longitude" << -125.9074
                  << bsoncxx::builder::stream::close_document;
-        
+
         auto doc_value = test_doc << bsoncxx::builder::stream::finalize;
-        
+
         // Print the document before insertion
         std::cout << "Attempting to insert document: " << bsoncxx::to_json(doc_value) << std::endl;
-        
+
         // Insert the document using the view
-        auto result = surf_location.insert_one(doc_value.view());
-        if (result) {
+        bool inserted = db.insertOne("SurfLocation", doc_value.view());
+        if (inserted) {
             std::cout << "Successfully inserted test document" << std::endl;
         } else {
             std::cout << "Failed to insert test document" << std::endl;
         }
+        return;
+    }
+
+    for (const char* collection_name : {"SurfLocation", "Post", "Comments", "Likes", "Weather"}) {
+        auto deleted_count = db.deleteMany(collection_name, {});
+        std::cout << "Deleted " << deleted_count << " documents from " << collection_name << std::endl;
+    }
+
+    DatasetOptions options;
+    // Smaller than gen_data's default, seeding happens at every startup
+    const char* locations_env = std::getenv("SEED_LOCATIONS");
+    options.locations = locations_env ? std::stoul(locations_env) : 1000;
+    DatasetGenerator generator(options);
+    std::atomic<size_t> inserted{0};
+    generator.run(std::max(1u, std::thread::hardware_concurrency()), [&db, &inserted](size_t) -> DatasetGenerator::Sink {
+        return [&db, &inserted](const std::string& collection, std::vector<bsoncxx::document::value>& docs) {
+            db.insertMany(collection, docs);
+            inserted += docs.size();
+        };
+    });
+    std::cout << "Inserted " << inserted << " synthetic documents for " << options.locations << " locations" << std::endl;
+}
+
+// `text` as a regex that matches it literally, so a search parameter is a substring to find and not a pattern.
+std::string regexEscape(const std::string& text)
+{
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (char ch : text) {
+        if (std::string("\\^$.|?*+()[]{}").find(ch) != std::string::npos)
+            escaped += '\\';
+        escaped += ch;
+    }
+    return escaped;
+}
+
+// Whether `given` is `expected`, in a time that doesn't depend on where they differ or on how long `given` is: both are
+// hashed first and the digests are compared in full. Never true for an empty `expected`.
+bool secretMatches(const std::string& given, const std::string& expected)
+{
+    if (expected.empty())
+        return false;
+    uint8_t givenDigest[20], expectedDigest[20];
+    sha1::SHA1().processBytes(given.data(), given.size()).getDigestBytes(givenDigest);
+    sha1::SHA1().processBytes(expected.data(), expected.size()).getDigestBytes(expectedDigest);
+    uint8_t difference = 0;
+    for (int i = 0; i < 20; i++)
+        difference |= givenDigest[i] ^ expectedDigest[i];
+    return difference == 0;
+}
+
+// Holds back /api requests with a 503 until startup has done what they depend on, and logs how long after the
+// process started the first one was served.
+struct ReadinessGate
+{
+    struct context
+    {};
+
+    std::atomic<bool> ready{false};
+    std::atomic<bool> served{false};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    void before_handle(crow::request& req, crow::response& res, context&)
+    {
+        if (ready.load(std::memory_order_acquire) || req.url.compare(0, 5, "/api/") != 0)
+            return;
+        res.code = 503;
+        res.set_header("Retry-After", "1");
+        res.end("Starting up, try again shortly");
+    }
+
+    void after_handle(crow::request& req, crow::response&, context&)
+    {
+        if (served.load(std::memory_order_relaxed) || !ready.load(std::memory_order_acquire) || req.url.compare(0, 5, "/api/") != 0)
+            return;
+        if (!served.exchange(true))
+            CROW_LOG_INFO << "First request served " << millisecondsSinceStart() << "ms after startup";
+    }
+
+    long long millisecondsSinceStart() const
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+int main()
+{
+    // Set up Crow HTTP server. Created first so startup times count from here.
+    crow::App<Cors, ReadinessGate> app;
+    auto& readiness = app.get_middleware<ReadinessGate>();
+
+    // Load environment variables from .env
+    loadDotEnv(".env");
+    
+    // Initialize MongoDB driver instance (only needed once per application)
+    mongocxx::instance instance{};
+
+    // Retrieve port, default to 3000 if not set.
+    const char* port_env = std::getenv("PORT");
+    int port = port_env ? std::stoi(port_env) : 3000;
+
+    // STORAGE=memory keeps the collections in this process instead of MongoDB, for benchmarks and load tests that
+    // shouldn't depend on the network. STORAGE_LATENCY then delays every call, e.g. "constant:2+exponential:0.5"
+    // (see LatencyModel in storage.h), with random draws seeded from STORAGE_SEED.
+    //
+    // SNAPSHOT_PATH keeps a snapshot of the collections in that file, written every SNAPSHOT_INTERVAL seconds (default
+    // 300) when something changed and at shutdown, and loaded at startup so requests are served right away. With
+    // MongoDB the collections are then also kept in memory and reads are served from there.
+    std::unique_ptr<mongocxx::pool> pool;
+    std::unique_ptr<Storage> storage;
+    std::unique_ptr<MemoryStorage> cache;
+    std::unique_ptr<CachedStorage> cached;
+    MemoryStorage* memory = nullptr;  // What snapshots are taken of
+    const char* snapshot_env = std::getenv("SNAPSHOT_PATH");
+    std::string snapshot_path = snapshot_env ? snapshot_env : "";
+    const char* snapshot_interval_env = std::getenv("SNAPSHOT_INTERVAL");
+    int snapshot_interval = snapshot_interval_env ? std::max(1, std::atoi(snapshot_interval_env)) : 300;
+    const char* storage_env = std::getenv("STORAGE");
+    if (storage_env && std::string(storage_env) == "memory")
+    {
+        const char* latency_env = std::getenv("STORAGE_LATENCY");
+        const char* seed_env = std::getenv("STORAGE_SEED");
+        LatencyModel latency;
+        try {
+            latency = LatencyModel(latency_env ? latency_env : "");
+        } catch (const std::invalid_argument& e) {
+            std::cerr << "Error: STORAGE_LATENCY: " << e.what() << std::endl;
+            return 1;
+        }
+        storage.reset(new MemoryStorage(latency, seed_env ? std::stoull(seed_env) : 1));
+        if (!snapshot_path.empty())
+            memory = static_cast<MemoryStorage*>(storage.get());
+        std::cout << "Using in-memory storage" << (latency_env ? std::string(" with latency ") + latency_env : "") << std::endl;
+    }
+    else
+    {
+        // Retrieve MongoDB connection info from environment variables.
+        const char* mongo_uri_env = std::getenv("MONGO_URI");
+        if (!mongo_uri_env)
+        {
+            std::cerr << "Error: MONGO_URI environment variable not set." << std::endl;
+            return 1;
+        }
+        std::string mongo_uri(mongo_uri_env);
+
+        const char* db_name_env = std::getenv("DATABASE");
+        if (!db_name_env)
+        {
+            std::cerr << "Error: DATABASE environment variable not set." << std::endl;
+            return 1;
+        }
+        std::string db_name(db_name_env);
+
+        // Create a pool of client connections to MongoDB Atlas, connecting lazily.
+        pool.reset(new mongocxx::pool{mongocxx::uri{mongo_uri}});
+        storage.reset(new MongoStorage(*pool, db_name));
+        if (!snapshot_path.empty())
+        {
+            cache.reset(new MemoryStorage());
+            cached.reset(new CachedStorage(*storage, *cache));
+            memory = cache.get();
+        }
+
+        // Print connection info
+        std::cout << "Connected to database: " << db_name << std::endl;
+        std::cout << "Using URI: " << mongo_uri << std::endl;
+    }
+    Storage& db = cached ? static_cast<Storage&>(*cached) : *storage;
+
+    // SEED=test or SEED=synthetic replaces the data with test data at startup, see seedStorage. Without it startup
+    // leaves the data alone.
+    const char* seed_mode_env = std::getenv("SEED");
+    std::string seed_mode = seed_mode_env ? seed_mode_env : "";
+    if (!seed_mode.empty() && seed_mode != "test" && seed_mode != "synthetic")
+    {
+        std::cerr << "Error: SEED must be test or synthetic." << std::endl;
+        return 1;
+    }
+
+    // A snapshot that loads stands in for the data until startup has caught up, unless seeding is going to replace it.
+    // One that doesn't load is left for the next write to replace.
+    if (memory)
+    {
+        auto start = std::chrono::steady_clock::now();
+        try {
+            std::size_t loaded = 0;
+            if (loadSnapshot(snapshot_path, *memory, &loaded)) {
+                CROW_LOG_INFO << "Loaded " << loaded << " documents from " << snapshot_path << " in "
+                              << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << "ms";
+                if (cached)
+                    cached->markWarm();
+                if (seed_mode.empty())
+                    readiness.ready = true;
+            } else {
+                CROW_LOG_INFO << "No snapshot at " << snapshot_path << ", starting cold";
+            }
+        } catch (const std::exception& e) {
+            CROW_LOG_WARNING << "Ignoring snapshot: " << e.what() << ", starting cold";
+        }
+    }
 
-        // Print current contents of SurfLocation collection
-        std::cout << "\nCurrent contents of SurfLocation collection:" << std::endl;
-        auto cursor = surf_location.find({});
-        for (auto&& doc : cursor) {
-            std::cout << bsoncxx::to_json(doc) << std::endl;
+    // /api/db-structure describes the collections from SCHEMA_SAMPLE random documents of each (default 100), inferred
+    // again in the background once the last result is SCHEMA_TTL seconds old (default 300).
+    const char* schema_sample_env = std::getenv("SCHEMA_SAMPLE");
+    const char* schema_ttl_env = std::getenv("SCHEMA_TTL");
+    SchemaCache schema(db, schema_sample_env ? std::max(1, std::atoi(schema_sample_env)) : 100,
+                       std::chrono::seconds(schema_ttl_env ? std::max(1, std::atoi(schema_ttl_env)) : 300));
+
+    // Startup work runs next to the listener: the collections first, then the indexes in the background while
+    // seeding (if asked for) runs. /api requests get a 503 until the collections exist and seeding is done. With a
+    // cache, its copy of MongoDB is refreshed last.
+    std::atomic<bool> stopping{false};
+    std::thread startup([&db, &readiness, &stopping, seed_mode, &cached, &schema]() {
+        if (!ensureCollections(db, stopping))
+            return;
+        std::thread indexing([&db]() {
+            ensureIndexes(db);
+        });
+        if (!seed_mode.empty()) {
+            try {
+                seedStorage(db, seed_mode);
+            } catch (const std::exception& e) {
+                std::cerr << "Error seeding " << seed_mode << " data: " << e.what() << std::endl;
+            }
+        }
+        if (!readiness.ready) {
+            readiness.ready = true;
+            CROW_LOG_INFO << "Ready after " << readiness.millisecondsSinceStart() << "ms";
         }
+        if (cached) {
+            auto start = std::chrono::steady_clock::now();
+            try {
+                std::size_t copied = cached->reconcile();
+                CROW_LOG_INFO << "Cached " << copied << " documents from MongoDB in "
+                              << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << "ms";
+            } catch (const std::exception& e) {
+                CROW_LOG_ERROR << "Error caching MongoDB: " << e.what();
+            }
+        }
+        schema.get();
+        indexing.join();
+    });
 
-    } catch (const std::exception& e) {
-        std::cerr << "Error setting up collections: " << e.what() << std::endl;
+    // Writes a snapshot when the data changed since the last one. A cache that isn't warm yet holds only part of the
+    // data, so it waits.
+    std::uint64_t snapshot_version = memory ? memory->version() : 0;
+    auto takeSnapshot = [&]() {
+        if (!memory || memory->version() == snapshot_version || (cached && !cached->warm()))
+            return;
+        auto start = std::chrono::steady_clock::now();
+        std::uint64_t version = memory->version();
+        try {
+            std::uint64_t size = writeSnapshot(*memory, snapshot_path);
+            snapshot_version = version;
+            CROW_LOG_INFO << "Wrote " << size << " bytes to " << snapshot_path << " in "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << "ms";
+        } catch (const std::exception& e) {
+            CROW_LOG_ERROR << "Error writing snapshot: " << e.what();
+        }
+    };
+    std::mutex snapshot_mutex;
+    std::condition_variable snapshot_wake;
+    std::thread snapshotter;
+    if (memory)
+    {
+        snapshotter = std::thread([&]() {
+            std::unique_lock<std::mutex> lock(snapshot_mutex);
+            while (!snapshot_wake.wait_for(lock, std::chrono::seconds(snapshot_interval), [&stopping] { return stopping.load(); }))
+                takeSnapshot();
+        });
     }
 
-    // Set up Crow HTTP server.
-    crow::SimpleApp app;
+    // CORS_ORIGINS lists the origins that may call the API, separated by commas (default "*", any). Browsers cache
+    // preflight answers for CORS_MAX_AGE seconds (default 7200, the most Chromium honors).
+    const char* cors_origins_env = std::getenv("CORS_ORIGINS");
+    const char* cors_max_age_env = std::getenv("CORS_MAX_AGE");
+    app.get_middleware<Cors>().configure(cors_origins_env ? cors_origins_env : "*",
+                                         cors_max_age_env ? std::max(0, std::atoi(cors_max_age_env)) : 7200);
+
+    // SERVER_TIMING=1 sends the phase breakdown of every request back in a Server-Timing header
+    const char* server_timing_env = std::getenv("SERVER_TIMING");
+    if (server_timing_env && std::string(server_timing_env) == "1")
+        app.server_timing(true);
 
     // Route to test server connectivity.
     CROW_ROUTE(app, "/")
@@ -166,6 +464,67 @@ int main()
         return "C++ backend server is up and running!";
     });
 
+    // Readiness for load balancers: 503 until the /api routes are served
+    CROW_ROUTE(app, "/ready")
+    .methods("GET"_method)
+    ([&readiness]() {
+        if (!readiness.ready)
+            return crow::response(503, "starting");
+        return crow::response(200, "ready");
+    });
+
+    // Latency histograms and traffic counters for Prometheus
+    CROW_ROUTE(app, "/metrics")
+    .methods("GET"_method)
+    ([&app]() {
+        crow::response res(app.metrics().render());
+        res.set_header("Content-Type", "text/plain; version=0.0.4");
+        return res;
+    });
+
+    // Admin only: samples the worker threads for ?seconds=N (default 10, at most 60) at ?hz=F (default 99) and returns
+    // folded stacks for a flame graph, e.g.
+    //   curl -H "Authorization: Bearer $ADMIN_TOKEN" 'localhost:3000/debug/profile?seconds=30' | flamegraph.pl > cpu.svg
+    // Disabled unless ADMIN_TOKEN is set. Link the server with -rdynamic to get names for its own functions.
+    const char* admin_token_env = std::getenv("ADMIN_TOKEN");
+    std::string admin_token = admin_token_env ? admin_token_env : "";
+    CROW_ROUTE(app, "/debug/profile")
+    .methods("GET"_method)
+    ([admin_token](const crow::request& req, crow::response& res) {
+        if (admin_token.empty()) {
+            res.code = 404;
+            res.end();
+            return;
+        }
+        if (!secretMatches(req.get_header_value("Authorization"), "Bearer " + admin_token)) {
+            res.code = 401;
+            res.end();
+            return;
+        }
+
+        int seconds = 10;
+        int hz = 99;
+        if (auto seconds_param = req.url_params.get("seconds"))
+            seconds = std::max(1, std::min(60, std::atoi(seconds_param)));
+        if (auto hz_param = req.url_params.get("hz"))
+            hz = std::max(1, std::min(1000, std::atoi(hz_param)));
+
+        if (!crow::sampling_profiler::start(hz)) {
+            res.code = 409;
+            res.end("A profile is already running, or profiling is not supported on this platform");
+            return;
+        }
+        // Finish from a timer on the connection's worker, which keeps serving while the profile runs. At shutdown the
+        // timer is dropped with the worker and main stops the profile.
+        auto timer = std::make_shared<asio::steady_timer>(*req.io_context, std::chrono::seconds(seconds));
+        timer->async_wait([timer, &res](const crow::error_code& ec) {
+            if (ec)
+                return;
+            res.set_header("Content-Type", "text/plain");
+            res.end(crow::sampling_profiler::stop());
+        });
+    });
+
     // Endpoint for surf locations with filtering
     CROW_ROUTE(app, "/api/surf-locations")
     .methods("GET"_method)
@@ -180,14 +539,12 @@ int main()
 
             // Build query document
             bsoncxx::builder::stream::document query{};
-            bool has_valid_query = false;
 
             // Handle country parameter
             if (country) {
                 std::string country_str(country);
                 if (!country_str.empty()) {
-                    query << "countryName" << bsoncxx::types::b_regex{country_str, "i"};
-                    has_valid_query = true;
+                    query << "countryName" << bsoncxx::types::b_regex{regexEscape(country_str), "i"};
                     std::cout << "Added country filter: " << country_str << std::endl;
                 }
             }
@@ -196,8 +553,7 @@ int main()
             if (location) {
                 std::string location_str(location);
                 if (!location_str.empty()) {
-                    query << "locationName" << bsoncxx::types::b_regex{location_str, "i"};
-                    has_valid_query = true;
+                    query << "locationName" << bsoncxx::types::b_regex{regexEscape(location_str), "i"};
                     std::cout << "Added location filter: " << location_str << std::endl;
                 }
             }
@@ -205,48 +561,45 @@ int main()
             // Finalize the query document
             auto query_value = query << bsoncxx::builder::stream::finalize;
             std::cout << "Final query: " << bsoncxx::to_json(query_value) << std::endl;
+            req.phases.mark("build_query");
 
             // Find documents
-            auto collection = db["SurfLocation"];
-            std::vector<bsoncxx::document::value> results;
-
             // Always perform query, but use empty query if no criteria provided
-            auto cursor = collection.find(query_value.view());
-            for (auto&& doc : cursor) {
-                results.push_back(bsoncxx::document::value(doc));
+            std::vector<bsoncxx::document::value> results = db.find("SurfLocation", query_value.view());
+            for (const auto& doc : results) {
                 std::cout << "Found document: " << bsoncxx::to_json(doc) << std::endl;
             }
+            req.phases.mark("find");
 
             // Print the locations being sent
             std::cout << "\nSending locations:" << std::endl;
             for (const auto& doc : results) {
                 auto view = doc.view();
-                std::cout << "Location: " << view["locationName"].get_string().value.to_string() 
-                          << ", Country: " << view["countryName"].get_string().value.to_string() 
-                          << ", Break Type: " << view["breakType"].get_string().value.to_string() 
+                std::cout << "Location: " << view["locationName"].get_string().value 
+                          << ", Country: " << view["countryName"].get_string().value 
+                          << ", Break Type: " << view["breakType"].get_string().value 
                           << ", Surf Score: " << view["surfScore"].get_int32().value 
                           << ", Total Likes: " << view["TotalLikes"].get_int32().value 
                           << ", Total Comments: " << view["TotalComments"].get_int32().value << std::endl;
             }
+            req.phases.mark("log_results");
 
-            // Convert to JSON string
-            std::string json_result = "[";
-            for (size_t i = 0; i < results.size(); ++i) {
-                json_result += bsoncxx::to_json(results[i]);
-                if (i < results.size() - 1) {
-                    json_result += ",";
-                }
-            }
-            json_result += "]";
-
-            std::cout << "Returning results: " << json_result << std::endl;
-            
             // Create response with explicit status code and headers
             crow::response res;
-            res.body = json_result;
+
+            // Write the results as JSON straight into the response body
+            crow::json::writer json(res.body);
+            json.begin_list();
+            for (const auto& doc : results) {
+                writeBson(json, doc.view());
+            }
+            json.end_list();
+            req.phases.mark("bson_to_json");
+
+            std::cout << "Returning results: " << res.body << std::endl;
+
             res.code = 200;
             res.add_header("Content-Type", "application/json");
-            res.add_header("Access-Control-Allow-Origin", "*");
             return res;
         } catch (const std::exception& e) {
             std::string error_msg = std::string("Error: ") + e.what();
@@ -258,57 +611,30 @@ int main()
     // Endpoint to show database structure
     CROW_ROUTE(app, "/api/db-structure")
     .methods("GET"_method)
-    ([&db](const crow::request& req) {
-        try {
-            std::string result = "{\n";
-            result += "  \"collections\": [\n";
-
-            // Get all collections
-            auto collections = db.list_collection_names();
-            bool first_collection = true;
-
-            for (const auto& collection_name : collections) {
-                if (!first_collection) {
-                    result += ",\n";
-                }
-                first_collection = false;
-
-                result += "    {\n";
-                result += "      \"name\": \"" + collection_name + "\",\n";
-                result += "      \"documents\": [\n";
-
-                // Get sample document from collection
-                auto collection = db[collection_name];
-                auto cursor = collection.find({});
-                bool first_doc = true;
-
-                for (auto&& doc : cursor) {
-                    if (!first_doc) {
-                        result += ",\n";
-                    }
-                    first_doc = false;
-                    
-                    // Convert document to JSON with all fields
-                    std::string doc_json = bsoncxx::to_json(doc);
-                    result += "        " + doc_json;
-                }
-
-                result += "\n      ]\n";
-                result += "    }";
-            }
-
-            result += "\n  ]\n";
-            result += "}";
-
-            return crow::response(result);
-        } catch (const std::exception& e) {
-            std::string error_msg = std::string("Error: ") + e.what();
-            return crow::response(500, error_msg);
+    ([&schema]() {
+        std::shared_ptr<const std::string> body = schema.get();
+        if (!body) {
+            crow::response res(503, "Inferring the schema, try again shortly");
+            res.set_header("Retry-After", "1");
+            return res;
         }
+        crow::response res(*body);
+        res.add_header("Content-Type", "application/json");
+        return res;
     });
 
     // Run the server on the specified port.
     app.port(port).multithreaded().run();
+    crow::sampling_profiler::stop();  // In case the server stopped during a profile
 
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        stopping = true;
+    }
+    snapshot_wake.notify_all();
+    startup.join();
+    if (snapshotter.joinable())
+        snapshotter.join();
+    takeSnapshot();
     return 0;
 }
@@ -0,0 +1,285 @@
+// Snapshots of a MemoryStorage in a file, so a restart serves the collections it had straight away instead of
+// rebuilding them from MongoDB.
+//
+// The file is
+//   header    "SURFSNAP", format version, byte order mark, collection count, creation time (all 8 byte aligned)
+//   for each collection
+//             name length, name, document count, byte length, then the documents as raw BSON back to back
+//   trailer   CRC-32C of everything before it
+// in the byte order of the machine that wrote it, the byte order mark tells. Loading maps the file and points the
+// documents into the mapping, so nothing is copied or parsed beyond checking lengths.
+#pragma once
+
+#include "storage.h"
+
+#include <chrono>     // For the creation time
+#include <cstdint>    // For fixed width integers
+#include <cstdio>     // For std::FILE, std::rename
+#include <cstring>    // For std::memcpy
+#include <map>        // For std::map
+#include <memory>     // For std::shared_ptr
+#include <stdexcept>  // For std::runtime_error
+#include <string>     // For std::string
+#include <vector>     // For std::vector
+
+#include <fcntl.h>    // For open
+#include <sys/mman.h> // For mmap
+#include <sys/stat.h> // For fstat
+#include <unistd.h>   // For close, fsync
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h> // For _mm_crc32_u64
+#endif
+
+namespace snapshot
+{
+    constexpr char magic[8] = {'S', 'U', 'R', 'F', 'S', 'N', 'A', 'P'};
+    // Bump when the layout changes, older snapshots are then ignored.
+    constexpr std::uint32_t formatVersion = 1;
+    constexpr std::uint32_t byteOrderMark = 0x01020304;
+
+    struct Header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byteOrder;
+        std::uint64_t collections;
+        std::uint64_t created;  // seconds since the epoch
+    };
+
+    // CRC-32C (Castagnoli), with the SSE 4.2 instruction when the build targets it.
+    inline std::uint32_t crc32c(std::uint32_t crc, const void* data, std::size_t length)
+    {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        crc = ~crc;
+#if defined(__SSE4_2__)
+        for (; length >= 8; p += 8, length -= 8)
+        {
+            std::uint64_t word;
+            std::memcpy(&word, p, 8);
+            crc = static_cast<std::uint32_t>(_mm_crc32_u64(crc, word));
+        }
+        for (; length; p++, length--)
+            crc = _mm_crc32_u8(crc, *p);
+#else
+        static const auto table = [] {
+            std::vector<std::uint32_t> t(256);
+            for (std::uint32_t i = 0; i < 256; i++)
+            {
+                std::uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = c & 1 ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+                t[i] = c;
+            }
+            return t;
+        }();
+        for (; length; p++, length--)
+            crc = table[(crc ^ *p) & 0xff] ^ (crc >> 8);
+#endif
+        return ~crc;
+    }
+
+    // Buffered writes that keep the checksum of what went out.
+    class Writer
+    {
+    public:
+        explicit Writer(const std::string& path) :
+          path_(path), file_(std::fopen(path.c_str(), "wb"))
+        {
+            if (!file_)
+                throw std::runtime_error("Could not create " + path);
+            std::setvbuf(file_, nullptr, _IOFBF, 1 << 20);
+        }
+
+        ~Writer()
+        {
+            if (file_)
+                std::fclose(file_);
+        }
+
+        void write(const void* data, std::size_t length)
+        {
+            crc_ = crc32c(crc_, data, length);
+            if (std::fwrite(data, 1, length, file_) != length)
+                throw std::runtime_error("Could not write " + path_);
+            written_ += length;
+        }
+
+        template <typename T>
+        void write(const T& value)
+        {
+            write(&value, sizeof(value));
+        }
+
+        void pad()
+        {
+            static const char zeros[8] = {};
+            write(zeros, (8 - written() % 8) % 8);
+        }
+
+        std::uint64_t written() const { return written_; }
+        std::uint32_t crc() const { return crc_; }
+
+        // Flushes to disk, so a rename after this can't leave a torn file behind.
+        void close()
+        {
+            bool ok = std::fflush(file_) == 0 && ::fsync(fileno(file_)) == 0;
+            ok = std::fclose(file_) == 0 && ok;
+            file_ = nullptr;
+            if (!ok)
+                throw std::runtime_error("Could not write " + path_);
+        }
+
+    private:
+        std::string path_;
+        std::FILE* file_;
+        std::uint64_t written_ = 0;
+        std::uint32_t crc_ = 0;
+    };
+
+    // The documents of a snapshot point into the mapping, which never frees them.
+    inline void keepBytes(std::uint8_t*) {}
+} // namespace snapshot
+
+// Writes the collections of `storage` to `path`, through a temporary file renamed over it so a crash leaves the
+// previous snapshot in place. Changes to `storage` wait until it's done. Returns the size of the file.
+// Throws std::runtime_error if the file can't be written.
+inline std::uint64_t writeSnapshot(const MemoryStorage& storage, const std::string& path)
+{
+    std::string temporary = path + ".tmp";
+    std::uint64_t size = 0;
+    try {
+        snapshot::Writer out(temporary);
+        storage.withCollections([&out](const std::map<std::string, std::vector<bsoncxx::document::value>>& collections) {
+            snapshot::Header header{};
+            std::memcpy(header.magic, snapshot::magic, sizeof(header.magic));
+            header.version = snapshot::formatVersion;
+            header.byteOrder = snapshot::byteOrderMark;
+            header.collections = collections.size();
+            header.created = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+                                                          std::chrono::system_clock::now().time_since_epoch())
+                                                          .count());
+            out.write(header);
+            for (const auto& collection : collections)
+            {
+                std::uint64_t bytes = 0;
+                for (const auto& doc : collection.second)
+                    bytes += doc.view().length();
+                out.write(static_cast<std::uint64_t>(collection.first.size()));
+                out.write(collection.first.data(), collection.first.size());
+                out.pad();
+                out.write(static_cast<std::uint64_t>(collection.second.size()));
+                out.write(bytes);
+                for (const auto& doc : collection.second)
+                    out.write(doc.view().data(), doc.view().length());
+                out.pad();
+            }
+        });
+        std::uint32_t crc = out.crc();
+        out.write(crc);
+        size = out.written();
+        out.close();
+    } catch (...) {
+        std::remove(temporary.c_str());
+        throw;
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Could not rename " + temporary + " to " + path);
+    }
+    return size;
+}
+
+// Replaces the collections of `storage` that are in the snapshot at `path`, leaving the documents in the mapped
+// file. Returns false if there is no snapshot, throws std::runtime_error if it's unusable: truncated, corrupt, or
+// written by another format version or byte order.
+inline bool loadSnapshot(const std::string& path, MemoryStorage& storage, std::size_t* loaded = nullptr)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(snapshot::Header) + sizeof(std::uint32_t)))
+    {
+        ::close(fd);
+        throw std::runtime_error(path + " is too short to be a snapshot");
+    }
+    std::size_t size = static_cast<std::size_t>(st.st_size);
+    void* address = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED)
+        throw std::runtime_error("Could not map " + path);
+    std::shared_ptr<const void> mapping(address, [size](const void* p) {
+        ::munmap(const_cast<void*>(p), size);
+    });
+    const std::uint8_t* base = static_cast<const std::uint8_t*>(address);
+
+    snapshot::Header header;
+    std::memcpy(&header, base, sizeof(header));
+    if (std::memcmp(header.magic, snapshot::magic, sizeof(header.magic)) != 0)
+        throw std::runtime_error(path + " is not a snapshot");
+    if (header.byteOrder != snapshot::byteOrderMark)
+        throw std::runtime_error(path + " was written on a machine with another byte order");
+    if (header.version != snapshot::formatVersion)
+        throw std::runtime_error(path + " has format version " + std::to_string(header.version) + ", expected " + std::to_string(snapshot::formatVersion));
+    std::uint32_t crc;
+    std::size_t body = size - sizeof(crc);
+    std::memcpy(&crc, base + body, sizeof(crc));
+    if (snapshot::crc32c(0, base, body) != crc)
+        throw std::runtime_error(path + " is corrupt, its checksum doesn't match");
+
+    // Only the checksum vouches for the lengths below, so check them against the file anyway
+    std::size_t at = sizeof(header);
+    auto read = [&](std::uint64_t& value) {
+        if (body - at < sizeof(value))
+            throw std::runtime_error(path + " is truncated");
+        std::memcpy(&value, base + at, sizeof(value));
+        at += sizeof(value);
+    };
+    auto skip = [&](std::uint64_t length) {
+        if (body - at < length)
+            throw std::runtime_error(path + " is truncated");
+        at += length;
+    };
+
+    std::vector<std::pair<std::string, std::vector<bsoncxx::document::value>>> collections;
+    std::size_t documents = 0;
+    for (std::uint64_t c = 0; c < header.collections; c++)
+    {
+        std::uint64_t nameLength, count, bytes;
+        read(nameLength);
+        std::size_t name = at;
+        skip(nameLength);
+        skip((8 - at % 8) % 8);
+        read(count);
+        read(bytes);
+        std::size_t start = at;
+        skip(bytes);
+        skip((8 - at % 8) % 8);
+
+        std::vector<bsoncxx::document::value> docs;
+        docs.reserve(count);
+        for (std::size_t p = start; p < start + bytes;)
+        {
+            std::int32_t length;
+            if (start + bytes - p < sizeof(length))
+                throw std::runtime_error(path + " has a truncated document");
+            std::memcpy(&length, base + p, sizeof(length));
+            if (length < 5 || static_cast<std::uint64_t>(length) > start + bytes - p || base[p + length - 1] != 0)
+                throw std::runtime_error(path + " has a malformed document");
+            docs.emplace_back(const_cast<std::uint8_t*>(base + p), static_cast<std::size_t>(length), snapshot::keepBytes);
+            p += length;
+        }
+        if (docs.size() != count)
+            throw std::runtime_error(path + " has a collection with the wrong document count");
+        documents += docs.size();
+        collections.emplace_back(std::string(reinterpret_cast<const char*>(base + name), nameLength), std::move(docs));
+    }
+
+    for (auto& collection : collections)
+        storage.replaceCollection(collection.first, std::move(collection.second), mapping);
+    if (loaded)
+        *loaded = documents;
+    return true;
+}
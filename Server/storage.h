@@ -0,0 +1,586 @@
+// The collections the handlers in server.cpp read and write, behind an interface so the server can run against
+// MongoDB (mongo_storage.h) or against MemoryStorage, which keeps everything in this process for benchmarks and
+// load tests that shouldn't depend on the network.
+#pragma once
+
+#include <bsoncxx/builder/basic/document.hpp>   // For adding an _id to inserted documents
+#include <bsoncxx/builder/basic/kvp.hpp>        // For bsoncxx::builder::basic::kvp
+#include <bsoncxx/builder/concatenate.hpp>      // For copying a document's fields into a builder
+#include <bsoncxx/document/value.hpp>           // For owned BSON documents
+#include <bsoncxx/document/view.hpp>            // For BSON document views
+#include <bsoncxx/oid.hpp>       // For generating ObjectIds
+#include <bsoncxx/types.hpp>     // For BSON types
+
+#include <algorithm>  // For std::remove_if, std::max, std::sort
+#include <atomic>     // For seeding each thread's random engine
+#include <chrono>     // For std::chrono::microseconds
+#include <cctype>     // For std::isalnum
+#include <cmath>      // For std::log, std::pow
+#include <cstdint>    // For std::int64_t
+#include <iterator>   // For std::make_move_iterator
+#include <map>        // For std::map
+#include <memory>     // For std::shared_ptr
+#include <mutex>      // For std::unique_lock
+#include <random>     // For the latency distributions
+#include <regex>      // For matching $regex filters
+#include <shared_mutex> // For std::shared_mutex
+#include <sstream>    // For parsing latency specs
+#include <stdexcept>  // For std::invalid_argument
+#include <string>     // For std::string
+#include <string_view> // For substring matches
+#include <thread>     // For std::this_thread::sleep_for
+#include <unordered_set> // For picking distinct samples
+#include <utility>    // For std::move
+#include <vector>     // For std::vector
+
+class Storage
+{
+public:
+    virtual ~Storage() = default;
+
+    virtual std::vector<std::string> collectionNames() = 0;
+    virtual void createCollection(const std::string& name) = 0;
+
+    // Ascending or descending on the fields of `keys`, e.g. {locationName: 1}. Does nothing if it exists already.
+    virtual void createIndex(const std::string& collection, bsoncxx::document::view keys) = 0;
+
+    // Documents of `collection` matching `filter`, in insertion order.
+    virtual std::vector<bsoncxx::document::value> find(const std::string& collection, bsoncxx::document::view filter) = 0;
+
+    // Up to `size` distinct documents of `collection` picked at random, for looking at a collection without reading
+    // all of it.
+    virtual std::vector<bsoncxx::document::value> sample(const std::string& collection, std::size_t size) = 0;
+
+    // How many documents `collection` has, from metadata where counting would mean a scan, so possibly a little off.
+    virtual std::int64_t count(const std::string& collection) = 0;
+
+    // Returns false if the database didn't acknowledge the insert.
+    virtual bool insertOne(const std::string& collection, bsoncxx::document::view doc) = 0;
+    virtual bool insertMany(const std::string& collection, const std::vector<bsoncxx::document::value>& docs) = 0;
+
+    // Returns how many documents were deleted.
+    virtual std::int64_t deleteMany(const std::string& collection, bsoncxx::document::view filter) = 0;
+};
+
+// How long a simulated database call takes, as a sum of terms joined with '+', each a distribution in milliseconds:
+//   constant:MS              always MS
+//   uniform:MIN:MAX          evenly between MIN and MAX
+//   normal:MEAN:STDDEV       normal, never below 0
+//   exponential:MEAN         exponential, the usual model for queueing delay
+//   lognormal:MEDIAN:SIGMA   log-normal, a long right tail
+//   pareto:MIN:ALPHA         Pareto, a heavy tail (the smaller ALPHA, the heavier)
+// e.g. "constant:2+exponential:0.5" is 2ms of round trip plus jitter. An empty spec adds no latency.
+class LatencyModel
+{
+public:
+    LatencyModel() = default;
+
+    // Throws std::invalid_argument for a spec it can't parse.
+    explicit LatencyModel(const std::string& spec)
+    {
+        std::stringstream terms(spec);
+        std::string term;
+        while (std::getline(terms, term, '+'))
+        {
+            std::stringstream fields(term);
+            std::string name, field;
+            std::getline(fields, name, ':');
+            Term t;
+            int count = 0;
+            while (std::getline(fields, field, ':'))
+            {
+                if (count == 2)
+                    throw std::invalid_argument("Too many parameters in latency term: " + term);
+                try {
+                    t.a[count++] = std::stod(field);
+                } catch (const std::exception&) {
+                    throw std::invalid_argument("Invalid number in latency term: " + term);
+                }
+            }
+
+            int expected;
+            if (name == "constant") { t.kind = Kind::Constant; expected = 1; }
+            else if (name == "uniform") { t.kind = Kind::Uniform; expected = 2; }
+            else if (name == "normal") { t.kind = Kind::Normal; expected = 2; }
+            else if (name == "exponential") { t.kind = Kind::Exponential; expected = 1; }
+            else if (name == "lognormal") { t.kind = Kind::LogNormal; expected = 2; }
+            else if (name == "pareto") { t.kind = Kind::Pareto; expected = 2; }
+            else throw std::invalid_argument("Unknown latency distribution: " + name);
+            if (count != expected)
+                throw std::invalid_argument("Wrong number of parameters in latency term: " + term);
+            if (t.a[0] < 0 || t.a[1] < 0 || (t.kind == Kind::Uniform && t.a[1] < t.a[0]) ||
+                ((t.kind == Kind::Exponential || t.kind == Kind::Pareto) && t.a[0] == 0) ||
+                ((t.kind == Kind::Normal || t.kind == Kind::LogNormal || t.kind == Kind::Pareto) && t.a[1] == 0))
+                throw std::invalid_argument("Invalid parameters in latency term: " + term);
+            terms_.push_back(t);
+        }
+    }
+
+    bool empty() const { return terms_.empty(); }
+
+    template <typename Random>
+    std::chrono::microseconds sample(Random& random) const
+    {
+        double ms = 0;
+        for (const Term& t : terms_)
+        {
+            switch (t.kind)
+            {
+                case Kind::Constant:
+                    ms += t.a[0];
+                    break;
+                case Kind::Uniform:
+                    ms += std::uniform_real_distribution<double>(t.a[0], t.a[1])(random);
+                    break;
+                case Kind::Normal:
+                    ms += std::max(0.0, std::normal_distribution<double>(t.a[0], t.a[1])(random));
+                    break;
+                case Kind::Exponential:
+                    ms += std::exponential_distribution<double>(1 / t.a[0])(random);
+                    break;
+                case Kind::LogNormal:
+                    ms += t.a[0] == 0 ? 0 : std::lognormal_distribution<double>(std::log(t.a[0]), t.a[1])(random);
+                    break;
+                case Kind::Pareto:
+                    // Inverse transform of a uniform draw in (0, 1]
+                    ms += t.a[0] / std::pow(1 - std::uniform_real_distribution<double>(0, 1)(random), 1 / t.a[1]);
+                    break;
+            }
+        }
+        return std::chrono::microseconds(static_cast<std::int64_t>(ms * 1000));
+    }
+
+private:
+    enum class Kind { Constant, Uniform, Normal, Exponential, LogNormal, Pareto };
+    struct Term
+    {
+        Kind kind = Kind::Constant;
+        double a[2] = {0, 0};
+    };
+    std::vector<Term> terms_;
+};
+
+// Like the driver, give documents without an _id a new ObjectId
+inline bsoncxx::document::value withObjectId(bsoncxx::document::view doc)
+{
+    if (doc["_id"])
+        return bsoncxx::document::value(doc);
+    bsoncxx::builder::basic::document stored;
+    stored.append(bsoncxx::builder::basic::kvp("_id", bsoncxx::types::b_oid{bsoncxx::oid{}}));
+    stored.append(bsoncxx::builder::concatenate(doc));
+    return stored.extract();
+}
+
+// Collections kept in this process. Filters are the subset of MongoDB's the server sends: top level fields compared
+// for equality (same BSON type and value) or matched against a regex, all of which must hold.
+// Every call sleeps for a sample of the latency model first, on the calling thread like a blocking driver call.
+class MemoryStorage : public Storage
+{
+public:
+    // Each thread draws latencies from its own engine, seeded from `seed` and the order threads first call in.
+    explicit MemoryStorage(LatencyModel latency = {}, std::uint64_t seed = 1) :
+      latency_(std::move(latency)), seed_(seed)
+    {}
+
+    std::vector<std::string> collectionNames() override
+    {
+        delay();
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        std::vector<std::string> names;
+        for (const auto& collection : collections_)
+            names.push_back(collection.first);
+        return names;
+    }
+
+    void createCollection(const std::string& name) override
+    {
+        delay();
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        collections_[name];
+        version_++;
+    }
+
+    // Scans are fast enough in memory, only the collection is created, as MongoDB does.
+    void createIndex(const std::string& collection, bsoncxx::document::view) override
+    {
+        delay();
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        collections_[collection];
+        version_++;
+    }
+
+    std::vector<bsoncxx::document::value> find(const std::string& collection, bsoncxx::document::view filter) override
+    {
+        delay();
+        Matcher matcher(filter);
+        std::vector<bsoncxx::document::value> results;
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = collections_.find(collection);
+        if (it == collections_.end())
+            return results;
+        for (const auto& doc : it->second)
+        {
+            if (matcher(doc.view()))
+                results.push_back(doc);
+        }
+        return results;
+    }
+
+    std::vector<bsoncxx::document::value> sample(const std::string& collection, std::size_t size) override
+    {
+        delay();
+        std::vector<bsoncxx::document::value> results;
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = collections_.find(collection);
+        if (it == collections_.end())
+            return results;
+        const auto& docs = it->second;
+        if (size >= docs.size())
+            return docs;
+        // Floyd's algorithm: `size` distinct positions without shuffling the whole collection
+        std::unordered_set<std::size_t> picked;
+        for (std::size_t last = docs.size() - size; last < docs.size(); last++)
+        {
+            std::size_t pick = std::uniform_int_distribution<std::size_t>(0, last)(random());
+            if (!picked.insert(pick).second)
+                picked.insert(last);
+        }
+        std::vector<std::size_t> positions(picked.begin(), picked.end());
+        std::sort(positions.begin(), positions.end());
+        results.reserve(positions.size());
+        for (std::size_t position : positions)
+            results.push_back(docs[position]);
+        return results;
+    }
+
+    std::int64_t count(const std::string& collection) override
+    {
+        delay();
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = collections_.find(collection);
+        return it == collections_.end() ? 0 : static_cast<std::int64_t>(it->second.size());
+    }
+
+    bool insertOne(const std::string& collection, bsoncxx::document::view doc) override
+    {
+        delay();
+        bsoncxx::document::value stored = withObjectId(doc);
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        collections_[collection].push_back(std::move(stored));
+        version_++;
+        return true;
+    }
+
+    bool insertMany(const std::string& collection, const std::vector<bsoncxx::document::value>& docs) override
+    {
+        delay();
+        std::vector<bsoncxx::document::value> stored;
+        stored.reserve(docs.size());
+        for (const auto& doc : docs)
+            stored.push_back(withObjectId(doc.view()));
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto& target = collections_[collection];
+        target.insert(target.end(), std::make_move_iterator(stored.begin()), std::make_move_iterator(stored.end()));
+        version_++;
+        return true;
+    }
+
+    std::int64_t deleteMany(const std::string& collection, bsoncxx::document::view filter) override
+    {
+        delay();
+        Matcher matcher(filter);
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = collections_.find(collection);
+        if (it == collections_.end())
+            return 0;
+        auto& docs = it->second;
+        auto kept = std::remove_if(docs.begin(), docs.end(), [&matcher](const bsoncxx::document::value& doc) {
+            return matcher(doc.view());
+        });
+        std::int64_t deleted = docs.end() - kept;
+        docs.erase(kept, docs.end());
+        if (deleted)
+            version_++;
+        return deleted;
+    }
+
+    // Goes up with every change, so snapshots are only written when there is something new.
+    std::uint64_t version() const { return version_; }
+
+    // Calls f with the documents of every collection by name, holding off changes until it returns.
+    template <typename F>
+    void withCollections(F&& f) const
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        f(collections_);
+    }
+
+    // Replaces the documents of a collection, creating it if needed. `keepAlive` owns memory the documents point
+    // into, like a mapped snapshot, and is kept for as long as this storage.
+    void replaceCollection(const std::string& name, std::vector<bsoncxx::document::value> docs, std::shared_ptr<const void> keepAlive = {})
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        collections_[name] = std::move(docs);
+        if (keepAlive && std::find(keepAlive_.begin(), keepAlive_.end(), keepAlive) == keepAlive_.end())
+            keepAlive_.push_back(std::move(keepAlive));
+        version_++;
+    }
+
+    void dropCollection(const std::string& name)
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        if (collections_.erase(name))
+            version_++;
+    }
+
+private:
+    // A filter with its regexes compiled once, rather than for every document. Patterns come from URLs, and
+    // std::regex compiles and matches recursively on the worker's stack, so plain text (what the server sends) is
+    // matched as a substring without std::regex and anything else is bounded before it's compiled.
+    class Matcher
+    {
+    public:
+        static constexpr std::size_t maxPatternLength = 256;
+        static constexpr int maxNesting = 8;
+
+        // Throws std::regex_error for an invalid pattern, where MongoDB would fail the query, and for one over the
+        // bounds above.
+        explicit Matcher(bsoncxx::document::view filter)
+        {
+            for (auto&& condition : filter)
+            {
+                Condition c{condition, {}, {}, false, false};
+                if (condition.type() == bsoncxx::type::k_regex)
+                {
+                    auto regex = condition.get_regex();
+                    std::string pattern(regex.regex.data(), regex.regex.size());
+                    c.icase = std::string(regex.options.data(), regex.options.size()).find('i') != std::string::npos;
+                    c.literal = literalOf(pattern, c.text);
+                    if (c.literal && c.icase)
+                        std::transform(c.text.begin(), c.text.end(), c.text.begin(), lower);
+                    if (!c.literal)
+                    {
+                        if (pattern.size() > maxPatternLength || nesting(pattern) > maxNesting)
+                            throw std::regex_error(std::regex_constants::error_complexity);
+                        auto flags = std::regex::ECMAScript;
+                        if (c.icase)
+                            flags |= std::regex::icase;
+                        c.regex = std::regex(pattern, flags);
+                    }
+                }
+                conditions_.push_back(std::move(c));
+            }
+        }
+
+        bool operator()(bsoncxx::document::view doc) const
+        {
+            for (const auto& c : conditions_)
+            {
+                auto field = doc[c.condition.key()];
+                if (!field)
+                    return false;
+                if (c.condition.type() == bsoncxx::type::k_regex)
+                {
+                    if (field.type() != bsoncxx::type::k_string)
+                        return false;
+                    auto value = field.get_string().value;
+                    if (c.literal ? !contains(value.data(), value.size(), c)
+                                  : !std::regex_search(value.data(), value.data() + value.size(), c.regex))
+                        return false;
+                }
+                else if (!(field.get_value() == c.condition.get_value()))
+                    return false;
+            }
+            return true;
+        }
+
+    private:
+        struct Condition
+        {
+            bsoncxx::document::element condition;
+            std::regex regex;
+            std::string text;  // The pattern unescaped when it's plain text, lower case for icase
+            bool literal;
+            bool icase;
+        };
+
+        static char lower(char ch)
+        {
+            return (ch >= 'A' && ch <= 'Z') ? static_cast<char>(ch - 'A' + 'a') : ch;
+        }
+
+        // Whether `pattern` matches only itself, with `text` set to it without the escapes, e.g. "St\\. Ives".
+        static bool literalOf(const std::string& pattern, std::string& text)
+        {
+            static const std::string special = "\\^$.|?*+()[]{}";
+            text.clear();
+            for (std::size_t i = 0; i < pattern.size(); i++)
+            {
+                char ch = pattern[i];
+                if (ch == '\\')
+                {
+                    // An escaped punctuation character is itself, escapes like \d or \b aren't text
+                    if (++i == pattern.size() || std::isalnum(static_cast<unsigned char>(pattern[i])))
+                        return false;
+                    ch = pattern[i];
+                }
+                else if (special.find(ch) != std::string::npos)
+                    return false;
+                text += ch;
+            }
+            return true;
+        }
+
+        // How deeply the groups of `pattern` nest.
+        static int nesting(const std::string& pattern)
+        {
+            int depth = 0, deepest = 0;
+            for (std::size_t i = 0; i < pattern.size(); i++)
+            {
+                if (pattern[i] == '\\')
+                    i++;
+                else if (pattern[i] == '(')
+                    deepest = std::max(deepest, ++depth);
+                else if (pattern[i] == ')')
+                    depth--;
+            }
+            return deepest;
+        }
+
+        static bool contains(const char* value, std::size_t size, const Condition& c)
+        {
+            if (!c.icase)
+                return std::string_view(value, size).find(c.text) != std::string_view::npos;
+            return std::search(value, value + size, c.text.begin(), c.text.end(),
+                               [](char a, char b) { return lower(a) == b; }) != value + size || c.text.empty();
+        }
+
+        std::vector<Condition> conditions_;
+    };
+
+    std::mt19937_64& random()
+    {
+        static std::atomic<std::uint64_t> threads{0};
+        thread_local std::mt19937_64 engine(seed_ + threads++);
+        return engine;
+    }
+
+    void delay()
+    {
+        if (latency_.empty())
+            return;
+        std::this_thread::sleep_for(latency_.sample(random()));
+    }
+
+    LatencyModel latency_;
+    std::uint64_t seed_;
+    mutable std::shared_mutex mutex_;
+    std::map<std::string, std::vector<bsoncxx::document::value>> collections_;
+    std::vector<std::shared_ptr<const void>> keepAlive_;
+    std::atomic<std::uint64_t> version_{0};
+};
+
+// Serves reads from `cache`, a MemoryStorage copy of `backing`, once it's warm: loaded from a snapshot (then call
+// markWarm()) or copied by reconcile(). Until then reads go to `backing`. Writes go to both.
+class CachedStorage : public Storage
+{
+public:
+    CachedStorage(Storage& backing, MemoryStorage& cache) :
+      backing_(backing), cache_(cache)
+    {}
+
+    void markWarm() { warm_ = true; }
+    bool warm() const { return warm_; }
+
+    // Copies every collection of `backing` into the cache, one at a time so reads keep being served, and drops the
+    // ones `backing` doesn't have. Writes wait while a collection is copied. Returns how many documents were copied.
+    std::size_t reconcile()
+    {
+        std::size_t copied = 0;
+        std::vector<std::string> names = backing_.collectionNames();
+        for (const auto& name : names)
+        {
+            std::unique_lock<std::shared_mutex> lock(writing_);
+            std::vector<bsoncxx::document::value> docs = backing_.find(name, {});
+            copied += docs.size();
+            cache_.replaceCollection(name, std::move(docs));
+        }
+        for (const auto& name : cache_.collectionNames())
+        {
+            if (std::find(names.begin(), names.end(), name) == names.end())
+                cache_.dropCollection(name);
+        }
+        warm_ = true;
+        return copied;
+    }
+
+    std::vector<std::string> collectionNames() override
+    {
+        return warm_ ? cache_.collectionNames() : backing_.collectionNames();
+    }
+
+    void createCollection(const std::string& name) override
+    {
+        std::shared_lock<std::shared_mutex> lock(writing_);
+        backing_.createCollection(name);
+        cache_.createCollection(name);
+    }
+
+    void createIndex(const std::string& collection, bsoncxx::document::view keys) override
+    {
+        std::shared_lock<std::shared_mutex> lock(writing_);
+        backing_.createIndex(collection, keys);
+        cache_.createIndex(collection, keys);
+    }
+
+    std::vector<bsoncxx::document::value> find(const std::string& collection, bsoncxx::document::view filter) override
+    {
+        return warm_ ? cache_.find(collection, filter) : backing_.find(collection, filter);
+    }
+
+    std::vector<bsoncxx::document::value> sample(const std::string& collection, std::size_t size) override
+    {
+        return warm_ ? cache_.sample(collection, size) : backing_.sample(collection, size);
+    }
+
+    std::int64_t count(const std::string& collection) override
+    {
+        return warm_ ? cache_.count(collection) : backing_.count(collection);
+    }
+
+    // The _id is added here, so the cache and `backing` get the same one.
+    bool insertOne(const std::string& collection, bsoncxx::document::view doc) override
+    {
+        bsoncxx::document::value stored = withObjectId(doc);
+        std::shared_lock<std::shared_mutex> lock(writing_);
+        if (!backing_.insertOne(collection, stored.view()))
+            return false;
+        return cache_.insertOne(collection, stored.view());
+    }
+
+    bool insertMany(const std::string& collection, const std::vector<bsoncxx::document::value>& docs) override
+    {
+        std::vector<bsoncxx::document::value> stored;
+        stored.reserve(docs.size());
+        for (const auto& doc : docs)
+            stored.push_back(withObjectId(doc.view()));
+        std::shared_lock<std::shared_mutex> lock(writing_);
+        if (!backing_.insertMany(collection, stored))
+            return false;
+        return cache_.insertMany(collection, stored);
+    }
+
+    std::int64_t deleteMany(const std::string& collection, bsoncxx::document::view filter) override
+    {
+        std::shared_lock<std::shared_mutex> lock(writing_);
+        std::int64_t deleted = backing_.deleteMany(collection, filter);
+        cache_.deleteMany(collection, filter);
+        return deleted;
+    }
+
+private:
+    Storage& backing_;
+    MemoryStorage& cache_;
+    std::atomic<bool> warm_{false};
+    std::shared_mutex writing_;
+};